@@ -143,19 +143,11 @@
 
 #include <stdio.h>
 
+#include <string.h>
+
 #include "alias_local.h"
 #include "alias.h"
 
-#define NETBIOS_NS_PORT_NUMBER 137
-#define NETBIOS_DGM_PORT_NUMBER 138
-#define FTP_CONTROL_PORT_NUMBER 21
-#define IRC_CONTROL_PORT_NUMBER_1 6667
-#define IRC_CONTROL_PORT_NUMBER_2 6668
-#define CUSEEME_PORT_NUMBER 7648
-#define RTSP_CONTROL_PORT_NUMBER_1 554
-#define RTSP_CONTROL_PORT_NUMBER_2 7070
-#define PPTP_CONTROL_PORT_NUMBER 1723
-
 
 
 
@@ -179,11 +171,9 @@ static void TcpMonitorIn(struct ip *, struct alias_link *);
 static void TcpMonitorOut(struct ip *, struct alias_link *);
 
 
-static u_short packetAliasMSS;
-
-void PacketAliasClampMSS(u_short mss)
+void LibAliasClampMSS(struct libalias *instance, u_short mss)
 {
-    packetAliasMSS = mss;
+    instance->packetAliasMSS = mss;
 }
 
 static void DoMSSClamp(struct tcphdr *tc)
@@ -223,13 +213,13 @@ static void DoMSSClamp(struct tcphdr *tc)
                     u_short *mssPtr = (u_short *) option + 1;
                     u_short mssVal  = ntohs(*mssPtr);
 
-                    if (packetAliasMSS < mssVal)
+                    if (libalias_cur->packetAliasMSS < mssVal)
                     {
                         int accumulate = mssVal;
                         int accnetorder = 0 ;
                         
-                        accumulate -= packetAliasMSS;
-                        *mssPtr = htons(packetAliasMSS);
+                        accumulate -= libalias_cur->packetAliasMSS;
+                        *mssPtr = htons(libalias_cur->packetAliasMSS);
                         accnetorder = htons(accumulate);
                         ADJUST_CHECKSUM(accnetorder, tc->th_sum);
                     }
@@ -261,7 +251,7 @@ TcpMonitorIn(struct ip *pip, struct alias_link *link)
             {
                 SetStateIn(link, ALIAS_TCP_STATE_CONNECTED);
 
-                if (packetAliasMSS)
+                if (libalias_cur->packetAliasMSS)
                     DoMSSClamp(tc);
             }
             break;
@@ -288,7 +278,7 @@ TcpMonitorOut(struct ip *pip, struct alias_link *link)
             {
                 SetStateOut(link, ALIAS_TCP_STATE_CONNECTED);
 
-                if (packetAliasMSS)
+                if (libalias_cur->packetAliasMSS)
                     DoMSSClamp(tc);
             }
             break;
@@ -303,6 +293,108 @@ TcpMonitorOut(struct ip *pip, struct alias_link *link)
 
 
 
+/* Protocol Helper Registry
+
+    HelperTableBuild()  -- Fill the port tables of the current
+                           instance from the enabled helpers.
+
+    FindHelper()        -- Look up the helper, if any, claiming a
+                           TCP or UDP packet by its ports.
+
+    LibAliasSetHelper() -- Turn a helper on or off by name.
+
+The helpers that look into the data of FTP, IRC, RTSP, PPTP, NetBIOS
+and CU-SeeMe packets are described by the modules implementing them.
+aliasHelpers[] lists them in order of precedence, which matters only
+when the source and destination ports of a packet belong to different
+helpers.  Each instance has a table for TCP and one for UDP giving,
+for every port, the helper claiming it, so a packet costs one lookup
+of each of its ports whatever the number of helpers.
+*/
+
+static struct alias_helper *aliasHelpers[] = {
+    &ftpHelper,
+    &ircHelper,
+    &rtspHelper,
+    &pptpHelper,
+    &cuseemeHelper,
+    &nbtDgmHelper,
+    &nbtNsHelper
+};
+
+#define HELPER_COUNT (int) (sizeof(aliasHelpers) / sizeof(aliasHelpers[0]))
+
+void
+HelperTableBuild(void)
+{
+    int i, j;
+    struct alias_helper *helper;
+
+    memset(libalias_cur->helperPort, 0, sizeof(libalias_cur->helperPort));
+
+/* Enter the helpers last to first so that earlier ones win ties */
+    for (i=HELPER_COUNT-1; i>=0; i--)
+    {
+        if (libalias_cur->helperDisabled & (1 << i))
+            continue;
+
+        helper = aliasHelpers[i];
+        for (j=0; j<HELPER_MAX_PORTS; j++)
+            if (helper->ports[j] != 0)
+                libalias_cur->helperPort[helper->proto][helper->ports[j]] =
+                    i + 1;
+    }
+}
+
+static struct alias_helper *
+FindHelper(int proto, u_short sport, u_short dport)
+{
+    int d, s;
+
+    d = libalias_cur->helperPort[proto][ntohs(dport)];
+    s = libalias_cur->helperPort[proto][ntohs(sport)];
+    if (d == 0 && s == 0)
+        return(NULL);
+
+    if (d != 0 && !(aliasHelpers[d-1]->match & HELPER_DST_PORT))
+        d = 0;
+    if (s != 0 && !(aliasHelpers[s-1]->match & HELPER_SRC_PORT))
+        s = 0;
+
+    if (d == 0 || (s != 0 && s < d))
+        d = s;
+    return(d == 0 ? NULL : aliasHelpers[d-1]);
+}
+
+int
+LibAliasSetHelper(struct libalias *instance, const char *name, int enable)
+{
+    int i;
+
+    libalias_cur = instance;
+    for (i=0; i<HELPER_COUNT; i++)
+    {
+        if (strcmp(aliasHelpers[i]->name, name) != 0)
+            continue;
+
+        if (enable)
+            libalias_cur->helperDisabled &= ~(1 << i);
+        else
+            libalias_cur->helperDisabled |= 1 << i;
+        HelperTableBuild();
+        return(0);
+    }
+
+#ifdef DEBUG
+    fprintf(stderr, "PacketAlias/SetHelper(): no helper %s\n", name);
+#endif
+    return(-1);
+}
+
+
+
+
+
 /* Protocol Specific Packet Aliasing Routines 
 
     IcmpAliasIn(), IcmpAliasIn1(), IcmpAliasIn2()
@@ -382,6 +474,7 @@ IcmpAliasIn1(struct ip *pip)
         int accumulate;
 
         original_id = GetOriginalPort(link);
+        AccountPacket(link, ACCT_IN, pip);
 
 /* Adjust ICMP checksum */
         accumulate  = ic->icmp_id;
@@ -525,7 +618,7 @@ IcmpAliasIn(struct ip *pip)
     struct icmp *ic;
 
 /* Return if proxy-only mode is enabled */
-    if (packetAliasMode & PKT_ALIAS_PROXY_ONLY)
+    if (libalias_cur->packetAliasMode & PKT_ALIAS_PROXY_ONLY)
         return PKT_ALIAS_OK;
 
     ic = (struct icmp *) ((char *) pip + (pip->ip_hl << 2));
@@ -575,6 +668,7 @@ IcmpAliasOut1(struct ip *pip)
         int accumulate;
 
         alias_id = GetAliasPort(link);
+        AccountPacket(link, ACCT_OUT, pip);
 
 /* Since data field is being modified, adjust ICMP checksum */
         accumulate  = ic->icmp_id;
@@ -729,7 +823,7 @@ IcmpAliasOut(struct ip *pip)
     struct icmp *ic;
 
 /* Return if proxy-only mode is enabled */
-    if (packetAliasMode & PKT_ALIAS_PROXY_ONLY)
+    if (libalias_cur->packetAliasMode & PKT_ALIAS_PROXY_ONLY)
         return PKT_ALIAS_OK;
 
     ic = (struct icmp *) ((char *) pip + (pip->ip_hl << 2));
@@ -771,7 +865,7 @@ ProtoAliasIn(struct ip *pip)
     struct alias_link *link;
 
 /* Return if proxy-only mode is enabled */
-    if (packetAliasMode & PKT_ALIAS_PROXY_ONLY)
+    if (libalias_cur->packetAliasMode & PKT_ALIAS_PROXY_ONLY)
         return PKT_ALIAS_OK;
 
     link = FindProtoIn(pip->ip_src, pip->ip_dst, pip->ip_p);
@@ -780,6 +874,7 @@ ProtoAliasIn(struct ip *pip)
         struct in_addr original_address;
 
         original_address = GetOriginalAddress(link);
+        AccountPacket(link, ACCT_IN, pip);
 
 /* Restore original IP address */
         DifferentialChecksum(&pip->ip_sum,
@@ -805,7 +900,7 @@ ProtoAliasOut(struct ip *pip)
     struct alias_link *link;
 
 /* Return if proxy-only mode is enabled */
-    if (packetAliasMode & PKT_ALIAS_PROXY_ONLY)
+    if (libalias_cur->packetAliasMode & PKT_ALIAS_PROXY_ONLY)
         return PKT_ALIAS_OK;
 
     link = FindProtoOut(pip->ip_src, pip->ip_dst, pip->ip_p);
@@ -814,6 +909,7 @@ ProtoAliasOut(struct ip *pip)
         struct in_addr alias_address;
 
         alias_address = GetAliasAddress(link);
+        AccountPacket(link, ACCT_OUT, pip);
 
 /* Change source address */
         DifferentialChecksum(&pip->ip_sum,
@@ -835,7 +931,7 @@ UdpAliasIn(struct ip *pip)
     struct alias_link *link;
 
 /* Return if proxy-only mode is enabled */
-    if (packetAliasMode & PKT_ALIAS_PROXY_ONLY)
+    if (libalias_cur->packetAliasMode & PKT_ALIAS_PROXY_ONLY)
         return PKT_ALIAS_OK;
 
     ud = (struct udphdr *) ((char *) pip + (pip->ip_hl << 2));
@@ -850,24 +946,26 @@ UdpAliasIn(struct ip *pip)
         u_short alias_port;
         int accumulate;
         u_short *sptr;
+        struct alias_helper *helper;
+        struct helper_args args;
 	int r = 0;
 
         alias_address = GetAliasAddress(link);
         original_address = GetOriginalAddress(link);
+        AccountPacket(link, ACCT_IN, pip);
         alias_port = ud->uh_dport;
         ud->uh_dport = GetOriginalPort(link);
 
 /* Special processing for IP encoding protocols */
-	if (ntohs(ud->uh_dport) == CUSEEME_PORT_NUMBER)
-	    AliasHandleCUSeeMeIn(pip, original_address);
-/* If NETBIOS Datagram, It should be alias address in UDP Data, too */
-	else if (ntohs(ud->uh_dport) == NETBIOS_DGM_PORT_NUMBER
-	      || ntohs(ud->uh_sport) == NETBIOS_DGM_PORT_NUMBER)
-	    r = AliasHandleUdpNbt(pip, link, &original_address, ud->uh_dport);
-	else if (ntohs(ud->uh_dport) == NETBIOS_NS_PORT_NUMBER
-	      || ntohs(ud->uh_sport) == NETBIOS_NS_PORT_NUMBER)
-	    r = AliasHandleUdpNbtNS(pip, link, &alias_address, &alias_port,
-				    &original_address, &ud->uh_dport);
+	helper = FindHelper(HELPER_UDP, ud->uh_sport, ud->uh_dport);
+	if (helper != NULL && helper->in != NULL)
+	{
+	    args.link = link;
+	    args.alias_address = &alias_address;
+	    args.alias_port = &alias_port;
+	    args.original_address = &original_address;
+	    r = helper->in(pip, &args);
+	}
 
 /* If UDP checksum is not zero, then adjust since destination port */
 /* is being unaliased and destination address is being altered.    */
@@ -909,7 +1007,7 @@ UdpAliasOut(struct ip *pip)
     struct alias_link *link;
 
 /* Return if proxy-only mode is enabled */
-    if (packetAliasMode & PKT_ALIAS_PROXY_ONLY)
+    if (libalias_cur->packetAliasMode & PKT_ALIAS_PROXY_ONLY)
         return PKT_ALIAS_OK;
 
     ud = (struct udphdr *) ((char *) pip + (pip->ip_hl << 2));
@@ -921,21 +1019,22 @@ UdpAliasOut(struct ip *pip)
     {
         u_short alias_port;
         struct in_addr alias_address;
+        struct alias_helper *helper;
+        struct helper_args args;
 
         alias_address = GetAliasAddress(link);
         alias_port = GetAliasPort(link);
+        AccountPacket(link, ACCT_OUT, pip);
 
 /* Special processing for IP encoding protocols */
-	if (ntohs(ud->uh_dport) == CUSEEME_PORT_NUMBER)
-	    AliasHandleCUSeeMeOut(pip, link);
-/* If NETBIOS Datagram, It should be alias address in UDP Data, too */
-	else if (ntohs(ud->uh_dport) == NETBIOS_DGM_PORT_NUMBER
-	      || ntohs(ud->uh_sport) == NETBIOS_DGM_PORT_NUMBER)
-	    AliasHandleUdpNbt(pip, link, &alias_address, alias_port);
-	else if (ntohs(ud->uh_dport) == NETBIOS_NS_PORT_NUMBER
-	      || ntohs(ud->uh_sport) == NETBIOS_NS_PORT_NUMBER)
-	    AliasHandleUdpNbtNS(pip, link, &pip->ip_src, &ud->uh_sport,
-				&alias_address, &alias_port);
+	helper = FindHelper(HELPER_UDP, ud->uh_sport, ud->uh_dport);
+	if (helper != NULL && helper->out != NULL)
+	{
+	    args.link = link;
+	    args.alias_address = &alias_address;
+	    args.alias_port = &alias_port;
+	    helper->out(pip, &args);
+	}
 
 /* If UDP checksum is not zero, adjust since source port is */
 /* being aliased and source address is being altered        */
@@ -983,7 +1082,8 @@ TcpAliasIn(struct ip *pip)
     link = FindUdpTcpIn(pip->ip_src, pip->ip_dst,
                         tc->th_sport, tc->th_dport,
                         IPPROTO_TCP,
-                        !(packetAliasMode & PKT_ALIAS_PROXY_ONLY));
+                        !(libalias_cur->packetAliasMode &
+                          PKT_ALIAS_PROXY_ONLY));
     if (link != NULL)
     {
         struct in_addr alias_address;
@@ -993,11 +1093,16 @@ TcpAliasIn(struct ip *pip)
         u_short proxy_port;
         int accumulate;
         u_short *sptr;
+        struct alias_helper *helper;
+        struct helper_args args;
 
 /* Special processing for IP encoding protocols */
-        if (ntohs(tc->th_dport) == PPTP_CONTROL_PORT_NUMBER
-         || ntohs(tc->th_sport) == PPTP_CONTROL_PORT_NUMBER)
-            AliasHandlePptpIn(pip, link);
+        helper = FindHelper(HELPER_TCP, tc->th_sport, tc->th_dport);
+        if (helper != NULL && helper->in != NULL)
+        {
+            args.link = link;
+            helper->in(pip, &args);
+        }
 
         alias_address = GetAliasAddress(link);
         original_address = GetOriginalAddress(link);
@@ -1077,8 +1182,9 @@ TcpAliasIn(struct ip *pip)
 
         ADJUST_CHECKSUM(accumulate, pip->ip_sum);
 
-/* Monitor TCP connection state */
+/* Monitor TCP connection state and count the packet */
         TcpMonitorIn(pip, link);
+        AccountPacket(link, ACCT_IN, pip);
 
         return(PKT_ALIAS_OK);
     }
@@ -1100,7 +1206,8 @@ TcpAliasOut(struct ip *pip, int maxpacketsize)
 
     proxy_type = ProxyCheck(pip, &proxy_server_address, &proxy_server_port);
 
-    if (proxy_type == 0 && (packetAliasMode & PKT_ALIAS_PROXY_ONLY))
+    if (proxy_type == 0
+     && (libalias_cur->packetAliasMode & PKT_ALIAS_PROXY_ONLY))
         return PKT_ALIAS_OK;
 
 /* If this is a transparent proxy, save original destination,
@@ -1145,6 +1252,8 @@ TcpAliasOut(struct ip *pip, int maxpacketsize)
         struct in_addr alias_address;
         int accumulate;
         u_short *sptr;
+        struct alias_helper *helper;
+        struct helper_args args;
 
 /* Save original destination address, if this is a proxy packet.
    Also modify packet to include destination encoding. */
@@ -1159,24 +1268,18 @@ TcpAliasOut(struct ip *pip, int maxpacketsize)
         alias_port = GetAliasPort(link);
         alias_address = GetAliasAddress(link);
 
-/* Monitor TCP connection state */
+/* Monitor TCP connection state and count the packet */
         TcpMonitorOut(pip, link);
+        AccountPacket(link, ACCT_OUT, pip);
 
 /* Special processing for IP encoding protocols */
-        if (ntohs(tc->th_dport) == FTP_CONTROL_PORT_NUMBER
-         || ntohs(tc->th_sport) == FTP_CONTROL_PORT_NUMBER)
-            AliasHandleFtpOut(pip, link, maxpacketsize);
-        else if (ntohs(tc->th_dport) == IRC_CONTROL_PORT_NUMBER_1
-         || ntohs(tc->th_dport) == IRC_CONTROL_PORT_NUMBER_2)
-            AliasHandleIrcOut(pip, link, maxpacketsize);
-        else if (ntohs(tc->th_dport) == RTSP_CONTROL_PORT_NUMBER_1
-         || ntohs(tc->th_sport) == RTSP_CONTROL_PORT_NUMBER_1
-         || ntohs(tc->th_dport) == RTSP_CONTROL_PORT_NUMBER_2
-         || ntohs(tc->th_sport) == RTSP_CONTROL_PORT_NUMBER_2) 
-            AliasHandleRtspOut(pip, link, maxpacketsize);
-        else if (ntohs(tc->th_dport) == PPTP_CONTROL_PORT_NUMBER
-         || ntohs(tc->th_sport) == PPTP_CONTROL_PORT_NUMBER)
-            AliasHandlePptpOut(pip, link);
+        helper = FindHelper(HELPER_TCP, tc->th_sport, tc->th_dport);
+        if (helper != NULL && helper->out != NULL)
+        {
+            args.link = link;
+            args.maxpacketsize = maxpacketsize;
+            helper->out(pip, &args);
+        }
 
 /* Adjust TCP checksum since source port is being aliased */
 /* and source address is being altered                    */
@@ -1237,10 +1340,10 @@ TcpAliasOut(struct ip *pip, int maxpacketsize)
 
 The packet aliasing module has a limited ability for handling IP
 fragments.  If the ICMP, TCP or UDP header is in the first fragment
-received, then the ID number of the IP packet is saved, and other
-fragments are identified according to their ID number and IP address
-they were sent from.  Pointers to unresolved fragments can also be
-saved and recalled when a header fragment is seen.
+received, then where it went is noted in the fragment cache, and
+other fragments are identified by their addresses, ID number and
+protocol.  Unresolved fragments can also be held in the cache and
+given back, all at once, when their header fragment is seen.
 */
 
 /* Local prototypes */
@@ -1251,14 +1354,11 @@ static int FragmentOut(struct ip *);
 static int
 FragmentIn(struct ip *pip)
 {
-    struct alias_link *link;
+    struct in_addr original_address;
 
-    link = FindFragmentIn2(pip->ip_src, pip->ip_dst, pip->ip_id);
-    if (link != NULL)
+    if (FragCacheLookup(pip->ip_src, pip->ip_dst, pip->ip_id, pip->ip_p,
+                        &original_address) == 0)
     {
-        struct in_addr original_address;
-
-        GetFragmentAddr(link, &original_address);
         DifferentialChecksum(&pip->ip_sum,
                              (u_short *) &original_address,
                              (u_short *) &pip->ip_dst,
@@ -1293,66 +1393,73 @@ FragmentOut(struct ip *pip)
 
 /* Outside World Access
 
-        PacketAliasSaveFragment()
-        PacketAliasGetFragment()
-        PacketAliasFragmentIn()
-        PacketAliasIn()
-        PacketAliasOut()
-        PacketUnaliasOut()
+        LibAliasSaveFragment()
+        LibAliasGetFragment()
+        LibAliasGetFragments()
+        LibAliasFragmentIn()
+        LibAliasIn()
+        LibAliasOut()
+        LibAliasInBatch()
+        LibAliasOutBatch()
+        LibAliasUnaliasOut()
+
+The work of LibAliasIn() and LibAliasOut() is done in AliasIn()
+and AliasOut(), which leave housekeeping to the caller so that the
+batch functions can do it once per batch rather than once per packet.
+
+Each function makes the instance it is given current before doing
+anything else.  The PacketAlias*() forms at the end of the file do
+the same on packetAliasInstance.
 
 (prototypes in alias.h)
 */
 
 
 int
-PacketAliasSaveFragment(char *ptr)
+LibAliasSaveFragment(struct libalias *instance, char *ptr)
 {
-    int iresult;
-    struct alias_link *link;
-    struct ip *pip;
-
-    pip = (struct ip *) ptr;
-    link = AddFragmentPtrLink(pip->ip_src, pip->ip_id);
-    iresult = PKT_ALIAS_ERROR;
-    if (link != NULL)
-    {
-        SetFragmentPtr(link, ptr);
-        iresult = PKT_ALIAS_OK;
-    }
-    return(iresult);
+    libalias_cur = instance;
+    if (FragCacheHold((struct ip *) ptr) == -1)
+        return(PKT_ALIAS_ERROR);
+    return(PKT_ALIAS_OK);
 }
 
 
 char *
-PacketAliasGetFragment(char *ptr)
+LibAliasGetFragment(struct libalias *instance, char *ptr)
 {
-    struct alias_link *link;
     char *fptr;
-    struct ip *pip;
-
-    pip = (struct ip *) ptr;
-    link = FindFragmentPtr(pip->ip_src, pip->ip_id);
-    if (link != NULL)
-    {
-        GetFragmentPtr(link, &fptr);
-        SetFragmentPtr(link, NULL);
-        SetExpire(link, 0); /* Deletes link */
 
-        return(fptr);
-    }
-    else
-    {
+    libalias_cur = instance;
+    if (FragCacheRelease((struct ip *) ptr, &fptr, 1) == 0)
         return(NULL);
-    }
+    return(fptr);
+}
+
+
+/* Give back up to max of the fragments held for the header fragment
+   at ptr, de-aliased to match it, and return how many there were. */
+int
+LibAliasGetFragments(struct libalias *instance, char *ptr,
+                     char **fragments, int max)
+{
+    int i, n;
+
+    libalias_cur = instance;
+    n = FragCacheRelease((struct ip *) ptr, fragments, max);
+    for (i = 0; i < n; i++)
+        LibAliasFragmentIn(instance, ptr, fragments[i]);
+    return(n);
 }
 
 
 void
-PacketAliasFragmentIn(char *ptr,          /* Points to correctly de-aliased
-                                             header fragment */
-                      char *ptr_fragment  /* Points to fragment which must
-                                             be de-aliased   */
-                     )
+LibAliasFragmentIn(struct libalias *instance,
+                   char *ptr,          /* Points to correctly de-aliased
+                                          header fragment */
+                   char *ptr_fragment  /* Points to fragment which must
+                                          be de-aliased   */
+                  )
 {
     struct ip *pip;
     struct ip *fpip;
@@ -1368,21 +1475,25 @@ PacketAliasFragmentIn(char *ptr,          /* Points to correctly de-aliased
 }
 
 
-int
-PacketAliasIn(char *ptr, int maxpacketsize)
+static int AliasIn(char *, int);
+static int AliasOut(char *, int);
+static void AliasPrefetch(char *, int, int);
+static int AliasBatch(char **, const int *, int *, int, int);
+
+static int
+AliasIn(char *ptr, int maxpacketsize)
 {
     struct in_addr alias_addr;
     struct ip *pip;
     int iresult;
 
-    if (packetAliasMode & PKT_ALIAS_REVERSE) {
-        packetAliasMode &= ~PKT_ALIAS_REVERSE;
-        iresult = PacketAliasOut(ptr, maxpacketsize);
-        packetAliasMode |= PKT_ALIAS_REVERSE;
+    if (libalias_cur->packetAliasMode & PKT_ALIAS_REVERSE) {
+        libalias_cur->packetAliasMode &= ~PKT_ALIAS_REVERSE;
+        iresult = AliasOut(ptr, maxpacketsize);
+        libalias_cur->packetAliasMode |= PKT_ALIAS_REVERSE;
         return iresult;
     }
 
-    HouseKeeping();
     ClearCheckNewLink();
     pip = (struct ip *) ptr;
     alias_addr = pip->ip_dst;
@@ -1407,7 +1518,7 @@ PacketAliasIn(char *ptr, int maxpacketsize)
                 iresult = TcpAliasIn(pip);
                 break;
             case IPPROTO_GRE:
-		if (packetAliasMode & PKT_ALIAS_PROXY_ONLY ||
+		if (libalias_cur->packetAliasMode & PKT_ALIAS_PROXY_ONLY ||
 		    AliasHandlePptpGreIn(pip) == 0)
 		    iresult = PKT_ALIAS_OK;
 		else
@@ -1420,18 +1531,11 @@ PacketAliasIn(char *ptr, int maxpacketsize)
 
         if (ntohs(pip->ip_off) & IP_MF)
         {
-            struct alias_link *link;
-
-            link = FindFragmentIn1(pip->ip_src, alias_addr, pip->ip_id);
-            if (link != NULL)
-            {
+            if (FragCacheResolve(pip->ip_src, alias_addr, pip->ip_id,
+                                 pip->ip_p, pip->ip_dst) == 0)
                 iresult = PKT_ALIAS_FOUND_HEADER_FRAGMENT;
-                SetFragmentAddr(link, pip->ip_dst);
-            }
             else
-            {
                 iresult = PKT_ALIAS_ERROR;
-            }
         }
     }
     else
@@ -1458,24 +1562,23 @@ PacketAliasIn(char *ptr, int maxpacketsize)
 #define UNREG_ADDR_C_LOWER 0xc0a80000
 #define UNREG_ADDR_C_UPPER 0xc0a8ffff
 
-int
-PacketAliasOut(char *ptr,           /* valid IP packet */
-               int  maxpacketsize   /* How much the packet data may grow
-                                       (FTP and IRC inline changes) */
-              )
+static int
+AliasOut(char *ptr,           /* valid IP packet */
+         int  maxpacketsize   /* How much the packet data may grow
+                                 (FTP and IRC inline changes) */
+        )
 {
     int iresult;
     struct in_addr addr_save;
     struct ip *pip;
 
-    if (packetAliasMode & PKT_ALIAS_REVERSE) {
-        packetAliasMode &= ~PKT_ALIAS_REVERSE;
-        iresult = PacketAliasIn(ptr, maxpacketsize);
-        packetAliasMode |= PKT_ALIAS_REVERSE;
+    if (libalias_cur->packetAliasMode & PKT_ALIAS_REVERSE) {
+        libalias_cur->packetAliasMode &= ~PKT_ALIAS_REVERSE;
+        iresult = AliasIn(ptr, maxpacketsize);
+        libalias_cur->packetAliasMode |= PKT_ALIAS_REVERSE;
         return iresult;
     }
 
-    HouseKeeping();
     ClearCheckNewLink();
     pip = (struct ip *) ptr;
 
@@ -1485,7 +1588,7 @@ PacketAliasOut(char *ptr,           /* valid IP packet */
         return PKT_ALIAS_IGNORED;
 
     addr_save = GetDefaultAliasAddress();
-    if (packetAliasMode & PKT_ALIAS_UNREGISTERED_ONLY)
+    if (libalias_cur->packetAliasMode & PKT_ALIAS_UNREGISTERED_ONLY)
     {
         in_addr_t addr;
         int iclass;
@@ -1539,10 +1642,144 @@ PacketAliasOut(char *ptr,           /* valid IP packet */
     return(iresult);
 }
 
+
+/* Start loading the link table chain that AliasIn() or AliasOut()
+   will search for this packet.  Only unfragmented ICMP, UDP and TCP
+   packets and simple protocols are looked at; anything else is left
+   to be found the slow way. */
+static void
+AliasPrefetch(char *ptr, int maxpacketsize, int incoming)
+{
+    struct ip *pip;
+    struct udphdr *ud;
+    struct icmp *ic;
+    u_short sport, dport;
+
+    if (libalias_cur->packetAliasMode & PKT_ALIAS_REVERSE)
+        incoming = !incoming;
+
+    pip = (struct ip *) ptr;
+    if (ntohs(pip->ip_len) > maxpacketsize
+     || (pip->ip_hl<<2) + 8 > maxpacketsize
+     || (ntohs(pip->ip_off) & IP_OFFMASK) != 0)
+        return;
+
+    sport = dport = 0;
+    switch (pip->ip_p)
+    {
+        case IPPROTO_ICMP:
+            ic = (struct icmp *) ((char *) pip + (pip->ip_hl << 2));
+            if (ic->icmp_type != ICMP_ECHO
+             && ic->icmp_type != ICMP_ECHOREPLY
+             && ic->icmp_type != ICMP_TSTAMP
+             && ic->icmp_type != ICMP_TSTAMPREPLY)
+                return;
+            sport = dport = ic->icmp_id;
+            break;
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+            /* The ports are at the same offset in both headers */
+            ud = (struct udphdr *) ((char *) pip + (pip->ip_hl << 2));
+            sport = ud->uh_sport;
+            dport = ud->uh_dport;
+            break;
+        case IPPROTO_GRE:
+            return;
+    }
+
+    if (incoming)
+        PrefetchLinkIn(pip->ip_dst, dport, pip->ip_p);
+    else
+        PrefetchLinkOut(pip->ip_src, pip->ip_dst, sport, dport, pip->ip_p);
+}
+
+
 int
-PacketUnaliasOut(char *ptr,           /* valid IP packet */
-                 int  maxpacketsize   /* for error checking */
-                )
+LibAliasIn(struct libalias *instance, char *ptr, int maxpacketsize)
+{
+    libalias_cur = instance;
+    HouseKeeping();
+    return AliasIn(ptr, maxpacketsize);
+}
+
+
+int
+LibAliasOut(struct libalias *instance,
+            char *ptr,           /* valid IP packet */
+            int  maxpacketsize   /* How much the packet data may grow
+                                    (FTP and IRC inline changes) */
+           )
+{
+    libalias_cur = instance;
+    HouseKeeping();
+    return AliasOut(ptr, maxpacketsize);
+}
+
+
+/* LibAliasInBatch() and LibAliasOutBatch() handle count packets
+   as LibAliasIn() and LibAliasOut() would, one after another,
+   leaving each packet's result in results[].  Housekeeping is done
+   once for the whole batch, and while one packet is being aliased the
+   headers and link table chain of the next are already being loaded.
+   The number of packets that came back PKT_ALIAS_OK is returned. */
+static int
+AliasBatch(char **ptrs, const int *maxpacketsizes, int *results, int count,
+           int incoming)
+{
+    int i, nok;
+
+    if (count <= 0)
+        return 0;
+
+    HouseKeepingBatch(count);
+
+    if (count > 1)
+        ALIAS_PREFETCH(ptrs[1]);
+    AliasPrefetch(ptrs[0], maxpacketsizes[0], incoming);
+
+    nok = 0;
+    for (i = 0; i < count; i++)
+    {
+        if (i + 2 < count)
+            ALIAS_PREFETCH(ptrs[i + 2]);
+        if (i + 1 < count)
+            AliasPrefetch(ptrs[i + 1], maxpacketsizes[i + 1], incoming);
+
+        if (incoming)
+            results[i] = AliasIn(ptrs[i], maxpacketsizes[i]);
+        else
+            results[i] = AliasOut(ptrs[i], maxpacketsizes[i]);
+        if (results[i] == PKT_ALIAS_OK)
+            nok++;
+    }
+
+    return nok;
+}
+
+
+int
+LibAliasInBatch(struct libalias *instance, char **ptrs,
+                const int *maxpacketsizes, int *results, int count)
+{
+    libalias_cur = instance;
+    return AliasBatch(ptrs, maxpacketsizes, results, count, 1);
+}
+
+
+int
+LibAliasOutBatch(struct libalias *instance, char **ptrs,
+                 const int *maxpacketsizes, int *results, int count)
+{
+    libalias_cur = instance;
+    return AliasBatch(ptrs, maxpacketsizes, results, count, 0);
+}
+
+
+int
+LibAliasUnaliasOut(struct libalias *instance,
+                   char *ptr,           /* valid IP packet */
+                   int  maxpacketsize   /* for error checking */
+                  )
 {
     struct ip		*pip;
     struct icmp 	*ic;
@@ -1551,6 +1788,7 @@ PacketUnaliasOut(char *ptr,           /* valid IP packet */
     struct alias_link 	*link;
     int 		iresult = PKT_ALIAS_IGNORED;
 
+    libalias_cur = instance;
     pip = (struct ip *) ptr;
 
     /* Defense against mangled packets */
@@ -1659,3 +1897,86 @@ PacketUnaliasOut(char *ptr,           /* valid IP packet */
     return(iresult);
 
 }
+
+
+/* Functions of the original interface, working on packetAliasInstance */
+
+void
+PacketAliasClampMSS(u_short mss)
+{
+    LibAliasClampMSS(packetAliasInstance, mss);
+}
+
+
+int
+PacketAliasSaveFragment(char *ptr)
+{
+    return LibAliasSaveFragment(packetAliasInstance, ptr);
+}
+
+
+char *
+PacketAliasGetFragment(char *ptr)
+{
+    return LibAliasGetFragment(packetAliasInstance, ptr);
+}
+
+
+int
+PacketAliasGetFragments(char *ptr, char **fragments, int max)
+{
+    return LibAliasGetFragments(packetAliasInstance, ptr, fragments, max);
+}
+
+
+void
+PacketAliasFragmentIn(char *ptr, char *ptr_fragment)
+{
+    LibAliasFragmentIn(packetAliasInstance, ptr, ptr_fragment);
+}
+
+
+int
+PacketAliasIn(char *ptr, int maxpacketsize)
+{
+    return LibAliasIn(packetAliasInstance, ptr, maxpacketsize);
+}
+
+
+int
+PacketAliasOut(char *ptr, int maxpacketsize)
+{
+    return LibAliasOut(packetAliasInstance, ptr, maxpacketsize);
+}
+
+
+int
+PacketAliasInBatch(char **ptrs, const int *maxpacketsizes, int *results,
+                   int count)
+{
+    return LibAliasInBatch(packetAliasInstance, ptrs, maxpacketsizes,
+                           results, count);
+}
+
+
+int
+PacketAliasOutBatch(char **ptrs, const int *maxpacketsizes, int *results,
+                    int count)
+{
+    return LibAliasOutBatch(packetAliasInstance, ptrs, maxpacketsizes,
+                            results, count);
+}
+
+
+int
+PacketUnaliasOut(char *ptr, int maxpacketsize)
+{
+    return LibAliasUnaliasOut(packetAliasInstance, ptr, maxpacketsize);
+}
+
+
+int
+PacketAliasSetHelper(const char *name, int enable)
+{
+    return LibAliasSetHelper(packetAliasInstance, name, enable);
+}
@@ -62,6 +62,37 @@
 /* Alias link representative (incomplete struct) */
 struct alias_link;
 
+/* Packet aliasing engine instance (incomplete struct) */
+struct libalias;
+
+/*
+ * Record of a link handed to the function set with
+ * PacketAliasSetAccounting(), when the link is made and again when it
+ * goes away.  Addresses and ports are in network byte order.
+ */
+struct alias_flow_record
+{
+    u_int8_t  type;              /* ALIAS_FLOW_CREATE or _EXPIRE        */
+    u_int8_t  proto;             /* IPPROTO_TCP, _UDP, _ICMP, ..., or 0 */
+    u_int16_t alias_port;        /*   for a PPTP or address link        */
+    struct in_addr src_addr;
+    struct in_addr dst_addr;
+    struct in_addr alias_addr;
+    u_int16_t src_port;
+    u_int16_t dst_port;
+    int32_t   time;              /* When the record was made            */
+    int32_t   last;              /* When the link last carried a packet */
+    u_int64_t packets_in;        /* Counts up to the time of the record */
+    u_int64_t packets_out;
+    u_int64_t bytes_in;
+    u_int64_t bytes_out;
+};
+
+#define ALIAS_FLOW_CREATE     1
+#define ALIAS_FLOW_EXPIRE     2
+
+typedef void alias_flow_fn(void *, const struct alias_flow_record *);
+
 /* External interfaces (API) to packet aliasing engine */
 
 /* Initialization and Control */
@@ -85,6 +116,12 @@ struct alias_link;
     extern void
     PacketAliasClampMSS(u_short mss);
 
+    extern int
+    PacketAliasReserveLinks(unsigned int);
+
+    extern void
+    PacketAliasSetMaxLinks(unsigned int);
+
 /* Packet Handling */
     extern int
     PacketAliasIn(char *, int maxpacketsize);
@@ -92,6 +129,14 @@ struct alias_link;
     extern int
     PacketAliasOut(char *, int maxpacketsize);
 
+    extern int
+    PacketAliasInBatch(char **, const int *maxpacketsizes, int *results,
+                       int count);
+
+    extern int
+    PacketAliasOutBatch(char **, const int *maxpacketsizes, int *results,
+                        int count);
+
     extern int
     PacketUnaliasOut(char *, int maxpacketsize);
 
@@ -127,6 +172,9 @@ struct alias_link;
     extern char *
     PacketAliasGetFragment(char *);
 
+    extern int
+    PacketAliasGetFragments(char *, char **, int);
+
     extern void 
     PacketAliasFragmentIn(char *, char *);
 
@@ -140,10 +188,146 @@ struct alias_link;
     extern u_short
     PacketAliasInternetChecksum(u_short *, int);
 
+    extern int
+    PacketAliasSetHelper(const char *, int);
+
+    extern int
+    PacketAliasSaveState(const char *);
+
+    extern int
+    PacketAliasLoadState(const char *, int);
+
+    extern int
+    PacketAliasSetAccounting(alias_flow_fn *, void *);
+
 /* Transparent Proxying */
     extern int
     PacketAliasProxyRule(const char *);
 
+    extern int
+    PacketAliasSetProxyRules(const char * const *, int);
+
+
+/* The same interfaces, working on a given instance rather than on the
+   one set up by PacketAliasInit().  Separate instances share no state,
+   so different threads may use different instances at the same time. */
+
+/* Initialization and Control */
+    extern struct libalias *
+    LibAliasInit(struct libalias *);
+
+    extern void
+    LibAliasUninit(struct libalias *);
+
+    extern void
+    LibAliasSetAddress(struct libalias *, struct in_addr);
+
+    extern unsigned int
+    LibAliasSetMode(struct libalias *, unsigned int, unsigned int);
+
+#ifndef NO_FW_PUNCH
+    extern void
+    LibAliasSetFWBase(struct libalias *, unsigned int, unsigned int);
+#endif
+
+    extern void
+    LibAliasClampMSS(struct libalias *, u_short mss);
+
+    extern int
+    LibAliasReserveLinks(struct libalias *, unsigned int);
+
+    extern void
+    LibAliasSetMaxLinks(struct libalias *, unsigned int);
+
+/* Packet Handling */
+    extern int
+    LibAliasIn(struct libalias *, char *, int maxpacketsize);
+
+    extern int
+    LibAliasOut(struct libalias *, char *, int maxpacketsize);
+
+    extern int
+    LibAliasInBatch(struct libalias *, char **, const int *maxpacketsizes,
+                    int *results, int count);
+
+    extern int
+    LibAliasOutBatch(struct libalias *, char **, const int *maxpacketsizes,
+                     int *results, int count);
+
+    extern int
+    LibAliasUnaliasOut(struct libalias *, char *, int maxpacketsize);
+
+/* Port and Address Redirection */
+    extern struct alias_link *
+    LibAliasRedirectPort(struct libalias *,
+                         struct in_addr, u_short,
+                         struct in_addr, u_short,
+                         struct in_addr, u_short,
+                         u_char);
+
+    extern int
+    LibAliasAddServer(struct libalias *,
+                      struct alias_link *link,
+                      struct in_addr addr,
+                      u_short port);
+
+    extern struct alias_link *
+    LibAliasRedirectProto(struct libalias *,
+                          struct in_addr,
+                          struct in_addr,
+                          struct in_addr,
+                          u_char);
+
+    extern struct alias_link *
+    LibAliasRedirectAddr(struct libalias *,
+                         struct in_addr,
+                         struct in_addr);
+
+    extern void
+    LibAliasRedirectDelete(struct libalias *, struct alias_link *);
+
+/* Fragment Handling */
+    extern int
+    LibAliasSaveFragment(struct libalias *, char *);
+
+    extern char *
+    LibAliasGetFragment(struct libalias *, char *);
+
+    extern int
+    LibAliasGetFragments(struct libalias *, char *, char **, int);
+
+    extern void
+    LibAliasFragmentIn(struct libalias *, char *, char *);
+
+/* Miscellaneous Functions */
+    extern void
+    LibAliasSetTarget(struct libalias *, struct in_addr addr);
+
+    extern int
+    LibAliasCheckNewLink(struct libalias *);
+
+    extern u_short
+    LibAliasInternetChecksum(struct libalias *, u_short *, int);
+
+    extern int
+    LibAliasSetHelper(struct libalias *, const char *, int);
+
+    extern int
+    LibAliasSaveState(struct libalias *, const char *);
+
+    extern int
+    LibAliasLoadState(struct libalias *, const char *, int);
+
+    extern int
+    LibAliasSetAccounting(struct libalias *, alias_flow_fn *, void *);
+
+/* Transparent Proxying */
+    extern int
+    LibAliasProxyRule(struct libalias *, const char *);
+
+    extern int
+    LibAliasSetProxyRules(struct libalias *, const char * const *, int);
+
 
 /********************** Mode flags ********************/
 /* Set these flags using PacketAliasSetMode() */
@@ -208,6 +392,11 @@ struct alias_link;
       and PacketAliasOut() are reversed */
 #define PKT_ALIAS_REVERSE 0x80
 
+/* If PKT_ALIAS_LARGE_TABLES is set, the link lookup tables start out
+      sized for a few hundred thousand links and never shrink below
+      that.  The tables still grow past it as links are added. */
+#define PKT_ALIAS_LARGE_TABLES 0x200
+
 /* Return Codes */
 #define PKT_ALIAS_ERROR -1
 #define PKT_ALIAS_OK 1
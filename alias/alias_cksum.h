@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2000-2002 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.1 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ *
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+    Alias_cksum.h holds the one's complement sum used for Internet
+    checksums.  It is kept in a header of inline functions so that
+    ping and traceroute can share it with the packet aliasing code
+    without linking against it.
+
+    CksumAccumulate() adds the 16 bit words of a buffer to a 64 bit
+    accumulator, with SSE2 or AVX2 when the compiler targets them and
+    with 32 bit loads otherwise.  CksumFold() reduces the accumulator
+    to 16 bits; the checksum itself is the complement of that.  As
+    with the original word loops, the sum is taken over host order
+    words, which gives the right result on either byte order.
+*/
+
+#ifndef _ALIAS_CKSUM_H_
+#define _ALIAS_CKSUM_H_
+
+#include <sys/types.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Number of vector loads between spills of the vector accumulator.
+ * Each 32 bit lane gains at most 2 * 0xffff per load, so this keeps
+ * the lanes well away from overflow.
+ */
+#define	CKSUM_VECTOR_RUN	4096
+
+static __inline u_int16_t
+CksumFold(u_int64_t sum)
+{
+    sum = (sum >> 32) + (sum & 0xffffffff);
+    sum = (sum >> 32) + (sum & 0xffffffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    return ((u_int16_t) sum);
+}
+
+static __inline u_int64_t
+CksumAccumulate(const void *buf, int nbytes, u_int64_t sum)
+{
+    const u_char *p;
+    u_int32_t w32;
+    u_int16_t w16;
+    int run;
+
+    p = buf;
+
+#if defined(__AVX2__)
+    while (nbytes >= 32)
+    {
+        __m256i zero, acc, v;
+        u_int32_t lanes[8];
+        int i;
+
+        zero = _mm256_setzero_si256();
+        acc = zero;
+        for (run = 0; run < CKSUM_VECTOR_RUN && nbytes >= 32; run++)
+        {
+            v = _mm256_loadu_si256((const __m256i *) p);
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+            p += 32;
+            nbytes -= 32;
+        }
+        _mm256_storeu_si256((__m256i *) lanes, acc);
+        for (i = 0; i < 8; i++)
+            sum += lanes[i];
+    }
+#elif defined(__SSE2__)
+    while (nbytes >= 16)
+    {
+        __m128i zero, acc, v;
+        u_int32_t lanes[4];
+
+        zero = _mm_setzero_si128();
+        acc = zero;
+        for (run = 0; run < CKSUM_VECTOR_RUN && nbytes >= 16; run++)
+        {
+            v = _mm_loadu_si128((const __m128i *) p);
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+            p += 16;
+            nbytes -= 16;
+        }
+        _mm_storeu_si128((__m128i *) lanes, acc);
+        sum += (u_int64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+#else
+    (void) run;
+    while (nbytes >= 16)
+    {
+        u_int32_t w[4];
+
+        memcpy(w, p, sizeof(w));
+        sum += (u_int64_t) w[0] + w[1] + w[2] + w[3];
+        p += 16;
+        nbytes -= 16;
+    }
+#endif
+
+    while (nbytes >= 4)
+    {
+        memcpy(&w32, p, 4);
+        sum += w32;
+        p += 4;
+        nbytes -= 4;
+    }
+    if (nbytes >= 2)
+    {
+        memcpy(&w16, p, 2);
+        sum += w16;
+        p += 2;
+        nbytes -= 2;
+    }
+    if (nbytes == 1)
+    {
+        w16 = 0;
+        ((u_char *) &w16)[0] = *p;
+        sum += w16;
+    }
+
+    return (sum);
+}
+
+#endif /* !_ALIAS_CKSUM_H_ */
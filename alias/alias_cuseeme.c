@@ -58,6 +58,8 @@
 
 #include "alias_local.h"
 
+#define CUSEEME_PORT_NUMBER 7648
+
 /* CU-SeeMe Data Header */
 struct cu_header {
     u_int16_t dest_family;
@@ -140,3 +142,26 @@ AliasHandleCUSeeMeIn(struct ip *pip, struct in_addr original_addr)
         }
   }
 }
+
+
+/* Protocol helper for alias.c: CU-SeeMe sessions */
+
+static int
+CUSeeMeHelperIn(struct ip *pip, struct helper_args *args)
+{
+    AliasHandleCUSeeMeIn(pip, *args->original_address);
+    return 0;
+}
+
+static int
+CUSeeMeHelperOut(struct ip *pip, struct helper_args *args)
+{
+    AliasHandleCUSeeMeOut(pip, args->link);
+    return 0;
+}
+
+struct alias_helper cuseemeHelper = {
+    "cuseeme", HELPER_UDP, HELPER_DST_PORT,
+    { CUSEEME_PORT_NUMBER },
+    CUSeeMeHelperIn, CUSeeMeHelperOut
+};
@@ -61,11 +61,11 @@
     port number.  Links are also used to store information about
     fragments.
 
-    There is a facility for sweeping through and deleting old
-    links as new packets are sent through.  A simple timeout is
-    used for ICMP and UDP links.  TCP links are left alone unless
-    there is an incomplete connection, in which case the link
-    can be deleted after a certain amount of time.
+    There is a facility for deleting old links as new packets
+    are sent through.  A simple timeout is used for ICMP and UDP
+    links.  TCP links are left alone unless there is an incomplete
+    connection, in which case the link can be deleted after a
+    certain amount of time.
 
 
     Initial version: August, 1996  (cjm)
@@ -166,13 +166,18 @@
 
 /* System include files */
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <syslog.h>
 
+#include <sys/mman.h>
 #include <sys/queue.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 
@@ -193,13 +198,31 @@
               near relevant functions or structs)
 */
 
-/* Sizes of input and output link tables */
-#define LINK_TABLE_OUT_SIZE         101
-#define LINK_TABLE_IN_SIZE         4001
+/* Sizing of input and output link tables.  The tables grow and
+   shrink with the number of live links; see LinkTableAdjust().
+   LINK_TABLE_MIN_SIZE is in alias_local.h. */
+#define LINK_TABLE_NSIZES            12 /* Up to LINK_TABLE_MIN_SIZE << 11 */
+#define LINK_TABLE_SIZE_INITIAL       0 /* Size indices, log2(size/min)  */
+#define LINK_TABLE_SIZE_LARGE         6 /*   (PKT_ALIAS_LARGE_TABLES)    */
+#define LINK_TABLE_MAX_LOAD           2 /* Grow above this many links per chain */
+#define LINK_TABLE_MIN_LOAD           8 /* Shrink below one link per this many chains */
+#define LINK_TABLE_REHASH_CHAINS     16 /* Chains moved per packet while resizing */
+
+/* Number of items carved from each slab of a link storage pool */
+#define POOL_SLAB_ITEMS             256
+
+/* Pool items are rounded up so that free list pointers stay aligned */
+#define POOL_ITEM_SIZE(type) \
+	((sizeof(type) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+/* Interval between chain length histograms in the log file */
+#define ALIAS_HISTOGRAM_INTERVAL_SECS 60
+#define ALIAS_HISTOGRAM_BUCKETS        8 /* Last bucket counts longer chains */
 
-/* Parameters used for cleanup of expired links */
-#define ALIAS_CLEANUP_INTERVAL_SECS  60
-#define ALIAS_CLEANUP_MAX_SPOKES     30
+/* Timing wheel used for cleanup of expired links.  Level 0 has
+   one-second slots; each slot of the next level covers a whole
+   turn of the level below it.  The slot counts are in alias_local.h. */
+#define WHEEL_RANGE      (1 << (WHEEL0_BITS + 2 * WHEELN_BITS))
 
 /* Timeouts (in seconds) for different link types */
 #define ICMP_EXPIRE_TIME             60
@@ -269,6 +292,13 @@ static int iChatAVHack = 1;
     port and link type.  On output, the lookup table indexes on
     source address, destination address, source port, destination
     port and link type.
+
+    Both lookup tables are resized as links come and go.  A resize
+    allocates the new chain array and then moves a few chains from
+    the old array per packet, so no single packet pays for the whole
+    table.  Until the old array is drained, a link lives in the old
+    array if its old chain has not been moved yet, and in the new
+    array otherwise.
 */
 
 struct ack_data_record     /* used to save changes to ACK/sequence numbers */
@@ -322,8 +352,6 @@ struct alias_link                /* Main data structure */
 #define LINK_ICMP                     IPPROTO_ICMP
 #define LINK_UDP                      IPPROTO_UDP
 #define LINK_TCP                      IPPROTO_TCP
-#define LINK_FRAGMENT_ID              (IPPROTO_MAX + 1)
-#define LINK_FRAGMENT_PTR             (IPPROTO_MAX + 2)
 #define LINK_ADDR                     (IPPROTO_MAX + 3)
 #define LINK_PPTP                     (IPPROTO_MAX + 4)
 
@@ -342,85 +370,49 @@ struct alias_link                /* Main data structure */
     int expire_time;             /* Expire time for link                */
 
     int sockfd;                  /* socket descriptor                   */
+    u_int acct;                  /* Index of the link's counters, or 0  */
 
     LIST_ENTRY(alias_link) list_out; /* Linked list of pointers for     */
     LIST_ENTRY(alias_link) list_in;  /* input and output lookup tables  */
+    LIST_ENTRY(alias_link) list_expire; /* Timing wheel slot            */
 
     union                        /* Auxiliary data                      */
     {
-        char *frag_ptr;
-        struct in_addr frag_addr;
         struct tcp_dat *tcp;
     } data;
 };
 
+struct pool_slab                 /* Block of memory carved into items   */
+{
+    struct pool_slab *next;
+    size_t nitems;
+};
+
+struct pool_item                 /* Header of an item on a free list    */
+{
+    struct pool_item *next;
+};
+
+
 
 
 
 
 /* Global Variables 
 
-    The global variables listed here are only accessed from
-    within alias_db.c and so are prefixed with the static 
-    designation.
+    Everything belonging to one aliasing engine is kept in struct
+    libalias (see alias_local.h).  The variables here are shared by
+    all instances.
 */
 
-int packetAliasMode;                 /* Mode flags                      */ 
-                                     /*        - documented in alias.h  */
+__thread struct libalias *libalias_cur; /* Instance being worked on by */
+                                        /*   this thread              */
 
-static struct in_addr aliasAddress;  /* Address written onto source     */
-                                     /*   field of IP packet.           */
-
-static struct in_addr targetAddress; /* IP address incoming packets     */
-                                     /*   are sent to if no aliasing    */
-                                     /*   link already exists           */
+struct libalias *packetAliasInstance; /* Instance used by the          */
+                                     /*   PacketAlias*() functions      */
 
 static struct in_addr nullAddress;   /* Used as a dummy parameter for   */
                                      /*   some function calls           */
-static LIST_HEAD(, alias_link)
-linkTableOut[LINK_TABLE_OUT_SIZE];   /* Lookup table of pointers to     */
-                                     /*   chains of link records. Each  */
-static LIST_HEAD(, alias_link)       /*   link record is doubly indexed */
-linkTableIn[LINK_TABLE_IN_SIZE];     /*   into input and output lookup  */
-                                     /*   tables.                       */
-
-static int icmpLinkCount;            /* Link statistics                 */
-static int udpLinkCount;
-static int tcpLinkCount;
-static int pptpLinkCount;
-static int protoLinkCount;
-static int fragmentIdLinkCount;
-static int fragmentPtrLinkCount;
-static int sockCount;
-
-static int cleanupIndex;             /* Index to chain of link table    */
-                                     /* being inspected for old links   */
-
-static int timeStamp;                /* System time in seconds for      */
-                                     /* current packet                  */
-
-static int lastCleanupTime;          /* Last time IncrementalCleanup()  */
-                                     /* was called                      */
-
-static int houseKeepingResidual;     /* used by HouseKeeping()          */
-
-static int deleteAllLinks;           /* If equal to zero, DeleteLink()  */
-                                     /* will not remove permanent links */
-
-static FILE *monitorFile;            /* File descriptor for link        */
-                                     /* statistics monitoring file      */
-
-static int newDefaultLink;           /* Indicates if a new aliasing     */
-                                     /* link has been created after a   */
-                                     /* call to PacketAliasIn/Out().    */
-             
-#ifndef NO_FW_PUNCH
-static int fireWallFD = -1;          /* File descriptor to be able to   */
-                                     /* control firewall.  Opened by    */
-                                     /* PacketAliasSetMode on first     */
-                                     /* setting the PKT_ALIAS_PUNCH_FW  */
-                                     /* flag.                           */
-#endif
 
 
 
@@ -431,27 +423,56 @@ static int fireWallFD = -1;          /* File descriptor to be able to   */
 /* Internal utility routines (used only in alias_db.c)
 
 Lookup table starting points:
+    LinkHash()               -- keyed hash of a lookup key
     StartPointIn()           -- link table initial search point for
                                 incoming packets
     StartPointOut()          -- link table initial search point for
                                 outgoing packets
+
+Lookup table maintenance:
+    LinkTableInit()          -- set up a table at its minimum size
+    LinkTableChain()         -- chain holding a given hash value
+    LinkTableResize()        -- start moving a table to a new size
+    LinkTableRehash()        -- move chains from the old array
+    LinkTableAdjust()        -- resize a table to fit the link count
+    LinkTableFree()          -- shrink an empty table back to its
+                                static array
     
 Miscellaneous:
     SeqDiff()                -- difference between two TCP sequences
     ShowAliasStats()         -- send alias statistics to a monitor file
+    ChainLengths()           -- count the chains of a table by length
+    ShowChainLengths()       -- send a chain length histogram to the
+                                monitor file
 */
 
 
 /* Local prototypes */
+static u_int LinkHash(u_int64_t, u_int64_t);
+
 static u_int StartPointIn(struct in_addr, u_short, int);
 
 static u_int StartPointOut(struct in_addr, struct in_addr,
                            u_short, u_short, int);
 
+static void LinkTableInit(struct link_table *, struct link_chain *);
+
+static struct link_chain *LinkTableChain(struct link_table *, u_int);
+
+static void LinkTableResize(struct link_table *, u_int);
+
+static void LinkTableRehash(struct link_table *, u_int);
+
+static void LinkTableAdjust(struct link_table *, u_int);
+
+static void LinkTableFree(struct link_table *);
+
 static int SeqDiff(__uint32_t, __uint32_t);
 
 #ifndef	DEBUG
 static void ShowAliasStats(void);
+
+static void ShowChainLengths(const char *, struct link_table *);
 #endif
 
 #ifndef NO_FW_PUNCH
@@ -459,24 +480,82 @@ static void ShowAliasStats(void);
 static void InitPunchFW(void);
 static void UninitPunchFW(void);
 static void ClearFWHole(struct alias_link *link);
+static void FlushFWHoles(void);
 #endif
 
+/* Link accounting */
+static int AcctGrow(void);
+static void AcctAttach(struct alias_link *);
+static void AcctDetach(struct alias_link *);
+static void AcctFree(void);
+
 /* Log file control */
 static void InitPacketAliasLog(void);
 static void UninitPacketAliasLog(void);
 
+/*
+    LinkHash() is SipHash-1-3 of a 16 byte message, keyed with
+    linkHashKey.  The key is chosen at random by LibAliasInit(),
+    so that remote hosts cannot pick addresses and ports which pile
+    up in a single chain.
+*/
+
+#define SIP_ROTL(x, b)  (u_int64_t) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIP_ROUND(v0, v1, v2, v3) \
+	do { \
+		v0 += v1; v1 = SIP_ROTL(v1, 13); v1 ^= v0; v0 = SIP_ROTL(v0, 32); \
+		v2 += v3; v3 = SIP_ROTL(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = SIP_ROTL(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = SIP_ROTL(v1, 17); v1 ^= v2; v2 = SIP_ROTL(v2, 32); \
+	} while (0)
+
+static u_int
+LinkHash(u_int64_t m0, u_int64_t m1)
+{
+    u_int64_t v0, v1, v2, v3;
+    u_int64_t b;
+
+    v0 = libalias_cur->linkHashKey[0] ^ 0x736f6d6570736575ULL;
+    v1 = libalias_cur->linkHashKey[1] ^ 0x646f72616e646f6dULL;
+    v2 = libalias_cur->linkHashKey[0] ^ 0x6c7967656e657261ULL;
+    v3 = libalias_cur->linkHashKey[1] ^ 0x7465646279746573ULL;
+
+    v3 ^= m0;
+    SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= m0;
+
+    v3 ^= m1;
+    SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= m1;
+
+    b = (u_int64_t) 16 << 56;
+    v3 ^= b;
+    SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+
+    b = v0 ^ v1 ^ v2 ^ v3;
+    return((u_int) (b ^ (b >> 32)));
+}
+
+
 static u_int
 StartPointIn(struct in_addr alias_addr,
              u_short alias_port,
              int link_type)
 {
-    u_int n;
+    u_int64_t m;
 
-    n  = alias_addr.s_addr;
+    m  = alias_addr.s_addr;
     if (link_type != LINK_PPTP)
-	n += alias_port;
-    n += link_type;
-    return(n % LINK_TABLE_IN_SIZE);
+	m |= (u_int64_t) alias_port << 32;
+    m |= (u_int64_t) link_type << 48;
+    return(LinkHash(m, 0));
 }
 
 
@@ -484,17 +563,174 @@ static u_int
 StartPointOut(struct in_addr src_addr, struct in_addr dst_addr,
               u_short src_port, u_short dst_port, int link_type)
 {
-    u_int n;
+    u_int64_t m0, m1;
 
-    n  = src_addr.s_addr;
-    n += dst_addr.s_addr;
+    m0  = src_addr.s_addr;
+    m0 |= (u_int64_t) dst_addr.s_addr << 32;
+    m1  = link_type;
     if (link_type != LINK_PPTP) {
-	n += src_port; 
-	n += dst_port;
+	m1 |= (u_int64_t) src_port << 32;
+	m1 |= (u_int64_t) dst_port << 48;
+    }
+
+    return(LinkHash(m0, m1));
+}
+
+
+static void
+LinkTableInit(struct link_table *table, struct link_chain *base)
+{
+    u_int i;
+
+    table->base = base;
+    table->chain = base;
+    table->size = LINK_TABLE_MIN_SIZE;
+    table->size_index = 0;
+    table->old_chain = NULL;
+    table->old_size = 0;
+    table->rehash_index = 0;
+
+    for (i=0; i<table->size; i++)
+        LIST_INIT(&table->chain[i]);
+}
+
+
+static struct link_chain *
+LinkTableChain(struct link_table *table, u_int hash)
+{
+/* Chains of the old array below rehash_index have already been
+   moved to the new array. */
+    if (table->old_chain != NULL)
+    {
+        u_int i;
+
+        i = hash & (table->old_size - 1);
+        if (i >= table->rehash_index)
+            return(&table->old_chain[i]);
+    }
+
+    return(&table->chain[hash & (table->size - 1)]);
+}
+
+
+static void
+LinkTableResize(struct link_table *table, u_int size_index)
+{
+    struct link_chain *chain;
+    u_int i, size;
+
+/* Only one resize may be in progress at a time */
+    if (table->old_chain != NULL || size_index == table->size_index)
+        return;
+
+    size = LINK_TABLE_MIN_SIZE << size_index;
+    if (size_index == 0)
+        chain = table->base;
+    else
+        chain = malloc(size * sizeof(struct link_chain));
+
+    if (chain == NULL)
+    {
+#ifdef DEBUG
+        fprintf(stderr, "PacketAlias/LinkTableResize(): ");
+        fprintf(stderr, "malloc() call failed.\n");
+#endif
+        return;
+    }
+
+    for (i=0; i<size; i++)
+        LIST_INIT(&chain[i]);
+
+    table->old_chain = table->chain;
+    table->old_size = table->size;
+    table->rehash_index = 0;
+    table->chain = chain;
+    table->size = size;
+    table->size_index = size_index;
+}
+
+
+static void
+LinkTableRehash(struct link_table *table, u_int nchains)
+{
+    struct alias_link *link;
+
+    while (table->old_chain != NULL && nchains-- > 0)
+    {
+        struct link_chain *old;
+
+        old = &table->old_chain[table->rehash_index++];
+        if (table == &libalias_cur->linkTableOut)
+        {
+            while ((link = LIST_FIRST(old)) != NULL)
+            {
+                u_int i;
+
+                i = StartPointOut(link->src_addr, link->dst_addr,
+                                  link->src_port, link->dst_port,
+                                  link->link_type);
+                LIST_REMOVE(link, list_out);
+                LIST_INSERT_HEAD(&table->chain[i & (table->size - 1)],
+                                 link, list_out);
+            }
+        }
+        else
+        {
+            while ((link = LIST_FIRST(old)) != NULL)
+            {
+                u_int i;
+
+                i = StartPointIn(link->alias_addr, link->alias_port,
+                                 link->link_type);
+                LIST_REMOVE(link, list_in);
+                LIST_INSERT_HEAD(&table->chain[i & (table->size - 1)],
+                                 link, list_in);
+            }
+        }
+
+        if (table->rehash_index == table->old_size)
+        {
+            if (table->old_chain != table->base)
+                free(table->old_chain);
+            table->old_chain = NULL;
+            table->old_size = 0;
+            table->rehash_index = 0;
+        }
+    }
+}
+
+
+static void
+LinkTableAdjust(struct link_table *table, u_int nchains)
+{
+    u_int size_index;
+
+/* Finish any resize in progress before considering another one */
+    if (table->old_chain != NULL)
+    {
+        LinkTableRehash(table, nchains);
+        return;
     }
-    n += link_type;
 
-    return(n % LINK_TABLE_OUT_SIZE);
+    size_index = table->size_index;
+    if (size_index < libalias_cur->linkTableMinIndex)
+        LinkTableResize(table, libalias_cur->linkTableMinIndex);
+    else if ((u_int) libalias_cur->linkCount > table->size * LINK_TABLE_MAX_LOAD
+          && size_index + 1 < LINK_TABLE_NSIZES)
+        LinkTableResize(table, size_index + 1);
+    else if (size_index > libalias_cur->linkTableMinIndex
+          && (u_int) libalias_cur->linkCount
+             < table->size / LINK_TABLE_MIN_LOAD)
+        LinkTableResize(table, size_index - 1);
+}
+
+
+static void
+LinkTableFree(struct link_table *table)
+{
+    LinkTableRehash(table, table->old_size);
+    LinkTableResize(table, 0);
+    LinkTableRehash(table, table->old_size);
 }
 
 
@@ -512,37 +748,225 @@ SeqDiff(__uint32_t x, __uint32_t y)
 }
 
 
+/* Count the chains of a table holding 0, 1, 2, ... links into
+   hist[0..nbuckets-1], the last bucket taking longer chains, and
+   return the length of the longest chain.  Chains not yet moved by
+   a resize are counted where they are. */
+u_int
+ChainLengths(struct link_table *table, u_int *hist, u_int nbuckets)
+{
+    u_int i, len, max;
+    struct alias_link *link;
+
+    memset(hist, 0, nbuckets * sizeof(u_int));
+    max = 0;
+    for (i=0; i<table->size + table->old_size; i++)
+    {
+        struct link_chain *chain;
+
+        if (i < table->size)
+            chain = &table->chain[i];
+        else if (i - table->size >= table->rehash_index)
+            chain = &table->old_chain[i - table->size];
+        else
+            continue;
+
+        len = 0;
+        if (table == &libalias_cur->linkTableOut)
+            LIST_FOREACH(link, chain, list_out)
+                len++;
+        else
+            LIST_FOREACH(link, chain, list_in)
+                len++;
+
+        if (len > max)
+            max = len;
+        if (len >= nbuckets)
+            len = nbuckets - 1;
+        hist[len]++;
+    }
+    return(max);
+}
+
+
 #ifndef	DEBUG
 static void
 ShowAliasStats(void)
 {
 /* Used for debugging */
 
-   if (monitorFile)
+   if (libalias_cur->monitorFile)
    {
-      fprintf(monitorFile, "icmp=%d, udp=%d, tcp=%d, pptp=%d, proto=%d, frag_id=%d frag_ptr=%d",
-              icmpLinkCount,
-              udpLinkCount,
-              tcpLinkCount,
-              pptpLinkCount,
-              protoLinkCount,
-              fragmentIdLinkCount,
-              fragmentPtrLinkCount);
-
-      fprintf(monitorFile, " / tot=%d  (sock=%d)\n",
-              icmpLinkCount + udpLinkCount
-                            + tcpLinkCount
-                            + pptpLinkCount
-                            + protoLinkCount
-                            + fragmentIdLinkCount
-                            + fragmentPtrLinkCount,
-              sockCount);
-
-      fflush(monitorFile);
+      fprintf(libalias_cur->monitorFile, "icmp=%d, udp=%d, tcp=%d, pptp=%d, proto=%d, frag_id=%d frag_ptr=%d",
+              libalias_cur->icmpLinkCount,
+              libalias_cur->udpLinkCount,
+              libalias_cur->tcpLinkCount,
+              libalias_cur->pptpLinkCount,
+              libalias_cur->protoLinkCount,
+              libalias_cur->fragmentIdCount,
+              libalias_cur->fragmentPtrCount);
+
+      fprintf(libalias_cur->monitorFile, " / tot=%d  (sock=%d)\n",
+              libalias_cur->icmpLinkCount + libalias_cur->udpLinkCount
+                            + libalias_cur->tcpLinkCount
+                            + libalias_cur->pptpLinkCount
+                            + libalias_cur->protoLinkCount,
+              libalias_cur->sockCount);
+
+      fprintf(libalias_cur->monitorFile,
+              "pool link=%u/%u tcp=%u/%u max=%u refused=%u\n",
+              libalias_cur->linkPool.nused, libalias_cur->linkPool.nitems,
+              libalias_cur->tcpPool.nused, libalias_cur->tcpPool.nitems,
+              libalias_cur->maxLinks, libalias_cur->linkLimitHits);
+
+      fprintf(libalias_cur->monitorFile, "ports map_full=%u no_port=%u\n",
+              libalias_cur->portMapFull, libalias_cur->portAllocFails);
+
+      if (libalias_cur->acctFn != NULL)
+          fprintf(libalias_cur->monitorFile, "acct uncounted=%u\n",
+                  libalias_cur->acctFails);
+
+      /* Walking the tables is expensive, so only do it once in a while */
+      if (libalias_cur->timeStamp - libalias_cur->lastHistogramTime >= ALIAS_HISTOGRAM_INTERVAL_SECS)
+      {
+         libalias_cur->lastHistogramTime = libalias_cur->timeStamp;
+         ShowChainLengths("out", &libalias_cur->linkTableOut);
+         ShowChainLengths("in", &libalias_cur->linkTableIn);
+      }
+
+      fflush(libalias_cur->monitorFile);
    }
 }
+
+
+static void
+ShowChainLengths(const char *name, struct link_table *table)
+{
+/* Print how many chains hold 0, 1, 2, ... links */
+
+    u_int hist[ALIAS_HISTOGRAM_BUCKETS];
+    u_int i, max;
+
+    max = ChainLengths(table, hist, ALIAS_HISTOGRAM_BUCKETS);
+
+    fprintf(libalias_cur->monitorFile, "%s chains=%u%s:", name, table->size,
+            table->old_chain != NULL ? " (resizing)" : "");
+    for (i=0; i<ALIAS_HISTOGRAM_BUCKETS - 1; i++)
+        fprintf(libalias_cur->monitorFile, " %u=%u", i, hist[i]);
+    fprintf(libalias_cur->monitorFile, " %u+=%u max=%u\n", i, hist[i], max);
+}
+#endif
+
+
+
+
+
+/* Link storage
+
+    Links and their auxiliary TCP data are taken from per-type pools
+    rather than from malloc() directly.  A pool grows a slab at a
+    time, and freed items go back on its free list, so a gateway
+    that has reserved enough items up front with
+    LibAliasReserveLinks() never enters the heap when creating
+    links.
+
+    PoolGrow()               -- add a slab of items to a pool
+    PoolGet()                -- take an item from a pool
+    PoolPut()                -- return an item to a pool
+    PoolRelease()            -- free all slabs of an idle pool
+*/
+
+/* Local prototypes */
+static int PoolGrow(struct link_pool *, u_int);
+
+static void *PoolGet(struct link_pool *);
+
+static void PoolPut(struct link_pool *, void *);
+
+static void PoolRelease(struct link_pool *);
+
+static int
+PoolGrow(struct link_pool *pool, u_int nitems)
+{
+    struct pool_slab *slab;
+    char *item;
+    u_int i;
+
+    slab = malloc(sizeof(struct pool_slab) + nitems * pool->item_size);
+    if (slab == NULL)
+    {
+#ifdef DEBUG
+        fprintf(stderr, "PacketAlias/PoolGrow(): ");
+        fprintf(stderr, "cannot allocate %u %s items\n", nitems, pool->name);
 #endif
+        return(-1);
+    }
+
+    slab->nitems = nitems;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+
+    item = (char *) (slab + 1);
+    for (i=0; i<nitems; i++, item += pool->item_size)
+    {
+        struct pool_item *p;
+
+        p = (struct pool_item *) item;
+        p->next = pool->free_list;
+        pool->free_list = p;
+    }
+    pool->nitems += nitems;
+
+    return(0);
+}
+
+
+static void *
+PoolGet(struct link_pool *pool)
+{
+    struct pool_item *p;
+
+    if (pool->free_list == NULL
+     && PoolGrow(pool, POOL_SLAB_ITEMS) != 0)
+        return(NULL);
+
+    p = pool->free_list;
+    pool->free_list = p->next;
+    pool->nused++;
+
+    return(p);
+}
+
+
+static void
+PoolPut(struct link_pool *pool, void *item)
+{
+    struct pool_item *p;
+
+    p = item;
+    p->next = pool->free_list;
+    pool->free_list = p;
+    pool->nused--;
+}
+
+
+static void
+PoolRelease(struct link_pool *pool)
+{
+    struct pool_slab *slab;
+
+/* Items still in use live in the slabs */
+    if (pool->nused != 0)
+        return;
 
+    while ((slab = pool->slabs) != NULL)
+    {
+        pool->slabs = slab->next;
+        free(slab);
+    }
+    pool->free_list = NULL;
+    pool->nitems = 0;
+}
 
 
 
@@ -552,10 +976,18 @@ ShowAliasStats(void)
 Port Allocation:
     GetNewPort()             -- find and reserve new alias port number
     GetSocket()              -- try to allocate a socket for a given port
+    PortMapGet()             -- find or make the port map of an address
+    PortMapRef()             -- count a link in or out of its port map
+    PortMapFind()            -- find a free port or group of ports
+    PortMapFree()            -- free the port maps of an instance
 
 Link creation and deletion:
     CleanupAliasData()      - remove all link chains from lookup table
-    IncrementalCleanup()    - look for stale links in a single chain
+    WheelInsert()           - put link in the wheel slot for a time
+    WheelSchedule()         - (re)schedule link for its expiry time
+    WheelCascade()          - spread a slot over the level below it
+    WheelExpire()           - delete or reschedule link whose slot came
+    WheelAdvance()          - run the wheel up to the current time
     DeleteLink()            - remove link
     AddLink()               - add link 
     ReLink()                - change link 
@@ -573,9 +1005,25 @@ static int GetNewPort(struct alias_link *, int);
 
 static u_short GetSocket(u_short, int *, int);
 
+static struct port_map *PortMapGet(struct in_addr, int);
+
+static void PortMapRef(struct alias_link *, int);
+
+static int PortMapFind(struct port_map *, int, int, int);
+
+static void PortMapFree(void);
+
 static void CleanupAliasData(void);
 
-static void IncrementalCleanup(void);
+static void WheelInsert(struct alias_link *, int);
+
+static void WheelSchedule(struct alias_link *);
+
+static void WheelCascade(struct link_chain *, int);
+
+static void WheelExpire(struct alias_link *, int);
+
+static void WheelAdvance(void);
 
 static void DeleteLink(struct alias_link *);
 
@@ -606,6 +1054,37 @@ FindLinkIn(struct in_addr, struct in_addr, u_short, u_short, int, int);
 
 #define FIND_EVEN_ALIAS_BASE             1
 
+/*
+ * A port map records which ports of the alias range are taken by
+ * links of one type on one alias address, so that a free one can be
+ * found in a few word operations however full the range is.  There
+ * is a bit for each port, set while it is free, and a summary bit
+ * for each word of those, set while the word has a free port.  The
+ * reference counts let several links share an alias port, as links
+ * to different remote ends may.
+ *
+ * Maps are only a guide to where a free port is: a port found in one
+ * is still checked with FindLinkIn() as before.  When no map can be
+ * had, or it has no free port, ports are tried at random.
+ */
+#define PORT_MAP_PORTS         (ALIAS_PORT_MASK + 1)
+#define PORT_MAP_WORDS         (PORT_MAP_PORTS / 64)
+#define PORT_MAP_SUMMARY       (PORT_MAP_WORDS / 64)
+#define PORT_MAP_GROUP_TRIALS           64
+
+#define PORT_MAP_EVEN   0x5555555555555555ULL /* Bits of even ports    */
+#define PORT_MAP_ANY    0xffffffffffffffffULL
+
+struct port_map
+{
+    struct in_addr addr;
+    int link_type;
+    u_int nfree;                          /* Ports with no links      */
+    u_int64_t summary[PORT_MAP_SUMMARY];  /* Words with a free port   */
+    u_int64_t free[PORT_MAP_WORDS];       /* Ports with no links      */
+    u_short refs[PORT_MAP_PORTS];         /* Links using each port    */
+};
+
 /* GetNewPort() allocates port numbers.  Note that if a port number
    is already in use, that does not mean that it cannot be used by
    another link concurrently.  This is because GetNewPort() looks for
@@ -655,8 +1134,10 @@ GetNewPort(struct alias_link *link, int alias_port_param)
 {
     int i;
     int max_trials;
+    int index;
     u_short port_sys;
     u_short port_net;
+    struct port_map *map;
 
 	if (alias_port_param == GET_ALIAS_EPHEMERAL_PORT)
 		return GetEphemeralPort(link);
@@ -670,6 +1151,7 @@ GetNewPort(struct alias_link *link, int alias_port_param)
    When this parameter is GET_ALIAS_PORT, it indicates to get a randomly
    selected port number.
 */
+    map = NULL;
     if (alias_port_param == GET_ALIAS_PORT)
     {
         /*
@@ -677,15 +1159,17 @@ GetNewPort(struct alias_link *link, int alias_port_param)
          * by one of two methods below:
          */
         max_trials = GET_NEW_PORT_MAX_ATTEMPTS;
+        if (link->link_type == LINK_TCP || link->link_type == LINK_UDP)
+            map = PortMapGet(link->alias_addr, link->link_type);
 
-        if (packetAliasMode & PKT_ALIAS_SAME_PORTS)
+        if (libalias_cur->packetAliasMode & PKT_ALIAS_SAME_PORTS)
         {
             /*
              * When the PKT_ALIAS_SAME_PORTS option is
              * chosen, the first try will be the
              * actual source port. If this is already
              * in use, the remainder of the trials
-             * will be random.
+             * will be free ports from the map, or random.
              */
             port_net = link->src_port;
             port_sys = ntohs(port_net);
@@ -694,6 +1178,17 @@ GetNewPort(struct alias_link *link, int alias_port_param)
         {
             /* First trial and all subsequent are random. */
             port_sys = random() & ALIAS_PORT_MASK;
+            if (map != NULL)
+            {
+                index = PortMapFind(map, port_sys, 1, 0);
+                if (index >= 0)
+                    port_sys = index;
+                else
+                {
+                    libalias_cur->portMapFull++;
+                    map = NULL;
+                }
+            }
             port_sys += ALIAS_PORT_BASE;
             port_net = htons(port_sys);
         }
@@ -733,7 +1228,7 @@ GetNewPort(struct alias_link *link, int alias_port_param)
 
         if (go_ahead)
         {
-            if ((packetAliasMode & PKT_ALIAS_USE_SOCKETS)
+            if ((libalias_cur->packetAliasMode & PKT_ALIAS_USE_SOCKETS)
              && (link->flags & LINK_PARTIALLY_SPECIFIED)
 	     && ((link->link_type == LINK_TCP) || 
 		 (link->link_type == LINK_UDP)))
@@ -752,6 +1247,17 @@ GetNewPort(struct alias_link *link, int alias_port_param)
         }
 
         port_sys = random() & ALIAS_PORT_MASK;
+        if (map != NULL)
+        {
+            index = PortMapFind(map, port_sys, 1, 0);
+            if (index >= 0)
+                port_sys = index;
+            else
+            {
+                libalias_cur->portMapFull++;
+                map = NULL;
+            }
+        }
         port_sys += ALIAS_PORT_BASE;
         port_net = htons(port_sys);
     }
@@ -760,6 +1266,7 @@ GetNewPort(struct alias_link *link, int alias_port_param)
     fprintf(stderr, "could not find free port\n");
 #endif
 
+    libalias_cur->portAllocFails++;
     return(-1);
 }
 
@@ -802,7 +1309,7 @@ GetSocket(u_short port_net, int *sockfd, int link_type)
                sizeof(sock_addr));
     if (err == 0)
     {
-        sockCount++;
+        libalias_cur->sockCount++;
         *sockfd = sock;
         return(1);
     }
@@ -814,56 +1321,250 @@ GetSocket(u_short port_net, int *sockfd, int link_type)
 }
 
 
-/* FindNewPortGroup() returns a base port number for an available        
-   range of contiguous port numbers. Note that if a port number
-   is already in use, that does not mean that it cannot be used by
-   another link concurrently.  This is because FindNewPortGroup()
-   looks for unused triplets: (dest addr, dest port, alias port). */
-
-int
-FindNewPortGroup(struct in_addr  dst_addr,
-                 struct in_addr  alias_addr,
-                 u_short         src_port,
-                 u_short         dst_port,
-                 u_short         port_count, 
-		 u_char          proto, 
-		 u_char          align)
+static struct port_map *
+PortMapGet(struct in_addr addr, int link_type)
 {
-    int     i, j;
-    int     max_trials;
-    u_short port_sys;
-    int     link_type;
+    int i, slot;
+    u_int port;
+    struct port_map *map;
+    struct alias_link *link;
 
-    /*
-     * Get link_type from protocol
-     */
+    slot = -1;
+    for (i=0; i<PORT_MAP_MAX; i++)
+    {
+        map = libalias_cur->portMaps[i];
+        if (map == NULL)
+        {
+            if (slot == -1)
+                slot = i;
+            continue;
+        }
+        if (map->addr.s_addr == addr.s_addr && map->link_type == link_type)
+            return(map);
+    /* A map with no links may be taken over */
+        if (slot == -1 && map->nfree == PORT_MAP_PORTS)
+            slot = i;
+    }
+    if (slot == -1)
+        return(NULL);
 
-    switch (proto)
+    map = libalias_cur->portMaps[slot];
+    if (map == NULL)
     {
-    case IPPROTO_UDP:
-        link_type = LINK_UDP;
-        break;
-    case IPPROTO_TCP:
-        link_type = LINK_TCP;
-        break;
-    default:
-        return (0);
-        break;
+        map = malloc(sizeof(struct port_map));
+        if (map == NULL)
+            return(NULL);
+        libalias_cur->portMaps[slot] = map;
     }
 
-    /*
-     * The aliasing port is automatically selected
-     * by one of two methods below:
-     */
-    max_trials = GET_NEW_PORT_MAX_ATTEMPTS;
+    map->addr = addr;
+    map->link_type = link_type;
+    map->nfree = PORT_MAP_PORTS;
+    memset(map->summary, 0xff, sizeof(map->summary));
+    memset(map->free, 0xff, sizeof(map->free));
+    memset(map->refs, 0, sizeof(map->refs));
+
+/* Count the links already using the address */
+    LinkTableRehash(&libalias_cur->linkTableOut,
+                    libalias_cur->linkTableOut.old_size);
+    for (i=0; i<(int) libalias_cur->linkTableOut.size; i++)
+    {
+        LIST_FOREACH(link, &libalias_cur->linkTableOut.chain[i], list_out)
+        {
+            port = ntohs(link->alias_port);
+            if (link->link_type == link_type
+             && link->alias_addr.s_addr == addr.s_addr
+             && port >= ALIAS_PORT_BASE)
+                PortMapRef(link, 1);
+        }
+    }
 
-    if (packetAliasMode & PKT_ALIAS_SAME_PORTS) {
-      /*
-       * When the ALIAS_SAME_PORTS option is
+    return(map);
+}
+
+
+static void
+PortMapRef(struct alias_link *link, int delta)
+{
+    int i;
+    u_int index, w;
+    struct port_map *map;
+
+    if (link->link_type != LINK_TCP && link->link_type != LINK_UDP)
+        return;
+
+    index = ntohs(link->alias_port);
+    if (index < ALIAS_PORT_BASE)
+        return;
+    index -= ALIAS_PORT_BASE;
+
+    for (i=0; i<PORT_MAP_MAX; i++)
+    {
+        map = libalias_cur->portMaps[i];
+        if (map != NULL
+         && map->addr.s_addr == link->alias_addr.s_addr
+         && map->link_type == link->link_type)
+            break;
+    }
+    if (i == PORT_MAP_MAX)
+        return;
+
+    w = index / 64;
+    if (delta > 0)
+    {
+        if (map->refs[index]++ == 0)
+        {
+            map->nfree--;
+            map->free[w] &= ~(1ULL << (index % 64));
+            if (map->free[w] == 0)
+                map->summary[w / 64] &= ~(1ULL << (w % 64));
+        }
+    }
+    else if (map->refs[index] != 0)
+    {
+        if (--map->refs[index] == 0)
+        {
+            map->nfree++;
+            map->free[w] |= 1ULL << (index % 64);
+            map->summary[w / 64] |= 1ULL << (w % 64);
+        }
+    }
+}
+
+
+/* Return the offset from ALIAS_PORT_BASE of the first free port at or
+   after start, going round to the start of the range if need be, or
+   -1.  If count is more than one, the port found is the first of that
+   many free ports in a row.  With align FIND_EVEN_ALIAS_BASE, only
+   even ports are taken. */
+static int
+PortMapFind(struct port_map *map, int start, int count, int align)
+{
+    int n, trials;
+    u_int w, s, j, index;
+    u_int64_t bits, pattern, mask;
+
+    pattern = align == FIND_EVEN_ALIAS_BASE ? PORT_MAP_EVEN : PORT_MAP_ANY;
+    if (count < 1 || count > PORT_MAP_PORTS || map->nfree < (u_int) count)
+        return(-1);
+
+    trials = count > 1 ? PORT_MAP_GROUP_TRIALS : 1;
+    while (trials-- > 0)
+    {
+        w = (start / 64) % PORT_MAP_WORDS;
+        mask = PORT_MAP_ANY << (start % 64);
+        index = PORT_MAP_PORTS;
+
+    /* Visit the words with free ports, the first one twice so as to
+       look at the ports below start last */
+        for (n=0; n<=PORT_MAP_WORDS; n++)
+        {
+            bits = map->free[w] & pattern & mask;
+            if (bits != 0)
+            {
+                index = w * 64 + __builtin_ctzll(bits);
+                break;
+            }
+            mask = PORT_MAP_ANY;
+
+            s = w + 1;
+            for (j=0; j<=PORT_MAP_SUMMARY; j++, s = (s | 63) + 1)
+            {
+                s %= PORT_MAP_WORDS;
+                bits = map->summary[s / 64] & (PORT_MAP_ANY << (s % 64));
+                if (bits != 0)
+                {
+                    s = (s & ~63) + __builtin_ctzll(bits);
+                    break;
+                }
+            }
+            if (j > PORT_MAP_SUMMARY)
+                return(-1);
+            w = s;
+        }
+        if (index == PORT_MAP_PORTS)
+            return(-1);
+
+        for (j=1; j<(u_int) count && index + j < PORT_MAP_PORTS; j++)
+            if (map->refs[index + j] != 0)
+                break;
+        if (j == (u_int) count)
+            return(index);
+
+        start = (index + j + 1) % PORT_MAP_PORTS;
+    }
+
+    return(-1);
+}
+
+
+static void
+PortMapFree(void)
+{
+    int i;
+
+    for (i=0; i<PORT_MAP_MAX; i++)
+    {
+        if (libalias_cur->portMaps[i] != NULL)
+            free(libalias_cur->portMaps[i]);
+        libalias_cur->portMaps[i] = NULL;
+    }
+}
+
+
+/* FindNewPortGroup() returns a base port number for an available        
+   range of contiguous port numbers. Note that if a port number
+   is already in use, that does not mean that it cannot be used by
+   another link concurrently.  This is because FindNewPortGroup()
+   looks for unused triplets: (dest addr, dest port, alias port). */
+
+int
+FindNewPortGroup(struct in_addr  dst_addr,
+                 struct in_addr  alias_addr,
+                 u_short         src_port,
+                 u_short         dst_port,
+                 u_short         port_count, 
+		 u_char          proto, 
+		 u_char          align)
+{
+    int     i, j;
+    int     max_trials;
+    int     index;
+    u_short port_sys;
+    int     link_type;
+    struct port_map *map;
+
+    /*
+     * Get link_type from protocol
+     */
+
+    switch (proto)
+    {
+    case IPPROTO_UDP:
+        link_type = LINK_UDP;
+        break;
+    case IPPROTO_TCP:
+        link_type = LINK_TCP;
+        break;
+    default:
+        return (0);
+        break;
+    }
+
+    /*
+     * The aliasing port is automatically selected
+     * by one of two methods below:
+     */
+    max_trials = GET_NEW_PORT_MAX_ATTEMPTS;
+    map = PortMapGet(alias_addr, link_type);
+
+    if (libalias_cur->packetAliasMode & PKT_ALIAS_SAME_PORTS) {
+      /*
+       * When the ALIAS_SAME_PORTS option is
        * chosen, the first try will be the
        * actual source port. If this is already
        * in use, the remainder of the trials
-       * will be random.
+       * will be free ports from the map, or random.
        */
       port_sys = ntohs(src_port);
 
@@ -875,6 +1576,9 @@ FindNewPortGroup(struct in_addr  dst_addr,
       else
         port_sys = random() & ALIAS_PORT_MASK;
 
+      if (map != NULL &&
+          (index = PortMapFind(map, port_sys, port_count, align)) >= 0)
+        port_sys = index;
       port_sys += ALIAS_PORT_BASE;
     }
 
@@ -899,6 +1603,15 @@ FindNewPortGroup(struct in_addr  dst_addr,
       else
         port_sys = random() & ALIAS_PORT_MASK;
 
+      if (map != NULL) {
+        index = PortMapFind(map, port_sys, port_count, align);
+        if (index >= 0)
+          port_sys = index;
+        else {
+          libalias_cur->portMapFull++;
+          map = NULL;
+        }
+      }
       port_sys += ALIAS_PORT_BASE;
     }
 
@@ -907,6 +1620,8 @@ FindNewPortGroup(struct in_addr  dst_addr,
     fprintf(stderr, "could not find free port(s)\n");
 #endif
 
+    libalias_cur->portAllocFails++;
+
     return(0);
 }
 
@@ -914,12 +1629,16 @@ static void
 CleanupAliasData(void)
 {
     struct alias_link *link;
-    int i, icount;
+    u_int i;
+    int icount;
+
+    LinkTableRehash(&libalias_cur->linkTableOut,
+                    libalias_cur->linkTableOut.old_size);
 
     icount = 0;
-    for (i=0; i<LINK_TABLE_OUT_SIZE; i++)
+    for (i=0; i<libalias_cur->linkTableOut.size; i++)
     {
-        link = LIST_FIRST(&linkTableOut[i]);
+        link = LIST_FIRST(&libalias_cur->linkTableOut.chain[i]);
         while (link != NULL)
         {
             struct alias_link *link_next;
@@ -929,63 +1648,179 @@ CleanupAliasData(void)
             link = link_next;
         }
     }
+}
+
+
+static void
+WheelInsert(struct alias_link *link, int when)
+{
+    int delta;
+    struct link_chain *slot;
+
+    delta = when - libalias_cur->wheelTime;
+    if (delta >= WHEEL_RANGE)
+    {
+    /* Too far out; WheelExpire() will find it early and move it again */
+        when = libalias_cur->wheelTime + WHEEL_RANGE - 1;
+        delta = WHEEL_RANGE - 1;
+    }
+
+    if (delta < WHEEL0_SIZE)
+        slot = &libalias_cur->expireWheel0[when & (WHEEL0_SIZE - 1)];
+    else if (delta < WHEEL0_SIZE << WHEELN_BITS)
+        slot = &libalias_cur->expireWheel1[(when >> WHEEL0_BITS)
+                                           & (WHEELN_SIZE - 1)];
+    else
+        slot = &libalias_cur->expireWheel2[(when >> (WHEEL0_BITS + WHEELN_BITS))
+                             & (WHEELN_SIZE - 1)];
 
-    cleanupIndex =0;
+    LIST_INSERT_HEAD(slot, link, list_expire);
 }
 
 
 static void
-IncrementalCleanup(void)
+WheelSchedule(struct alias_link *link)
+{
+    int when;
+
+/* A link is due once timeStamp - timestamp exceeds expire_time */
+    when = link->timestamp + link->expire_time + 1;
+    if (when <= libalias_cur->wheelTime)
+        when = libalias_cur->wheelTime + 1;
+
+    LIST_REMOVE(link, list_expire);
+    WheelInsert(link, when);
+}
+
+
+static void
+WheelCascade(struct link_chain *slot, int now)
 {
-    int icount;
     struct alias_link *link;
 
-    icount = 0;
-    link = LIST_FIRST(&linkTableOut[cleanupIndex++]);
-    while (link != NULL)
+    while ((link = LIST_FIRST(slot)) != NULL)
     {
-        int idelta;
-        struct alias_link *link_next;
+        int when;
+
+        when = link->timestamp + link->expire_time + 1;
+        if (when < now)
+            when = now;
+
+        LIST_REMOVE(link, list_expire);
+        WheelInsert(link, when);
+    }
+}
 
-        link_next = LIST_NEXT(link, list_out);
-        idelta = timeStamp - link->timestamp;
-        switch (link->link_type)
+
+static void
+WheelExpire(struct alias_link *link, int now)
+{
+    if (link->flags & LINK_PERMANENT)
+    {
+    /* Permanent links only leave the wheel when they are deleted */
+        LIST_REMOVE(link, list_expire);
+        WheelInsert(link, now + WHEEL_RANGE - 1);
+    }
+    else if (libalias_cur->timeStamp - link->timestamp > link->expire_time)
+    {
+        if (link->link_type == LINK_TCP
+         && link->data.tcp->state.in  == ALIAS_TCP_STATE_CONNECTED
+         && link->data.tcp->state.out == ALIAS_TCP_STATE_CONNECTED)
         {
-            case LINK_TCP:
-                if (idelta > link->expire_time)
-                {
-                    struct tcp_dat *tcp_aux;
+        /* Established connections are never timed out */
+            LIST_REMOVE(link, list_expire);
+            WheelInsert(link, now + link->expire_time);
+        }
+        else
+            DeleteLink(link);
+    }
+    else
+    {
+    /* Refreshed by a packet since it was scheduled */
+        WheelSchedule(link);
+    }
+}
 
-                    tcp_aux = link->data.tcp; 
-                    if (tcp_aux->state.in  != ALIAS_TCP_STATE_CONNECTED
-                     || tcp_aux->state.out != ALIAS_TCP_STATE_CONNECTED)
-                    {
-                        DeleteLink(link);
-                        icount++;
-                    }
-                }
-                break;
-            default:
-                if (idelta > link->expire_time)
-                {
-                    DeleteLink(link);
-                    icount++;
-                }
-                break;
+
+static void
+WheelAdvance(void)
+{
+    struct alias_link *link;
+
+    if (libalias_cur->timeStamp < libalias_cur->wheelTime)
+    {
+#ifdef DEBUG
+        fprintf(stderr, "PacketAlias/WheelAdvance(): ");
+        fprintf(stderr, "something unexpected in time values\n");
+#endif
+        libalias_cur->wheelTime = libalias_cur->timeStamp;
+        return;
+    }
+
+    if (libalias_cur->timeStamp - libalias_cur->wheelTime >= WHEEL_RANGE)
+    {
+    /* After a long idle period or a clock step, re-file every link
+       rather than stepping through each second in between. */
+        struct link_chain pending;
+        int i;
+
+        LIST_INIT(&pending);
+        for (i=0; i<WHEEL0_SIZE + 2 * WHEELN_SIZE; i++)
+        {
+            struct link_chain *slot;
+
+            if (i < WHEEL0_SIZE)
+                slot = &libalias_cur->expireWheel0[i];
+            else if (i < WHEEL0_SIZE + WHEELN_SIZE)
+                slot = &libalias_cur->expireWheel1[i - WHEEL0_SIZE];
+            else
+                slot = &libalias_cur->expireWheel2[i - WHEEL0_SIZE
+                                                   - WHEELN_SIZE];
+
+            while ((link = LIST_FIRST(slot)) != NULL)
+            {
+                LIST_REMOVE(link, list_expire);
+                LIST_INSERT_HEAD(&pending, link, list_expire);
+            }
         }
-        link = link_next;
+
+        libalias_cur->wheelTime = libalias_cur->timeStamp;
+        while ((link = LIST_FIRST(&pending)) != NULL)
+            WheelExpire(link, libalias_cur->wheelTime);
+        return;
     }
 
-    if (cleanupIndex == LINK_TABLE_OUT_SIZE)
-        cleanupIndex = 0;
+    while (libalias_cur->wheelTime < libalias_cur->timeStamp)
+    {
+        int now;
+        struct link_chain *slot;
+
+        now = ++libalias_cur->wheelTime;
+        if ((now & (WHEEL0_SIZE - 1)) == 0)
+        {
+            int i1;
+
+            i1 = (now >> WHEEL0_BITS) & (WHEELN_SIZE - 1);
+            if (i1 == 0)
+                WheelCascade(&libalias_cur->expireWheel2[(now >> (WHEEL0_BITS + WHEELN_BITS))
+                                           & (WHEELN_SIZE - 1)], now);
+            WheelCascade(&libalias_cur->expireWheel1[i1], now);
+        }
+
+    /* Links put back in the wheel land in other slots, so this ends */
+        slot = &libalias_cur->expireWheel0[now & (WHEEL0_SIZE - 1)];
+        while ((link = LIST_FIRST(slot)) != NULL)
+            WheelExpire(link, now);
+    }
 }
 
+
 static void
 DeleteLink(struct alias_link *link)
 {
 
 /* Don't do anything if the link is marked permanent */
-    if (deleteAllLinks == 0 && link->flags & LINK_PERMANENT)
+    if (libalias_cur->deleteAllLinks == 0 && link->flags & LINK_PERMANENT)
         return;
 
 #ifndef NO_FW_PUNCH
@@ -1009,11 +1844,22 @@ DeleteLink(struct alias_link *link)
 
 /* Adjust input table pointers */
     LIST_REMOVE(link, list_in);
+    libalias_cur->linkCount--;
+
+/* Give back its alias port */
+    PortMapRef(link, -1);
+
+/* Report and drop its counters */
+    if (link->acct != 0)
+        AcctDetach(link);
+
+/* Take link off the timing wheel */
+    LIST_REMOVE(link, list_expire);
 
 /* Close socket, if one has been allocated */
     if (link->sockfd != -1)
     {
-        sockCount--;
+        libalias_cur->sockCount--;
         close(link->sockfd);
     }
 
@@ -1021,35 +1867,27 @@ DeleteLink(struct alias_link *link)
     switch(link->link_type)
     {
         case LINK_ICMP:
-            icmpLinkCount--;
+            libalias_cur->icmpLinkCount--;
             break;
         case LINK_UDP:
-            udpLinkCount--;
+            libalias_cur->udpLinkCount--;
             break;
         case LINK_TCP:
-            tcpLinkCount--;
-            free(link->data.tcp);
+            libalias_cur->tcpLinkCount--;
+            PoolPut(&libalias_cur->tcpPool, link->data.tcp);
             break;
         case LINK_PPTP:
-            pptpLinkCount--;
-            break;
-        case LINK_FRAGMENT_ID:
-            fragmentIdLinkCount--;
-            break;
-        case LINK_FRAGMENT_PTR:
-            fragmentPtrLinkCount--;
-            if (link->data.frag_ptr != NULL)
-                free(link->data.frag_ptr);
+            libalias_cur->pptpLinkCount--;
             break;
 	case LINK_ADDR:
 	    break;
         default:
-            protoLinkCount--;
+            libalias_cur->protoLinkCount--;
             break;
     }
 
 #ifdef DEBUG
-    if ((packetAliasMode & PKT_ALIAS_LOG) != 0 &&
+    if ((libalias_cur->packetAliasMode & PKT_ALIAS_LOG) != 0 &&
     	!IN_MULTICAST(link->src_addr.s_addr) &&
     	!IN_MULTICAST(link->dst_addr.s_addr))
     {
@@ -1068,21 +1906,21 @@ DeleteLink(struct alias_link *link)
     		default:
     			proto = "";
     	}
-    	fprintf(monitorFile, "Deleted%s %s:%d<->%s:%d to %s:%d<->%s:%d\n",
+    	fprintf(libalias_cur->monitorFile, "Deleted%s %s:%d<->%s:%d to %s:%d<->%s:%d\n",
     		proto,
     		inet_ntop(AF_INET, &link->src_addr, src, sizeof(src)), link->src_port,
     		inet_ntop(AF_INET, &link->dst_addr, dst, sizeof(dst)), link->dst_port,
     		inet_ntop(AF_INET, &link->alias_addr, alias, sizeof(alias)), link->alias_port,
     		dst, link->dst_port);
-		fflush(monitorFile);
+		fflush(libalias_cur->monitorFile);
     }
 #else
-	if (packetAliasMode & PKT_ALIAS_LOG)
+	if (libalias_cur->packetAliasMode & PKT_ALIAS_LOG)
 		ShowAliasStats();
 #endif
 
 /* Free memory */
-    free(link);
+    PoolPut(&libalias_cur->linkPool, link);
 }
 
 
@@ -1098,7 +1936,18 @@ AddLink(struct in_addr  src_addr,
     u_int start_point;                     /* zero, equal to alias port  */
     struct alias_link *link;
 
-    link = malloc(sizeof(struct alias_link));
+    if (libalias_cur->maxLinks != 0
+     && libalias_cur->linkPool.nused >= libalias_cur->maxLinks)
+    {
+        libalias_cur->linkLimitHits++;
+#ifdef DEBUG
+        fprintf(stderr, "PacketAlias/AddLink(): ");
+        fprintf(stderr, "link limit %u reached\n", libalias_cur->maxLinks);
+#endif
+        return(NULL);
+    }
+
+    link = PoolGet(&libalias_cur->linkPool);
     if (link != NULL)
     {
     /* Basic initialization */
@@ -1112,8 +1961,9 @@ AddLink(struct in_addr  src_addr,
         link->server            = NULL;
         link->link_type         = link_type;
         link->sockfd            = -1;
+        link->acct              = 0;
         link->flags             = 0;
-        link->timestamp         = timeStamp;
+        link->timestamp         = libalias_cur->timeStamp;
 
     /* Expiration time */
         switch (link_type)
@@ -1132,14 +1982,10 @@ AddLink(struct in_addr  src_addr,
             break;
         case LINK_PPTP:
             link->flags |= LINK_PERMANENT;	/* no timeout. */
-            break;
-        case LINK_FRAGMENT_ID:
-            link->expire_time = FRAGMENT_ID_EXPIRE_TIME;
-            break;
-        case LINK_FRAGMENT_PTR:
-            link->expire_time = FRAGMENT_PTR_EXPIRE_TIME;
+            link->expire_time = 0;
             break;
 	case LINK_ADDR:
+	    link->expire_time = 0;	/* made permanent by caller */
 	    break;
         default:
             link->expire_time = PROTO_EXPIRE_TIME;
@@ -1155,7 +2001,7 @@ AddLink(struct in_addr  src_addr,
     /* Determine alias port */
         if (GetNewPort(link, alias_port_param) != 0)
         {
-            free(link);
+            PoolPut(&libalias_cur->linkPool, link);
             return(NULL);
         }
     /* Link-type dependent initialization */
@@ -1164,18 +2010,18 @@ AddLink(struct in_addr  src_addr,
             struct tcp_dat  *aux_tcp;
 
             case LINK_ICMP:
-                icmpLinkCount++;
+                libalias_cur->icmpLinkCount++;
                 break;
             case LINK_UDP:
-                udpLinkCount++;
+                libalias_cur->udpLinkCount++;
                 break;
             case LINK_TCP:
-                aux_tcp = malloc(sizeof(struct tcp_dat));
+                aux_tcp = PoolGet(&libalias_cur->tcpPool);
                 if (aux_tcp != NULL)
                 {
                     int i;
 
-                    tcpLinkCount++;
+                    libalias_cur->tcpLinkCount++;
                     aux_tcp->state.in = ALIAS_TCP_STATE_NOT_CONNECTED;
                     aux_tcp->state.out = ALIAS_TCP_STATE_NOT_CONNECTED;
                     aux_tcp->state.index = 0;
@@ -1191,45 +2037,52 @@ AddLink(struct in_addr  src_addr,
                     fprintf(stderr, "PacketAlias/AddLink: ");
                     fprintf(stderr, " cannot allocate auxiliary TCP data\n");
 #endif
-		    free(link);
+		    PoolPut(&libalias_cur->linkPool, link);
 		    return (NULL);
                 }
                 break;
             case LINK_PPTP:
-                pptpLinkCount++;
-                break;
-            case LINK_FRAGMENT_ID:
-                fragmentIdLinkCount++;
-                break;
-            case LINK_FRAGMENT_PTR:
-                fragmentPtrLinkCount++;
+                libalias_cur->pptpLinkCount++;
                 break;
 	    case LINK_ADDR:
 		break;
             default:
-                protoLinkCount++;
+                libalias_cur->protoLinkCount++;
                 break;
         }
 
     /* Set up pointers for output lookup table */
         start_point = StartPointOut(src_addr, dst_addr, 
                                     src_port, dst_port, link_type);
-        LIST_INSERT_HEAD(&linkTableOut[start_point], link, list_out);
+        LIST_INSERT_HEAD(LinkTableChain(&libalias_cur->linkTableOut,
+                                        start_point),
+                         link, list_out);
 
     /* Set up pointers for input lookup table */
         start_point = StartPointIn(alias_addr, link->alias_port, link_type); 
-        LIST_INSERT_HEAD(&linkTableIn[start_point], link, list_in);
+        LIST_INSERT_HEAD(LinkTableChain(&libalias_cur->linkTableIn,
+                                        start_point),
+                         link, list_in);
+        libalias_cur->linkCount++;
+        PortMapRef(link, 1);
+
+    /* Start counting its packets */
+        if (libalias_cur->acctFn != NULL)
+            AcctAttach(link);
+
+    /* Schedule expiry */
+        WheelInsert(link, libalias_cur->timeStamp + link->expire_time + 1);
     }
     else
     {
 #ifdef DEBUG
         fprintf(stderr, "PacketAlias/AddLink(): ");
-        fprintf(stderr, "malloc() call failed.\n");
+        fprintf(stderr, "PoolGet() call failed.\n");
 #endif
     }
 
 #ifdef DEBUG
-    if ((packetAliasMode & PKT_ALIAS_LOG) != 0 &&
+    if ((libalias_cur->packetAliasMode & PKT_ALIAS_LOG) != 0 &&
     	!IN_MULTICAST(link->src_addr.s_addr) &&
     	!IN_MULTICAST(link->dst_addr.s_addr))
     {
@@ -1248,7 +2101,7 @@ AddLink(struct in_addr  src_addr,
     		default:
     			proto = "";
     	}
-    	fprintf(monitorFile, "Added  %s %s:%d<->%s:%d to %s:%d<->%s:%d\n",
+    	fprintf(libalias_cur->monitorFile, "Added  %s %s:%d<->%s:%d to %s:%d<->%s:%d\n",
     		proto,
     		inet_ntop(AF_INET, &link->src_addr, src, sizeof(src)), link->src_port,
     		inet_ntop(AF_INET, &link->dst_addr, dst, sizeof(dst)), link->dst_port,
@@ -1256,7 +2109,7 @@ AddLink(struct in_addr  src_addr,
     		dst, link->dst_port);
     }
 #else
-	if (packetAliasMode & PKT_ALIAS_LOG)
+	if (libalias_cur->packetAliasMode & PKT_ALIAS_LOG)
 		ShowAliasStats();
 #endif
 
@@ -1302,7 +2155,7 @@ _FindLinkOut(struct in_addr src_addr,
     struct alias_link *link;
 
     i = StartPointOut(src_addr, dst_addr, src_port, dst_port, link_type);
-    LIST_FOREACH(link, &linkTableOut[i], list_out)
+    LIST_FOREACH(link, LinkTableChain(&libalias_cur->linkTableOut, i), list_out)
     {
         if (link->src_addr.s_addr == src_addr.s_addr
          && link->server          == NULL
@@ -1311,7 +2164,7 @@ _FindLinkOut(struct in_addr src_addr,
          && link->src_port        == src_port
          && link->link_type       == link_type)
         {
-            link->timestamp = timeStamp;
+            link->timestamp = libalias_cur->timeStamp;
             break;
         }
     }
@@ -1364,8 +2217,8 @@ FindLinkOut(struct in_addr src_addr,
        specified as using the default source address
        (i.e. device interface address) without knowing
        in advance what that address is. */
-        if (aliasAddress.s_addr != 0 &&
-            src_addr.s_addr == aliasAddress.s_addr)
+        if (libalias_cur->aliasAddress.s_addr != 0 &&
+            src_addr.s_addr == libalias_cur->aliasAddress.s_addr)
         {
             link = _FindLinkOut(nullAddress, dst_addr, src_port, dst_port,
                                link_type, replace_partial_links);
@@ -1409,7 +2262,8 @@ _FindLinkIn(struct in_addr dst_addr,
 
 /* Search loop */
     start_point = StartPointIn(alias_addr, alias_port, link_type);
-    LIST_FOREACH(link, &linkTableIn[start_point], list_in)
+    LIST_FOREACH(link, LinkTableChain(&libalias_cur->linkTableIn, start_point),
+                 list_in)
     {
         int flags;
 
@@ -1465,7 +2319,7 @@ _FindLinkIn(struct in_addr dst_addr,
 
     if (link_fully_specified != NULL)
     {
-        link_fully_specified->timestamp = timeStamp;
+        link_fully_specified->timestamp = libalias_cur->timeStamp;
         link = link_fully_specified;
     }
     else if (link_unknown_dst_port != NULL)
@@ -1520,8 +2374,8 @@ FindLinkIn(struct in_addr dst_addr,
        specified as using the default aliasing address
        (i.e. device interface address) without knowing
        in advance what that address is. */
-        if (aliasAddress.s_addr != 0 &&
-            alias_addr.s_addr == aliasAddress.s_addr)
+        if (libalias_cur->aliasAddress.s_addr != 0 &&
+            alias_addr.s_addr == libalias_cur->aliasAddress.s_addr)
         {
             link = _FindLinkIn(dst_addr, nullAddress, dst_port, alias_port,
                                link_type, replace_partial_links);
@@ -1539,13 +2393,12 @@ FindLinkIn(struct in_addr dst_addr,
 -- "external" means outside alias_db.c, but within alias*.c --
 
     FindIcmpIn(), FindIcmpOut()
-    FindFragmentIn1(), FindFragmentIn2()
-    AddFragmentPtrLink(), FindFragmentPtr()
     FindProtoIn(), FindProtoOut()
     FindUdpTcpIn(), FindUdpTcpOut()
     AddPptp(), FindPptpOutByCallId(), FindPptpInByCallId(),
     FindPptpOutByPeerCallId(), FindPptpInByPeerCallId()
     FindOriginalAddress(), FindAliasAddress()
+    PrefetchLinkIn(), PrefetchLinkOut()
 
 (prototypes in alias_local.h)
 */
@@ -1562,7 +2415,7 @@ FindIcmpIn(struct in_addr dst_addr,
     link = FindLinkIn(dst_addr, alias_addr,
                       NO_DEST_PORT, id_alias,
                       LINK_ICMP, 0);
-    if (link == NULL && create && !(packetAliasMode & PKT_ALIAS_DENY_INCOMING))
+    if (link == NULL && create && !(libalias_cur->packetAliasMode & PKT_ALIAS_DENY_INCOMING))
     {
         struct in_addr target_addr;
 
@@ -1601,59 +2454,6 @@ FindIcmpOut(struct in_addr src_addr,
 }
 
 
-struct alias_link *
-FindFragmentIn1(struct in_addr dst_addr,
-                struct in_addr alias_addr,
-                u_short ip_id)
-{
-    struct alias_link *link;
-
-    link = FindLinkIn(dst_addr, alias_addr,
-                      NO_DEST_PORT, ip_id,
-                      LINK_FRAGMENT_ID, 0);
-
-    if (link == NULL)
-    {
-        link = AddLink(nullAddress, dst_addr, alias_addr,
-                       NO_SRC_PORT, NO_DEST_PORT, ip_id,
-                       LINK_FRAGMENT_ID);
-    }
-
-    return(link);
-}
-
-
-struct alias_link *
-FindFragmentIn2(struct in_addr dst_addr,   /* Doesn't add a link if one */
-                struct in_addr alias_addr, /*   is not found.           */
-                u_short ip_id)
-{
-    return FindLinkIn(dst_addr, alias_addr,
-                      NO_DEST_PORT, ip_id,
-                      LINK_FRAGMENT_ID, 0);
-}
-
-
-struct alias_link *
-AddFragmentPtrLink(struct in_addr dst_addr,
-                   u_short ip_id)
-{
-    return AddLink(nullAddress, dst_addr, nullAddress,
-                   NO_SRC_PORT, NO_DEST_PORT, ip_id,
-                   LINK_FRAGMENT_PTR);
-}
-
-
-struct alias_link *
-FindFragmentPtr(struct in_addr dst_addr,
-                u_short ip_id)
-{
-    return FindLinkIn(dst_addr, nullAddress,
-                      NO_DEST_PORT, ip_id,
-                      LINK_FRAGMENT_PTR, 0);
-}
-
-
 struct alias_link *
 FindProtoIn(struct in_addr dst_addr,
             struct in_addr alias_addr,
@@ -1665,7 +2465,8 @@ FindProtoIn(struct in_addr dst_addr,
                       NO_DEST_PORT, 0,
                       proto, 1);
 
-    if (link == NULL && !(packetAliasMode & PKT_ALIAS_DENY_INCOMING))
+    if (link == NULL
+     && !(libalias_cur->packetAliasMode & PKT_ALIAS_DENY_INCOMING))
     {
         struct in_addr target_addr;
 
@@ -1732,7 +2533,7 @@ FindUdpTcpIn(struct in_addr dst_addr,
                       dst_port, alias_port,
                       link_type, create);
 
-    if (link == NULL && create && !(packetAliasMode & PKT_ALIAS_DENY_INCOMING))
+    if (link == NULL && create && !(libalias_cur->packetAliasMode & PKT_ALIAS_DENY_INCOMING))
     {
         struct in_addr target_addr;
 
@@ -1825,7 +2626,7 @@ FindPptpOutByCallId(struct in_addr src_addr,
     struct alias_link *link;
 
     i = StartPointOut(src_addr, dst_addr, 0, 0, LINK_PPTP);
-    LIST_FOREACH(link, &linkTableOut[i], list_out)
+    LIST_FOREACH(link, LinkTableChain(&libalias_cur->linkTableOut, i), list_out)
 	if (link->link_type == LINK_PPTP &&
 	    link->src_addr.s_addr == src_addr.s_addr &&
 	    link->dst_addr.s_addr == dst_addr.s_addr &&
@@ -1845,7 +2646,7 @@ FindPptpOutByPeerCallId(struct in_addr src_addr,
     struct alias_link *link;
 
     i = StartPointOut(src_addr, dst_addr, 0, 0, LINK_PPTP);
-    LIST_FOREACH(link, &linkTableOut[i], list_out)
+    LIST_FOREACH(link, LinkTableChain(&libalias_cur->linkTableOut, i), list_out)
 	if (link->link_type == LINK_PPTP &&
 	    link->src_addr.s_addr == src_addr.s_addr &&
 	    link->dst_addr.s_addr == dst_addr.s_addr &&
@@ -1865,7 +2666,7 @@ FindPptpInByCallId(struct in_addr dst_addr,
     struct alias_link *link;
 
     i = StartPointIn(alias_addr, 0, LINK_PPTP);
-    LIST_FOREACH(link, &linkTableIn[i], list_in)
+    LIST_FOREACH(link, LinkTableChain(&libalias_cur->linkTableIn, i), list_in)
 	if (link->link_type == LINK_PPTP &&
 	    link->dst_addr.s_addr == dst_addr.s_addr &&
 	    link->alias_addr.s_addr == alias_addr.s_addr &&
@@ -1940,13 +2741,13 @@ FindOriginalAddress(struct in_addr alias_addr)
                       0, 0, LINK_ADDR, 0);
     if (link == NULL)
     {
-        newDefaultLink = 1;
-        if (targetAddress.s_addr == INADDR_ANY)
+        libalias_cur->newDefaultLink = 1;
+        if (libalias_cur->targetAddress.s_addr == INADDR_ANY)
             return alias_addr;
-        else if (targetAddress.s_addr == INADDR_NONE)
-            return aliasAddress;
+        else if (libalias_cur->targetAddress.s_addr == INADDR_NONE)
+            return libalias_cur->aliasAddress;
         else
-            return targetAddress;
+            return libalias_cur->targetAddress;
     }
     else
     {
@@ -1957,7 +2758,7 @@ FindOriginalAddress(struct in_addr alias_addr)
 	    link->server = link->server->next;
 	    return (src_addr);
         } else if (link->src_addr.s_addr == INADDR_ANY)
-            return aliasAddress;
+            return libalias_cur->aliasAddress;
         else
             return link->src_addr;
     }
@@ -1973,54 +2774,114 @@ FindAliasAddress(struct in_addr original_addr)
                        0, 0, LINK_ADDR, 0);
     if (link == NULL)
     {
-        return aliasAddress;
+        return libalias_cur->aliasAddress;
     }
     else
     {
         if (link->alias_addr.s_addr == INADDR_ANY)
-            return aliasAddress;
+            return libalias_cur->aliasAddress;
         else
             return link->alias_addr;
     }
 }
 
-/* FindAliasPortOut */
-/* external routine for NatPortMap */
-/* return alias port for the src_addr,dst_addr,src_port and proto */
-/* if one doesn't existed, create a mapping with providing pub_port if it's not 0 */
-/* delete mapping if addmapping is not true */
-int
-FindAliasPortOut(struct in_addr src_addr, struct in_addr dst_addr, u_short src_port, u_short pub_port, u_char proto, int lifetime, char addmapping)
+/* PrefetchLinkIn() and PrefetchLinkOut() start loading the lookup
+   table chain that FindUdpTcpIn/Out(), FindIcmpIn/Out() or
+   FindProtoIn/Out() will search for the given packet, so that a
+   caller with several packets in hand can overlap the cache miss
+   with work on the previous packet. */
+void
+PrefetchLinkIn(struct in_addr alias_addr,
+               u_short        alias_port,
+               u_char         proto)
 {
     u_int i;
-    struct alias_link *link;
-    int link_type;
 
     switch (proto)
     {
+    case IPPROTO_ICMP:
     case IPPROTO_UDP:
-        link_type = LINK_UDP;
-        break;
     case IPPROTO_TCP:
-        link_type = LINK_TCP;
         break;
     default:
-        return 0;
+        alias_port = 0;
         break;
     }
 
-#ifdef DEBUG
-	{
-		int icount = 0;
-		
-		printf("FindAliasPortOut:: srcaddr= %s:%u, ", 
-			inet_ntoa(src_addr), ntohs(src_port));
-		printf("dstadd= %s:%u link_type= %d, lifetime= %d\n", 
+    i = StartPointIn(alias_addr, alias_port, proto);
+    ALIAS_PREFETCH(LinkTableChain(&libalias_cur->linkTableIn, i));
+}
+
+
+void
+PrefetchLinkOut(struct in_addr src_addr,
+                struct in_addr dst_addr,
+                u_short        src_port,
+                u_short        dst_port,
+                u_char         proto)
+{
+    u_int i;
+
+    switch (proto)
+    {
+    case IPPROTO_ICMP:
+        dst_port = NO_DEST_PORT;
+        break;
+    case IPPROTO_UDP:
+    case IPPROTO_TCP:
+        break;
+    default:
+        src_port = NO_SRC_PORT;
+        dst_port = NO_DEST_PORT;
+        break;
+    }
+
+    i = StartPointOut(src_addr, dst_addr, src_port, dst_port, proto);
+    ALIAS_PREFETCH(LinkTableChain(&libalias_cur->linkTableOut, i));
+}
+
+
+/* FindAliasPortOut */
+/* external routine for NatPortMap */
+/* return alias port for the src_addr,dst_addr,src_port and proto */
+/* if one doesn't existed, create a mapping with providing pub_port if it's not 0 */
+/* delete mapping if addmapping is not true */
+int
+LibAliasFindAliasPortOut(struct libalias *instance, struct in_addr src_addr, struct in_addr dst_addr, u_short src_port, u_short pub_port, u_char proto, int lifetime, char addmapping)
+{
+    u_int i;
+    struct alias_link *link;
+    int link_type;
+
+    switch (proto)
+    {
+    case IPPROTO_UDP:
+        link_type = LINK_UDP;
+        break;
+    case IPPROTO_TCP:
+        link_type = LINK_TCP;
+        break;
+    default:
+        return 0;
+        break;
+    }
+
+    libalias_cur = instance;
+
+#ifdef DEBUG
+	{
+		int icount = 0;
+		
+		printf("FindAliasPortOut:: srcaddr= %s:%u, ", 
+			inet_ntoa(src_addr), ntohs(src_port));
+		printf("dstadd= %s:%u link_type= %d, lifetime= %d\n", 
 			inet_ntoa(dst_addr), ntohs(pub_port), link_type, lifetime);
 			
-		for (i=0; i<LINK_TABLE_OUT_SIZE; i++)
+		LinkTableRehash(&libalias_cur->linkTableOut,
+				libalias_cur->linkTableOut.old_size);
+		for (i=0; i<libalias_cur->linkTableOut.size; i++)
 		{
-			link = LIST_FIRST(&linkTableOut[i]);
+			link = LIST_FIRST(&libalias_cur->linkTableOut.chain[i]);
 			while (link != NULL)
 			{
 				struct alias_link *link_next;
@@ -2050,7 +2911,7 @@ FindAliasPortOut(struct in_addr src_addr, struct in_addr dst_addr, u_short src_p
 #ifdef DEBUG
 	printf("PORTMAP::StartPointOut returns %d\n", i);
 #endif
-    LIST_FOREACH(link, &linkTableOut[i], list_out)
+    LIST_FOREACH(link, LinkTableChain(&libalias_cur->linkTableOut, i), list_out)
 	{
 		if (link->src_addr.s_addr == src_addr.s_addr &&
 			link->dst_addr.s_addr == dst_addr.s_addr &&
@@ -2093,12 +2954,18 @@ FindAliasPortOut(struct in_addr src_addr, struct in_addr dst_addr, u_short src_p
 	return -1;
 }
 
+int
+FindAliasPortOut(struct in_addr src_addr, struct in_addr dst_addr, u_short src_port, u_short pub_port, u_char proto, int lifetime, char addmapping)
+{
+    return LibAliasFindAliasPortOut(packetAliasInstance, src_addr, dst_addr,
+                                    src_port, pub_port, proto, lifetime,
+                                    addmapping);
+}
+
 
 /* External routines for getting or changing link data
    (external to alias_db.c, but internal to alias*.c)
 
-    SetFragmentData(), GetFragmentData()
-    SetFragmentPtr(), GetFragmentPtr()
     SetStateIn(), SetStateOut(), GetStateIn(), GetStateOut()
     GetOriginalAddress(), GetDestAddress(), GetAliasAddress()
     GetOriginalPort(), GetAliasPort()
@@ -2109,34 +2976,6 @@ FindAliasPortOut(struct in_addr src_addr, struct in_addr dst_addr, u_short src_p
 */
 
 
-void
-SetFragmentAddr(struct alias_link *link, struct in_addr src_addr)
-{
-    link->data.frag_addr = src_addr;
-}
-
-
-void
-GetFragmentAddr(struct alias_link *link, struct in_addr *src_addr)
-{
-    *src_addr = link->data.frag_addr;
-}
-
-
-void
-SetFragmentPtr(struct alias_link *link, char *fptr)
-{
-    link->data.frag_ptr = fptr;
-}
-
-
-void
-GetFragmentPtr(struct alias_link *link, char **fptr)
-{
-   *fptr = link->data.frag_ptr;
-}
-
-
 void
 SetStateIn(struct alias_link *link, int state)
 {
@@ -2156,6 +2995,7 @@ SetStateIn(struct alias_link *link, int state)
         abort();
     }
     link->data.tcp->state.in = state;
+    WheelSchedule(link);
 }
 
 
@@ -2178,6 +3018,7 @@ SetStateOut(struct alias_link *link, int state)
         abort();
     }
     link->data.tcp->state.out = state;
+    WheelSchedule(link);
 }
 
 
@@ -2201,7 +3042,7 @@ struct in_addr
 GetOriginalAddress(struct alias_link *link)
 {
     if (link->src_addr.s_addr == INADDR_ANY)
-        return aliasAddress;
+        return libalias_cur->aliasAddress;
     else
         return(link->src_addr);
 }
@@ -2218,7 +3059,7 @@ struct in_addr
 GetAliasAddress(struct alias_link *link)
 {
     if (link->alias_addr.s_addr == INADDR_ANY)
-        return aliasAddress;
+        return libalias_cur->aliasAddress;
     else
         return link->alias_addr;
 }
@@ -2227,14 +3068,14 @@ GetAliasAddress(struct alias_link *link)
 struct in_addr
 GetDefaultAliasAddress()
 {
-    return aliasAddress;
+    return libalias_cur->aliasAddress;
 }
 
 
 void
 SetDefaultAliasAddress(struct in_addr alias_addr)
 {
-    aliasAddress = alias_addr;
+    libalias_cur->aliasAddress = alias_addr;
 }
 
 
@@ -2455,6 +3296,7 @@ SetExpire(struct alias_link *link, int expire)
     else if (expire > 0)
     {
         link->expire_time = expire;
+        WheelSchedule(link);
     }
     else
     {
@@ -2468,7 +3310,7 @@ SetExpire(struct alias_link *link, int expire)
 void
 ClearCheckNewLink(void)
 {
-    newDefaultLink = 0;
+    libalias_cur->newDefaultLink = 0;
 }
 
 void
@@ -2492,10 +3334,478 @@ void
 SetDestCallId(struct alias_link *link, u_int16_t cid)
 {
 
-    deleteAllLinks = 1;
+    libalias_cur->deleteAllLinks = 1;
     link = ReLink(link, link->src_addr, link->dst_addr, link->alias_addr,
 		  link->src_port, cid, link->alias_port, link->link_type);
-    deleteAllLinks = 0;
+    libalias_cur->deleteAllLinks = 0;
+}
+
+
+/* Fragment Cache
+
+    FragHash()               -- keyed hash of a fragmented packet
+    FragFind()               -- look up, and optionally add, a packet
+    FragDrop()               -- forget a packet and free the fragments
+                                held for it
+    FragCacheResolve()       -- note where the header of a packet went
+    FragCacheLookup()        -- find where the rest of a packet goes
+    FragCacheHold()          -- keep a fragment until its header comes
+    FragCacheRelease()       -- give back the fragments held for a header
+    FragCacheExpire()        -- forget packets which are out of time
+    FragCacheFree()          -- free the cache of an instance
+
+Incoming fragmented packets are tracked in a table of their own rather
+than as aliasing links, so that heavy fragmented traffic does not
+lengthen the chains every other packet is looked up in.  A packet is
+known by its source and destination addresses, IP id and protocol as
+received.  The destination is left out of the hash, so that the
+fragments held for a header can be found from the header after it
+has been de-aliased.
+
+The table is allocated with the first fragment seen and holds at most
+FRAG_CACHE_SIZE packets; when it is full, the packet seen least
+recently is dropped to make room.  A packet is forgotten
+FRAGMENT_ID_EXPIRE_TIME seconds after its last fragment, or
+FRAGMENT_PTR_EXPIRE_TIME seconds if fragments are still held for it.
+Held fragments are freed when their packet is forgotten, as the
+library has owned them since they were handed to it.
+*/
+
+#define FRAG_CACHE_SIZE     1024     /* Packets tracked at once         */
+#define FRAG_CACHE_BUCKETS  1024     /* Must be a power of 2            */
+#define FRAG_CACHE_HELD       16     /* Fragments held for a packet     */
+
+struct frag_entry
+{
+    struct in_addr src_addr;     /* Addresses as received               */
+    struct in_addr dst_addr;
+    struct in_addr orig_addr;    /* Where the header went, if resolved  */
+    u_short ip_id;
+    u_char proto;
+    u_char resolved;
+
+    int timestamp;               /* Time a fragment was last seen       */
+    int nheld;
+    char *held[FRAG_CACHE_HELD]; /* Fragments that came before header   */
+
+    LIST_ENTRY(frag_entry) hash;
+    TAILQ_ENTRY(frag_entry) age; /* Seen order, or free list            */
+};
+
+struct frag_cache
+{
+    LIST_HEAD(, frag_entry) bucket[FRAG_CACHE_BUCKETS];
+    TAILQ_HEAD(, frag_entry) age;    /* Least recently seen first       */
+    TAILQ_HEAD(, frag_entry) free;
+    int lastExpire;                  /* Time of last FragCacheExpire()  */
+    struct frag_entry entry[FRAG_CACHE_SIZE];
+};
+
+static u_int FragHash(struct in_addr, u_short, u_char);
+static struct frag_entry *FragFind(struct in_addr, struct in_addr,
+                                   u_short, u_char, int);
+static void FragDrop(struct frag_entry *);
+
+static u_int
+FragHash(struct in_addr src_addr, u_short ip_id, u_char proto)
+{
+    u_int64_t m;
+
+    m = ((u_int64_t) src_addr.s_addr << 32)
+      | ((u_int64_t) ip_id << 8)
+      | proto;
+    return(LinkHash(m, 0) & (FRAG_CACHE_BUCKETS - 1));
+}
+
+static struct frag_entry *
+FragFind(struct in_addr src_addr, struct in_addr dst_addr,
+         u_short ip_id, u_char proto, int create)
+{
+    struct frag_cache *fc;
+    struct frag_entry *fe;
+    u_int i;
+
+    fc = libalias_cur->fragCache;
+    if (fc == NULL)
+    {
+        if (!create)
+            return(NULL);
+
+        fc = malloc(sizeof(struct frag_cache));
+        if (fc == NULL)
+            return(NULL);
+        for (i = 0; i < FRAG_CACHE_BUCKETS; i++)
+            LIST_INIT(&fc->bucket[i]);
+        TAILQ_INIT(&fc->age);
+        TAILQ_INIT(&fc->free);
+        for (i = 0; i < FRAG_CACHE_SIZE; i++)
+            TAILQ_INSERT_TAIL(&fc->free, &fc->entry[i], age);
+        fc->lastExpire = libalias_cur->timeStamp;
+        libalias_cur->fragCache = fc;
+    }
+
+    i = FragHash(src_addr, ip_id, proto);
+    LIST_FOREACH(fe, &fc->bucket[i], hash)
+    {
+        if (fe->src_addr.s_addr == src_addr.s_addr
+         && fe->dst_addr.s_addr == dst_addr.s_addr
+         && fe->ip_id == ip_id
+         && fe->proto == proto)
+        {
+            fe->timestamp = libalias_cur->timeStamp;
+            TAILQ_REMOVE(&fc->age, fe, age);
+            TAILQ_INSERT_TAIL(&fc->age, fe, age);
+            return(fe);
+        }
+    }
+
+    if (!create)
+        return(NULL);
+
+    if (TAILQ_EMPTY(&fc->free))
+        FragDrop(TAILQ_FIRST(&fc->age));
+    fe = TAILQ_FIRST(&fc->free);
+    TAILQ_REMOVE(&fc->free, fe, age);
+
+    fe->src_addr = src_addr;
+    fe->dst_addr = dst_addr;
+    fe->orig_addr.s_addr = INADDR_ANY;
+    fe->ip_id = ip_id;
+    fe->proto = proto;
+    fe->resolved = 0;
+    fe->timestamp = libalias_cur->timeStamp;
+    fe->nheld = 0;
+    LIST_INSERT_HEAD(&fc->bucket[i], fe, hash);
+    TAILQ_INSERT_TAIL(&fc->age, fe, age);
+    libalias_cur->fragmentIdCount++;
+
+    return(fe);
+}
+
+static void
+FragDrop(struct frag_entry *fe)
+{
+    struct frag_cache *fc;
+
+    fc = libalias_cur->fragCache;
+    libalias_cur->fragmentPtrCount -= fe->nheld;
+    while (fe->nheld > 0)
+        free(fe->held[--fe->nheld]);
+    LIST_REMOVE(fe, hash);
+    TAILQ_REMOVE(&fc->age, fe, age);
+    TAILQ_INSERT_HEAD(&fc->free, fe, age);
+    libalias_cur->fragmentIdCount--;
+}
+
+/* Note that the rest of a packet whose header came from src_addr to
+   dst_addr is to go to orig_addr */
+int
+FragCacheResolve(struct in_addr src_addr, struct in_addr dst_addr,
+                 u_short ip_id, u_char proto, struct in_addr orig_addr)
+{
+    struct frag_entry *fe;
+
+    fe = FragFind(src_addr, dst_addr, ip_id, proto, 1);
+    if (fe == NULL)
+        return(-1);
+
+    fe->orig_addr = orig_addr;
+    fe->resolved = 1;
+    return(0);
+}
+
+int
+FragCacheLookup(struct in_addr src_addr, struct in_addr dst_addr,
+                u_short ip_id, u_char proto, struct in_addr *orig_addr)
+{
+    struct frag_entry *fe;
+
+    fe = FragFind(src_addr, dst_addr, ip_id, proto, 0);
+    if (fe == NULL || !fe->resolved)
+        return(-1);
+
+    *orig_addr = fe->orig_addr;
+    return(0);
+}
+
+/* Keep a fragment that came before its header.  The library owns it
+   from then on. */
+int
+FragCacheHold(struct ip *pip)
+{
+    struct frag_entry *fe;
+
+    fe = FragFind(pip->ip_src, pip->ip_dst, pip->ip_id, pip->ip_p, 1);
+    if (fe == NULL || fe->nheld == FRAG_CACHE_HELD)
+        return(-1);
+
+    fe->held[fe->nheld++] = (char *) pip;
+    libalias_cur->fragmentPtrCount++;
+    return(0);
+}
+
+/* Give back up to max of the fragments held for a header, which may
+   already have been de-aliased, in the order they were held.  Returns
+   the number given back. */
+int
+FragCacheRelease(struct ip *pip, char **fptr, int max)
+{
+    struct frag_entry *fe;
+    int n;
+
+    if (libalias_cur->fragCache == NULL)
+        return(0);
+
+    LIST_FOREACH(fe, &libalias_cur->fragCache->bucket[FragHash(pip->ip_src,
+                                                     pip->ip_id,
+                                                     pip->ip_p)], hash)
+    {
+        if (fe->src_addr.s_addr == pip->ip_src.s_addr
+         && fe->ip_id == pip->ip_id
+         && fe->proto == pip->ip_p
+         && (fe->dst_addr.s_addr == pip->ip_dst.s_addr
+          || (fe->resolved
+           && fe->orig_addr.s_addr == pip->ip_dst.s_addr)))
+            break;
+    }
+    if (fe == NULL)
+        return(0);
+
+    n = fe->nheld < max ? fe->nheld : max;
+    memcpy(fptr, fe->held, n * sizeof(char *));
+    fe->nheld -= n;
+    memmove(fe->held, fe->held + n, fe->nheld * sizeof(char *));
+    libalias_cur->fragmentPtrCount -= n;
+
+    /* Nothing more can come of a packet with no header */
+    if (!fe->resolved && fe->nheld == 0)
+        FragDrop(fe);
+
+    return(n);
+}
+
+/* The age list is in the order packets were last seen, so only its
+   head is looked at; packets there which still hold fragments are
+   stepped over until their longer time is up.  This is done at most
+   once a second. */
+void
+FragCacheExpire(void)
+{
+    struct frag_cache *fc;
+    struct frag_entry *fe;
+    struct frag_entry *fe_next;
+    int idle;
+
+    fc = libalias_cur->fragCache;
+    if (fc->lastExpire == libalias_cur->timeStamp)
+        return;
+    fc->lastExpire = libalias_cur->timeStamp;
+
+    for (fe = TAILQ_FIRST(&fc->age); fe != NULL; fe = fe_next)
+    {
+        fe_next = TAILQ_NEXT(fe, age);
+        idle = libalias_cur->timeStamp - fe->timestamp;
+        if (idle <= FRAGMENT_ID_EXPIRE_TIME)
+            break;
+        if (fe->nheld == 0 || idle > FRAGMENT_PTR_EXPIRE_TIME)
+            FragDrop(fe);
+    }
+}
+
+void
+FragCacheFree(void)
+{
+    struct frag_cache *fc;
+
+    fc = libalias_cur->fragCache;
+    if (fc == NULL)
+        return;
+
+    while (!TAILQ_EMPTY(&fc->age))
+        FragDrop(TAILQ_FIRST(&fc->age));
+    free(fc);
+    libalias_cur->fragCache = NULL;
+}
+
+
+/* Link Accounting
+
+    AcctGrow()               -- add a block of counters
+    AcctAttach()             -- give a new link counters
+    AcctDetach()             -- report a link going away and free
+                                its counters
+    AcctRecord()             -- fill in the record of a link
+    AcctFree()               -- free the counters of an instance
+    AccountPacket()          -- count a packet of a link
+    LibAliasSetAccounting()  -- turn accounting on or off
+
+The packet and byte counts of links are not kept in struct alias_link,
+which is walked by every lookup, but in blocks of entries beside it,
+which only the packets of a link touch.  The entries are half a cache
+line each and the blocks are aligned to cache lines, so an entry never
+straddles two.  Blocks are added as links need them and never move, so
+making a link costs at most one block allocation however many links
+there are.  Free entries are chained through their first counter.  A
+link made while accounting is on gets an entry, and its record is
+handed to the function set with LibAliasSetAccounting() when it is
+made and when it goes away.  Links for which no entry can be allocated
+are not counted or reported, and are counted in acctFails instead.
+*/
+
+#define ACCT_CACHE_LINE      64
+#define ACCT_CHUNK         1024 /* Entries in each block              */
+
+struct link_acct
+{
+    u_int64_t packets[2];        /* Indexed by ACCT_IN and ACCT_OUT     */
+    u_int64_t bytes[2];
+};
+
+#define ACCT_ENTRY(i) \
+    (&libalias_cur->acct[(i) / ACCT_CHUNK][(i) % ACCT_CHUNK])
+
+static void AcctRecord(struct alias_link *, int, struct alias_flow_record *);
+
+static int
+AcctGrow(void)
+{
+    u_int i, base, max;
+    struct link_acct **chunks;
+    struct link_acct *acct;
+
+    if (libalias_cur->acctChunks == libalias_cur->acctChunkMax)
+    {
+        max = libalias_cur->acctChunkMax ? libalias_cur->acctChunkMax * 2
+                                         : 16;
+        chunks = realloc(libalias_cur->acct, max * sizeof(*chunks));
+        if (chunks == NULL)
+            return(-1);
+        libalias_cur->acct = chunks;
+        libalias_cur->acctChunkMax = max;
+    }
+
+    if (posix_memalign((void **) &acct, ACCT_CACHE_LINE,
+                       ACCT_CHUNK * sizeof(struct link_acct)) != 0)
+        return(-1);
+    base = libalias_cur->acctChunks * ACCT_CHUNK;
+    libalias_cur->acct[libalias_cur->acctChunks++] = acct;
+
+/* Chain the new entries, lowest first; entry 0 stays unused */
+    for (i = ACCT_CHUNK; i-- > 0 && base + i != 0; )
+    {
+        acct[i].packets[0] = libalias_cur->acctFree;
+        libalias_cur->acctFree = base + i;
+    }
+    return(0);
+}
+
+static void
+AcctAttach(struct alias_link *link)
+{
+    struct link_acct *acct;
+    struct alias_flow_record rec;
+
+    if (libalias_cur->acctFree == 0 && AcctGrow() != 0)
+    {
+        libalias_cur->acctFails++;
+#ifdef DEBUG
+        fprintf(stderr, "PacketAlias/AcctAttach(): ");
+        fprintf(stderr, "cannot allocate link counters\n");
+#endif
+        return;
+    }
+
+    link->acct = libalias_cur->acctFree;
+    acct = ACCT_ENTRY(link->acct);
+    libalias_cur->acctFree = (u_int) acct->packets[0];
+    memset(acct, 0, sizeof(struct link_acct));
+
+    AcctRecord(link, ALIAS_FLOW_CREATE, &rec);
+    libalias_cur->acctFn(libalias_cur->acctArg, &rec);
+}
+
+static void
+AcctDetach(struct alias_link *link)
+{
+    struct link_acct *acct;
+    struct alias_flow_record rec;
+
+    if (libalias_cur->acctFn != NULL)
+    {
+        AcctRecord(link, ALIAS_FLOW_EXPIRE, &rec);
+        libalias_cur->acctFn(libalias_cur->acctArg, &rec);
+    }
+    acct = ACCT_ENTRY(link->acct);
+    acct->packets[0] = libalias_cur->acctFree;
+    libalias_cur->acctFree = link->acct;
+    link->acct = 0;
+}
+
+static void
+AcctRecord(struct alias_link *link, int type, struct alias_flow_record *rec)
+{
+    struct link_acct *acct;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->type = type;
+    if (link->link_type < IPPROTO_MAX)
+        rec->proto = link->link_type;
+    else if (link->link_type == LINK_PPTP)
+        rec->proto = IPPROTO_GRE;
+    rec->src_addr   = link->src_addr;
+    rec->dst_addr   = link->dst_addr;
+    rec->alias_addr = link->alias_addr;
+    rec->src_port   = link->src_port;
+    rec->dst_port   = link->dst_port;
+    rec->alias_port = link->alias_port;
+    rec->time       = libalias_cur->timeStamp;
+    rec->last       = link->timestamp;
+
+    acct = ACCT_ENTRY(link->acct);
+    rec->packets_in  = acct->packets[ACCT_IN];
+    rec->packets_out = acct->packets[ACCT_OUT];
+    rec->bytes_in    = acct->bytes[ACCT_IN];
+    rec->bytes_out   = acct->bytes[ACCT_OUT];
+}
+
+static void
+AcctFree(void)
+{
+    u_int i;
+
+    for (i = 0; i < libalias_cur->acctChunks; i++)
+        free(libalias_cur->acct[i]);
+    free(libalias_cur->acct);
+    libalias_cur->acct = NULL;
+    libalias_cur->acctChunks = 0;
+    libalias_cur->acctChunkMax = 0;
+    libalias_cur->acctFree = 0;
+}
+
+void
+AccountPacket(struct alias_link *link, int direction, struct ip *pip)
+{
+    struct link_acct *acct;
+
+    if (link->acct != 0)
+    {
+        acct = ACCT_ENTRY(link->acct);
+        acct->packets[direction]++;
+        acct->bytes[direction] += ntohs(pip->ip_len);
+    }
+}
+
+/* Have records of links handed to fn, or turn accounting off if fn is
+   NULL.  Only links made while accounting is on are counted. */
+int
+LibAliasSetAccounting(struct libalias *instance,
+                      alias_flow_fn *fn,
+                      void *arg)
+{
+    libalias_cur = instance;
+    libalias_cur->acctFn = fn;
+    libalias_cur->acctArg = arg;
+    return(0);
 }
 
 
@@ -2508,17 +3818,27 @@ SetDestCallId(struct alias_link *link, u_int16_t cid)
 
 /*
     Whenever an outgoing or incoming packet is handled, HouseKeeping()
-    is called to find and remove timed-out aliasing links.  Logic exists
-    to sweep through the entire table and linked list structure
-    every 60 seconds.
+    is called to find and remove timed-out aliasing links.  The timing
+    wheel is run up to the current second, so links are removed as
+    soon as they are due, and only links that are due are looked at.
 
-    (prototype in alias_local.h)
+    HouseKeepingBatch() does the same once for a batch of packets,
+    moving as many chains of a table being resized as the packets
+    would have moved one by one.
+
+    (prototypes in alias_local.h)
 */
 
 void
 HouseKeeping(void)
 {
-    int i, n, n100;
+    HouseKeepingBatch(1);
+}
+
+
+void
+HouseKeepingBatch(int npackets)
+{
     struct timeval tv;
     struct timezone tz;
 
@@ -2528,42 +3848,27 @@ HouseKeeping(void)
      * waste timeline by making system calls.
      */
     gettimeofday(&tv, &tz);
-    timeStamp = tv.tv_sec;
+    libalias_cur->timeStamp = tv.tv_sec;
 
-    /* Compute number of spokes (output table link chains) to cover */
-    n100  = LINK_TABLE_OUT_SIZE * 100 + houseKeepingResidual;
-    n100 *= timeStamp - lastCleanupTime;
-    n100 /= ALIAS_CLEANUP_INTERVAL_SECS;
+    /* Grow or shrink the lookup tables a few chains at a time */
+    LinkTableAdjust(&libalias_cur->linkTableOut,
+                    LINK_TABLE_REHASH_CHAINS * npackets);
+    LinkTableAdjust(&libalias_cur->linkTableIn,
+                    LINK_TABLE_REHASH_CHAINS * npackets);
 
-    n = n100/100;
+    /* Expire links which are due */
+    WheelAdvance();
 
-    /* Handle different cases */
-    if (n > ALIAS_CLEANUP_MAX_SPOKES)
-    {
-        n = ALIAS_CLEANUP_MAX_SPOKES;
-        lastCleanupTime = timeStamp;
-        houseKeepingResidual = 0;
-
-        for (i=0; i<n; i++)
-            IncrementalCleanup();
-    }
-    else if (n > 0)
-    {
-        lastCleanupTime = timeStamp;
-        houseKeepingResidual = n100 - 100*n;
+    /* Forget fragmented packets which are out of time */
+    if (libalias_cur->fragCache != NULL)
+        FragCacheExpire();
 
-        for (i=0; i<n; i++)
-            IncrementalCleanup();
-    }
-    else if (n < 0)
-    {
-#ifdef DEBUG
-        fprintf(stderr, "PacketAlias/HouseKeeping(): ");
-        fprintf(stderr, "something unexpected in time values\n");
+#ifndef NO_FW_PUNCH
+    /* Apply the firewall holes punched and cleared since last time */
+    if (libalias_cur->fireWallQueued != 0
+     || libalias_cur->fireWallStaleCount != 0)
+        FlushFWHoles();
 #endif
-        lastCleanupTime = timeStamp;
-        houseKeepingResidual = 0;
-    }
 }
 
 
@@ -2571,11 +3876,11 @@ HouseKeeping(void)
 static void
 InitPacketAliasLog(void)
 {
-   if ((~packetAliasMode & PKT_ALIAS_LOG)
-    && (monitorFile = fopen("/var/log/alias.log", "w")))
+   if ((~libalias_cur->packetAliasMode & PKT_ALIAS_LOG)
+    && (libalias_cur->monitorFile = fopen("/var/log/alias.log", "w")))
    {
-      packetAliasMode |= PKT_ALIAS_LOG;
-      fprintf(monitorFile,
+      libalias_cur->packetAliasMode |= PKT_ALIAS_LOG;
+      fprintf(libalias_cur->monitorFile,
       "PacketAlias/InitPacketAliasLog: Packet alias logging enabled.\n");
    }
 }
@@ -2585,11 +3890,11 @@ InitPacketAliasLog(void)
 static void
 UninitPacketAliasLog(void)
 {
-    if (monitorFile) {
-        fclose(monitorFile);
-        monitorFile = NULL;
+    if (libalias_cur->monitorFile) {
+        fclose(libalias_cur->monitorFile);
+        libalias_cur->monitorFile = NULL;
     }
-    packetAliasMode &= ~PKT_ALIAS_LOG;
+    libalias_cur->packetAliasMode &= ~PKT_ALIAS_LOG;
 }
 
 
@@ -2601,15 +3906,20 @@ UninitPacketAliasLog(void)
 
 -- "outside world" means other than alias*.c routines --
 
-    PacketAliasRedirectPort()
-    PacketAliasAddServer()
-    PacketAliasRedirectProto()
-    PacketAliasRedirectAddr()
-    PacketAliasRedirectDelete()
-    PacketAliasSetAddress()
-    PacketAliasInit()
-    PacketAliasUninit()
-    PacketAliasSetMode()
+    LibAliasRedirectPort()
+    LibAliasAddServer()
+    LibAliasRedirectProto()
+    LibAliasRedirectAddr()
+    LibAliasRedirectDelete()
+    LibAliasSetAddress()
+    LibAliasInit()
+    LibAliasUninit()
+    LibAliasSetMode()
+    LibAliasReserveLinks()
+    LibAliasSetMaxLinks()
+
+The PacketAlias*() forms of these, which work on packetAliasInstance,
+are at the end of the file.
 
 (prototypes in alias.h)
 */
@@ -2617,14 +3927,16 @@ UninitPacketAliasLog(void)
 /* Redirection from a specific public addr:port to a
    private addr:port */
 struct alias_link *
-PacketAliasRedirectPort(struct in_addr src_addr,   u_short src_port,
-                        struct in_addr dst_addr,   u_short dst_port,
-                        struct in_addr alias_addr, u_short alias_port,
-                        u_char proto)
+LibAliasRedirectPort(struct libalias *instance,
+                     struct in_addr src_addr,   u_short src_port,
+                     struct in_addr dst_addr,   u_short dst_port,
+                     struct in_addr alias_addr, u_short alias_port,
+                     u_char proto)
 {
     int link_type;
     struct alias_link *link;
 
+    libalias_cur = instance;
     switch(proto)
     {
     case IPPROTO_UDP:
@@ -2662,7 +3974,8 @@ PacketAliasRedirectPort(struct in_addr src_addr,   u_short src_port,
 
 /* Add server to the pool of servers */
 int
-PacketAliasAddServer(struct alias_link *link, struct in_addr addr, u_short port)
+LibAliasAddServer(struct libalias *instance,
+                  struct alias_link *link, struct in_addr addr, u_short port)
 {
     struct server *server;
 
@@ -2693,13 +4006,15 @@ PacketAliasAddServer(struct alias_link *link, struct in_addr addr, u_short port)
 /* Redirect packets of a given IP protocol from a specific
    public address to a private address */
 struct alias_link *
-PacketAliasRedirectProto(struct in_addr src_addr,
-                         struct in_addr dst_addr,
-                         struct in_addr alias_addr,
-                         u_char proto)
+LibAliasRedirectProto(struct libalias *instance,
+                      struct in_addr src_addr,
+                      struct in_addr dst_addr,
+                      struct in_addr alias_addr,
+                      u_char proto)
 {
     struct alias_link *link;
 
+    libalias_cur = instance;
     link = AddLink(src_addr, dst_addr, alias_addr,
                    NO_SRC_PORT, NO_DEST_PORT, 0,
                    proto);
@@ -2721,11 +4036,13 @@ PacketAliasRedirectProto(struct in_addr src_addr,
 
 /* Static address translation */
 struct alias_link *
-PacketAliasRedirectAddr(struct in_addr src_addr,
-                        struct in_addr alias_addr)
+LibAliasRedirectAddr(struct libalias *instance,
+                     struct in_addr src_addr,
+                     struct in_addr alias_addr)
 {
     struct alias_link *link;
 
+    libalias_cur = instance;
     link = AddLink(src_addr, nullAddress, alias_addr,
                    0, 0, 0,
                    LINK_ADDR);
@@ -2747,104 +4064,150 @@ PacketAliasRedirectAddr(struct in_addr src_addr,
 
 
 void
-PacketAliasRedirectDelete(struct alias_link *link)
+LibAliasRedirectDelete(struct libalias *instance, struct alias_link *link)
 {
 /* This is a dangerous function to put in the API,
    because an invalid pointer can crash the program. */
 
-    deleteAllLinks = 1;
+    libalias_cur = instance;
+    libalias_cur->deleteAllLinks = 1;
     DeleteLink(link);
-    deleteAllLinks = 0;
+    libalias_cur->deleteAllLinks = 0;
 }
 
 
 void
-PacketAliasSetAddress(struct in_addr addr)
+LibAliasSetAddress(struct libalias *instance, struct in_addr addr)
 {
-    if (packetAliasMode & PKT_ALIAS_RESET_ON_ADDR_CHANGE
-     && aliasAddress.s_addr != addr.s_addr)
+    libalias_cur = instance;
+    if (libalias_cur->packetAliasMode & PKT_ALIAS_RESET_ON_ADDR_CHANGE
+     && libalias_cur->aliasAddress.s_addr != addr.s_addr)
         CleanupAliasData();
 
-    aliasAddress = addr;
+    libalias_cur->aliasAddress = addr;
 }
 
 
 void
-PacketAliasSetTarget(struct in_addr target_addr)
+LibAliasSetTarget(struct libalias *instance, struct in_addr target_addr)
 {
-    targetAddress = target_addr;
+    instance->targetAddress = target_addr;
 }
 
 
-void
-PacketAliasInit(void)
+/* Set up a new instance if given NULL, or reset an existing one to
+   its initial state, dropping all links.  NULL is returned if no
+   memory is available for a new instance. */
+struct libalias *
+LibAliasInit(struct libalias *instance)
 {
     int i;
     struct timeval tv;
     struct timezone tz;
-    static int firstCall = 1;
 
-    if (firstCall == 1)
+    if (instance == NULL)
     {
+        instance = calloc(1, sizeof(struct libalias));
+        if (instance == NULL)
+            return (NULL);
+        libalias_cur = instance;
+
         gettimeofday(&tv, &tz);
-        timeStamp = tv.tv_sec;
-        lastCleanupTime = tv.tv_sec;
-        houseKeepingResidual = 0;
+        libalias_cur->timeStamp = tv.tv_sec;
+        libalias_cur->wheelTime = tv.tv_sec;
+        libalias_cur->lastHistogramTime = 0;
 
-        for (i=0; i<LINK_TABLE_OUT_SIZE; i++)
-            LIST_INIT(&linkTableOut[i]);
-        for (i=0; i<LINK_TABLE_IN_SIZE; i++)
-            LIST_INIT(&linkTableIn[i]);
+        for (i=0; i<WHEEL0_SIZE; i++)
+            LIST_INIT(&libalias_cur->expireWheel0[i]);
+        for (i=0; i<WHEELN_SIZE; i++)
+        {
+            LIST_INIT(&libalias_cur->expireWheel1[i]);
+            LIST_INIT(&libalias_cur->expireWheel2[i]);
+        }
 
-        atexit(PacketAliasUninit);
-        firstCall = 0;
+        LinkTableInit(&libalias_cur->linkTableOut, libalias_cur->linkChainsOut);
+        LinkTableInit(&libalias_cur->linkTableIn, libalias_cur->linkChainsIn);
+
+        libalias_cur->linkPool.name = "link";
+        libalias_cur->linkPool.item_size = POOL_ITEM_SIZE(struct alias_link);
+        libalias_cur->tcpPool.name = "tcp";
+        libalias_cur->tcpPool.item_size = POOL_ITEM_SIZE(struct tcp_dat);
+
+#ifndef NO_FW_PUNCH
+        libalias_cur->fireWallFD = -1;
+#endif
     }
     else
     {
-        deleteAllLinks = 1;
+        libalias_cur = instance;
+        libalias_cur->deleteAllLinks = 1;
         CleanupAliasData();
-        deleteAllLinks = 0;
+        libalias_cur->deleteAllLinks = 0;
+        FragCacheFree();
     }
 
-    aliasAddress.s_addr = INADDR_ANY;
-    targetAddress.s_addr = INADDR_ANY;
+    libalias_cur->aliasAddress.s_addr = INADDR_ANY;
+    libalias_cur->targetAddress.s_addr = INADDR_ANY;
 
-    icmpLinkCount = 0;
-    udpLinkCount = 0;
-    tcpLinkCount = 0;
-    pptpLinkCount = 0;
-    protoLinkCount = 0;
-    fragmentIdLinkCount = 0;
-    fragmentPtrLinkCount = 0;
-    sockCount = 0;
+/* The tables are empty, so the hash key can be changed */
+    arc4random_buf(libalias_cur->linkHashKey,
+                   sizeof(libalias_cur->linkHashKey));
 
-    cleanupIndex =0;
+    libalias_cur->icmpLinkCount = 0;
+    libalias_cur->udpLinkCount = 0;
+    libalias_cur->tcpLinkCount = 0;
+    libalias_cur->pptpLinkCount = 0;
+    libalias_cur->protoLinkCount = 0;
+    libalias_cur->fragmentIdCount = 0;
+    libalias_cur->fragmentPtrCount = 0;
+    libalias_cur->sockCount = 0;
+    libalias_cur->linkTableMinIndex = LINK_TABLE_SIZE_INITIAL;
 
-    packetAliasMode = PKT_ALIAS_SAME_PORTS
+    libalias_cur->packetAliasMode = PKT_ALIAS_SAME_PORTS
                     | PKT_ALIAS_USE_SOCKETS
                     | PKT_ALIAS_RESET_ON_ADDR_CHANGE;
+
+    libalias_cur->helperDisabled = 0;
+    HelperTableBuild();
+
+    return (instance);
 }
 
+/* Drop all links of an instance and free it */
 void
-PacketAliasUninit(void) {
-    deleteAllLinks = 1;
+LibAliasUninit(struct libalias *instance) {
+    libalias_cur = instance;
+    libalias_cur->deleteAllLinks = 1;
     CleanupAliasData();
-    deleteAllLinks = 0;
+    libalias_cur->deleteAllLinks = 0;
+    LinkTableFree(&libalias_cur->linkTableOut);
+    LinkTableFree(&libalias_cur->linkTableIn);
+    PoolRelease(&libalias_cur->linkPool);
+    PoolRelease(&libalias_cur->tcpPool);
+    PortMapFree();
+    AcctFree();
+    FragCacheFree();
+    ProxyUninit();
     UninitPacketAliasLog();
 #ifndef NO_FW_PUNCH
     UninitPunchFW();
 #endif
+    libalias_cur = NULL;
+    free(instance);
 }
 
 
 /* Change mode for some operations */
 unsigned int
-PacketAliasSetMode(
+LibAliasSetMode(
+    struct libalias *instance,
     unsigned int flags, /* Which state to bring flags to */
     unsigned int mask   /* Mask of which flags to affect (use 0 to do a
                            probe for flag values) */
 )
 {
+    libalias_cur = instance;
+
 /* Enable logging? */
     if (flags & mask & PKT_ALIAS_LOG)
     {
@@ -2866,16 +4229,51 @@ PacketAliasSetMode(
     }
 #endif
 
+/* Choose the size below which the link tables never shrink.  They
+   are grown to it on the next packets. */
+    if (flags & mask & PKT_ALIAS_LARGE_TABLES)
+        libalias_cur->linkTableMinIndex = LINK_TABLE_SIZE_LARGE;
+    else if (~flags & mask & PKT_ALIAS_LARGE_TABLES)
+        libalias_cur->linkTableMinIndex = LINK_TABLE_SIZE_INITIAL;
+
 /* Other flags can be set/cleared without special action */
-    packetAliasMode = (flags & mask) | (packetAliasMode & ~mask);
-    return packetAliasMode;
+    libalias_cur->packetAliasMode = (flags & mask)
+                                  | (libalias_cur->packetAliasMode & ~mask);
+    return libalias_cur->packetAliasMode;
 }
 
 
+/* Make sure storage for at least count links, TCP or not, is
+   allocated, so that later link creation does not call malloc() */
 int
-PacketAliasCheckNewLink(void)
+LibAliasReserveLinks(struct libalias *instance, unsigned int count)
+{
+    libalias_cur = instance;
+    if (count > libalias_cur->linkPool.nitems
+     && PoolGrow(&libalias_cur->linkPool,
+                 count - libalias_cur->linkPool.nitems) != 0)
+        return (-1);
+    if (count > libalias_cur->tcpPool.nitems
+     && PoolGrow(&libalias_cur->tcpPool,
+                 count - libalias_cur->tcpPool.nitems) != 0)
+        return (-1);
+    return (0);
+}
+
+
+/* Limit the number of links which may exist at once (zero means no
+   limit).  Links beyond the limit are refused as if out of memory. */
+void
+LibAliasSetMaxLinks(struct libalias *instance, unsigned int max)
 {
-    return newDefaultLink;
+    instance->maxLinks = max;
+}
+
+
+int
+LibAliasCheckNewLink(struct libalias *instance)
+{
+    return instance->newDefaultLink;
 }
 
 
@@ -2892,91 +4290,165 @@ PacketAliasCheckNewLink(void)
 #include <string.h>
 #include <err.h>
 
-static void ClearAllFWHoles(void);
+/*
+ * Rule numbers in use are kept in a bitmap, with the bits past the
+ * end of the range set so that they are never handed out.  Holes are
+ * not punched or cleared at once, but queued and applied together by
+ * HouseKeeping() before the next packet is aliased, which is before
+ * that packet goes on through the firewall.  A hole cleared before it
+ * was punched costs no call to the firewall at all, and the number of
+ * a cleared hole is not given out again until its rules are gone.
+ */
+#define FW_WORDS(n)     (((n) + 63) / 64)
 
-static int fireWallBaseNum;     /* The first firewall entry free for our use */
-static int fireWallNumNums;     /* How many entries can we use? */
-static int fireWallActiveNum;   /* Which entry did we last use? */
-static char *fireWallField;     /* bool array for entries */
-
-#define fw_setfield(field, num)                         \
-do {                                                    \
-    (field)[(num) - fireWallBaseNum] = 1;               \
-} /*lint -save -e717 */ while(0) /*lint -restore */
-#define fw_clrfield(field, num)                         \
-do {                                                    \
-    (field)[(num) - fireWallBaseNum] = 0;               \
-} /*lint -save -e717 */ while(0) /*lint -restore */
-#define fw_tstfield(field, num) ((field)[(num) - fireWallBaseNum])
+static void ClearAllFWHoles(void);
+static void DeleteFWHole(int);
+static void ApplyFWHole(struct alias_link *);
+static int FindFWHole(void);
 
 static void
 InitPunchFW(void) {
-    fireWallField = malloc(fireWallNumNums);
-    if (fireWallField) {
-        memset(fireWallField, 0, fireWallNumNums);
-        if (fireWallFD < 0) {
-            fireWallFD = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
+    int words;
+
+    free(libalias_cur->fireWallField);
+    free(libalias_cur->fireWallStale);
+    free(libalias_cur->fireWallQueue);
+
+    words = FW_WORDS(libalias_cur->fireWallNumNums);
+    libalias_cur->fireWallField = calloc(words, sizeof(u_int64_t));
+    libalias_cur->fireWallStale = calloc(words, sizeof(u_int64_t));
+    libalias_cur->fireWallQueue = calloc(libalias_cur->fireWallNumNums,
+                               sizeof(struct alias_link *));
+    if (libalias_cur->fireWallField && libalias_cur->fireWallStale
+     && libalias_cur->fireWallQueue) {
+        if (libalias_cur->fireWallNumNums % 64)
+            libalias_cur->fireWallField[words - 1] =
+                ~0ULL << (libalias_cur->fireWallNumNums % 64);
+        libalias_cur->fireWallStaleCount = 0;
+        libalias_cur->fireWallQueued = 0;
+        if (libalias_cur->fireWallFD < 0) {
+            libalias_cur->fireWallFD = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
         }
         ClearAllFWHoles();
-        fireWallActiveNum = fireWallBaseNum;
+        libalias_cur->fireWallActiveNum = libalias_cur->fireWallBaseNum;
+    } else {
+        free(libalias_cur->fireWallField);
+        free(libalias_cur->fireWallStale);
+        free(libalias_cur->fireWallQueue);
+        libalias_cur->fireWallField = NULL;
+        libalias_cur->fireWallStale = NULL;
+        libalias_cur->fireWallQueue = NULL;
     }
 }
 
 static void
 UninitPunchFW(void) {
-    ClearAllFWHoles();
-    if (fireWallFD >= 0)
-        close(fireWallFD);
-    fireWallFD = -1;
-    if (fireWallField)
-        free(fireWallField);
-    fireWallField = NULL;
-    packetAliasMode &= ~PKT_ALIAS_PUNCH_FW;
+    int i, words;
+    u_int64_t bits;
+
+    if (libalias_cur->fireWallField) {
+    /* Forget the holes not punched yet, then clear the others */
+        while (libalias_cur->fireWallQueued > 0) {
+            struct alias_link *link;
+
+            link = libalias_cur->fireWallQueue[--libalias_cur->fireWallQueued];
+            link->data.tcp->fwhole = -1;
+        }
+        words = FW_WORDS(libalias_cur->fireWallNumNums);
+        if (libalias_cur->fireWallNumNums % 64)
+            libalias_cur->fireWallField[words - 1] &=
+                ~(~0ULL << (libalias_cur->fireWallNumNums % 64));
+        for (i = 0; i < words; i++) {
+            for (bits = libalias_cur->fireWallField[i]; bits != 0;
+                 bits &= bits - 1)
+                DeleteFWHole(libalias_cur->fireWallBaseNum + i * 64 +
+                             __builtin_ctzll(bits));
+        }
+    }
+    if (libalias_cur->fireWallFD >= 0)
+        close(libalias_cur->fireWallFD);
+    libalias_cur->fireWallFD = -1;
+    free(libalias_cur->fireWallField);
+    free(libalias_cur->fireWallStale);
+    free(libalias_cur->fireWallQueue);
+    libalias_cur->fireWallField = NULL;
+    libalias_cur->fireWallStale = NULL;
+    libalias_cur->fireWallQueue = NULL;
+    libalias_cur->fireWallQueued = 0;
+    libalias_cur->fireWallStaleCount = 0;
+    libalias_cur->packetAliasMode &= ~PKT_ALIAS_PUNCH_FW;
+}
+
+/* Find a free rule number, starting after the last one handed out */
+static int
+FindFWHole(void) {
+    int i, n, w, words;
+    u_int64_t bits;
+
+    words = FW_WORDS(libalias_cur->fireWallNumNums);
+    if (words == 0)
+        return -1;
+    i = libalias_cur->fireWallActiveNum - libalias_cur->fireWallBaseNum;
+    if (i < 0 || i >= libalias_cur->fireWallNumNums)
+        i = 0;
+
+    w = i / 64;
+    bits = ~libalias_cur->fireWallField[w] & (~0ULL << (i % 64));
+    for (n = 0; n <= words; n++) {
+        if (bits != 0)
+            return libalias_cur->fireWallBaseNum + w * 64
+                 + __builtin_ctzll(bits);
+        w = (w + 1) % words;
+        bits = ~libalias_cur->fireWallField[w];
+    }
+    return -1;
 }
 
 /* Make a certain link go through the firewall */
 void
 PunchFWHole(struct alias_link *link) {
-    int r;                      /* Result code */
-    struct ip_fw rule;          /* On-the-fly built rule */
     int fwhole;                 /* Where to punch hole */
 
 /* Don't do anything unless we are asked to */
-    if ( !(packetAliasMode & PKT_ALIAS_PUNCH_FW) ||
-         fireWallFD < 0 ||
-         link->link_type != LINK_TCP)
+    if ( !(libalias_cur->packetAliasMode & PKT_ALIAS_PUNCH_FW) ||
+         libalias_cur->fireWallFD < 0 ||
+         libalias_cur->fireWallField == NULL ||
+         link->link_type != LINK_TCP ||
+         link->data.tcp->fwhole >= 0)
         return;
 
-    memset(&rule, 0, sizeof rule);
-
-/** Build rule **/
-
     /* Find empty slot */
-    for (fwhole = fireWallActiveNum;
-         fwhole < fireWallBaseNum + fireWallNumNums &&
-             fw_tstfield(fireWallField, fwhole);
-         fwhole++)
-        ;
-    if (fwhole == fireWallBaseNum + fireWallNumNums) {
-        for (fwhole = fireWallBaseNum;
-             fwhole < fireWallActiveNum &&
-                 fw_tstfield(fireWallField, fwhole);
-             fwhole++)
-            ;
-        if (fwhole == fireWallActiveNum) {
-            /* No rule point empty - we can't punch more holes. */
-            fireWallActiveNum = fireWallBaseNum;
+    fwhole = FindFWHole();
+    if (fwhole < 0) {
+        /* No rule point empty - we can't punch more holes. */
+        libalias_cur->fireWallActiveNum = libalias_cur->fireWallBaseNum;
 #ifdef DEBUG
-            fprintf(stderr, "libalias: Unable to create firewall hole!\n");
+        fprintf(stderr, "libalias: Unable to create firewall hole!\n");
 #endif
-            return;
-        }
+        return;
     }
     /* Start next search at next position */
-    fireWallActiveNum = fwhole+1;
+    libalias_cur->fireWallActiveNum = fwhole+1;
+
+/* Indicate hole applied, and have it punched on the next packet */
+    fwhole -= libalias_cur->fireWallBaseNum;
+    libalias_cur->fireWallField[fwhole / 64] |= 1ULL << (fwhole % 64);
+    link->data.tcp->fwhole = libalias_cur->fireWallBaseNum + fwhole;
+    libalias_cur->fireWallQueue[libalias_cur->fireWallQueued++] = link;
+}
+
+/* Add the rules for the hole of a link */
+static void
+ApplyFWHole(struct alias_link *link) {
+    int r;                      /* Result code */
+    struct ip_fw rule;          /* On-the-fly built rule */
+
+    memset(&rule, 0, sizeof rule);
+
+/** Build rule **/
 
     /* Build generic part of the two rules */
-    rule.fw_number = fwhole;
+    rule.fw_number = link->data.tcp->fwhole;
     IP_FW_SETNSRCP(&rule, 1);	/* Number of source ports. */
     IP_FW_SETNDSTP(&rule, 1);	/* Number of destination ports. */
     rule.fw_flg = IP_FW_F_ACCEPT | IP_FW_F_IN | IP_FW_F_OUT;
@@ -2995,7 +4467,7 @@ PunchFWHole(struct alias_link *link) {
        (Code should be left even if the problem is fixed - it is a
        clear optimization) */
     if (rule.fw_uar.fw_pts[0] != 0 && rule.fw_uar.fw_pts[1] != 0) {
-        r = setsockopt(fireWallFD, IPPROTO_IP, IP_FW_ADD, &rule, sizeof rule);
+        r = setsockopt(libalias_cur->fireWallFD, IPPROTO_IP, IP_FW_ADD, &rule, sizeof rule);
 #ifdef DEBUG
         if (r)
             err(1, "alias punch inbound(1) setsockopt(IP_FW_ADD)");
@@ -3004,15 +4476,23 @@ PunchFWHole(struct alias_link *link) {
         rule.fw_dst = GetOriginalAddress(link);
         rule.fw_uar.fw_pts[0] = ntohs(GetDestPort(link));
         rule.fw_uar.fw_pts[1] = ntohs(GetOriginalPort(link));
-        r = setsockopt(fireWallFD, IPPROTO_IP, IP_FW_ADD, &rule, sizeof rule);
+        r = setsockopt(libalias_cur->fireWallFD, IPPROTO_IP, IP_FW_ADD, &rule, sizeof rule);
 #ifdef DEBUG
         if (r)
             err(1, "alias punch inbound(2) setsockopt(IP_FW_ADD)");
 #endif
     }
-/* Indicate hole applied */
-    link->data.tcp->fwhole = fwhole;
-    fw_setfield(fireWallField, fwhole);
+}
+
+/* Delete the rules of a hole */
+static void
+DeleteFWHole(int fwhole) {
+    struct ip_fw rule;
+
+    memset(&rule, 0, sizeof rule);
+    rule.fw_number = fwhole;
+    while (!setsockopt(libalias_cur->fireWallFD, IPPROTO_IP, IP_FW_DEL, &rule, sizeof rule))
+        ;
 }
 
 /* Remove a hole in a firewall associated with a particular alias
@@ -3021,56 +4501,113 @@ static void
 ClearFWHole(struct alias_link *link) {
     if (link->link_type == LINK_TCP) {
         int fwhole =  link->data.tcp->fwhole; /* Where is the firewall hole? */
-        struct ip_fw rule;
+        int i;
 
         if (fwhole < 0)
             return;
-
-        memset(&rule, 0, sizeof rule);
-        rule.fw_number = fwhole;
-        while (!setsockopt(fireWallFD, IPPROTO_IP, IP_FW_DEL, &rule, sizeof rule))
-            ;
-        fw_clrfield(fireWallField, fwhole);
         link->data.tcp->fwhole = -1;
+        if (libalias_cur->fireWallField == NULL)
+            return;
+
+        fwhole -= libalias_cur->fireWallBaseNum;
+        for (i = 0; i < libalias_cur->fireWallQueued; i++) {
+            if (libalias_cur->fireWallQueue[i] == link) {
+            /* Never punched, so the number is free again at once */
+                libalias_cur->fireWallQueue[i] =
+                    libalias_cur->fireWallQueue[--libalias_cur->fireWallQueued];
+                libalias_cur->fireWallField[fwhole / 64] &=
+                    ~(1ULL << (fwhole % 64));
+                return;
+            }
+        }
+        libalias_cur->fireWallStale[fwhole / 64] |= 1ULL << (fwhole % 64);
+        libalias_cur->fireWallStaleCount++;
+    }
+}
+
+/* Delete the rules of cleared holes and add those of punched ones */
+static void
+FlushFWHoles(void) {
+    int i, words;
+    u_int64_t bits;
+
+    if (libalias_cur->fireWallStaleCount != 0) {
+        words = FW_WORDS(libalias_cur->fireWallNumNums);
+        for (i = 0; i < words; i++) {
+            for (bits = libalias_cur->fireWallStale[i]; bits != 0;
+                 bits &= bits - 1)
+                DeleteFWHole(libalias_cur->fireWallBaseNum + i * 64 +
+                             __builtin_ctzll(bits));
+            libalias_cur->fireWallField[i] &= ~libalias_cur->fireWallStale[i];
+            libalias_cur->fireWallStale[i] = 0;
+        }
+        libalias_cur->fireWallStaleCount = 0;
     }
+
+    for (i = 0; i < libalias_cur->fireWallQueued; i++)
+        ApplyFWHole(libalias_cur->fireWallQueue[i]);
+    libalias_cur->fireWallQueued = 0;
 }
 
 /* Clear out the entire range dedicated to firewall holes. */
 static void
 ClearAllFWHoles(void) {
-    struct ip_fw rule;          /* On-the-fly built rule */
     int i;
     
-    if (fireWallFD < 0)
+    if (libalias_cur->fireWallFD < 0)
         return;
 
-    memset(&rule, 0, sizeof rule);
-    for (i = fireWallBaseNum; i < fireWallBaseNum + fireWallNumNums; i++) {
-        rule.fw_number = i;
-        while (!setsockopt(fireWallFD, IPPROTO_IP, IP_FW_DEL, &rule, sizeof rule))
-            ;
-    }
-    memset(fireWallField, 0, fireWallNumNums);
+    for (i = libalias_cur->fireWallBaseNum; i < libalias_cur->fireWallBaseNum + libalias_cur->fireWallNumNums; i++)
+        DeleteFWHole(i);
 }
 #endif
 
 void
-PacketAliasSetFWBase(unsigned int base, unsigned int num) {
+LibAliasSetFWBase(struct libalias *instance, unsigned int base, unsigned int num) {
 #ifndef NO_FW_PUNCH
-    fireWallBaseNum = base;
-    fireWallNumNums = num;
+    instance->fireWallBaseNum = base;
+    instance->fireWallNumNums = num;
 #endif
 }
 
 void
-DumpInfo(void)
+LibAliasDumpInfo(struct libalias *instance)
 {
-	int i, icount = 0;
+	u_int i;
+	int icount = 0;
 	struct alias_link *link;
 	
-	for (i=0; i<LINK_TABLE_OUT_SIZE; i++)
+	libalias_cur = instance;
+
+	syslog(LOG_ERR, " pool link= %u/%u tcp= %u/%u max= %u refused= %u",
+		libalias_cur->linkPool.nused, libalias_cur->linkPool.nitems, libalias_cur->tcpPool.nused, libalias_cur->tcpPool.nitems,
+		libalias_cur->maxLinks, libalias_cur->linkLimitHits);
+	syslog(LOG_ERR, " ports map_full= %u no_port= %u",
+		libalias_cur->portMapFull, libalias_cur->portAllocFails);
+	if (libalias_cur->acctFn != NULL)
+		syslog(LOG_ERR, " acct uncounted= %u", libalias_cur->acctFails);
+#ifndef NO_FW_PUNCH
+	if (libalias_cur->fireWallField != NULL) {
+		int holes = 0;
+
+		/* The bits past the end of the range are set too */
+		for (i = 0; i < FW_WORDS(libalias_cur->fireWallNumNums); i++)
+			holes += __builtin_popcountll(
+			    libalias_cur->fireWallField[i]);
+		holes -= FW_WORDS(libalias_cur->fireWallNumNums) * 64
+		       - libalias_cur->fireWallNumNums;
+		syslog(LOG_ERR, " fw holes= %d/%d queued= %d stale= %d",
+			holes, libalias_cur->fireWallNumNums,
+			libalias_cur->fireWallQueued,
+			libalias_cur->fireWallStaleCount);
+	}
+#endif
+
+	LinkTableRehash(&libalias_cur->linkTableOut,
+			libalias_cur->linkTableOut.old_size);
+	for (i=0; i<libalias_cur->linkTableOut.size; i++)
 	{
-		link = LIST_FIRST(&linkTableOut[i]);
+		link = LIST_FIRST(&libalias_cur->linkTableOut.chain[i]);
 		while (link != NULL)
 		{
 			struct alias_link *link_next;
@@ -3094,3 +4631,484 @@ DumpInfo(void)
 	}
 	
 }
+
+void
+DumpInfo(void)
+{
+	LibAliasDumpInfo(packetAliasInstance);
+}
+
+
+/* Saving and Restoring Link State
+
+    LibAliasSaveState()  - write the links of an instance to a file
+    LibAliasLoadState()  - add the links saved in a file to an instance
+
+So that a restarted natd can carry on with the connections going
+through it, the links of an instance can be written to a snapshot
+file and read back.  The file is a header followed by an array of
+fixed size records, written through a memory mapping into a temporary
+file which is then renamed over the old one, so that a reader never
+sees a partial snapshot.  Loading maps the file and adds a link for
+each record, which takes milliseconds even for large tables.
+
+Records hold everything about a link that does not point into the
+process: addresses, ports, flags, timestamps, and TCP state with the
+sequence number deltas of rewritten streams.  Fragments, LSNAT
+server pools, sockets and firewall holes are not saved.  Sockets are
+opened again as the link is restored.
+*/
+
+#define ALIAS_STATE_MAGIC   0x6c617374   /* "last" in host byte order   */
+#define ALIAS_STATE_VERSION 1
+
+struct alias_state_header
+{
+    u_int32_t magic;
+    u_int32_t version;
+    u_int32_t record_size;       /* sizeof(struct alias_state_record)   */
+    u_int32_t count;             /* Number of records which follow      */
+    int32_t saved_time;          /* timeStamp when written              */
+    struct in_addr alias_addr;   /* Default alias address then          */
+};
+
+struct alias_state_record
+{
+    struct in_addr src_addr;
+    struct in_addr dst_addr;
+    struct in_addr alias_addr;
+    struct in_addr proxy_addr;
+    u_short src_port;
+    u_short dst_port;
+    u_short alias_port;
+    u_short proxy_port;
+    int32_t link_type;
+    int32_t flags;
+    int32_t timestamp;
+    int32_t expire_time;
+    int32_t tcp_in;              /* TCP links only from here on         */
+    int32_t tcp_out;
+    int32_t tcp_index;
+    int32_t tcp_ack_modified;
+    struct
+    {
+        u_int32_t ack_old;
+        u_int32_t ack_new;
+        int32_t delta;
+        int32_t active;
+    } ack[N_LINK_TCP_DATA];
+};
+
+int
+LibAliasSaveState(struct libalias *instance, const char *path)
+{
+    char tmp_path[1024];
+    struct alias_state_header *header;
+    struct alias_state_record *rec;
+    struct alias_link *link;
+    size_t size;
+    void *map;
+    u_int i, count;
+    int fd, j;
+
+    libalias_cur = instance;
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path)
+        >= (int) sizeof(tmp_path))
+        return(-1);
+
+    fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1)
+        return(-1);
+
+    size = sizeof(struct alias_state_header)
+         + libalias_cur->linkCount * sizeof(struct alias_state_record);
+    if (ftruncate(fd, size) == -1)
+        goto bad;
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        goto bad;
+
+    header = map;
+    rec = (struct alias_state_record *) (header + 1);
+    count = 0;
+
+    LinkTableRehash(&libalias_cur->linkTableOut,
+                    libalias_cur->linkTableOut.old_size);
+    for (i=0; i<libalias_cur->linkTableOut.size; i++)
+    {
+        LIST_FOREACH(link, &libalias_cur->linkTableOut.chain[i], list_out)
+        {
+            if (link->server != NULL
+             || count == (u_int) libalias_cur->linkCount)
+                continue;
+
+            memset(rec, 0, sizeof(*rec));
+            rec->src_addr    = link->src_addr;
+            rec->dst_addr    = link->dst_addr;
+            rec->alias_addr  = link->alias_addr;
+            rec->proxy_addr  = link->proxy_addr;
+            rec->src_port    = link->src_port;
+            rec->dst_port    = link->dst_port;
+            rec->alias_port  = link->alias_port;
+            rec->proxy_port  = link->proxy_port;
+            rec->link_type   = link->link_type;
+            rec->flags       = link->flags;
+            rec->timestamp   = link->timestamp;
+            rec->expire_time = link->expire_time;
+            if (link->link_type == LINK_TCP)
+            {
+                rec->tcp_in = link->data.tcp->state.in;
+                rec->tcp_out = link->data.tcp->state.out;
+                rec->tcp_index = link->data.tcp->state.index;
+                rec->tcp_ack_modified = link->data.tcp->state.ack_modified;
+                for (j=0; j<N_LINK_TCP_DATA; j++)
+                {
+                    rec->ack[j].ack_old = link->data.tcp->ack[j].ack_old;
+                    rec->ack[j].ack_new = link->data.tcp->ack[j].ack_new;
+                    rec->ack[j].delta   = link->data.tcp->ack[j].delta;
+                    rec->ack[j].active  = link->data.tcp->ack[j].active;
+                }
+            }
+            rec++;
+            count++;
+        }
+    }
+
+    header->magic       = ALIAS_STATE_MAGIC;
+    header->version     = ALIAS_STATE_VERSION;
+    header->record_size = sizeof(struct alias_state_record);
+    header->count       = count;
+    header->saved_time  = libalias_cur->timeStamp;
+    header->alias_addr  = libalias_cur->aliasAddress;
+
+    if (msync(map, size, MS_SYNC) == -1)
+    {
+        munmap(map, size);
+        goto bad;
+    }
+    munmap(map, size);
+
+/* Drop the room left by links which were not saved */
+    size = sizeof(struct alias_state_header)
+         + count * sizeof(struct alias_state_record);
+    if (ftruncate(fd, size) == -1 || close(fd) == -1)
+    {
+        unlink(tmp_path);
+        return(-1);
+    }
+
+    if (rename(tmp_path, path) == -1)
+    {
+        unlink(tmp_path);
+        return(-1);
+    }
+    return(count);
+
+bad:
+#ifdef DEBUG
+    fprintf(stderr, "PacketAlias/SaveState(): %s: %s\n",
+            tmp_path, strerror(errno));
+#endif
+    close(fd);
+    unlink(tmp_path);
+    return(-1);
+}
+
+/* Whether a record read back holds only values a link could have had,
+   so that a damaged file cannot point past arrays or confuse expiry */
+static int
+StateRecordValid(const struct alias_state_record *rec)
+{
+    int j;
+
+    if ((rec->link_type < 0 || rec->link_type >= IPPROTO_MAX)
+     && rec->link_type != LINK_ADDR && rec->link_type != LINK_PPTP)
+        return(0);
+    if (rec->flags & ~(LINK_PARTIALLY_SPECIFIED | LINK_PERMANENT
+                     | LINK_UNFIREWALLED | LINK_LAST_LINE_CRLF_TERMED
+                     | LINK_CONE))
+        return(0);
+    if (rec->timestamp < 0 || rec->expire_time < 0
+     || rec->expire_time > INT_MAX - libalias_cur->timeStamp - 1)
+        return(0);
+
+    if (rec->link_type != LINK_TCP)
+        return(1);
+    if (rec->tcp_in < ALIAS_TCP_STATE_NOT_CONNECTED
+     || rec->tcp_in > ALIAS_TCP_STATE_DISCONNECTED
+     || rec->tcp_out < ALIAS_TCP_STATE_NOT_CONNECTED
+     || rec->tcp_out > ALIAS_TCP_STATE_DISCONNECTED
+     || rec->tcp_index < 0 || rec->tcp_index >= N_LINK_TCP_DATA
+     || (rec->tcp_ack_modified != 0 && rec->tcp_ack_modified != 1))
+        return(0);
+    for (j=0; j<N_LINK_TCP_DATA; j++)
+    {
+        if (rec->ack[j].active != 0 && rec->ack[j].active != 1)
+            return(0);
+    }
+    return(1);
+}
+
+int
+LibAliasLoadState(struct libalias *instance, const char *path, int redirects)
+{
+    const struct alias_state_header *header;
+    const struct alias_state_record *rec;
+    struct alias_link *link;
+    struct stat st;
+    struct timeval tv;
+    struct timezone tz;
+    void *map;
+    u_int i;
+    int fd, j, count;
+
+    libalias_cur = instance;
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return(-1);
+    if (fstat(fd, &st) == -1 ||
+        st.st_size < (off_t) sizeof(struct alias_state_header))
+    {
+        close(fd);
+        return(-1);
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return(-1);
+
+    header = map;
+    rec = (const struct alias_state_record *) (header + 1);
+    if (header->magic != ALIAS_STATE_MAGIC
+     || header->version != ALIAS_STATE_VERSION
+     || header->record_size != sizeof(struct alias_state_record)
+     || header->count > (st.st_size - sizeof(struct alias_state_header))
+                        / sizeof(struct alias_state_record)
+     || st.st_size != (off_t) (sizeof(struct alias_state_header)
+                        + header->count * sizeof(struct alias_state_record)))
+    {
+#ifdef DEBUG
+        fprintf(stderr, "PacketAlias/LoadState(): %s: bad snapshot\n",
+                path);
+#endif
+        munmap(map, st.st_size);
+        return(-1);
+    }
+
+/* Restored links must not look idle for longer than they have been */
+    gettimeofday(&tv, &tz);
+    libalias_cur->timeStamp = tv.tv_sec;
+
+/* Keep the address the links were aliased to unless one is set */
+    if (libalias_cur->aliasAddress.s_addr == INADDR_ANY)
+        libalias_cur->aliasAddress = header->alias_addr;
+
+    count = 0;
+    for (i=0; i<header->count; i++, rec++)
+    {
+        if (!StateRecordValid(rec))
+        {
+#ifdef DEBUG
+            fprintf(stderr, "PacketAlias/LoadState(): %s: ", path);
+            fprintf(stderr, "record %u out of range\n", i);
+#endif
+            continue;
+        }
+
+        if (rec->flags & LINK_PERMANENT && rec->link_type != LINK_PPTP)
+        {
+            if (!redirects)
+                continue;
+        /* Skip redirects which have been set up again already */
+            if (_FindLinkOut(rec->src_addr, rec->dst_addr,
+                             rec->src_port, rec->dst_port,
+                             rec->link_type, 0) != NULL)
+                continue;
+        }
+
+        link = AddLink(rec->src_addr, rec->dst_addr, rec->alias_addr,
+                       rec->src_port, rec->dst_port, rec->alias_port,
+                       rec->link_type);
+        if (link == NULL)
+            continue;
+
+        link->proxy_addr  = rec->proxy_addr;
+        link->proxy_port  = rec->proxy_port;
+        link->flags       = rec->flags;
+        link->expire_time = rec->expire_time;
+        link->timestamp   = rec->timestamp;
+        if (link->timestamp > libalias_cur->timeStamp)
+            link->timestamp = libalias_cur->timeStamp;
+
+        if (link->link_type == LINK_TCP)
+        {
+            link->data.tcp->state.in = rec->tcp_in;
+            link->data.tcp->state.out = rec->tcp_out;
+            link->data.tcp->state.index = rec->tcp_index;
+            link->data.tcp->state.ack_modified = rec->tcp_ack_modified;
+            for (j=0; j<N_LINK_TCP_DATA; j++)
+            {
+                link->data.tcp->ack[j].ack_old = rec->ack[j].ack_old;
+                link->data.tcp->ack[j].ack_new = rec->ack[j].ack_new;
+                link->data.tcp->ack[j].delta   = rec->ack[j].delta;
+                link->data.tcp->ack[j].active  = rec->ack[j].active;
+            }
+        }
+
+        if ((libalias_cur->packetAliasMode & PKT_ALIAS_USE_SOCKETS)
+         && (link->flags & LINK_PARTIALLY_SPECIFIED)
+         && (link->link_type == LINK_TCP || link->link_type == LINK_UDP))
+            GetSocket(link->alias_port, &link->sockfd, link->link_type);
+
+        WheelSchedule(link);
+        count++;
+    }
+
+    munmap(map, st.st_size);
+    return(count);
+}
+
+
+/* Functions of the original interface, working on packetAliasInstance */
+
+void
+PacketAliasInit(void)
+{
+    static int firstCall = 1;
+
+    packetAliasInstance = LibAliasInit(packetAliasInstance);
+    if (firstCall == 1)
+    {
+        atexit(PacketAliasUninit);
+        firstCall = 0;
+    }
+}
+
+
+void
+PacketAliasUninit(void)
+{
+    if (packetAliasInstance != NULL)
+    {
+        LibAliasUninit(packetAliasInstance);
+        packetAliasInstance = NULL;
+    }
+}
+
+
+void
+PacketAliasSetAddress(struct in_addr addr)
+{
+    LibAliasSetAddress(packetAliasInstance, addr);
+}
+
+
+void
+PacketAliasSetTarget(struct in_addr target_addr)
+{
+    LibAliasSetTarget(packetAliasInstance, target_addr);
+}
+
+
+unsigned int
+PacketAliasSetMode(unsigned int flags, unsigned int mask)
+{
+    return LibAliasSetMode(packetAliasInstance, flags, mask);
+}
+
+
+void
+PacketAliasSetFWBase(unsigned int base, unsigned int num)
+{
+    LibAliasSetFWBase(packetAliasInstance, base, num);
+}
+
+
+int
+PacketAliasReserveLinks(unsigned int count)
+{
+    return LibAliasReserveLinks(packetAliasInstance, count);
+}
+
+
+void
+PacketAliasSetMaxLinks(unsigned int max)
+{
+    LibAliasSetMaxLinks(packetAliasInstance, max);
+}
+
+
+int
+PacketAliasCheckNewLink(void)
+{
+    return LibAliasCheckNewLink(packetAliasInstance);
+}
+
+
+struct alias_link *
+PacketAliasRedirectPort(struct in_addr src_addr,   u_short src_port,
+                        struct in_addr dst_addr,   u_short dst_port,
+                        struct in_addr alias_addr, u_short alias_port,
+                        u_char proto)
+{
+    return LibAliasRedirectPort(packetAliasInstance,
+                                src_addr, src_port,
+                                dst_addr, dst_port,
+                                alias_addr, alias_port,
+                                proto);
+}
+
+
+int
+PacketAliasAddServer(struct alias_link *link, struct in_addr addr, u_short port)
+{
+    return LibAliasAddServer(packetAliasInstance, link, addr, port);
+}
+
+
+struct alias_link *
+PacketAliasRedirectProto(struct in_addr src_addr,
+                         struct in_addr dst_addr,
+                         struct in_addr alias_addr,
+                         u_char proto)
+{
+    return LibAliasRedirectProto(packetAliasInstance,
+                                 src_addr, dst_addr, alias_addr, proto);
+}
+
+
+struct alias_link *
+PacketAliasRedirectAddr(struct in_addr src_addr,
+                        struct in_addr alias_addr)
+{
+    return LibAliasRedirectAddr(packetAliasInstance, src_addr, alias_addr);
+}
+
+
+void
+PacketAliasRedirectDelete(struct alias_link *link)
+{
+    LibAliasRedirectDelete(packetAliasInstance, link);
+}
+
+
+int
+PacketAliasSaveState(const char *path)
+{
+    return LibAliasSaveState(packetAliasInstance, path);
+}
+
+
+int
+PacketAliasLoadState(const char *path, int redirects)
+{
+    return LibAliasLoadState(packetAliasInstance, path, redirects);
+}
+
+
+int
+PacketAliasSetAccounting(alias_flow_fn *fn, void *arg)
+{
+    return LibAliasSetAccounting(packetAliasInstance, fn, arg);
+}
@@ -125,8 +125,6 @@ static int ParseFtp227Reply(char *, int);
 static int ParseFtp229Reply(char *, int);
 static void NewFtpMessage(struct ip *, struct alias_link *, int, int);
 
-static struct in_addr true_addr;	/* in network byte order. */
-static u_short true_port;		/* in host byte order. */
 
 void
 AliasHandleFtpOut(
@@ -247,8 +245,8 @@ ParseFtpPortCommand(char *sptr, int dlen)
     }
 
     if (state == 13) {
-	true_addr.s_addr = htonl(addr);
-	true_port = port;
+	libalias_cur->true_addr.s_addr = htonl(addr);
+	libalias_cur->true_port = port;
 	return 1;
     } else
 	return 0;
@@ -334,8 +332,8 @@ ParseFtpEprtCommand(char *sptr, int dlen)
     }
 
     if (state == 13) {
-	true_addr.s_addr = htonl(addr);
-	true_port = port;
+	libalias_cur->true_addr.s_addr = htonl(addr);
+	libalias_cur->true_port = port;
 	return 1;
     } else
 	return 0;
@@ -400,8 +398,8 @@ ParseFtp227Reply(char *sptr, int dlen)
     }
 
     if (state == 13) {
-        true_port = port;
-        true_addr.s_addr = htonl(addr);
+        libalias_cur->true_port = port;
+        libalias_cur->true_addr.s_addr = htonl(addr);
 	return 1;
     } else
 	return 0;
@@ -471,7 +469,7 @@ ParseFtp229Reply(char *sptr, int dlen)
     }
 
     if (state == 7) {
-	true_port = port;
+	libalias_cur->true_port = port;
 	return 1;
     } else
 	return 0;
@@ -487,20 +485,21 @@ NewFtpMessage(struct ip *pip,
 
 /* Security checks. */
     if (ftp_message_type != FTP_229_REPLY &&
-	pip->ip_src.s_addr != true_addr.s_addr)
+	pip->ip_src.s_addr != libalias_cur->true_addr.s_addr)
 	return;
 
-    if (true_port < IPPORT_RESERVED)
+    if (libalias_cur->true_port < IPPORT_RESERVED)
 	return;
 
 /* Establish link to address and port found in FTP control message. */
-    ftp_link = FindUdpTcpOut(true_addr, GetDestAddress(link),
-                             htons(true_port), 0, IPPROTO_TCP, 1);
+    ftp_link = FindUdpTcpOut(libalias_cur->true_addr, GetDestAddress(link),
+                             htons(libalias_cur->true_port), 0, IPPROTO_TCP, 1);
 
     if (ftp_link != NULL)
     {
         int slen, hlen, tlen, dlen;
         struct tcphdr *tc;
+        u_short old_sum, old_len;
 
 #ifndef NO_FW_PUNCH
 	if (ftp_message_type == FTP_PORT_COMMAND ||
@@ -568,6 +567,7 @@ NewFtpMessage(struct ip *pip,
 
 /* Copy modified buffer into IP packet. */
             sptr = (char *) pip; sptr += hlen;
+            old_sum = PartialChecksum(sptr, dlen, 0);
             strncpy(sptr, stemp, maxpacketsize-hlen);
         }
 
@@ -584,6 +584,7 @@ NewFtpMessage(struct ip *pip,
         {
             u_short new_len;
 
+            old_len = pip->ip_len;
             new_len = htons(hlen + slen);
             DifferentialChecksum(&pip->ip_sum,
                                  &new_len,
@@ -592,9 +593,10 @@ NewFtpMessage(struct ip *pip,
             pip->ip_len = new_len;
         }
 
-/* Compute TCP checksum for revised packet */
-        tc->th_sum = 0;
-        tc->th_sum = TcpChecksum(pip);
+/* Update TCP checksum for the new message */
+        TcpChecksumUpdate(pip, old_sum,
+                          PartialChecksum((char *) pip + hlen, slen, 0),
+                          old_len);
     }
     else
     {
@@ -604,3 +606,19 @@ NewFtpMessage(struct ip *pip,
 #endif
     }
 }
+
+
+/* Protocol helper for alias.c: FTP control connections */
+
+static int
+FtpHelperOut(struct ip *pip, struct helper_args *args)
+{
+    AliasHandleFtpOut(pip, args->link, args->maxpacketsize);
+    return 0;
+}
+
+struct alias_helper ftpHelper = {
+    "ftp", HELPER_TCP, HELPER_SRC_PORT | HELPER_DST_PORT,
+    { FTP_CONTROL_PORT_NUMBER },
+    NULL, FtpHelperOut
+};
@@ -83,6 +83,8 @@
 
 /* Local defines */
 #define DBprintf(a)
+#define IRC_CONTROL_PORT_NUMBER_1 6667
+#define IRC_CONTROL_PORT_NUMBER_2 6668
 
 
 void
@@ -125,6 +127,7 @@ lFOUND_CTCP:
 		 char newpacket[65536];	  /* Estimate of maximum packet size :) */
 		 int  copyat = i;			  /* Same */
 		 int  iCopy = 0;			  /* How much data have we written to copy-back string? */
+		 u_short old_sum, old_len;	  /* For the TCP checksum update */
 		 in_addr_t org_addr;  /* Original IP address */
 		 unsigned short org_port; /* Original source port address */
 	 lCTCP_START:
@@ -318,6 +321,7 @@ lFOUND_CTCP:
 		 /* Handle the end of a packet */
 	 lPACKET_DONE:
 		 iCopy = iCopy > maxsize-copyat ? maxsize-copyat : iCopy;
+		 old_sum = PartialChecksum(sptr+copyat, dlen-copyat, copyat & 1);
 		 memcpy(sptr+copyat, newpacket, iCopy);
 
 /* Save information regarding modified seq and ack numbers */
@@ -333,6 +337,7 @@ lFOUND_CTCP:
         {
 			  u_short new_len;
 			  
+			  old_len = pip->ip_len;
 			  new_len = htons(hlen + iCopy + copyat);
 			  DifferentialChecksum(&pip->ip_sum,
 										  &new_len,
@@ -341,13 +346,29 @@ lFOUND_CTCP:
 			  pip->ip_len = new_len;
         }
 
-		  /* Compute TCP checksum for revised packet */
-        tc->th_sum = 0;
-        tc->th_sum = TcpChecksum(pip);
+		  /* Update TCP checksum for the rewritten part only */
+		  TcpChecksumUpdate(pip, old_sum,
+							 PartialChecksum(sptr+copyat, iCopy, copyat & 1),
+							 old_len);
 		  return;
 	 }
 }
 
+/* Protocol helper for alias.c: DCC requests sent to IRC servers */
+
+static int
+IrcHelperOut(struct ip *pip, struct helper_args *args)
+{
+    AliasHandleIrcOut(pip, args->link, args->maxpacketsize);
+    return 0;
+}
+
+struct alias_helper ircHelper = {
+    "irc", HELPER_TCP, HELPER_DST_PORT,
+    { IRC_CONTROL_PORT_NUMBER_1, IRC_CONTROL_PORT_NUMBER_2 },
+    NULL, IrcHelperOut
+};
+
 /* Notes:
 	[Note 1]
 	The initial search will most often fail; it could be replaced with a 32-bit specific search.
@@ -68,6 +68,9 @@
 #ifndef _ALIAS_LOCAL_H_
 #define	_ALIAS_LOCAL_H_
 
+#include <sys/queue.h>
+#include <stdio.h>
+
 #ifndef NULL
 #define NULL 0
 #endif
@@ -97,14 +100,240 @@
 		} \
 	} while (0)
 
-/* Globals */
+/*
+ * Start loading a cache line that will soon be read.  This is only
+ * a hint, so it may do nothing.
+ */
+#if defined(__GNUC__)
+#define	ALIAS_PREFETCH(addr)	__builtin_prefetch(addr)
+#else
+#define	ALIAS_PREFETCH(addr)	do { } while (0)
+#endif
+
+/* Sizes of the arrays embedded in struct libalias */
+#define LINK_TABLE_MIN_SIZE        4096 /* Must be a power of two        */
+#define WHEEL0_BITS                   8
+#define WHEELN_BITS                   6
+#define WHEEL0_SIZE      (1 << WHEEL0_BITS)
+#define WHEELN_SIZE      (1 << WHEELN_BITS)
+#define HELPER_PROTOS                 2 /* HELPER_TCP and HELPER_UDP     */
+#define PORT_MAP_MAX                  8 /* Alias address and protocol    */
+                                        /*   pairs with a port map       */
 
-extern int packetAliasMode;
+/* Directions for AccountPacket() */
+#define ACCT_IN                       0
+#define ACCT_OUT                      1
+
+/* Protocol helper tables and match flags */
+#define HELPER_TCP                    0
+#define HELPER_UDP                    1
+#define HELPER_MAX_PORTS              2
+#define HELPER_SRC_PORT            0x01 /* Claims packets from its ports */
+#define HELPER_DST_PORT            0x02 /* Claims packets to its ports   */
 
 
 /* Structs */
 
 struct alias_link;    /* Incomplete structure */
+struct proxy_entry;
+struct proxy_rules;
+struct port_map;
+struct frag_cache;
+struct link_acct;
+struct alias_flow_record;
+struct pool_item;
+struct pool_slab;
+
+LIST_HEAD(link_chain, alias_link);
+
+struct link_table                /* Resizable link lookup table         */
+{
+    struct link_chain *chain;    /* Current array of chains             */
+    u_int size;
+    u_int size_index;            /* size == LINK_TABLE_MIN_SIZE << index */
+
+    struct link_chain *old_chain; /* Array being drained, or NULL       */
+    u_int old_size;
+    u_int rehash_index;          /* Next chain of old_chain to move     */
+
+    struct link_chain *base;     /* Static array used at minimum size   */
+};
+
+/*
+ * A protocol helper looks into the data of packets on its ports to
+ * alias addresses carried there.  Each alias_*.c module describes its
+ * helpers with a struct alias_helper; the list of them is in alias.c,
+ * and each instance keeps a table from port to helper so that packets
+ * on other ports cost one lookup per port.
+ */
+struct helper_args               /* What a helper may need to know      */
+{
+    struct alias_link *link;
+    int maxpacketsize;           /* TCP: room for rewriting the data    */
+    struct in_addr *alias_address; /* UDP: address and port the packet  */
+    u_short *alias_port;         /*   is, or was, aliased to            */
+    struct in_addr *original_address; /* UDP in: address restored       */
+};
+
+struct alias_helper
+{
+    const char *name;            /* For LibAliasSetHelper()             */
+    int proto;                   /* HELPER_TCP or HELPER_UDP            */
+    int match;                   /* HELPER_SRC_PORT and/or _DST_PORT    */
+    u_short ports[HELPER_MAX_PORTS]; /* Host order, unused ones zero    */
+    int (*in)(struct ip *, struct helper_args *);  /* Either may be    */
+    int (*out)(struct ip *, struct helper_args *); /*   NULL           */
+};
+
+struct link_pool                 /* Free list of fixed size items       */
+{
+    const char *name;
+    size_t item_size;
+    struct pool_item *free_list;
+    struct pool_slab *slabs;
+    u_int nitems;                /* Items carved from all slabs         */
+    u_int nused;                 /* Items handed out                    */
+};
+
+/*
+ * All the state of one packet aliasing engine.  The LibAlias*()
+ * functions take the instance to work on and make it current for
+ * the calling thread in libalias_cur, which the rest of the code
+ * uses, so that different threads may work on different instances
+ * at once.  Every exported function that reaches that code sets it.
+ */
+struct libalias
+{
+    int packetAliasMode;                 /* Mode flags                  */
+                                         /*        - documented in alias.h */
+
+    struct in_addr aliasAddress;         /* Address written onto source */
+                                         /*   field of IP packet.       */
+
+    struct in_addr targetAddress;        /* IP address incoming packets */
+                                         /*   are sent to if no aliasing */
+                                         /*   link already exists       */
+
+    struct link_table linkTableOut;      /* Lookup table of pointers to */
+                                         /*   chains of link records. Each */
+    struct link_table linkTableIn;       /*   link record is doubly indexed */
+                                         /*   into input and output lookup */
+                                         /*   tables.                   */
+
+    struct link_chain                    /* Chain arrays used while the */
+    linkChainsOut[LINK_TABLE_MIN_SIZE];  /*   tables are at their minimum */
+    struct link_chain                    /*   size, so that initialization */
+    linkChainsIn[LINK_TABLE_MIN_SIZE];   /*   cannot fail.              */
+
+    u_int linkTableMinIndex;             /* Tables never shrink below this */
+                                         /*   size index                */
+
+    u_int64_t linkHashKey[2];            /* Key for StartPointIn/Out(), */
+                                         /*   chosen by LibAliasInit()  */
+
+    int lastHistogramTime;               /* Last time ShowAliasStats()  */
+                                         /*   printed chain lengths     */
+
+    int linkCount;                       /* Number of links in the tables */
+
+    struct link_pool linkPool;           /* Storage for struct alias_link */
+    struct link_pool tcpPool;            /* Storage for struct tcp_dat  */
+
+    u_int maxLinks;                      /* Limit on links, or zero     */
+    u_int linkLimitHits;                 /* Links refused due to maxLinks */
+
+    struct port_map                      /* Free alias ports of the     */
+    *portMaps[PORT_MAP_MAX];             /*   addresses ports are chosen */
+                                         /*   on, allocated as needed   */
+    u_int portMapFull;                   /* Ports chosen by random trials */
+                                         /*   as a port map had none free */
+    u_int portAllocFails;                /* Links refused for want of a */
+                                         /*   free alias port           */
+
+    struct frag_cache *fragCache;        /* Fragmented incoming packets, */
+                                         /*   allocated as needed       */
+
+    void (*acctFn)(void *,               /* Where link records go, or   */
+        const struct alias_flow_record *); /*   NULL for no accounting  */
+    void *acctArg;
+    struct link_acct **acct;             /* Blocks of link counters,    */
+    u_int acctChunks;                    /*   indexed by alias_link.acct; */
+    u_int acctChunkMax;                  /*   entry 0 is never used     */
+    u_int acctFree;                      /* First free entry, or 0      */
+    u_int acctFails;                     /* Links left uncounted for    */
+                                         /*   want of memory            */
+
+    int icmpLinkCount;                   /* Link statistics             */
+    int udpLinkCount;
+    int tcpLinkCount;
+    int pptpLinkCount;
+    int protoLinkCount;
+    int fragmentIdCount;                 /* Fragmented packets tracked  */
+    int fragmentPtrCount;                /* Fragments held for them     */
+    int sockCount;
+
+    int timeStamp;                       /* System time in seconds for  */
+                                         /* current packet              */
+
+    struct link_chain                    /* Timing wheel holding every link */
+    expireWheel0[WHEEL0_SIZE];           /*   in the slot of the time it is */
+    struct link_chain                    /*   due to expire.  A packet that */
+    expireWheel1[WHEELN_SIZE];           /*   refreshes a link's timestamp */
+    struct link_chain                    /*   leaves it in place; the link */
+    expireWheel2[WHEELN_SIZE];           /*   is moved when its slot comes. */
+
+    int wheelTime;                       /* Time up to which the wheel has */
+                                         /* been run by HouseKeeping()  */
+
+    int deleteAllLinks;                  /* If equal to zero, DeleteLink() */
+                                         /* will not remove permanent links */
+
+    FILE *monitorFile;                   /* File descriptor for link    */
+                                         /* statistics monitoring file  */
+
+    int newDefaultLink;                  /* Indicates if a new aliasing */
+                                         /* link has been created after a */
+                                         /* call to LibAliasIn/Out().   */
+
+    u_short packetAliasMSS;              /* MSS to clamp TCP SYNs to, or 0 */
+
+    struct in_addr true_addr;            /* FTP address and port found  */
+    u_short true_port;                   /*   by the last PORT command  */
+
+    struct proxy_rules *proxyRules;      /* Transparent proxy rules     */
+
+    u_char helperPort                    /* For each port, one more than */
+    [HELPER_PROTOS][65536];              /*   the number of the helper  */
+                                         /*   claiming it, or zero      */
+    u_int helperDisabled;                /* Bit for each helper turned  */
+                                         /*   off by LibAliasSetHelper() */
+
+#ifndef NO_FW_PUNCH
+    int fireWallFD;                      /* File descriptor to be able to */
+                                         /* control firewall.  Opened by */
+                                         /* LibAliasSetMode on first    */
+                                         /* setting the PKT_ALIAS_PUNCH_FW */
+                                         /* flag.                       */
+    int fireWallBaseNum;                 /* The first firewall entry free */
+                                         /*   for our use               */
+    int fireWallNumNums;                 /* How many entries can we use? */
+    int fireWallActiveNum;               /* Which entry did we last use? */
+    u_int64_t *fireWallField;            /* Bit for each entry in use   */
+    u_int64_t *fireWallStale;            /* Bit for each entry whose    */
+                                         /*   rules are to be deleted   */
+    int fireWallStaleCount;
+    struct alias_link **fireWallQueue;   /* Links whose holes are to be */
+    int fireWallQueued;                  /*   punched, and how many     */
+#endif
+};
+
+
+/* Globals, kept out of the library's exported symbols */
+
+extern __thread struct libalias *libalias_cur  /* Current instance      */
+    __attribute__((visibility("hidden")));
+extern struct libalias *packetAliasInstance    /* Used by PacketAlias*() */
+    __attribute__((visibility("hidden")));
 
 
 /* Prototypes */
@@ -113,6 +342,8 @@ struct alias_link;    /* Incomplete structure */
 u_short IpChecksum(struct ip *);
 u_short TcpChecksum(struct ip *);
 void DifferentialChecksum(u_short *, u_short *, u_short *, int);
+u_short PartialChecksum(void *, int, int);
+void TcpChecksumUpdate(struct ip *, u_short, u_short, u_short);
 
 /* Internal data access */
 struct alias_link *
@@ -121,18 +352,6 @@ FindIcmpIn(struct in_addr, struct in_addr, u_short, int);
 struct alias_link *
 FindIcmpOut(struct in_addr, struct in_addr, u_short, int);
 
-struct alias_link *
-FindFragmentIn1(struct in_addr, struct in_addr, u_short);
-
-struct alias_link *
-FindFragmentIn2(struct in_addr, struct in_addr, u_short);
-
-struct alias_link *
-AddFragmentPtrLink(struct in_addr, u_short);
-
-struct alias_link *
-FindFragmentPtr(struct in_addr, u_short);
-
 struct alias_link *
 FindProtoIn(struct in_addr, struct in_addr, u_char);
 
@@ -169,13 +388,25 @@ FindOriginalAddress(struct in_addr);
 struct in_addr
 FindAliasAddress(struct in_addr);
 
+void
+PrefetchLinkIn(struct in_addr, u_short, u_char);
+
+void
+PrefetchLinkOut(struct in_addr, struct in_addr, u_short, u_short, u_char);
+
+/* Fragment cache */
+int FragCacheResolve(struct in_addr, struct in_addr, u_short, u_char,
+                     struct in_addr);
+int FragCacheLookup(struct in_addr, struct in_addr, u_short, u_char,
+                    struct in_addr *);
+int FragCacheHold(struct ip *);
+int FragCacheRelease(struct ip *, char **, int);
+void FragCacheExpire(void);
+void FragCacheFree(void);
+
 /* External data access/modification */
 int FindNewPortGroup(struct in_addr, struct in_addr,
                      u_short, u_short, u_short, u_char, u_char);
-void GetFragmentAddr(struct alias_link *, struct in_addr *);
-void SetFragmentAddr(struct alias_link *, struct in_addr);
-void GetFragmentPtr(struct alias_link *, char **);
-void SetFragmentPtr(struct alias_link *, char *);
 void SetStateIn(struct alias_link *, int);
 void SetStateOut(struct alias_link *, int);
 int GetStateIn(struct alias_link *);
@@ -201,6 +432,7 @@ void ClearCheckNewLink(void);
 void SetLastLineCrlfTermed(struct alias_link *, int);
 int GetLastLineCrlfTermed(struct alias_link *);
 void SetDestCallId(struct alias_link *, u_int16_t);
+void AccountPacket(struct alias_link *, int, struct ip *);
 #ifndef NO_FW_PUNCH
 void PunchFWHole(struct alias_link *);
 #endif
@@ -208,36 +440,51 @@ void PunchFWHole(struct alias_link *);
 
 /* Housekeeping function */
 void HouseKeeping(void);
+void HouseKeepingBatch(int);
+
+/* Link table statistics */
+u_int ChainLengths(struct link_table *, u_int *, u_int);
 
 /* Tcp specfic routines */
 /*lint -save -library Suppress flexelint warnings */
 
+/* Protocol helper registry */
+void HelperTableBuild(void);
+
 /* FTP routines */
 void AliasHandleFtpOut(struct ip *, struct alias_link *, int);
+extern struct alias_helper ftpHelper;
 
 /* IRC routines */
 void AliasHandleIrcOut(struct ip *, struct alias_link *, int);
+extern struct alias_helper ircHelper;
 
 /* RTSP routines */
 void AliasHandleRtspOut(struct ip *, struct alias_link *, int);
+extern struct alias_helper rtspHelper;
 
 /* PPTP routines */
 void AliasHandlePptpOut(struct ip *, struct alias_link *);
 void AliasHandlePptpIn(struct ip *, struct alias_link *);
 int AliasHandlePptpGreOut(struct ip *);
 int AliasHandlePptpGreIn(struct ip *);
+extern struct alias_helper pptpHelper;
 
 /* NetBIOS routines */
 int AliasHandleUdpNbt(struct ip *, struct alias_link *, struct in_addr *, u_short);
 int AliasHandleUdpNbtNS(struct ip *, struct alias_link *, struct in_addr *, u_short *, struct in_addr *, u_short *);
+extern struct alias_helper nbtDgmHelper;
+extern struct alias_helper nbtNsHelper;
 
 /* CUSeeMe routines */
 void AliasHandleCUSeeMeOut(struct ip *, struct alias_link *);
 void AliasHandleCUSeeMeIn(struct ip *, struct in_addr);
+extern struct alias_helper cuseemeHelper;
 
 /* Transparent proxy routines */
 int ProxyCheck(struct ip *, struct in_addr *, u_short *);
 void ProxyModify(struct alias_link *, struct ip *, int, int);
+void ProxyUninit(void);
 
 
 enum alias_tcp_state {
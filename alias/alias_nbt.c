@@ -75,6 +75,9 @@
 
 #include "alias_local.h"
 
+#define NETBIOS_NS_PORT_NUMBER 137
+#define NETBIOS_DGM_PORT_NUMBER 138
+
 typedef struct {
 	struct in_addr		oldaddr;
 	u_short 			oldport;
@@ -730,3 +733,57 @@ int AliasHandleUdpNbtNS(
 #endif
     return ((p == NULL) ? -1 : 0);
 }
+
+
+/* Protocol helpers for alias.c: NetBIOS datagram and name services */
+
+static int
+NbtDgmHelperIn(struct ip *pip, struct helper_args *args)
+{
+    struct udphdr *ud;
+
+    ud = (struct udphdr *) ((char *) pip + (pip->ip_hl << 2));
+    return AliasHandleUdpNbt(pip, args->link, args->original_address,
+                             ud->uh_dport);
+}
+
+static int
+NbtDgmHelperOut(struct ip *pip, struct helper_args *args)
+{
+    return AliasHandleUdpNbt(pip, args->link, args->alias_address,
+                             *args->alias_port);
+}
+
+static int
+NbtNsHelperIn(struct ip *pip, struct helper_args *args)
+{
+    struct udphdr *ud;
+
+    ud = (struct udphdr *) ((char *) pip + (pip->ip_hl << 2));
+    return AliasHandleUdpNbtNS(pip, args->link,
+                               args->alias_address, args->alias_port,
+                               args->original_address, &ud->uh_dport);
+}
+
+static int
+NbtNsHelperOut(struct ip *pip, struct helper_args *args)
+{
+    struct udphdr *ud;
+
+    ud = (struct udphdr *) ((char *) pip + (pip->ip_hl << 2));
+    return AliasHandleUdpNbtNS(pip, args->link,
+                               &pip->ip_src, &ud->uh_sport,
+                               args->alias_address, args->alias_port);
+}
+
+struct alias_helper nbtDgmHelper = {
+    "nbt_dgm", HELPER_UDP, HELPER_SRC_PORT | HELPER_DST_PORT,
+    { NETBIOS_DGM_PORT_NUMBER },
+    NbtDgmHelperIn, NbtDgmHelperOut
+};
+
+struct alias_helper nbtNsHelper = {
+    "nbt_ns", HELPER_UDP, HELPER_SRC_PORT | HELPER_DST_PORT,
+    { NETBIOS_NS_PORT_NUMBER },
+    NbtNsHelperIn, NbtNsHelperOut
+};
@@ -113,6 +113,7 @@ struct grehdr			/* Enhanced GRE header. */
 typedef struct grehdr		GreHdr;
 
 /* The PPTP protocol ID used in the GRE 'proto' field. */
+#define PPTP_CONTROL_PORT_NUMBER 1723
 #define PPTP_GRE_PROTO          0x880b
 
 /* Bits that must be set a certain way in all PPTP/GRE packets. */
@@ -388,3 +389,26 @@ AliasHandlePptpGreIn(struct ip *pip)
 
     return (0);
 }
+
+
+/* Protocol helper for alias.c: PPTP control connections */
+
+static int
+PptpHelperIn(struct ip *pip, struct helper_args *args)
+{
+    AliasHandlePptpIn(pip, args->link);
+    return 0;
+}
+
+static int
+PptpHelperOut(struct ip *pip, struct helper_args *args)
+{
+    AliasHandlePptpOut(pip, args->link);
+    return 0;
+}
+
+struct alias_helper pptpHelper = {
+    "pptp", HELPER_TCP, HELPER_SRC_PORT | HELPER_DST_PORT,
+    { PPTP_CONTROL_PORT_NUMBER },
+    PptpHelperIn, PptpHelperOut
+};
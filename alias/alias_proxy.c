@@ -68,13 +68,18 @@
     beginning a of tcp stream, or inclusion of an optional field
     in the IP header.
     
-    There is one public API function:
+    There are two public API functions:
 
-        PacketAliasProxyRule()    -- Adds and deletes proxy
-                                     rules.
+        PacketAliasProxyRule()     -- Adds and deletes proxy
+                                      rules.
+        PacketAliasSetProxyRules() -- Replaces all the rules at once.
 
-    Rules are stored in a linear linked list, so lookup efficiency
-    won't be too good for large lists.
+    Rules are stored in a linked list in search order.  Before the
+    first lookup after a change, the list is compiled into an index:
+    rules are hashed on protocol and destination port, and within
+    each port on the pair of address masks they use.  A lookup then
+    costs a hash probe per distinct pair of masks for the port,
+    rather than a look at every rule.
 
 
     Initial development: April, 1998 (cjm)
@@ -133,15 +138,62 @@ struct proxy_entry
 
     struct proxy_entry *next;
     struct proxy_entry *last;
+
+    int position;                    /* In the list, when indexed   */
+    struct proxy_group *group;       /* Index group holding it      */
+    struct proxy_entry *chain_next;  /* Next in its group chain     */
+};
+
+/*
+ * The rules for one protocol and destination port (0 for any port)
+ * which use the same source and destination masks form a group.
+ * Each group hashes its rules on their masked addresses; rules with
+ * the same addresses follow each other in a chain in search order.
+ * The groups for a port are listed in the order of their first rule,
+ * so a lookup can stop at the first group which starts after the
+ * best match found so far.
+ */
+struct proxy_group
+{
+    struct in_addr src_mask;
+    struct in_addr dst_mask;
+    int first;                       /* Position of first rule      */
+    int count;                       /* Number of rules             */
+    u_int mask;                      /* Number of chains, less one  */
+    struct proxy_entry **chain;
+    struct proxy_group *next;
+};
+
+struct proxy_port
+{
+    u_char proto;
+    u_short port;
+    struct proxy_group *groups;
+    struct proxy_group *last_group;
+    struct proxy_port *next;         /* In hash chain               */
+};
+
+/*
+ * The rules of an instance.  The index is rebuilt on the next lookup
+ * whenever the list changes; if there is no memory for it, lookups
+ * fall back to walking the list.
+ */
+struct proxy_rules
+{
+    struct proxy_entry *list;        /* In search order             */
+    int count;
+    int indexed;                     /* Index matches list          */
+    u_int port_mask;                 /* Number of chains, less one  */
+    struct proxy_port **ports;
 };
 
 
 
 /*
-    File scope variables
+    The rules of each instance are kept on its proxyRules (see
+    struct libalias in alias_local.h).
 */
 
-static struct proxy_entry *proxyList;
 
 
 
@@ -157,6 +209,13 @@ static struct proxy_entry *proxyList;
     RuleDelete()             -- Removes an element from the rule list.
     RuleNumberDelete()       -- Removes all elements from the rule list
                                 having a certain rule number.
+    RuleParse()              -- Adds or deletes rules as told by a
+                                command string.
+    RulesFree()              -- Deletes all rules in a list and the list.
+    IndexFree()              -- Frees the index of a rule list.
+    IndexBuild()             -- Compiles a rule list into an index.
+    IndexLookup()            -- Finds the first rule matching a packet
+                                in the groups for a port.
     ProxyEncodeTcpStream()   -- Adds [DEST x.x.x.x xxxx] to the beginning
                                 of a TCP stream.
     ProxyEncodeIpHeader()    -- Adds an IP option indicating the true
@@ -166,12 +225,25 @@ static struct proxy_entry *proxyList;
 static int IpMask(int, struct in_addr *);
 static int IpAddr(char *, struct in_addr *);
 static int IpPort(char *, int, int *);
-static void RuleAdd(struct proxy_entry *);
-static void RuleDelete(struct proxy_entry *);
-static int RuleNumberDelete(int);
+static void RuleAdd(struct proxy_rules *, struct proxy_entry *);
+static void RuleDelete(struct proxy_rules *, struct proxy_entry *);
+static int RuleNumberDelete(struct proxy_rules *, int);
+static int RuleParse(struct proxy_rules *, const char *);
+static void RulesFree(struct proxy_rules *);
+static void IndexFree(struct proxy_rules *);
+static int IndexBuild(struct proxy_rules *);
+static struct proxy_entry *IndexLookup(struct proxy_port *, struct in_addr,
+                                       struct in_addr, struct proxy_entry *);
 static void ProxyEncodeTcpStream(struct alias_link *, struct ip *, int);
 static void ProxyEncodeIpHeader(struct ip *, int);
 
+#define PROXY_PORT_HASH(proto, port, mask) \
+    (((u_int) ntohs(port) * 31 + (proto)) & (mask))
+
+#define PROXY_ADDR_HASH(src, dst, mask) \
+    ((((u_int32_t) (src) * 2654435761U) ^ \
+      ((u_int32_t) (dst) * 2246822519U)) >> 16 & (mask))
+
 static int
 IpMask(int nbits, struct in_addr *mask)
 {
@@ -224,23 +296,26 @@ IpPort(char *s, int proto, int *port)
     return 0;
 }
 
-void
-RuleAdd(struct proxy_entry *entry)
+static void
+RuleAdd(struct proxy_rules *rules, struct proxy_entry *entry)
 {
     int rule_index;
     struct proxy_entry *ptr;
     struct proxy_entry *ptr_last;
 
-    if (proxyList == NULL)
+    rules->count++;
+    rules->indexed = 0;
+
+    if (rules->list == NULL)
     {
-        proxyList = entry;
+        rules->list = entry;
         entry->last = NULL;
         entry->next = NULL;
         return;
     }
 
     rule_index = entry->rule_index;
-    ptr = proxyList;
+    ptr = rules->list;
     ptr_last = NULL;
     while (ptr != NULL)
     {
@@ -248,17 +323,17 @@ RuleAdd(struct proxy_entry *entry)
         {
             if (ptr_last == NULL)
             {
-                entry->next = proxyList;
+                entry->next = rules->list;
                 entry->last = NULL;
-                proxyList->last = entry;
-                proxyList = entry;
+                rules->list->last = entry;
+                rules->list = entry;
                 return;
             }
 
             ptr_last->next = entry;
-            ptr->last = entry;
-            entry->last = ptr->last;
+            entry->last = ptr_last;
             entry->next = ptr;
+            ptr->last = entry;
             return;
         }
         ptr_last = ptr;
@@ -271,27 +346,29 @@ RuleAdd(struct proxy_entry *entry)
 }
 
 static void
-RuleDelete(struct proxy_entry *entry)
+RuleDelete(struct proxy_rules *rules, struct proxy_entry *entry)
 {
     if (entry->last != NULL)
         entry->last->next = entry->next;
     else
-        proxyList = entry->next;
+        rules->list = entry->next;
 
     if (entry->next != NULL)
         entry->next->last = entry->last;
 
+    rules->count--;
+    rules->indexed = 0;
     free(entry);
 }
 
 static int
-RuleNumberDelete(int rule_index)
+RuleNumberDelete(struct proxy_rules *rules, int rule_index)
 {
     int err;
     struct proxy_entry *ptr;
 
     err = -1;
-    ptr = proxyList;
+    ptr = rules->list;
     while (ptr != NULL)
     {
         struct proxy_entry *ptr_next;
@@ -300,7 +377,7 @@ RuleNumberDelete(int rule_index)
         if (ptr->rule_index == rule_index)
         {
             err = 0;
-            RuleDelete(ptr);
+            RuleDelete(rules, ptr);
         }
 
         ptr = ptr_next;
@@ -309,6 +386,177 @@ RuleNumberDelete(int rule_index)
     return err;
 }
 
+static void
+RulesFree(struct proxy_rules *rules)
+{
+    IndexFree(rules);
+    while (rules->list != NULL)
+        RuleDelete(rules, rules->list);
+    free(rules);
+}
+
+static void
+IndexFree(struct proxy_rules *rules)
+{
+    u_int i;
+    struct proxy_port *port;
+    struct proxy_group *group;
+
+    if (rules->ports == NULL)
+        return;
+
+    for (i=0; i<=rules->port_mask; i++)
+    {
+        while ((port = rules->ports[i]) != NULL)
+        {
+            rules->ports[i] = port->next;
+            while ((group = port->groups) != NULL)
+            {
+                port->groups = group->next;
+                free(group->chain);
+                free(group);
+            }
+            free(port);
+        }
+    }
+    free(rules->ports);
+    rules->ports = NULL;
+    rules->indexed = 0;
+}
+
+static int
+IndexBuild(struct proxy_rules *rules)
+{
+    u_int n, h;
+    int position;
+    struct proxy_entry *ptr;
+    struct proxy_entry *tail;
+    struct proxy_port *port;
+    struct proxy_group *group;
+
+    IndexFree(rules);
+
+    for (n=1; n<(u_int) rules->count; n<<=1)
+        ;
+    rules->port_mask = n - 1;
+    rules->ports = calloc(n, sizeof(struct proxy_port *));
+    if (rules->ports == NULL)
+        return -1;
+
+/* Sort rules into ports and groups, numbering them in search order */
+    position = 0;
+    tail = NULL;
+    for (ptr = rules->list; ptr != NULL; ptr = ptr->next)
+    {
+        ptr->position = position++;
+        tail = ptr;
+
+        h = PROXY_PORT_HASH(ptr->proto, ptr->proxy_port, rules->port_mask);
+        for (port = rules->ports[h]; port != NULL; port = port->next)
+            if (port->proto == ptr->proto && port->port == ptr->proxy_port)
+                break;
+        if (port == NULL)
+        {
+            port = calloc(1, sizeof(struct proxy_port));
+            if (port == NULL)
+                goto bad;
+            port->proto = ptr->proto;
+            port->port = ptr->proxy_port;
+            port->next = rules->ports[h];
+            rules->ports[h] = port;
+        }
+
+        for (group = port->groups; group != NULL; group = group->next)
+            if (group->src_mask.s_addr == ptr->src_mask.s_addr
+             && group->dst_mask.s_addr == ptr->dst_mask.s_addr)
+                break;
+        if (group == NULL)
+        {
+            group = calloc(1, sizeof(struct proxy_group));
+            if (group == NULL)
+                goto bad;
+            group->src_mask = ptr->src_mask;
+            group->dst_mask = ptr->dst_mask;
+            group->first = ptr->position;
+            if (port->last_group != NULL)
+                port->last_group->next = group;
+            else
+                port->groups = group;
+            port->last_group = group;
+        }
+        group->count++;
+        ptr->group = group;
+    }
+
+/* Hash each rule into its group.  Going through the list backwards
+   and adding at the heads of chains leaves the chains in search order. */
+    for (ptr = tail; ptr != NULL; ptr = ptr->last)
+    {
+        group = ptr->group;
+        if (group->chain == NULL)
+        {
+            for (n=1; n<(u_int) group->count; n<<=1)
+                ;
+            group->mask = n - 1;
+            group->chain = calloc(n, sizeof(struct proxy_entry *));
+            if (group->chain == NULL)
+                goto bad;
+        }
+        h = PROXY_ADDR_HASH(ptr->src_addr.s_addr, ptr->dst_addr.s_addr,
+                            group->mask);
+        ptr->chain_next = group->chain[h];
+        group->chain[h] = ptr;
+    }
+
+    rules->indexed = 1;
+    return 0;
+
+bad:
+#ifdef DEBUG
+    fprintf(stderr, "PacketAlias/IndexBuild(): ");
+    fprintf(stderr, "no memory for %d rules\n", rules->count);
+#endif
+    IndexFree(rules);
+    return -1;
+}
+
+static struct proxy_entry *
+IndexLookup(struct proxy_port *port,
+            struct in_addr src_addr,
+            struct in_addr dst_addr,
+            struct proxy_entry *best)
+{
+    u_int h;
+    u_int32_t src_masked;
+    u_int32_t dst_masked;
+    struct proxy_entry *ptr;
+    struct proxy_group *group;
+
+    for (group = port->groups; group != NULL; group = group->next)
+    {
+        if (best != NULL && group->first > best->position)
+            break;
+
+        src_masked = src_addr.s_addr & group->src_mask.s_addr;
+        dst_masked = dst_addr.s_addr & group->dst_mask.s_addr;
+        h = PROXY_ADDR_HASH(src_masked, dst_masked, group->mask);
+        for (ptr = group->chain[h]; ptr != NULL; ptr = ptr->chain_next)
+        {
+            if (best != NULL && ptr->position > best->position)
+                break;
+            if (ptr->src_addr.s_addr == src_masked
+             && ptr->dst_addr.s_addr == dst_masked
+             && src_addr.s_addr != ptr->server_addr.s_addr)
+            {
+                best = ptr;
+                break;
+            }
+        }
+    }
+
+    return best;
+}
+
 static void
 ProxyEncodeTcpStream(struct alias_link *link,
                      struct ip *pip,
@@ -317,6 +565,7 @@ ProxyEncodeTcpStream(struct alias_link *link,
     int slen;
     char buffer[40];
     struct tcphdr *tc;
+    u_short old_len;
 
 /* Compute pointer to tcp header */
     tc = (struct tcphdr *) ((char *) pip + (pip->ip_hl << 2));
@@ -381,6 +630,7 @@ ProxyEncodeTcpStream(struct alias_link *link,
     {
         int accumulate;
 
+        old_len     = pip->ip_len;
         accumulate  = pip->ip_len;
         pip->ip_len = htons(ntohs(pip->ip_len) + slen);
         accumulate -= pip->ip_len;
@@ -388,11 +638,11 @@ ProxyEncodeTcpStream(struct alias_link *link,
         ADJUST_CHECKSUM(accumulate, pip->ip_sum);
     }
 
-/* Update TCP checksum, Use TcpChecksum since so many things have
-   already changed. */
+/* Update TCP checksum.  The string is padded to an even length, so
+   the data moved after it still falls in the same halves of words
+   and only the inserted bytes need to be summed. */
 
-    tc->th_sum = 0;
-    tc->th_sum = TcpChecksum (pip);
+    TcpChecksumUpdate(pip, 0, PartialChecksum(buffer, slen, 0), old_len);
 }
 
 static void
@@ -472,6 +722,7 @@ ProxyEncodeIpHeader(struct ip *pip,
     ProxyModify()        -- Encodes the original destination address/port
                             for a packet which is to be redirected to
                             a proxy server.
+    ProxyUninit()        -- Deletes all the rules of an instance.
 */
 
 int
@@ -482,14 +733,49 @@ ProxyCheck(struct ip *pip,
     u_short dst_port;
     struct in_addr src_addr;
     struct in_addr dst_addr;
+    struct proxy_rules *rules;
     struct proxy_entry *ptr;
+    struct proxy_port *port;
+
+    rules = libalias_cur->proxyRules;
+    if (rules == NULL || rules->list == NULL)
+        return 0;
 
     src_addr = pip->ip_src;
     dst_addr = pip->ip_dst;
     dst_port = ((struct tcphdr *) ((char *) pip + (pip->ip_hl << 2)))
         ->th_dport;
 
-    ptr = proxyList;
+    if (rules->indexed || IndexBuild(rules) == 0)
+    {
+    /* Rules for the port, then rules for any port which come earlier */
+        ptr = NULL;
+        port = rules->ports[PROXY_PORT_HASH(pip->ip_p, dst_port,
+                                            rules->port_mask)];
+        for (; port != NULL; port = port->next)
+            if (port->proto == pip->ip_p && port->port == dst_port)
+            {
+                ptr = IndexLookup(port, src_addr, dst_addr, ptr);
+                break;
+            }
+
+        port = rules->ports[PROXY_PORT_HASH(pip->ip_p, 0, rules->port_mask)];
+        for (; port != NULL; port = port->next)
+            if (port->proto == pip->ip_p && port->port == 0)
+            {
+                ptr = IndexLookup(port, src_addr, dst_addr, ptr);
+                break;
+            }
+
+        if (ptr == NULL)
+            return 0;
+        if ((*proxy_server_port = ptr->server_port) == 0)
+            *proxy_server_port = dst_port;
+        *proxy_server_addr = ptr->server_addr;
+        return ptr->proxy_type;
+    }
+
+    ptr = rules->list;
     while (ptr != NULL)
     {
         u_short proxy_port;
@@ -538,13 +824,17 @@ ProxyModify(struct alias_link *link,
     }
 }
 
+void
+ProxyUninit(void)
+{
+    if (libalias_cur->proxyRules != NULL)
+        RulesFree(libalias_cur->proxyRules);
+    libalias_cur->proxyRules = NULL;
+}
 
-/*
-    Public API functions
-*/
 
-int
-PacketAliasProxyRule(const char *cmd)
+static int
+RuleParse(struct proxy_rules *rules, const char *cmd)
 {
 /*
  * This function takes command strings of the form:
@@ -722,7 +1012,7 @@ PacketAliasProxyRule(const char *cmd)
                 n = sscanf(token, "%d", &rule_to_delete);
                 if (n != 1)
                     return -1;
-                err = RuleNumberDelete(rule_to_delete);
+                err = RuleNumberDelete(rules, rule_to_delete);
                 if (err)
                     return -1;
                 return 0;
@@ -859,7 +1149,77 @@ PacketAliasProxyRule(const char *cmd)
     proxy_entry->src_mask = src_mask;
     proxy_entry->dst_mask = dst_mask;
 
-    RuleAdd(proxy_entry);
+    RuleAdd(rules, proxy_entry);
 
     return 0;
 }
+
+
+/*
+    Public API functions
+*/
+
+int
+LibAliasProxyRule(struct libalias *instance, const char *cmd)
+{
+    libalias_cur = instance;
+    if (libalias_cur->proxyRules == NULL)
+    {
+        libalias_cur->proxyRules = calloc(1, sizeof(struct proxy_rules));
+        if (libalias_cur->proxyRules == NULL)
+            return -1;
+    }
+
+    return RuleParse(libalias_cur->proxyRules, cmd);
+}
+
+/*
+ * Replace all the rules of an instance by the count rules in cmds,
+ * which take the same form as for LibAliasProxyRule().  The new set is
+ * parsed and indexed to the side; if any rule is bad, the old set is
+ * kept and the number of the bad rule, counting from one, is returned.
+ */
+int
+LibAliasSetProxyRules(struct libalias *instance,
+                      const char * const *cmds,
+                      int count)
+{
+    int i;
+    struct proxy_rules *rules;
+
+    libalias_cur = instance;
+    rules = calloc(1, sizeof(struct proxy_rules));
+    if (rules == NULL)
+        return -1;
+
+    for (i=0; i<count; i++)
+    {
+        if (RuleParse(rules, cmds[i]) == -1)
+        {
+            RulesFree(rules);
+            return i + 1;
+        }
+    }
+    if (rules->list != NULL)
+        IndexBuild(rules);
+
+    ProxyUninit();
+    libalias_cur->proxyRules = rules;
+    return 0;
+}
+
+
+/* Original interface, working on packetAliasInstance */
+
+int
+PacketAliasProxyRule(const char *cmd)
+{
+    return LibAliasProxyRule(packetAliasInstance, cmd);
+}
+
+
+int
+PacketAliasSetProxyRules(const char * const *cmds, int count)
+{
+    return LibAliasSetProxyRules(packetAliasInstance, cmds, count);
+}
@@ -174,7 +174,7 @@ alias_rtsp_out(struct ip *pip,
     int     hlen, tlen, dlen;
     struct tcphdr *tc;
     int     i, j, pos, state, port_dlen, new_dlen, delta;
-    u_short p[2], new_len;
+    u_short p[2], new_len, old_len, old_sum;
     u_short sport, eport, base_port;
     u_short salias = 0, ealias = 0, base_alias = 0;
     const char *transport_str = "transport:";
@@ -365,12 +365,14 @@ alias_rtsp_out(struct ip *pip,
 	
     /* Create new packet */
     new_dlen = port_newdata - newdata;
+    old_sum = PartialChecksum(data, dlen, 0);
     memcpy (data, newdata, new_dlen);
 	
     SetAckModified(link);
     delta = GetDeltaSeqOut(pip, link);
     AddSeq(pip, link, delta + new_dlen - dlen);
 	
+    old_len = pip->ip_len;
     new_len = htons(hlen + new_dlen);
     DifferentialChecksum(&pip->ip_sum,
 						 &new_len,
@@ -378,8 +380,8 @@ alias_rtsp_out(struct ip *pip,
 						 1);
     pip->ip_len = new_len;
 	
-    tc->th_sum = 0;
-    tc->th_sum = TcpChecksum(pip);
+    TcpChecksumUpdate(pip, old_sum, PartialChecksum(data, new_dlen, 0),
+                      old_len);
 	
     return 0;
 }
@@ -396,6 +398,8 @@ alias_pna_out(struct ip *pip,
     u_short msg_id, msg_len;
     char    *work;
     u_short alias_port, port;
+    u_short old_sum;
+    int     odd;
     struct  tcphdr *tc;
 
     work = data;
@@ -420,11 +424,13 @@ alias_pna_out(struct ip *pip,
 #endif
 		tc = (struct tcphdr *) ((char *) pip + (pip->ip_hl << 2));
 		alias_port = GetAliasPort(pna_links);
+		odd = (work - (char *) tc) & 1;
+		old_sum = PartialChecksum(work, 2, odd);
 		memcpy(work, &alias_port, 2);
 
-		/* Compute TCP checksum for revised packet */
-		tc->th_sum = 0;
-		tc->th_sum = TcpChecksum(pip);
+		/* Update TCP checksum for the two bytes changed */
+		TcpChecksumUpdate(pip, old_sum, PartialChecksum(work, 2, odd),
+				  pip->ip_len);
 	    }
 	}
 	work += ntohs(msg_len);
@@ -499,3 +505,19 @@ AliasHandleRtspOut(struct ip *pip, struct alias_link *link, int maxpacketsize)
       }
     }
 }
+
+
+/* Protocol helper for alias.c: RTSP control connections */
+
+static int
+RtspHelperOut(struct ip *pip, struct helper_args *args)
+{
+    AliasHandleRtspOut(pip, args->link, args->maxpacketsize);
+    return 0;
+}
+
+struct alias_helper rtspHelper = {
+    "rtsp", HELPER_TCP, HELPER_SRC_PORT | HELPER_DST_PORT,
+    { RTSP_CONTROL_PORT_NUMBER_1, RTSP_CONTROL_PORT_NUMBER_2 },
+    NULL, RtspHelperOut
+};
@@ -61,6 +61,10 @@
 
     Version 1.7:  January 9, 1997
          Added differential checksum update function.
+
+    The word loops have since been replaced by the shared summing
+    code in alias_cksum.h, and differential updates follow RFC 1624
+    so that a rewrite touching a few bytes need not sum the rest.
 */
 
 /*
@@ -78,28 +82,18 @@ purposes);
 
 #include "alias.h"
 #include "alias_local.h"
+#include "alias_cksum.h"
 
 u_short
 PacketAliasInternetChecksum(u_short *ptr, int nbytes)
 {
-    int sum, oddbyte;
+    return((u_short) ~CksumFold(CksumAccumulate(ptr, nbytes, 0)));
+}
 
-    sum = 0;
-    while (nbytes > 1)
-    {
-        sum += *ptr++;
-        nbytes -= 2;
-    }
-    if (nbytes == 1)
-    {
-        oddbyte = 0;
-        ((u_char *) &oddbyte)[0] = *(u_char *) ptr;
-        ((u_char *) &oddbyte)[1] = 0;
-        sum += oddbyte;
-    }
-    sum = (sum >> 16) + (sum & 0xffff);
-    sum += (sum >> 16);
-    return(~sum);
+u_short
+LibAliasInternetChecksum(struct libalias *instance, u_short *ptr, int nbytes)
+{
+    return PacketAliasInternetChecksum(ptr, nbytes);
 }
 
 u_short
@@ -115,30 +109,16 @@ TcpChecksum(struct ip *pip)
 {
     u_short *ptr;
     struct tcphdr *tc;
-    int nhdr, ntcp, nbytes;
-    int sum, oddbyte;
+    int nhdr, ntcp;
+    u_int64_t sum;
 
     nhdr = pip->ip_hl << 2;
     ntcp = ntohs(pip->ip_len) - nhdr;
 
     tc = (struct tcphdr *) ((char *) pip + nhdr);
-    ptr = (u_short *) tc;
     
 /* Add up TCP header and data */
-    nbytes = ntcp;
-    sum = 0;
-    while (nbytes > 1)
-    {
-        sum += *ptr++;
-        nbytes -= 2;
-    }
-    if (nbytes == 1)
-    {
-        oddbyte = 0;
-        ((u_char *) &oddbyte)[0] = *(u_char *) ptr;
-        ((u_char *) &oddbyte)[1] = 0;
-        sum += oddbyte;
-    }
+    sum = CksumAccumulate(tc, ntcp, 0);
 
 /* "Pseudo-header" data */
     ptr = (u_short *) &(pip->ip_dst);
@@ -150,40 +130,76 @@ TcpChecksum(struct ip *pip)
     sum += htons((u_short) ntcp);
     sum += htons((u_short) pip->ip_p);
 
-/* Roll over carry bits */
-    sum = (sum >> 16) + (sum & 0xffff);
-    sum += (sum >> 16);
-
-/* Return checksum */
-    return((u_short) ~sum);
+/* Roll over carry bits and return checksum */
+    return((u_short) ~CksumFold(sum));
 }
 
 
+/*
+ * Update a checksum for n 16 bit words changing from old to new, by
+ * equation 3 of RFC 1624: HC' = ~(~HC + ~m + m').  Unlike subtracting
+ * the old words this never leaves a checksum of -0.
+ */
 void
 DifferentialChecksum(u_short *cksum, u_short *new, u_short *old, int n)
 {
     int i;
-    int accumulate;
+    u_int64_t sum;
 
-    accumulate = *cksum;
+    sum = (u_short) ~*cksum;
     for (i=0; i<n; i++)
     {
-        accumulate -= *new++;
-        accumulate += *old++;
+        sum += (u_short) ~*old++;
+        sum += *new++;
     }
 
-    if (accumulate < 0)
-    {
-        accumulate = -accumulate;
-        accumulate = (accumulate >> 16) + (accumulate & 0xffff);
-        accumulate += accumulate >> 16;
-        *cksum = (u_short) ~accumulate;
-    }
-    else
-    {
-        accumulate = (accumulate >> 16) + (accumulate & 0xffff);
-        accumulate += accumulate >> 16;
-        *cksum = (u_short) accumulate;
-    }
+    *cksum = (u_short) ~CksumFold(sum);
+}
+
+
+/*
+ * Sum a stretch of bytes for use with TcpChecksumUpdate().  Bytes
+ * at an odd offset from the start of the checksummed data count in
+ * the other half of their words, which by RFC 1071 is the same as
+ * swapping the bytes of the sum.
+ */
+u_short
+PartialChecksum(void *ptr, int nbytes, int odd)
+{
+    u_short sum;
+
+    sum = CksumFold(CksumAccumulate(ptr, nbytes, 0));
+    if (odd)
+        sum = (u_short) ((sum << 8) | (sum >> 8));
+    return(sum);
+}
+
+
+/*
+ * Update the TCP checksum of a packet after part of its segment,
+ * whose PartialChecksum() was oldsum, has been replaced by data with
+ * sum newsum and the IP length changed from old_len.  The rest of
+ * the segment is not read again.
+ */
+void
+TcpChecksumUpdate(struct ip *pip, u_short oldsum, u_short newsum,
+                  u_short old_len)
+{
+    struct tcphdr *tc;
+    int nhdr;
+    u_int64_t sum;
+
+    nhdr = pip->ip_hl << 2;
+    tc = (struct tcphdr *) ((char *) pip + nhdr);
+
+    sum = (u_short) ~tc->th_sum;
+    sum += (u_short) ~oldsum;
+    sum += newsum;
+
+/* Length in the pseudo-header */
+    sum += (u_short) ~htons((u_short) (ntohs(old_len) - nhdr));
+    sum += htons((u_short) (ntohs(pip->ip_len) - nhdr));
+
+    tc->th_sum = (u_short) ~CksumFold(sum);
 }
 
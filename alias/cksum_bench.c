@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2000-2002 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.1 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ *
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+    Cksum_bench.c is a microbenchmark for the checksum code in
+    alias_util.c.  It is not part of the library; build it by hand:
+
+        cc -O2 -o cksum_bench cksum_bench.c alias_util.c
+
+    (add -msse2 or -mavx2 to select a vector kernel).  It first checks
+    the summing kernel and the incremental TCP checksum update against
+    the plain word loop, then times
+
+        - the word loop against CksumAccumulate() over whole packets,
+        - recomputing the TCP checksum with TcpChecksum() against
+          TcpChecksumUpdate() after rewriting a few bytes of payload,
+          as the FTP, IRC, RTSP and proxy handlers do.
+
+    Usage: cksum_bench [packet size [bytes rewritten [iterations]]]
+*/
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <netinet/in_systm.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alias.h"
+#include "alias_local.h"
+#include "alias_cksum.h"
+
+static u_short
+WordLoopChecksum(u_short *ptr, int nbytes)
+{
+    int sum, oddbyte;
+
+    sum = 0;
+    while (nbytes > 1)
+    {
+        sum += *ptr++;
+        nbytes -= 2;
+    }
+    if (nbytes == 1)
+    {
+        oddbyte = 0;
+        ((u_char *) &oddbyte)[0] = *(u_char *) ptr;
+        sum += oddbyte;
+    }
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += (sum >> 16);
+    return(~sum);
+}
+
+static double
+Elapsed(struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return((now.tv_sec - start->tv_sec) * 1e9 +
+           (now.tv_usec - start->tv_usec) * 1e3);
+}
+
+static void
+MakePacket(struct ip *pip, int size)
+{
+    struct tcphdr *tc;
+    u_char *p;
+    int i;
+
+    p = (u_char *) pip;
+    for (i = 0; i < size; i++)
+        p[i] = random();
+
+    pip->ip_v = 4;
+    pip->ip_hl = 5;
+    pip->ip_len = htons(size);
+    pip->ip_p = IPPROTO_TCP;
+    tc = (struct tcphdr *) (pip + 1);
+    tc->th_off = 5;
+    tc->th_sum = 0;
+    tc->th_sum = TcpChecksum(pip);
+}
+
+/* Replace n bytes at payload offset off, as a protocol handler would */
+static void
+Rewrite(struct ip *pip, int off, int n, int incremental)
+{
+    struct tcphdr *tc;
+    u_char *data;
+    u_short old_sum;
+    int i;
+
+    tc = (struct tcphdr *) (pip + 1);
+    data = (u_char *) tc + (tc->th_off << 2) + off;
+
+    if (incremental)
+    {
+        old_sum = PartialChecksum(data, n, off & 1);
+        for (i = 0; i < n; i++)
+            data[i] += 1;
+        TcpChecksumUpdate(pip, old_sum, PartialChecksum(data, n, off & 1),
+                          pip->ip_len);
+    }
+    else
+    {
+        for (i = 0; i < n; i++)
+            data[i] += 1;
+        tc->th_sum = 0;
+        tc->th_sum = TcpChecksum(pip);
+    }
+}
+
+static int
+Check(void)
+{
+    char buf[2048];
+    struct ip *pip;
+    int i, len, off, n, bad;
+
+    bad = 0;
+    pip = (struct ip *) buf;
+    for (i = 0; i < 100000; i++)
+    {
+        len = random() % 1500;
+        MakePacket(pip, sizeof(buf));
+        if (WordLoopChecksum((u_short *) (buf + 2), len) !=
+            PacketAliasInternetChecksum((u_short *) (buf + 2), len))
+            bad++;
+
+        len = 60 + random() % 1400;
+        MakePacket(pip, len);
+        off = random() % (len - 40);
+        n = 1 + random() % (len - 40 - off);
+        Rewrite(pip, off, n, 1);
+        if (TcpChecksum(pip) != 0)	/* Zero over a correct checksum */
+            bad++;
+    }
+    return(bad);
+}
+
+int
+main(int argc, char **argv)
+{
+    char buf[IP_MAXPACKET];
+    struct ip *pip;
+    struct timeval start;
+    volatile u_short sink;
+    int size, n, iterations, i, bad;
+    double t_loop, t_kernel, t_full, t_incr;
+
+    size = argc > 1 ? atoi(argv[1]) : 1500;
+    n = argc > 2 ? atoi(argv[2]) : 16;
+    iterations = argc > 3 ? atoi(argv[3]) : 1000000;
+    if (size < 41 || size > IP_MAXPACKET || n < 1 || n > size - 40)
+    {
+        fprintf(stderr, "cksum_bench: bad packet size or rewrite length\n");
+        return(2);
+    }
+
+    bad = Check();
+    printf("check: %d mismatches\n", bad);
+
+    pip = (struct ip *) buf;
+    MakePacket(pip, size);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < iterations; i++)
+        sink = WordLoopChecksum((u_short *) buf, size);
+    t_loop = Elapsed(&start) / iterations;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < iterations; i++)
+        sink = PacketAliasInternetChecksum((u_short *) buf, size);
+    t_kernel = Elapsed(&start) / iterations;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < iterations; i++)
+        Rewrite(pip, 0, n, 0);
+    t_full = Elapsed(&start) / iterations;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < iterations; i++)
+        Rewrite(pip, 0, n, 1);
+    t_incr = Elapsed(&start) / iterations;
+    (void) sink;
+
+    printf("sum of %d bytes:   word loop %8.1f ns   kernel %8.1f ns\n",
+           size, t_loop, t_kernel);
+    printf("rewrite %d bytes:  full sum  %8.1f ns   RFC 1624 %6.1f ns\n",
+           n, t_full, t_incr);
+
+    return(bad != 0);
+}
@@ -0,0 +1,861 @@
+/*
+ * Copyright (c) 2000-2002 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.1 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ *
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+    Libalias_bench.c drives LibAliasOut() and LibAliasIn() with
+    synthetic traffic or with the packets of a pcap capture, so that
+    changes to the aliasing code can be measured without natd and
+    divert sockets.  Like cksum_bench.c it is not part of the library;
+    build it by hand, on Mac OS X or on Linux with glibc 2.38 or later:
+
+        cc -O2 -DNO_FW_PUNCH -o libalias_bench libalias_bench.c alias*.c
+
+    Synthetic traffic is a set of flows between inside hosts on
+    10.0.0.0/8 and outside hosts, all of which are started before
+    timing begins.  Each packet then belongs to a random flow and goes
+    out or comes back in; a given share of packets instead starts a
+    new flow in place of an old one.  Flows are UDP or TCP, FTP control
+    connections carrying PORT commands, or IRC connections carrying
+    DCC offers.  With redirects, a share of new flows are connections
+    from outside to the redirected ports.  A share of incoming UDP
+    packets can be sent as two fragments, the trailing one first half
+    of the time.
+
+    A capture is replayed as it is: packets from the inside network go
+    out, and packets to it have their destination replaced with the
+    alias address and come in.  With the default same_ports mode, most
+    replies then find the links made by the packets they answer.
+    Ethernet, raw IP and loopback captures are understood.
+
+    Only time spent in the library is counted.  The report gives
+    packets per second, nanoseconds per packet at several percentiles,
+    what the library returned, the chain lengths of the link tables,
+    and the memory used for links.
+
+    Usage: libalias_bench [-b batch] [-f flows] [-n packets] [-r new%]
+                          [-T tcp%] [-P ftp%] [-I irc%] [-F frag%]
+                          [-R redirects [-D redirected%]] [-s seed]
+           libalias_bench [-b batch] -p capture [-l loops] [-i net/bits]
+*/
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <netinet/in_systm.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alias.h"
+#include "alias_local.h"
+
+#define BENCH_PACKET        2048    /* Room for a packet to grow in     */
+#define BENCH_MAX_BATCH      256
+#define BENCH_HISTOGRAM        8    /* Last bucket counts longer chains */
+#define BENCH_REDIRECT_PORT 20000   /* First alias port redirected      */
+
+#define DIR_OUT  0
+#define DIR_IN   1
+
+enum
+{
+    FLOW_UDP,
+    FLOW_TCP,
+    FLOW_FTP,
+    FLOW_IRC,
+    FLOW_REDIRECT
+};
+
+struct flow
+{
+    struct in_addr src_addr;     /* Inside host                         */
+    struct in_addr dst_addr;     /* Outside host                        */
+    u_short src_port;
+    u_short dst_port;
+    u_short alias_port;          /* Seen on the first packet either way */
+    u_char kind;
+    u_char started;
+    u_int32_t seq_out;
+    u_int32_t seq_in;
+};
+
+struct bench
+{
+    struct libalias *la;
+    struct in_addr alias_addr;
+
+    /* Synthetic traffic */
+    int nflows;
+    long npackets;
+    double new_share;
+    double tcp_share;
+    double ftp_share;
+    double irc_share;
+    double frag_share;
+    int nredirects;
+    double redirect_share;
+    struct flow *flows;
+
+    /* Capture replay */
+    const char *capture;
+    int loops;
+    in_addr_t inside_net;
+    in_addr_t inside_mask;
+
+    /* Packets waiting for the library, all going the same way */
+    int batch;
+    int queued;
+    int direction;
+    char *buf[BENCH_MAX_BATCH];
+    int maxsize[BENCH_MAX_BATCH];
+    int result[BENCH_MAX_BATCH];
+    struct flow *owner[BENCH_MAX_BATCH];
+
+    /* Results */
+    u_int32_t *ns;               /* Time of each packet                 */
+    long nsamples;
+    long nsize;
+    u_int64_t total_ns;
+    u_long results[6];           /* By PKT_ALIAS_* result, less         */
+                                 /*   PKT_ALIAS_ERROR                   */
+    u_long saved;                /* Fragments handed to the library    */
+    u_long released;             /*   and given back                    */
+
+    u_int64_t rng;
+};
+
+static void Usage(void);
+static u_int64_t Now(void);
+static u_int32_t Random(struct bench *);
+static int Chance(struct bench *, double);
+static void Sample(struct bench *, u_int64_t, int);
+static void Flush(struct bench *);
+static void Queue(struct bench *, int, struct flow *);
+static int MakePacket(struct bench *, char *, struct flow *, int, int);
+static void StartFlow(struct bench *, struct flow *);
+static void RunSynthetic(struct bench *);
+static void RunCapture(struct bench *);
+static int CompareNs(const void *, const void *);
+static void ReportTable(const char *, struct link_table *);
+static void Report(struct bench *);
+
+static void
+Usage(void)
+{
+    fprintf(stderr,
+        "usage: libalias_bench [-b batch] [-f flows] [-n packets] [-r new%%]\n"
+        "                      [-T tcp%%] [-P ftp%%] [-I irc%%] [-F frag%%]\n"
+        "                      [-R redirects [-D redirected%%]] [-s seed]\n"
+        "       libalias_bench [-b batch] -p capture [-l loops] "
+        "[-i net/bits]\n");
+    exit(2);
+}
+
+static u_int64_t
+Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((u_int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/* xorshift64*, so that runs with the same seed see the same traffic */
+static u_int32_t
+Random(struct bench *b)
+{
+    b->rng ^= b->rng >> 12;
+    b->rng ^= b->rng << 25;
+    b->rng ^= b->rng >> 27;
+    return((u_int32_t) ((b->rng * 0x2545f4914f6cdd1dULL) >> 32));
+}
+
+static int
+Chance(struct bench *b, double share)
+{
+    return(Random(b) < share * 4294967295.0);
+}
+
+/* Record that n packets took ns nanoseconds between them */
+static void
+Sample(struct bench *b, u_int64_t ns, int n)
+{
+    int i;
+
+    b->total_ns += ns;
+    for (i = 0; i < n; i++)
+    {
+        if (b->nsamples == b->nsize)
+        {
+            b->nsize = b->nsize ? b->nsize * 2 : 1 << 20;
+            b->ns = realloc(b->ns, b->nsize * sizeof(u_int32_t));
+            if (b->ns == NULL)
+            {
+                fprintf(stderr, "libalias_bench: out of memory\n");
+                exit(1);
+            }
+        }
+        b->ns[b->nsamples++] = ns / n > 0xffffffff ? 0xffffffff : ns / n;
+    }
+}
+
+/* Hand the queued packets to the library, timing the call, then deal
+   with what it returned */
+static void
+Flush(struct bench *b)
+{
+    struct ip *pip;
+    struct flow *f;
+    char *frags[BENCH_MAX_BATCH];
+    char *copy;
+    u_int64_t start, ns;
+    int i, j, n;
+
+    if (b->queued == 0)
+        return;
+
+    start = Now();
+    if (b->batch > 1)
+    {
+        if (b->direction == DIR_OUT)
+            LibAliasOutBatch(b->la, b->buf, b->maxsize, b->result, b->queued);
+        else
+            LibAliasInBatch(b->la, b->buf, b->maxsize, b->result, b->queued);
+    }
+    else
+    {
+        if (b->direction == DIR_OUT)
+            b->result[0] = LibAliasOut(b->la, b->buf[0], b->maxsize[0]);
+        else
+            b->result[0] = LibAliasIn(b->la, b->buf[0], b->maxsize[0]);
+    }
+    ns = Now() - start;
+    Sample(b, ns, b->queued);
+
+    for (i = 0; i < b->queued; i++)
+    {
+        if (b->result[i] >= PKT_ALIAS_ERROR
+         && b->result[i] <= PKT_ALIAS_FOUND_HEADER_FRAGMENT)
+            b->results[b->result[i] - PKT_ALIAS_ERROR]++;
+
+        pip = (struct ip *) b->buf[i];
+        switch (b->result[i])
+        {
+        case PKT_ALIAS_UNRESOLVED_FRAGMENT:
+            copy = malloc(ntohs(pip->ip_len));
+            if (copy == NULL)
+                break;
+            memcpy(copy, pip, ntohs(pip->ip_len));
+            start = Now();
+            if (LibAliasSaveFragment(b->la, copy) == PKT_ALIAS_OK)
+                b->saved++;
+            else
+                free(copy);
+            b->total_ns += Now() - start;
+            break;
+
+        case PKT_ALIAS_FOUND_HEADER_FRAGMENT:
+            start = Now();
+            n = LibAliasGetFragments(b->la, b->buf[i], frags,
+                                     BENCH_MAX_BATCH);
+            b->total_ns += Now() - start;
+            for (j = 0; j < n; j++)
+                free(frags[j]);
+            b->released += n;
+            break;
+        }
+
+    /* Learn the alias port of a flow from its first packet */
+        f = b->owner[i];
+        if (f != NULL && f->alias_port == 0)
+        {
+            struct udphdr *ud;
+
+            ud = (struct udphdr *) ((char *) pip + (pip->ip_hl << 2));
+            f->alias_port = b->direction == DIR_OUT
+                            ? ud->uh_sport : ud->uh_dport;
+        }
+    }
+    b->queued = 0;
+}
+
+/* Take the next packet buffer for the library, flushing first if the
+   batch is full or going the other way */
+static void
+Queue(struct bench *b, int direction, struct flow *f)
+{
+    if (b->queued > 0
+     && (b->queued == b->batch || b->direction != direction))
+        Flush(b);
+    b->direction = direction;
+    b->maxsize[b->queued] = BENCH_PACKET;
+    b->owner[b->queued] = f;
+    b->queued++;
+}
+
+/* Build a packet of flow f going the given way into buf.  frag is 0
+   for a whole packet, or 1 or 2 for the first or last fragment of one.
+   Checksums are not filled in, as the library only adjusts them. */
+static int
+MakePacket(struct bench *b, char *buf, struct flow *f, int direction,
+           int frag)
+{
+    struct ip *pip;
+    struct udphdr *ud;
+    struct tcphdr *tc;
+    char *data;
+    int hlen, dlen;
+    u_char *a;
+
+    pip = (struct ip *) buf;
+    memset(pip, 0, sizeof(struct ip) + sizeof(struct tcphdr));
+    pip->ip_v = 4;
+    pip->ip_hl = sizeof(struct ip) >> 2;
+    pip->ip_ttl = 64;
+    pip->ip_id = htons(Random(b));
+
+    if (direction == DIR_OUT)
+    {
+        pip->ip_src = f->src_addr;
+        pip->ip_dst = f->dst_addr;
+    }
+    else
+    {
+        pip->ip_src = f->dst_addr;
+        pip->ip_dst = b->alias_addr;
+    }
+
+    if (f->kind == FLOW_UDP)
+    {
+        pip->ip_p = IPPROTO_UDP;
+        ud = (struct udphdr *) (pip + 1);
+        hlen = sizeof(struct udphdr);
+        if (direction == DIR_OUT)
+        {
+            ud->uh_sport = f->src_port;
+            ud->uh_dport = f->dst_port;
+        }
+        else
+        {
+            ud->uh_sport = f->dst_port;
+            ud->uh_dport = f->alias_port;
+        }
+        dlen = 32;
+        ud->uh_ulen = htons(hlen + dlen);
+        data = (char *) (ud + 1);
+        memset(data, 0, dlen);
+
+    /* A fragmented packet is split after the first 16 bytes of data */
+        if (frag == 1)
+        {
+            pip->ip_off = htons(IP_MF);
+            dlen = 16;
+        }
+        else if (frag == 2)
+        {
+            pip->ip_off = htons((hlen + 16) >> 3);
+            memmove(ud, data + 16, dlen - 16);
+            hlen = 0;
+            dlen -= 16;
+        }
+    }
+    else
+    {
+        pip->ip_p = IPPROTO_TCP;
+        tc = (struct tcphdr *) (pip + 1);
+        hlen = sizeof(struct tcphdr);
+        tc->th_off = hlen >> 2;
+        tc->th_win = htons(65535);
+        data = (char *) (tc + 1);
+        dlen = 0;
+
+        if (direction == DIR_OUT)
+        {
+            tc->th_sport = f->src_port;
+            tc->th_dport = f->dst_port;
+            tc->th_seq = htonl(f->seq_out);
+            tc->th_ack = htonl(f->seq_in);
+            tc->th_flags = f->started ? TH_ACK : TH_SYN;
+
+            a = (u_char *) &f->src_addr;
+            if (f->started && f->kind == FLOW_FTP)
+                dlen = sprintf(data, "PORT %u,%u,%u,%u,%u,%u\r\n",
+                               a[0], a[1], a[2], a[3],
+                               Random(b) & 0xff, Random(b) & 0xff);
+            else if (f->started && f->kind == FLOW_IRC)
+                dlen = sprintf(data,
+                               "PRIVMSG bob :\001DCC CHAT chat %u %u\001\r\n",
+                               (u_int) ntohl(f->src_addr.s_addr),
+                               1024 + (Random(b) & 0x7fff));
+            f->seq_out += dlen ? dlen : 1;
+        }
+        else
+        {
+            tc->th_sport = f->dst_port;
+            tc->th_dport = f->alias_port;
+            tc->th_seq = htonl(f->seq_in);
+            tc->th_ack = htonl(f->seq_out);
+            tc->th_flags = f->started ? TH_ACK : TH_SYN;
+            f->seq_in++;
+        }
+    }
+
+    pip->ip_len = htons(sizeof(struct ip) + hlen + dlen);
+    return(sizeof(struct ip) + hlen + dlen);
+}
+
+/* Make f a new flow and queue its first packet */
+static void
+StartFlow(struct bench *b, struct flow *f)
+{
+    u_int32_t r;
+    int i;
+
+    memset(f, 0, sizeof(*f));
+    r = Random(b);
+    f->src_addr.s_addr = htonl(0x0a000000 | (r & 0xffffff));
+    f->dst_addr.s_addr = htonl(0x40000000 + (Random(b) & 0x3fffffff));
+    f->src_port = htons(1024 + Random(b) % 60000);
+    f->seq_out = Random(b);
+    f->seq_in = Random(b);
+
+    if (b->nredirects > 0 && Chance(b, b->redirect_share))
+    {
+    /* From outside to one of the redirected ports */
+        i = Random(b) % b->nredirects;
+        f->kind = FLOW_REDIRECT;
+        f->src_addr.s_addr = htonl(0x0a640000 | i);
+        f->src_port = htons(8000);
+        f->dst_port = htons(1024 + Random(b) % 60000);
+        f->alias_port = htons(BENCH_REDIRECT_PORT + i);
+        Queue(b, DIR_IN, f);
+        MakePacket(b, b->buf[b->queued - 1], f, DIR_IN, 0);
+        f->started = 1;
+        return;
+    }
+
+    if (Chance(b, b->ftp_share))
+    {
+        f->kind = FLOW_FTP;
+        f->dst_port = htons(21);
+    }
+    else if (Chance(b, b->irc_share))
+    {
+        f->kind = FLOW_IRC;
+        f->dst_port = htons(6667);
+    }
+    else if (Chance(b, b->tcp_share))
+    {
+        f->kind = FLOW_TCP;
+        f->dst_port = htons(80);
+    }
+    else
+    {
+        f->kind = FLOW_UDP;
+        f->dst_port = htons(53);
+    }
+
+    Queue(b, DIR_OUT, f);
+    MakePacket(b, b->buf[b->queued - 1], f, DIR_OUT, 0);
+    f->started = 1;
+}
+
+static void
+RunSynthetic(struct bench *b)
+{
+    struct flow *f;
+    long i;
+    int j, direction, first;
+    u_short id;
+
+    b->flows = calloc(b->nflows, sizeof(struct flow));
+    if (b->flows == NULL)
+    {
+        fprintf(stderr, "libalias_bench: out of memory\n");
+        exit(1);
+    }
+
+    for (j = 0; j < b->nredirects; j++)
+    {
+        struct in_addr inside, any;
+
+        inside.s_addr = htonl(0x0a640000 | j);
+        any.s_addr = INADDR_ANY;
+        if (LibAliasRedirectPort(b->la, inside, htons(8000), any, 0,
+                                 b->alias_addr,
+                                 htons(BENCH_REDIRECT_PORT + j),
+                                 IPPROTO_TCP) == NULL)
+        {
+            fprintf(stderr, "libalias_bench: cannot add redirect %d\n", j);
+            exit(1);
+        }
+    }
+
+/* Start every flow, then forget the time it took */
+    for (j = 0; j < b->nflows; j++)
+        StartFlow(b, &b->flows[j]);
+    Flush(b);
+    b->nsamples = 0;
+    b->total_ns = 0;
+    memset(b->results, 0, sizeof(b->results));
+
+    for (i = 0; i < b->npackets; i++)
+    {
+        f = &b->flows[Random(b) % b->nflows];
+        if (Chance(b, b->new_share))
+        {
+            StartFlow(b, f);
+            continue;
+        }
+
+        direction = Random(b) & 1 ? DIR_IN : DIR_OUT;
+        if (direction == DIR_IN && f->kind == FLOW_UDP
+         && Chance(b, b->frag_share))
+        {
+        /* Fragments go one at a time, so that one held by the
+           caller is saved before its header is looked at */
+            first = Random(b) & 1 ? 2 : 1;
+            Queue(b, DIR_IN, f);
+            MakePacket(b, b->buf[b->queued - 1], f, DIR_IN, first);
+            id = ((struct ip *) b->buf[b->queued - 1])->ip_id;
+            Flush(b);
+            Queue(b, DIR_IN, f);
+            MakePacket(b, b->buf[b->queued - 1], f, DIR_IN, 3 - first);
+            ((struct ip *) b->buf[b->queued - 1])->ip_id = id;
+            Flush(b);
+            i++;
+            continue;
+        }
+
+        Queue(b, direction, f);
+        MakePacket(b, b->buf[b->queued - 1], f, direction, 0);
+    }
+    Flush(b);
+}
+
+static void
+RunCapture(struct bench *b)
+{
+    FILE *fp;
+    u_char *file, *p, *end;
+    u_int32_t magic, linktype, caplen;
+    struct ip *pip;
+    long size;
+    int swap, skip, loop, direction;
+
+#define PCAP32(x) (swap ? __builtin_bswap32(x) : (x))
+
+    fp = fopen(b->capture, "r");
+    if (fp == NULL)
+    {
+        perror(b->capture);
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    file = malloc(size);
+    if (file == NULL || size < 24 || fread(file, 1, size, fp) != (size_t) size)
+    {
+        fprintf(stderr, "libalias_bench: cannot read %s\n", b->capture);
+        exit(1);
+    }
+    fclose(fp);
+
+    memcpy(&magic, file, 4);
+    swap = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+    if (!swap && magic != 0xa1b2c3d4 && magic != 0xa1b23c4d)
+    {
+        fprintf(stderr, "libalias_bench: %s is not a pcap file\n",
+                b->capture);
+        exit(1);
+    }
+    memcpy(&linktype, file + 20, 4);
+    switch (PCAP32(linktype))
+    {
+    case 0:                      /* Loopback: 4 byte family             */
+        skip = 4;
+        break;
+    case 1:                      /* Ethernet                            */
+        skip = 14;
+        break;
+    case 101:                    /* Raw IP                              */
+        skip = 0;
+        break;
+    default:
+        fprintf(stderr, "libalias_bench: link type %u not understood\n",
+                PCAP32(linktype));
+        exit(1);
+    }
+
+    end = file + size;
+    for (loop = 0; loop < b->loops; loop++)
+    {
+        for (p = file + 24; p + 16 <= end; p += 16 + caplen)
+        {
+            memcpy(&caplen, p + 8, 4);
+            caplen = PCAP32(caplen);
+            if (p + 16 + caplen > end)
+                break;
+            if (caplen < skip + sizeof(struct ip)
+             || caplen - skip > BENCH_PACKET / 2)
+                continue;
+
+        /* Only IPv4 is aliased */
+            if (skip == 14 && (p[16 + 12] != 0x08 || p[16 + 13] != 0x00))
+                continue;
+            pip = (struct ip *) (p + 16 + skip);
+            if (pip->ip_v != 4 || ntohs(pip->ip_len) > caplen - skip)
+                continue;
+
+            if ((pip->ip_src.s_addr & b->inside_mask) == b->inside_net)
+                direction = DIR_OUT;
+            else if ((pip->ip_dst.s_addr & b->inside_mask) == b->inside_net)
+                direction = DIR_IN;
+            else
+                continue;
+
+            Queue(b, direction, NULL);
+            memcpy(b->buf[b->queued - 1], pip, ntohs(pip->ip_len));
+            if (direction == DIR_IN)
+                ((struct ip *) b->buf[b->queued - 1])->ip_dst = b->alias_addr;
+
+        /* As with synthetic traffic, fragments go one at a time */
+            if (ntohs(pip->ip_off) & (IP_MF | IP_OFFMASK))
+                Flush(b);
+        }
+    }
+    Flush(b);
+    free(file);
+
+#undef PCAP32
+}
+
+static int
+CompareNs(const void *a, const void *b)
+{
+    u_int32_t x, y;
+
+    x = *(const u_int32_t *) a;
+    y = *(const u_int32_t *) b;
+    return(x < y ? -1 : x > y);
+}
+
+static void
+ReportTable(const char *name, struct link_table *table)
+{
+    u_int hist[BENCH_HISTOGRAM];
+    u_int i, max, used, links;
+
+    max = ChainLengths(table, hist, BENCH_HISTOGRAM);
+    used = links = 0;
+    for (i = 1; i < BENCH_HISTOGRAM; i++)
+    {
+        used += hist[i];
+        links += i * hist[i];
+    }
+
+    printf("%-3s chains %u, %u used, %.2f links per used chain, longest %u\n",
+           name, table->size, used, used ? (double) links / used : 0.0, max);
+    printf("    chains holding");
+    for (i = 0; i < BENCH_HISTOGRAM - 1; i++)
+        printf(" %u: %u", i, hist[i]);
+    printf(" %u+: %u\n", i, hist[i]);
+}
+
+static void
+Report(struct bench *b)
+{
+    struct libalias *cur_save;
+    struct rusage ru;
+    long rss;
+    u_int32_t *ns;
+    long n;
+
+    n = b->nsamples;
+    ns = b->ns;
+    if (n == 0)
+    {
+        printf("no packets\n");
+        return;
+    }
+    qsort(ns, n, sizeof(u_int32_t), CompareNs);
+
+    printf("%ld packets in %.3f s: %.0f packets/s\n", n,
+           b->total_ns / 1e9, n / (b->total_ns / 1e9));
+    printf("ns/packet   p50 %u  p90 %u  p99 %u  p99.9 %u  max %u\n",
+           ns[n / 2], ns[n * 9 / 10], ns[n * 99 / 100],
+           ns[n * 999 / 1000], ns[n - 1]);
+    printf("results     ok %lu  ignored %lu  unresolved %lu  header %lu  "
+           "error %lu\n",
+           b->results[PKT_ALIAS_OK - PKT_ALIAS_ERROR],
+           b->results[PKT_ALIAS_IGNORED - PKT_ALIAS_ERROR],
+           b->results[PKT_ALIAS_UNRESOLVED_FRAGMENT - PKT_ALIAS_ERROR],
+           b->results[PKT_ALIAS_FOUND_HEADER_FRAGMENT - PKT_ALIAS_ERROR],
+           b->results[0]);
+    if (b->saved != 0)
+        printf("fragments   saved %lu  given back %lu\n",
+               b->saved, b->released);
+
+/* ChainLengths() works on the current instance */
+    cur_save = libalias_cur;
+    libalias_cur = b->la;
+    printf("links       %d\n", libalias_cur->linkCount);
+    ReportTable("out", &libalias_cur->linkTableOut);
+    ReportTable("in", &libalias_cur->linkTableIn);
+
+    getrusage(RUSAGE_SELF, &ru);
+    rss = ru.ru_maxrss;
+#ifdef __APPLE__
+    rss /= 1024;
+#endif
+    printf("memory      links %zu KB  tcp %zu KB  peak rss %ld KB\n",
+           libalias_cur->linkPool.nitems
+           * libalias_cur->linkPool.item_size / 1024,
+           libalias_cur->tcpPool.nitems
+           * libalias_cur->tcpPool.item_size / 1024, rss);
+    libalias_cur = cur_save;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct bench b;
+    char *slash;
+    int ch, i, bits;
+
+    memset(&b, 0, sizeof(b));
+    b.nflows = 10000;
+    b.npackets = 1000000;
+    b.new_share = 0.01;
+    b.tcp_share = 0.5;
+    b.redirect_share = 0.1;
+    b.loops = 1;
+    b.batch = 1;
+    b.inside_net = htonl(0x0a000000);
+    b.inside_mask = htonl(0xff000000);
+    b.rng = 0x9e3779b97f4a7c15ULL;
+
+    while ((ch = getopt(argc, argv, "b:D:f:F:i:I:l:n:p:P:r:R:s:T:")) != -1)
+    {
+        switch (ch)
+        {
+        case 'b':
+            b.batch = atoi(optarg);
+            break;
+        case 'D':
+            b.redirect_share = atof(optarg) / 100;
+            break;
+        case 'f':
+            b.nflows = atoi(optarg);
+            break;
+        case 'F':
+            b.frag_share = atof(optarg) / 100;
+            break;
+        case 'i':
+            slash = strchr(optarg, '/');
+            bits = slash ? atoi(slash + 1) : 32;
+            if (slash)
+                *slash = '\0';
+            if (bits < 0 || bits > 32)
+                Usage();
+            b.inside_net = inet_addr(optarg);
+            b.inside_mask = bits ? htonl(0xffffffffU << (32 - bits)) : 0;
+            b.inside_net &= b.inside_mask;
+            break;
+        case 'I':
+            b.irc_share = atof(optarg) / 100;
+            break;
+        case 'l':
+            b.loops = atoi(optarg);
+            break;
+        case 'n':
+            b.npackets = atol(optarg);
+            break;
+        case 'p':
+            b.capture = optarg;
+            break;
+        case 'P':
+            b.ftp_share = atof(optarg) / 100;
+            break;
+        case 'r':
+            b.new_share = atof(optarg) / 100;
+            break;
+        case 'R':
+            b.nredirects = atoi(optarg);
+            break;
+        case 's':
+            b.rng = strtoull(optarg, NULL, 0) | 1;
+            break;
+        case 'T':
+            b.tcp_share = atof(optarg) / 100;
+            break;
+        default:
+            Usage();
+        }
+    }
+    if (b.batch < 1 || b.batch > BENCH_MAX_BATCH || b.nflows < 1
+     || b.npackets < 0 || b.loops < 1 || b.nredirects < 0
+     || b.nredirects > 65536 - BENCH_REDIRECT_PORT)
+        Usage();
+
+    for (i = 0; i < BENCH_MAX_BATCH; i++)
+    {
+        b.buf[i] = malloc(BENCH_PACKET);
+        if (b.buf[i] == NULL)
+        {
+            fprintf(stderr, "libalias_bench: out of memory\n");
+            exit(1);
+        }
+    }
+
+    b.la = LibAliasInit(NULL);
+    if (b.la == NULL)
+    {
+        fprintf(stderr, "libalias_bench: cannot initialize libalias\n");
+        exit(1);
+    }
+    b.alias_addr.s_addr = htonl(0xc0000201);    /* 192.0.2.1 */
+    LibAliasSetAddress(b.la, b.alias_addr);
+    LibAliasSetMode(b.la, 0, PKT_ALIAS_USE_SOCKETS);
+
+    if (b.capture != NULL)
+        RunCapture(&b);
+    else
+        RunSynthetic(&b);
+
+    Report(&b);
+    LibAliasUninit(b.la);
+    for (i = 0; i < BENCH_MAX_BATCH; i++)
+        free(b.buf[i]);
+    free(b.flows);
+    free(b.ns);
+    return(0);
+}
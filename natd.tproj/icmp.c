@@ -57,7 +57,8 @@
 
 #include "natd.h"
 
-int SendNeedFragIcmp (int sock, struct ip* failedDgram, int mtu)
+int SendNeedFragIcmp (struct libalias* instance, int sock,
+		      struct ip* failedDgram, int mtu)
 {
 	char			icmpBuf[IP_MAXPACKET];
 	struct ip*		ip;
@@ -107,8 +108,9 @@ int SendNeedFragIcmp (int sock, struct ip* failedDgram, int mtu)
 /*
  * Calculate checksum.
  */
-	icmp->icmp_cksum = PacketAliasInternetChecksum ((u_short*) icmp,
-							icmpLen);
+	icmp->icmp_cksum = LibAliasInternetChecksum (instance,
+						     (u_short*) icmp,
+						     icmpLen);
 /*
  * Add IP header using old IP header as template.
  */
@@ -124,7 +126,7 @@ int SendNeedFragIcmp (int sock, struct ip* failedDgram, int mtu)
 	ip->ip_dst = ip->ip_src;
 	ip->ip_src = swap;
 
-	PacketAliasIn ((char*) ip, IP_MAXPACKET);
+	LibAliasIn (instance, (char*) ip, IP_MAXPACKET);
 
 	addr.sin_family		= AF_INET;
 	addr.sin_addr		= ip->ip_dst;
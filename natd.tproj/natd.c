@@ -49,6 +49,8 @@
 #include <ifaddrs.h>
 #include <sys/sysctl.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/un.h>
 
 #include <netinet/in.h>
 #include <netinet/in_systm.h>
@@ -62,7 +64,7 @@
 #include <arpa/inet.h>
 
 #include <alias.h>
-void DumpInfo(void);
+void LibAliasDumpInfo(struct libalias *);
 
 #include <ctype.h>
 #include <err.h>
@@ -75,6 +77,8 @@ void DumpInfo(void);
 #include <syslog.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <mach/mach_time.h>
 #include <mach/clock_types.h>
 
@@ -106,6 +110,67 @@ typedef uint32_t port_range;
 /* Set y to be the number of ports in port_range variable x. */
 #define SETNUMPORTS(x,y) ((x) = ((x) & 0xffff0000) | (y))
 
+/*
+ * Packets read from the divert sockets are kept in a ring of
+ * slots until they have been written back.  Up to packetBurst
+ * packets are read per wakeup and aliased together.
+ */
+
+#define	DEFAULT_BURST	1
+#define	MAX_BURST	256
+
+struct packetSlot {
+	int			fd;
+	int			direction;
+	int			origLen;
+	int			len;
+	struct sockaddr_in	addr;
+	char			buf[IP_MAXPACKET];
+};
+
+struct packetQueue {
+	struct packetSlot*	slots;
+	int			size;
+	int			head;
+	int			count;
+	char**			ptrs;		/* Scratch space for */
+	int*			sizes;		/* LibAlias*Batch()  */
+	int*			results;
+};
+
+#define	PACKET_SLOT(q, n)	(&(q)->slots[((q)->head + (n)) % (q)->size])
+
+/*
+ * In multi-worker mode the main thread only reads packets and hands
+ * each one to the worker thread owning its flow.  Every worker has
+ * an aliasing instance of its own, so workers never share link state.
+ * The queue head and count are protected by the worker's lock; the
+ * slots being worked on belong to the worker alone.
+ */
+
+#define	MAX_WORKERS	64
+#define	WORKER_QUEUE	64
+
+/*
+ * Helpers whose data connections may come from an address other than
+ * the remote end of their control connection.  Such a connection
+ * would be hashed to another worker than the one holding the link
+ * made for it, so these are turned off when there are many workers.
+ */
+static const char* const splitHelpers[] = { "irc", "cuseeme", "rtsp" };
+
+#define	SPLIT_HELPERS	(sizeof splitHelpers / sizeof splitHelpers[0])
+
+struct worker {
+	pthread_t		thread;
+	pthread_mutex_t		lock;
+	pthread_cond_t		wakeup;
+	struct packetQueue	queue;
+	struct libalias*	la;
+	int			generation;	/* Of settings applied to la */
+	u_int			dropped;	/* Packets lost to a full queue */
+};
+
 /*
  * Function prototypes.
  */
@@ -133,9 +198,29 @@ static int      StrToPortRange (const char* str, const char* proto, port_range *
 static int 	StrToProto (const char* str);
 static int      StrToAddrAndPortRange (const char* str, struct in_addr* addr, char* proto, port_range *portRange);
 static void	ParseArgs (int argc, char** argv);
-static void	FlushPacketBuffer (int fd);
+static void	AllocPacketQueue (struct packetQueue *queue, int size);
+static void	AliasPackets (struct libalias *instance,
+			      struct packetQueue *queue, int first, int count);
+static int	SendPacket (struct libalias *instance,
+			    struct packetSlot *slot, int flags);
+static void	FlushPacketBuffer (void);
+static void	SetupWorkers (int argc, char** argv);
+static void	StartWorkers (void);
+static void*	WorkerMain (void *arg);
+static void	DispatchPackets (int fd, int direction);
+static int	FlowWorker (struct ip *ip, int direction);
+static void	DumpWorkers (int priority);
+static void	ApplySettings (struct worker *w);
+static void	SetAliasAddress (struct in_addr addr);
+static void	SetClampMSS (u_short mss);
 static void	DiscardIncomingPackets (int fd);
 static void	SetupPunchFW(const char *strValue);
+static void	SetupHelper(const char *strValue);
+static const char* StateFileName (char* buf, size_t len, int worker);
+static void	LoadState (void);
+static void	SaveState (void);
+static void	SetupFlowLog (void);
+static void	LogFlow (void* arg, const struct alias_flow_record* rec);
 
 /*
  * Globals.
@@ -156,15 +241,29 @@ static  int			clampMSS;
 static  int			ifMTU;
 static	int			aliasOverhead;
 static 	int			icmpSock;
-static	char			packetBuf[IP_MAXPACKET];
-static 	int			packetLen;
-static	struct sockaddr_in	packetAddr;
+static	struct libalias*	mla;
+static	struct packetQueue	packetQueue;
+static	int			packetBurst;
 static 	int			packetSock;
-static 	int			packetDirection;
+static	int			numWorkers;
+static	struct worker*		workers;
+static	struct packetSlot*	dispatchSlot;
+static	pthread_mutex_t		settingsLock = PTHREAD_MUTEX_INITIALIZER;
+static	int			settingsGeneration;
+static	int			reverseFlows;
+static	const char*		splitHelperWanted;
+static	struct in_addr		settingsAddr;
+static	u_short			settingsMSS;
 static  int			dropIgnoredIncoming;
 static  int			logDropped;
 static	int			logFacility;
 static	int			dumpinfo;
+static	char*			stateFile;
+static	int			statePending;
+static	char*			flowLog;
+static	int			flowSock = -1;
+static	u_int32_t		flowRecords;
+static	u_long			flowDrops;
 
 #define	NATPORTMAP		1
 
@@ -261,7 +360,7 @@ static void		NotifyPublicAddress();
 static void		DoPortMapping( int fd, struct sockaddr_in *clientaddr, int clientaddrlen, publicportreq *req);
 static void		NatPortMapPInit();
 
-extern int FindAliasPortOut(struct in_addr src_addr,  struct in_addr dst_addr, u_short src_port, u_short pub_port, u_char proto, int lifetime, char addmapping);
+extern int LibAliasFindAliasPortOut(struct libalias *instance, struct in_addr src_addr,  struct in_addr dst_addr, u_short src_port, u_short pub_port, u_char proto, int lifetime, char addmapping);
 
 #endif /* NATPORTMAP */
 
@@ -281,7 +380,9 @@ int main (int argc, char** argv)
  * Done already here to be able to alter option bits
  * during command line and configuration file processing.
  */
-	PacketAliasInit ();
+	mla = LibAliasInit (NULL);
+	if (mla == NULL)
+		errx (1, "unable to initialize packet aliasing");
 /*
  * Parse options.
  */
@@ -306,14 +407,25 @@ int main (int argc, char** argv)
  * Mark packet buffer empty.
  */
 	packetSock		= -1;
-	packetDirection		= DONT_KNOW;
+	packetBurst		= DEFAULT_BURST;
+	numWorkers		= 1;
 
 	ParseArgs (argc, argv);
+/*
+ * Set up an aliasing instance for each worker.
+ */
+	if (numWorkers > 1)
+		SetupWorkers (argc, argv);
 /*
  * Open syslog channel.
  */
 	openlog ("natd", LOG_CONS | LOG_PID | (verbose ? LOG_PERROR : 0),
 		 logFacility);
+/*
+ * Allocate packet buffers.
+ */
+	if (workers == NULL)
+		AllocPacketQueue (&packetQueue, packetBurst);
 /*
  * Check that valid aliasing address has been given.
  */
@@ -333,7 +445,7 @@ int main (int argc, char** argv)
 /*
  * Check if ignored packets should be dropped.
  */
-	dropIgnoredIncoming = PacketAliasSetMode (0, 0);
+	dropIgnoredIncoming = LibAliasSetMode (mla, 0, 0);
 	dropIgnoredIncoming &= PKT_ALIAS_DENY_INCOMING;
 /*
  * Create divert sockets. Use only one socket if -p was specified
@@ -451,6 +563,11 @@ int main (int argc, char** argv)
 	}
 #endif /* NATPORTMAP */
 
+/*
+ * Open the flow log before leaving the working directory.
+ */
+	if (flowLog)
+		SetupFlowLog ();
 /*
  * Become a daemon unless verbose mode was requested.
  */
@@ -470,7 +587,7 @@ int main (int argc, char** argv)
  */
 	if (aliasAddr.s_addr != INADDR_NONE)
 	{
-		PacketAliasSetAddress (aliasAddr);
+		SetAliasAddress (aliasAddr);
 #ifdef NATPORTMAP
 		if ( (enable_natportmap) && (aliasAddr.s_addr != lastassignaliasAddr.s_addr) ){
 			lastassignaliasAddr.s_addr = aliasAddr.s_addr;
@@ -478,6 +595,22 @@ int main (int argc, char** argv)
 		}
 #endif
 	}
+/*
+ * Pick up the links of the previous natd, once the
+ * alias address is known; setting it later would
+ * drop the links again.
+ */
+	if (stateFile) {
+		if (assignAliasAddr)
+			statePending = 1;
+		else
+			LoadState ();
+	}
+/*
+ * Start worker threads now that we are in the background.
+ */
+	if (workers != NULL)
+		StartWorkers ();
 /*
  * We need largest descriptor number for select.
  */
@@ -563,7 +696,10 @@ int main (int argc, char** argv)
 
 			if (errno == EINTR) {
 				if (dumpinfo) {
-					DumpInfo();
+					if (workers == NULL)
+						LibAliasDumpInfo(mla);
+					else
+						DumpWorkers (LOG_ERR);
 					dumpinfo = 0;
 				}
 				continue;
@@ -573,7 +709,7 @@ int main (int argc, char** argv)
 
 		if (packetSock != -1)
 			if (FD_ISSET (packetSock, &writeMask))
-				FlushPacketBuffer (packetSock);
+				FlushPacketBuffer ();
 
 		if (divertIn != -1)
 			if (FD_ISSET (divertIn, &readMask))
@@ -602,6 +738,15 @@ int main (int argc, char** argv)
 #endif
 	}
 
+	if (stateFile)
+		SaveState ();
+
+	if (flowDrops != 0 && verbose)
+		printf ("%lu flow records dropped\n", flowDrops);
+
+	if (workers != NULL && verbose)
+		DumpWorkers (LOG_INFO);
+
 	if (background)
 		unlink (PIDFILE);
 
@@ -681,167 +826,573 @@ static void ParseArgs (int argc, char** argv)
 
 static void DoAliasing (int fd, int direction)
 {
-	int			bytes;
+	int			nread;
+	int			nfree;
 	int			origBytes;
-	int			status;
-	socklen_t	addrSize;
-	struct ip*	ip;
+	socklen_t		addrSize;
+	struct packetSlot*	slot;
 
 	if (assignAliasAddr) {
 
 		SetAliasAddressFromIfName (ifName);
 		assignAliasAddr = 0;
-	}
-/*
- * Get packet from socket.
- */
-	addrSize  = sizeof packetAddr;
-	origBytes = recvfrom (fd,
-			      packetBuf,
-			      sizeof packetBuf,
-			      0,
-			      (struct sockaddr*) &packetAddr,
-			      &addrSize);
 
-	if (origBytes == -1) {
+		if (statePending) {
+
+			LoadState ();
+			statePending = 0;
+		}
+	}
 
-		if (errno != EINTR)
-			Warn ("read from divert socket failed");
+	if (workers != NULL) {
 
+		DispatchPackets (fd, direction);
 		return;
 	}
 /*
- * This is a IP packet.
+ * Get up to a burst of packets from socket.  Only the first
+ * read may block; the rest just take what is already queued.
  */
-	ip = (struct ip*) packetBuf;
-	if (direction == DONT_KNOW) {
-		if (packetAddr.sin_addr.s_addr == INADDR_ANY)
-			direction = OUTPUT;
-		else
-			direction = INPUT;
+	nfree = packetQueue.size - packetQueue.count;
+	for (nread = 0; nread < nfree; nread++) {
+
+		slot = PACKET_SLOT (&packetQueue, packetQueue.count + nread);
+		addrSize  = sizeof slot->addr;
+		origBytes = recvfrom (fd,
+				      slot->buf,
+				      sizeof slot->buf,
+				      nread ? MSG_DONTWAIT : 0,
+				      (struct sockaddr*) &slot->addr,
+				      &addrSize);
+
+		if (origBytes == -1) {
+
+			if (errno != EINTR &&
+			    (nread == 0 ||
+			     (errno != EWOULDBLOCK && errno != EAGAIN)))
+				Warn ("read from divert socket failed");
+
+			break;
+		}
+
+		slot->fd	= fd;
+		slot->origLen	= origBytes;
+		slot->direction	= direction;
+		if (direction == DONT_KNOW) {
+			if (slot->addr.sin_addr.s_addr == INADDR_ANY)
+				slot->direction = OUTPUT;
+			else
+				slot->direction = INPUT;
+		}
 	}
 
-	if (verbose) {
+	if (nread == 0)
+		return;
+
+	AliasPackets (mla, &packetQueue, packetQueue.count, nread);
+	packetQueue.count += nread;
+
+	FlushPacketBuffer ();
+}
+
+static void AllocPacketQueue (struct packetQueue *queue, int size)
+{
+	queue->slots   = malloc (size * sizeof (struct packetSlot));
+	queue->ptrs    = malloc (size * sizeof (char*));
+	queue->sizes   = malloc (size * sizeof (int));
+	queue->results = malloc (size * sizeof (int));
+	if (queue->slots == NULL || queue->ptrs == NULL ||
+	    queue->sizes == NULL || queue->results == NULL)
+		Quit ("Unable to allocate packet buffers.");
+
+	queue->size  = size;
+	queue->head  = 0;
+	queue->count = 0;
+}
+
 /*
- * Print packet direction and protocol type.
+ * Alias the count packets starting at queue position first.  Runs of
+ * packets going the same way are handed to the aliasing engine in
+ * one call.  Packets which are to be dropped get zero length.
  */
-		printf (direction == OUTPUT ? "Out " : "In  ");
+static void AliasPackets (struct libalias *instance,
+			  struct packetQueue *queue, int first, int count)
+{
+	int			i;
+	int			j;
+	int			k;
+	int			bytes;
+	struct packetSlot*	slot;
+	struct ip*		ip;
 
-		switch (ip->ip_p) {
-		case IPPROTO_TCP:
-			printf ("[TCP]  ");
-			break;
+	for (i = 0; i < count; i = j) {
 
-		case IPPROTO_UDP:
-			printf ("[UDP]  ");
-			break;
+		slot = PACKET_SLOT (queue, first + i);
+/*
+ * In verbose mode, alias packets one by one so that
+ * each packet is printed next to its aliased form.
+ */
+		for (j = i; j < count; j++) {
 
-		case IPPROTO_ICMP:
-			printf ("[ICMP] ");
-			break;
+			if (PACKET_SLOT (queue, first + j)->direction !=
+			    slot->direction)
+				break;
 
-		default:
-			printf ("[%d]    ", ip->ip_p);
-			break;
+			if (verbose && j > i)
+				break;
+
+			queue->ptrs[j - i]  = PACKET_SLOT (queue, first + j)->buf;
+			queue->sizes[j - i] = IP_MAXPACKET;
 		}
+
+		if (verbose) {
 /*
- * Print addresses.
+ * Print packet direction and protocol type.
  */
-		PrintPacket (ip);
-	}
+			ip = (struct ip*) slot->buf;
+			printf (slot->direction == OUTPUT ? "Out " : "In  ");
+
+			switch (ip->ip_p) {
+			case IPPROTO_TCP:
+				printf ("[TCP]  ");
+				break;
+
+			case IPPROTO_UDP:
+				printf ("[UDP]  ");
+				break;
 
-	if (direction == OUTPUT) {
+			case IPPROTO_ICMP:
+				printf ("[ICMP] ");
+				break;
+
+			default:
+				printf ("[%d]    ", ip->ip_p);
+				break;
+			}
 /*
- * Outgoing packets. Do aliasing.
+ * Print addresses.
  */
-		PacketAliasOut (packetBuf, IP_MAXPACKET);
-	}
-	else {
-
+			PrintPacket (ip);
+		}
 /*
  * Do aliasing.
- */	
-		status = PacketAliasIn (packetBuf, IP_MAXPACKET);
-		if (status == PKT_ALIAS_IGNORED &&
-		    dropIgnoredIncoming) {
+ */
+		if (slot->direction == OUTPUT)
+			LibAliasOutBatch (instance, queue->ptrs, queue->sizes,
+					  queue->results + i, j - i);
+		else
+			LibAliasInBatch (instance, queue->ptrs, queue->sizes,
+					 queue->results + i, j - i);
 
-			if (verbose)
-				printf (" dropped.\n");
+		for (k = i; k < j; k++) {
 
-			if (logDropped)
-				SyslogPacket (ip, LOG_WARNING, "denied");
+			slot = PACKET_SLOT (queue, first + k);
+			ip   = (struct ip*) slot->buf;
 
-			return;
-		}
-	}
+			if (slot->direction == INPUT &&
+			    queue->results[k] == PKT_ALIAS_IGNORED &&
+			    dropIgnoredIncoming) {
+
+				if (verbose)
+					printf (" dropped.\n");
+
+				if (logDropped)
+					SyslogPacket (ip, LOG_WARNING, "denied");
+
+				slot->len = 0;
+				continue;
+			}
 /*
  * Length might have changed during aliasing.
  */
-	bytes = ntohs (ip->ip_len);
+			bytes = ntohs (ip->ip_len);
 /*
  * Update alias overhead size for outgoing packets.
  */
-	if (direction == OUTPUT &&
-	    bytes - origBytes > aliasOverhead)
-		aliasOverhead = bytes - origBytes;
+			if (slot->direction == OUTPUT &&
+			    bytes - slot->origLen > aliasOverhead)
+				aliasOverhead = bytes - slot->origLen;
 
-	if (verbose) {
-		
+			if (verbose) {
 /*
  * Print addresses after aliasing.
  */
-		printf (" aliased to\n");
-		printf ("           ");
-		PrintPacket (ip);
-		printf ("\n");
-	}
-
-	packetLen  	= bytes;
-	packetSock 	= fd;
-	packetDirection = direction;
+				printf (" aliased to\n");
+				printf ("           ");
+				PrintPacket (ip);
+				printf ("\n");
+			}
 
-	FlushPacketBuffer (fd);
+			slot->len = bytes;
+		}
+	}
 }
 
-static void FlushPacketBuffer (int fd)
+/*
+ * Write an aliased packet back.  Returns -1 if it could not be
+ * written yet and should be tried again later.
+ */
+static int SendPacket (struct libalias *instance,
+		       struct packetSlot *slot, int flags)
 {
 	int			wrote;
 	char			msgBuf[80];
+
+	if (slot->len == 0)
+		return 0;
+
+	wrote = sendto (slot->fd, 
+		        slot->buf,
+	    		slot->len,
+	    		flags,
+	    		(struct sockaddr*) &slot->addr,
+	    		sizeof slot->addr);
+	
+	if (wrote == slot->len)
+		return 0;
+
+	if (errno == ENOBUFS ||
+	    errno == EWOULDBLOCK ||
+	    errno == EAGAIN ||
+	    errno == EINTR)
+		return -1;
+
+	if (errno == EMSGSIZE) {
+
+		if (slot->direction == OUTPUT &&
+		    ifMTU != -1)
+			SendNeedFragIcmp (instance,
+					  icmpSock,
+					  (struct ip*) slot->buf,
+					  ifMTU - aliasOverhead);
+	}
+	else {
+
+		snprintf (msgBuf, sizeof(msgBuf), "failed to write packet back");
+		Warn (msgBuf);
+	}
+
+	return 0;
+}
+
+static void FlushPacketBuffer (void)
+{
+	struct packetSlot*	slot;
 /*
- * Put packet back for processing.
+ * Put packets back for processing, oldest first.
  */
-	wrote = sendto (fd, 
-		        packetBuf,
-	    		packetLen,
-	    		0,
-	    		(struct sockaddr*) &packetAddr,
-	    		sizeof packetAddr);
-	
-	if (wrote != packetLen) {
+	while (packetQueue.count > 0) {
+
+		slot = PACKET_SLOT (&packetQueue, 0);
 /*
  * If buffer space is not available,
  * just return. Main loop will take care of 
  * retrying send when space becomes available.
+ * This packet and the ones after it stay queued.
  */
-		if (errno == ENOBUFS)
+		if (SendPacket (mla, slot, MSG_DONTWAIT) == -1) {
+
+			packetSock = slot->fd;
 			return;
+		}
 
-		if (errno == EMSGSIZE) {
+		packetQueue.head = (packetQueue.head + 1) % packetQueue.size;
+		--packetQueue.count;
+	}
 
-			if (packetDirection == OUTPUT &&
-			    ifMTU != -1)
-				SendNeedFragIcmp (icmpSock,
-						  (struct ip*) packetBuf,
-						  ifMTU - aliasOverhead);
+	packetSock = -1;
+}
+
+/*
+ * Create an aliasing instance for each worker but the first, which
+ * takes over the one already configured, and repeat the option
+ * processing for each so that all get the same modes and redirects.
+ */
+static void SetupWorkers (int argc, char** argv)
+{
+	int			i;
+	u_int			j;
+
+	if (LibAliasSetMode (mla, 0, 0) & PKT_ALIAS_PUNCH_FW)
+		errx (1, "punch_fw cannot be used with more than one worker");
+	if (splitHelperWanted != NULL)
+		errx (1, "helper %s cannot be used with more than one worker",
+		      splitHelperWanted);
+#ifdef NATPORTMAP
+	if (enable_natportmap)
+		errx (1, "enable_natportmap cannot be used with more than "
+		      "one worker");
+#endif
+
+	workers = calloc (numWorkers, sizeof (struct worker));
+	if (workers == NULL)
+		errx (1, "malloc failed");
+
+	workers[0].la = mla;
+	for (i = 1; i < numWorkers; i++) {
+
+		mla = LibAliasInit (NULL);
+		if (mla == NULL)
+			errx (1, "unable to initialize packet aliasing");
+
+		ParseArgs (argc, argv);
+		workers[i].la = mla;
+	}
+	mla = workers[0].la;
+
+	reverseFlows = LibAliasSetMode (mla, 0, 0) & PKT_ALIAS_REVERSE;
+
+	for (i = 0; i < numWorkers; i++) {
+
+		for (j = 0; j < SPLIT_HELPERS; j++)
+			LibAliasSetHelper (workers[i].la, splitHelpers[j], 0);
+
+		AllocPacketQueue (&workers[i].queue, WORKER_QUEUE);
+		pthread_mutex_init (&workers[i].lock, NULL);
+		pthread_cond_init (&workers[i].wakeup, NULL);
+		workers[i].generation = 0;
+	}
+
+	dispatchSlot = malloc (sizeof (struct packetSlot));
+	if (dispatchSlot == NULL)
+		errx (1, "malloc failed");
+}
+
+static void StartWorkers (void)
+{
+	int			i;
+
+	for (i = 0; i < numWorkers; i++)
+		if (pthread_create (&workers[i].thread, NULL,
+				    WorkerMain, &workers[i]) != 0)
+			Quit ("Unable to start worker thread.");
+}
+
+static void* WorkerMain (void *arg)
+{
+	struct worker*		w = arg;
+	struct packetSlot*	slot;
+	struct pollfd		pfd;
+	int			count;
+	int			i;
+
+	for (;;) {
+
+		pthread_mutex_lock (&w->lock);
+		while (w->queue.count == 0)
+			pthread_cond_wait (&w->wakeup, &w->lock);
+		count = w->queue.count;
+		pthread_mutex_unlock (&w->lock);
+
+		ApplySettings (w);
+		AliasPackets (w->la, &w->queue, 0, count);
+/*
+ * Write packets back.  This thread has nothing
+ * else to do meanwhile, so just wait for space.
+ */
+		for (i = 0; i < count; i++) {
+
+			slot = PACKET_SLOT (&w->queue, i);
+			while (SendPacket (w->la, slot, 0) == -1) {
+
+				pfd.fd     = slot->fd;
+				pfd.events = POLLOUT;
+				poll (&pfd, 1, 10);
+			}
 		}
-		else {
 
-			snprintf (msgBuf, sizeof(msgBuf), "failed to write packet back");
-			Warn (msgBuf);
+		pthread_mutex_lock (&w->lock);
+		w->queue.head   = (w->queue.head + count) % w->queue.size;
+		w->queue.count -= count;
+		pthread_mutex_unlock (&w->lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Read up to a burst of packets and queue each one
+ * to its worker.  Packets for a worker whose queue
+ * is full are dropped.
+ */
+static void DispatchPackets (int fd, int direction)
+{
+	int			nread;
+	int			origBytes;
+	int			dir;
+	socklen_t		addrSize;
+	struct worker*		w;
+	struct packetSlot*	slot;
+
+	for (nread = 0; nread < packetBurst; nread++) {
+
+		addrSize  = sizeof dispatchSlot->addr;
+		origBytes = recvfrom (fd,
+				      dispatchSlot->buf,
+				      sizeof dispatchSlot->buf,
+				      nread ? MSG_DONTWAIT : 0,
+				      (struct sockaddr*) &dispatchSlot->addr,
+				      &addrSize);
+
+		if (origBytes == -1) {
+
+			if (errno != EINTR &&
+			    (nread == 0 ||
+			     (errno != EWOULDBLOCK && errno != EAGAIN)))
+				Warn ("read from divert socket failed");
+
+			break;
+		}
+
+		dir = direction;
+		if (dir == DONT_KNOW) {
+			if (dispatchSlot->addr.sin_addr.s_addr == INADDR_ANY)
+				dir = OUTPUT;
+			else
+				dir = INPUT;
+		}
+
+		w = &workers[FlowWorker ((struct ip*) dispatchSlot->buf, dir)];
+
+		pthread_mutex_lock (&w->lock);
+		if (w->queue.count == w->queue.size) {
+
+			w->dropped++;
+			pthread_mutex_unlock (&w->lock);
+			continue;
 		}
+
+		slot = PACKET_SLOT (&w->queue, w->queue.count);
+		slot->fd	= fd;
+		slot->direction	= dir;
+		slot->origLen	= origBytes;
+		slot->addr	= dispatchSlot->addr;
+		memcpy (slot->buf, dispatchSlot->buf, origBytes);
+
+		if (w->queue.count++ == 0)
+			pthread_cond_signal (&w->wakeup);
+		pthread_mutex_unlock (&w->lock);
 	}
+}
 
-	packetSock = -1;
+/*
+ * Choose the worker owning the flow of a packet.  Only the address
+ * of the remote end is hashed: it is the destination of packets
+ * going out to be aliased and the source of the replies, and
+ * aliasing leaves it alone, so both directions of a flow meet in the
+ * same worker, as do the FTP and PPTP data connections made with the
+ * same remote host.  In reverse mode the outgoing packets are those
+ * from the input side.  ICMP errors are sent to the worker of the
+ * packet they quote.
+ */
+static int FlowWorker (struct ip *ip, int direction)
+{
+	struct in_addr		remote;
+	struct icmp*		ic;
+	struct ip*		inner;
+	int			hlen;
+	int			outgoing;
+	u_int32_t		hash;
+
+	outgoing = (direction == OUTPUT) != (reverseFlows != 0);
+	if (outgoing)
+		remote = ip->ip_dst;
+	else
+		remote = ip->ip_src;
+
+	hlen = ip->ip_hl << 2;
+	if (ip->ip_p == IPPROTO_ICMP &&
+	    (ntohs (ip->ip_off) & IP_OFFMASK) == 0 &&
+	    ntohs (ip->ip_len) >= hlen + ICMP_MINLEN + sizeof (struct ip)) {
+
+		ic = (struct icmp*) ((char*) ip + hlen);
+		switch (ic->icmp_type) {
+		case ICMP_UNREACH:
+		case ICMP_SOURCEQUENCH:
+		case ICMP_TIMXCEED:
+		case ICMP_PARAMPROB:
+			inner = &ic->icmp_ip;
+			if (outgoing)
+				remote = inner->ip_src;
+			else
+				remote = inner->ip_dst;
+			break;
+		}
+	}
+
+	hash = ntohl (remote.s_addr) * 2654435761U;
+	return (hash >> 16) % numWorkers;
+}
+
+/*
+ * Log how many packets each worker has queued and how many
+ * it lost to a full queue.
+ */
+static void DumpWorkers (int priority)
+{
+	struct worker*		w;
+	int			i;
+	int			count;
+	u_int			dropped;
+
+	for (i = 0; i < numWorkers; i++) {
+
+		w = &workers[i];
+		pthread_mutex_lock (&w->lock);
+		count   = w->queue.count;
+		dropped = w->dropped;
+		pthread_mutex_unlock (&w->lock);
+
+		syslog (priority, " worker %d queued= %d dropped= %u",
+			i, count, dropped);
+	}
+}
+
+/*
+ * Pick up a new alias address or MSS.
+ */
+static void ApplySettings (struct worker *w)
+{
+	pthread_mutex_lock (&settingsLock);
+	if (w->generation != settingsGeneration) {
+
+		LibAliasSetAddress (w->la, settingsAddr);
+		if (settingsMSS != 0)
+			LibAliasClampMSS (w->la, settingsMSS);
+		w->generation = settingsGeneration;
+	}
+	pthread_mutex_unlock (&settingsLock);
+}
+
+/*
+ * Change the alias address, in every worker if there are many.
+ */
+static void SetAliasAddress (struct in_addr addr)
+{
+	if (workers == NULL) {
+
+		LibAliasSetAddress (mla, addr);
+		return;
+	}
+
+	pthread_mutex_lock (&settingsLock);
+	settingsAddr = addr;
+	++settingsGeneration;
+	pthread_mutex_unlock (&settingsLock);
+}
+
+static void SetClampMSS (u_short mss)
+{
+	if (workers == NULL) {
+
+		LibAliasClampMSS (mla, mss);
+		return;
+	}
+
+	pthread_mutex_lock (&settingsLock);
+	settingsMSS = mss;
+	++settingsGeneration;
+	pthread_mutex_unlock (&settingsLock);
 }
 
 static void HandleRoutingInfo (int fd)
@@ -1143,7 +1694,7 @@ void DoPortMapping( int fd, struct sockaddr_in *clientaddr, int clientaddrlen, p
 	if ( req->lifetime == 0)
 	{
 		/* remove port mapping */
-		if ( !FindAliasPortOut( clientaddr->sin_addr,
+		if ( !LibAliasFindAliasPortOut( mla, clientaddr->sin_addr,
 								inany,
 								req->privateport,
 								req->publicport,
@@ -1160,7 +1711,7 @@ void DoPortMapping( int fd, struct sockaddr_in *clientaddr, int clientaddrlen, p
 	{
 		/* look for port mapping - public port is ignored in this case */
 		/* create port mapping - map provided public port to private port if public port is not 0 */
-		aliasport = FindAliasPortOut( clientaddr->sin_addr, 
+		aliasport = LibAliasFindAliasPortOut( mla, clientaddr->sin_addr, 
 									  inany, /* lastassignaliasAddr */
 									  req->privateport, 
 									  0, 
@@ -1369,7 +1920,7 @@ SetAliasAddressFromIfName(const char *ifn)
 				ifIndex = ifm->ifm_index;
 				ifMTU = ifm->ifm_data.ifi_mtu;
 				if (clampMSS)
-					PacketAliasClampMSS(ifMTU - sizeof(struct tcphdr) - sizeof(struct ip));
+					SetClampMSS(ifMTU - sizeof(struct tcphdr) - sizeof(struct ip));
 				break;
 			}
 		}
@@ -1412,7 +1963,7 @@ SetAliasAddressFromIfName(const char *ifn)
 	if (sin == NULL)
 		errx(1, "%s: cannot get interface address", ifn);
 
-	PacketAliasSetAddress(sin->sin_addr);
+	SetAliasAddress(sin->sin_addr);
 #ifdef NATPORTMAP
 	if ( (enable_natportmap) && (sin->sin_addr.s_addr != lastassignaliasAddr.s_addr) )
 	{
@@ -1498,6 +2049,13 @@ enum Option {
  	LogDenied,
  	LogFacility,
 	PunchFW,
+	ReserveLinks,
+	MaxLinks,
+	Burst,
+	Workers,
+	Helper,
+	StateFile,
+	FlowLog,
 #ifdef NATPORTMAP
 	NATPortMap,
 	ToInterfaceName
@@ -1591,6 +2149,14 @@ static struct OptionInfo optionTable[] = {
 		"same_ports",
 		"m" },
 
+	{ PacketAliasOption,
+		PKT_ALIAS_LARGE_TABLES,
+		YesNo,
+		"[yes|no]",
+		"size link tables for a large number of connections",
+		"large_tables",
+		NULL },
+
 	{ Verbose,
 		0,
 		YesNo,
@@ -1729,6 +2295,62 @@ static struct OptionInfo optionTable[] = {
 		"punch_fw",
 		NULL },
 
+	{ ReserveLinks,
+		0,
+		Numeric,
+	        "count",
+		"allocate memory for this many aliasing links at startup",
+		"reserve_links",
+		NULL },
+
+	{ MaxLinks,
+		0,
+		Numeric,
+	        "count",
+		"maximum number of aliasing links (0 means no limit)",
+		"max_links",
+		NULL },
+
+	{ Burst,
+		0,
+		Numeric,
+	        "count",
+		"read and alias up to this many packets at a time",
+		"burst",
+		NULL },
+
+	{ Workers,
+		0,
+		Numeric,
+	        "count",
+		"alias packets in this many threads, each owning part of the flows",
+		"workers",
+		NULL },
+
+	{ Helper,
+		0,
+		String,
+	        "ftp|irc|rtsp|pptp|cuseeme|nbt_dgm|nbt_ns [yes|no]",
+		"turn aliasing of addresses inside a protocol's data on or off",
+		"helper",
+		NULL },
+
+	{ StateFile,
+		0,
+		String,
+	        "file_name",
+		"save aliasing links on exit and restore them on start",
+		"state_file",
+		NULL },
+
+	{ FlowLog,
+		0,
+		String,
+	        "file_name|unix:socket_name",
+		"record the packets and bytes of each flow when it ends",
+		"flow_log",
+		NULL },
+
 #ifdef NATPORTMAP
 	{ NATPortMap,
 		0,
@@ -1845,7 +2467,7 @@ static void ParseOption (const char* option, const char* parms)
 	case PacketAliasOption:
 	
 		aliasValue = yesNoValue ? info->packetAliasOpt : 0;
-		PacketAliasSetMode (aliasValue, info->packetAliasOpt);
+		LibAliasSetMode (mla, aliasValue, info->packetAliasOpt);
 		break;
 
 	case Verbose:
@@ -1877,7 +2499,7 @@ static void ParseOption (const char* option, const char* parms)
 		break;
 
 	case TargetAddress:
-		PacketAliasSetTarget(addrValue);
+		LibAliasSetTarget(mla, addrValue);
 		break;
 
 	case RedirectPort:
@@ -1893,7 +2515,7 @@ static void ParseOption (const char* option, const char* parms)
 		break;
 
 	case ProxyRule:
-		PacketAliasProxyRule (strValue);
+		LibAliasProxyRule (mla, strValue);
 		break;
 
 	case InterfaceName:
@@ -1935,6 +2557,51 @@ static void ParseOption (const char* option, const char* parms)
 		SetupPunchFW(strValue);
 		break;
 
+	case StateFile:
+		if (stateFile)
+			free (stateFile);
+
+		stateFile = strdup (strValue);
+		break;
+
+	case FlowLog:
+		if (flowLog)
+			free (flowLog);
+
+		flowLog = strdup (strValue);
+		break;
+
+	case Helper:
+		SetupHelper(strValue);
+		break;
+
+	case ReserveLinks:
+		if (numValue < 0)
+			errx (1, "%s needs a non-negative count", option);
+		if (LibAliasReserveLinks (mla, numValue) == -1)
+			errx (1, "unable to reserve %d aliasing links", numValue);
+		break;
+
+	case MaxLinks:
+		if (numValue < 0)
+			errx (1, "%s needs a non-negative count", option);
+		LibAliasSetMaxLinks (mla, numValue);
+		break;
+
+	case Burst:
+		if (numValue < 1 || numValue > MAX_BURST)
+			errx (1, "%s needs a count between 1 and %d",
+			      option, MAX_BURST);
+		packetBurst = numValue;
+		break;
+
+	case Workers:
+		if (numValue < 1 || numValue > MAX_WORKERS)
+			errx (1, "%s needs a count between 1 and %d",
+			      option, MAX_WORKERS);
+		numWorkers = numValue;
+		break;
+
 #ifdef NATPORTMAP
 	case NATPortMap:
 		enable_natportmap = yesNoValue;
@@ -2161,7 +2828,7 @@ void SetupPortRedirect (const char* parms)
 	        if (numRemotePorts == 1 && remotePort == 0)
 		        remotePortCopy = 0;
 
-		link = PacketAliasRedirectPort (localAddr,
+		link = LibAliasRedirectPort (mla, localAddr,
 						htons(localPort + i),
 						remoteAddr,
 						htons(remotePortCopy),
@@ -2182,7 +2849,7 @@ void SetupPortRedirect (const char* parms)
 			localPort = GETLOPORT(portRange);
 			if (GETNUMPORTS(portRange) != 1)
 				errx(1, "redirect_port: local port must be single in this context");
-			PacketAliasAddServer(link, localAddr, htons(localPort));
+			LibAliasAddServer(mla, link, localAddr, htons(localPort));
 			ptr = strtok(NULL, ",");
 		}
 	}
@@ -2240,7 +2907,7 @@ SetupProtoRedirect(const char* parms)
 /*
  * Create aliasing link.
  */
-	(void)PacketAliasRedirectProto(localAddr, remoteAddr, publicAddr,
+	(void)LibAliasRedirectProto(mla, localAddr, remoteAddr, publicAddr,
 				       proto);
 }
 
@@ -2278,7 +2945,7 @@ void SetupAddressRedirect (const char* parms)
 		errx (1, "redirect_address: missing public address");
 
 	StrToAddr (ptr, &publicAddr);
-	link = PacketAliasRedirectAddr(localAddr, publicAddr);
+	link = LibAliasRedirectAddr(mla, localAddr, publicAddr);
 
 /*
  * Setup LSNAT server pool.
@@ -2287,7 +2954,7 @@ void SetupAddressRedirect (const char* parms)
 		ptr = strtok(serverPool, ",");
 		while (ptr != NULL) {
 			StrToAddr(ptr, &localAddr);
-			PacketAliasAddServer(link, localAddr, htons(~0));
+			LibAliasAddServer(mla, link, localAddr, htons(~0));
 			ptr = strtok(NULL, ",");
 		}
 	}
@@ -2402,6 +3069,276 @@ SetupPunchFW(const char *strValue)
 	if (sscanf(strValue, "%u:%u", &base, &num) != 2)
 		errx(1, "punch_fw: basenumber:count parameter required");
 
-	PacketAliasSetFWBase(base, num);
-	(void)PacketAliasSetMode(PKT_ALIAS_PUNCH_FW, PKT_ALIAS_PUNCH_FW);
+	LibAliasSetFWBase(mla, base, num);
+	(void)LibAliasSetMode(mla, PKT_ALIAS_PUNCH_FW, PKT_ALIAS_PUNCH_FW);
+}
+
+static void
+SetupHelper(const char *strValue)
+{
+	char name[16], state[8];
+	int n, enable;
+	u_int i;
+
+	n = sscanf(strValue, "%15s %7s", name, state);
+	if (n < 1)
+		errx(1, "helper: helper name required");
+
+	if (n == 1 || !strcmp(state, "yes"))
+		enable = 1;
+	else if (!strcmp(state, "no"))
+		enable = 0;
+	else
+		errx(1, "helper: yes/no parameter required");
+
+	if (LibAliasSetHelper(mla, name, enable) == -1)
+		errx(1, "helper: unknown helper %s", name);
+
+	for (i = 0; i < SPLIT_HELPERS; i++)
+		if (!strcmp(name, splitHelpers[i]))
+			splitHelperWanted = enable ? splitHelpers[i] : NULL;
+}
+
+/*
+ * With -state_file, the aliasing links are saved when natd exits
+ * and restored when it starts again, so that connections through
+ * the gateway survive a restart.  Each worker's instance has a file
+ * of its own, named after the worker; flows are hashed to workers
+ * the same way as long as the number of workers stays the same.
+ */
+static const char* StateFileName (char* buf, size_t len, int worker)
+{
+	if (workers == NULL)
+		return stateFile;
+
+	snprintf (buf, len, "%s.%d", stateFile, worker);
+	return buf;
+}
+
+static void LoadState (void)
+{
+	char			buf[1024];
+	const char*		fileName;
+	struct worker*		w;
+	int			i;
+	int			n;
+
+	for (i = 0; i < (workers ? numWorkers : 1); i++) {
+
+		fileName = StateFileName (buf, sizeof buf, i);
+		if (workers == NULL) {
+
+			n = LibAliasLoadState (mla, fileName, 0);
+		}
+		else {
+/*
+ * Give the worker's instance the alias address first,
+ * as the worker would otherwise set it on its first
+ * packet and drop the restored links.
+ */
+			w = &workers[i];
+			pthread_mutex_lock (&w->lock);
+			ApplySettings (w);
+			n = LibAliasLoadState (w->la, fileName, 0);
+			pthread_mutex_unlock (&w->lock);
+		}
+
+		if (n == -1) {
+
+			if (errno != ENOENT)
+				Warn ("unable to restore aliasing links");
+			continue;
+		}
+
+		if (verbose)
+			printf ("%d links restored from %s\n", n, fileName);
+	}
+}
+
+static void SaveState (void)
+{
+	char			buf[1024];
+	const char*		fileName;
+	struct worker*		w;
+	int			i;
+	int			n;
+
+	for (i = 0; i < (workers ? numWorkers : 1); i++) {
+
+		fileName = StateFileName (buf, sizeof buf, i);
+		if (workers == NULL) {
+
+			n = LibAliasSaveState (mla, fileName);
+		}
+		else {
+/*
+ * Let the worker finish the packets it has
+ * and keep it out of its instance meanwhile.
+ */
+			w = &workers[i];
+			pthread_mutex_lock (&w->lock);
+			while (w->queue.count != 0) {
+
+				pthread_mutex_unlock (&w->lock);
+				usleep (1000);
+				pthread_mutex_lock (&w->lock);
+			}
+			n = LibAliasSaveState (w->la, fileName);
+			pthread_mutex_unlock (&w->lock);
+		}
+
+		if (n == -1)
+			Warn ("unable to save aliasing links");
+		else if (verbose)
+			printf ("%d links saved to %s\n", n, fileName);
+	}
+}
+
+/*
+ * With -flow_log, a record of each aliasing link is written when the
+ * link is made and when it goes away, the latter with the packets and
+ * bytes it carried.  The records are struct alias_flow_record from
+ * <alias.h>.  A name starting with "unix:" is a local datagram socket,
+ * which is sent one record per datagram; records that do not fit in
+ * its buffer are dropped and counted rather than holding up packets.
+ *
+ * Any other name is a file holding a header and then a ring of
+ * records for each aliasing instance, so that every ring has a single
+ * writer and needs no lock.  Each ring starts with a head counting the
+ * records ever written to it, followed by its slots; record n is in
+ * slot n % records.  A slot's seq is 2n+1 while record n is being
+ * written into it and 2n+2 once the record is complete.  A reader
+ * polls head, and takes a record it copies out only if seq was 2n+2
+ * both before and after the copy, as the writer may have gone round
+ * the ring and be overwriting the slot.
+ */
+#define	FLOW_RING_MAGIC		0x666c6f77
+#define	FLOW_RING_VERSION	2
+#define	FLOW_RING_RECORDS	65536	/* In all rings together */
+#define	FLOW_RING_MIN		4096	/* In each ring */
+
+struct flowFile {
+
+	u_int32_t		magic;
+	u_int32_t		version;
+	u_int32_t		slotSize;
+	u_int32_t		records;	/* In each ring */
+	u_int32_t		rings;
+	char			pad[44];
+};
+
+struct flowSlot {
+
+	volatile u_int64_t	seq;
+	struct alias_flow_record	rec;
+};
+
+struct flowRing {
+
+	volatile u_int64_t	head;
+	char			pad[56];
+	struct flowSlot		slot[0];
+};
+
+static void SetupFlowLog (void)
+{
+	struct sockaddr_un	addr;
+	struct flowFile*	file;
+	struct flowRing*	ring;
+	size_t			ringSize;
+	size_t			size;
+	u_int32_t		records;
+	int			rings;
+	int			fd;
+	int			i;
+
+	rings    = workers ? numWorkers : 1;
+	ring     = NULL;
+	ringSize = 0;
+
+	if (strncmp (flowLog, "unix:", 5) == 0) {
+
+		memset (&addr, 0, sizeof addr);
+		addr.sun_family = AF_UNIX;
+		if (strlcpy (addr.sun_path, flowLog + 5, sizeof addr.sun_path) >=
+		    sizeof addr.sun_path)
+			errx (1, "flow_log: socket name too long");
+
+		flowSock = socket (AF_UNIX, SOCK_DGRAM, 0);
+		if (flowSock == -1)
+			err (1, "flow_log: socket");
+		if (connect (flowSock, (struct sockaddr*) &addr, sizeof addr) == -1)
+			err (1, "flow_log: %s", addr.sun_path);
+		fcntl (flowSock, F_SETFL, O_NONBLOCK);
+	}
+	else {
+
+		records = FLOW_RING_RECORDS / rings;
+		if (records < FLOW_RING_MIN)
+			records = FLOW_RING_MIN;
+		ringSize = sizeof (struct flowRing) +
+			   records * sizeof (struct flowSlot);
+		size = sizeof (struct flowFile) + rings * ringSize;
+
+		fd = open (flowLog, O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (fd == -1)
+			err (1, "flow_log: %s", flowLog);
+		if (ftruncate (fd, size) == -1)
+			err (1, "flow_log: %s", flowLog);
+		file = mmap (NULL, size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED, fd, 0);
+		if (file == MAP_FAILED)
+			err (1, "flow_log: %s", flowLog);
+		close (fd);
+
+		file->version  = FLOW_RING_VERSION;
+		file->slotSize = sizeof (struct flowSlot);
+		file->records  = records;
+		file->rings    = rings;
+		file->magic    = FLOW_RING_MAGIC;
+
+		flowRecords = records;
+		ring = (struct flowRing*) (file + 1);
+	}
+/*
+ * Each instance is given its own ring, which is
+ * unused when records go to a socket.
+ */
+	for (i = 0; i < rings; i++) {
+
+		LibAliasSetAccounting (workers ? workers[i].la : mla,
+				       LogFlow, ring);
+		if (ring != NULL)
+			ring = (struct flowRing*) ((char*) ring + ringSize);
+	}
+}
+
+static void LogFlow (void* arg, const struct alias_flow_record* rec)
+{
+	struct flowRing*	ring = arg;
+	struct flowSlot*	slot;
+	u_int64_t		n;
+
+	if (ring != NULL) {
+/*
+ * Only the thread working on the instance gets here, so
+ * the ring is written without a lock.  The slot is marked
+ * as being written before it is changed, and head moves
+ * only once the slot is marked complete.
+ */
+		n    = ring->head;
+		slot = &ring->slot[n % flowRecords];
+		slot->seq = 2 * n + 1;
+		__sync_synchronize ();
+		slot->rec = *rec;
+		__sync_synchronize ();
+		slot->seq  = 2 * n + 2;
+		__sync_synchronize ();
+		ring->head = n + 1;
+	}
+	else if (send (flowSock, rec, sizeof *rec, 0) == -1) {
+
+		if (__sync_fetch_and_add (&flowDrops, 1) == 0)
+			Warn ("flow_log: dropping records");
+	}
 }
@@ -41,6 +41,9 @@
 
 extern void Quit (const char* msg);
 extern void Warn (const char* msg);
-extern int SendNeedFragIcmp (int sock, struct ip* failedDgram, int mtu);
+struct libalias;
+
+extern int SendNeedFragIcmp (struct libalias* instance, int sock,
+			     struct ip* failedDgram, int mtu);
 
 
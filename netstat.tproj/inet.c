@@ -95,6 +95,8 @@
 #include <string.h>
 #include <unistd.h>
 #include "netstat.h"
+#include "pcblist.h"
+#include "statfield.h"
 
 #ifdef __APPLE__
 #include <TargetConditionals.h>
@@ -190,24 +192,148 @@ _serv_cache_getservbyport(int port, char *proto)
  * -a (all) flag is specified.
  */
 
-struct xgen_n {
-	u_int32_t	xgn_len;			/* length of this structure */
-	u_int32_t	xgn_kind;		/* number of PCBs at this time */
-};
+/*
+ * Start the name lookups for the addresses of every PCB in the list,
+ * so that they run in parallel rather than one per line printed.
+ */
+static void
+pcb_prefetch(char *buf, size_t len, int istcp)
+{
+	struct pcb_iter it;
+	struct pcb_rec *rec;
+	struct sockaddr_in sin;
+#ifdef INET6
+	struct sockaddr_in6 sin6;
+#endif
 
-#define ALL_XGN_KIND_INP (XSO_SOCKET | XSO_RCVBUF | XSO_SNDBUF | XSO_STATS | XSO_INPCB)
-#define ALL_XGN_KIND_TCP (ALL_XGN_KIND_INP | XSO_TCPCB)
+	bzero(&sin, sizeof(sin));
+	sin.sin_len = sizeof(sin);
+	sin.sin_family = AF_INET;
+#ifdef INET6
+	bzero(&sin6, sizeof(sin6));
+	sin6.sin6_len = sizeof(sin6);
+	sin6.sin6_family = AF_INET6;
+#endif
+	if (pcb_iter_init(&it, buf, len, istcp) < 0)
+		return;
+	while ((rec = pcb_iter_next(&it)) != NULL) {
+		if (rec->inp->inp_vflag & INP_IPV4) {
+			sin.sin_addr = rec->inp->inp_laddr;
+			addr_prefetch((struct sockaddr *)&sin);
+			sin.sin_addr = rec->inp->inp_faddr;
+			addr_prefetch((struct sockaddr *)&sin);
+		}
+#ifdef INET6
+		else if (rec->inp->inp_vflag & INP_IPV6) {
+			sin6.sin6_addr = rec->inp->in6p_laddr;
+			addr_prefetch((struct sockaddr *)&sin6);
+			sin6.sin6_addr = rec->inp->in6p_faddr;
+			addr_prefetch((struct sockaddr *)&sin6);
+		}
+#endif /* INET6 */
+	}
+}
+
+/* The sysctl listing the PCBs of a protocol */
+static const char *
+pcb_mib(uint32_t proto)
+{
+
+	switch (proto) {
+		case IPPROTO_TCP:
+			return ("net.inet.tcp.pcblist_n");
+		case IPPROTO_UDP:
+			return ("net.inet.udp.pcblist_n");
+		case IPPROTO_DIVERT:
+			return ("net.inet.divert.pcblist_n");
+		default:
+			return ("net.inet.raw.pcblist_n");
+	}
+}
+
+/*
+ * Fetch a PCB list into a buffer that is kept from one call to the
+ * next, so that it is only grown when the list outgrows it, or read
+ * the list from the file given with -M.
+ */
+static char *
+pcb_fetch(const char *mibvar, size_t *lenp)
+{
+	static char *buf;
+	static size_t size;
+	char *nbuf;
+	size_t len;
+	FILE *fp;
+
+	if (pcbfile != NULL) {
+		if ((fp = fopen(pcbfile, "r")) == NULL) {
+			warn("%s", pcbfile);
+			return (NULL);
+		}
+		len = 0;
+		for (;;) {
+			if (len == size) {
+				nbuf = realloc(buf, size ? size * 2 : 65536);
+				if (nbuf == NULL) {
+					warn("malloc %lu bytes", (u_long)size * 2);
+					fclose(fp);
+					return (NULL);
+				}
+				buf = nbuf;
+				size = size ? size * 2 : 65536;
+			}
+			len += fread(buf + len, 1, size - len, fp);
+			if (len < size)
+				break;
+		}
+		if (ferror(fp)) {
+			warn("%s", pcbfile);
+			fclose(fp);
+			return (NULL);
+		}
+		fclose(fp);
+		*lenp = len;
+		return (buf);
+	}
+
+	for (;;) {
+		len = size;
+		if (size > 0 && sysctlbyname(mibvar, buf, &len, 0, 0) == 0) {
+			*lenp = len;
+			return (buf);
+		}
+		if (size > 0 && errno != ENOMEM) {
+			warn("sysctl: %s", mibvar);
+			return (NULL);
+		}
+		len = 0;
+		if (sysctlbyname(mibvar, 0, &len, 0, 0) < 0) {
+			if (errno != ENOENT)
+				warn("sysctl: %s", mibvar);
+			return (NULL);
+		}
+		/* Leave room for the sockets opened before the copy */
+		len += len / 8;
+		if ((nbuf = realloc(buf, len)) == NULL) {
+			warn("malloc %lu bytes", (u_long)len);
+			return (NULL);
+		}
+		buf = nbuf;
+		size = len;
+	}
+}
 
 void
 protopr(uint32_t proto,		/* for sysctl version we pass proto # */
 		char *name, int af)
 {
-	int istcp;
+	int istcp, tty;
 	static int first = 1;
-	char *buf, *next;
+	char *buf;
 	const char *mibvar;
 	struct xinpgen *xig, *oxig;
-	struct xgen_n *xgn;
+	struct pcb_iter it;
+	struct pcb_rec *rec;
 	size_t len;
 	struct xtcpcb_n *tp = NULL;
 	struct xinpcb_n *inp = NULL;
@@ -215,7 +341,6 @@ protopr(uint32_t proto,		/* for sysctl version we pass proto # */
 	struct xsockbuf_n *so_rcv = NULL;
 	struct xsockbuf_n *so_snd = NULL;
 	struct xsockstat_n *so_stat = NULL;
-	int which = 0;
 
 	istcp = 0;
 	switch (proto) {
@@ -227,7 +352,6 @@ protopr(uint32_t proto,		/* for sysctl version we pass proto # */
 				tcp_done = 1;
 #endif
 			istcp = 1;
-			mibvar = "net.inet.tcp.pcblist_n";
 			break;
 		case IPPROTO_UDP:
 #ifdef INET6
@@ -236,80 +360,39 @@ protopr(uint32_t proto,		/* for sysctl version we pass proto # */
 			else
 				udp_done = 1;
 #endif
-			mibvar = "net.inet.udp.pcblist_n";
-			break;
-		case IPPROTO_DIVERT:
-			mibvar = "net.inet.divert.pcblist_n";
-			break;
-		default:
-			mibvar = "net.inet.raw.pcblist_n";
 			break;
 	}
-	len = 0;
-	if (sysctlbyname(mibvar, 0, &len, 0, 0) < 0) {
-		if (errno != ENOENT)
-			warn("sysctl: %s", mibvar);
+	mibvar = pcb_mib(proto);
+	if ((buf = pcb_fetch(mibvar, &len)) == NULL)
 		return;
-	}        
-	if ((buf = malloc(len)) == 0) {
-		warn("malloc %lu bytes", (u_long)len);
-		return;
-	}
-	if (sysctlbyname(mibvar, buf, &len, 0, 0) < 0) {
-		warn("sysctl: %s", mibvar);
-		free(buf);
-		return;
-	}
 	
 	/*
-	 * Bail-out to avoid logic error in the loop below when
-	 * there is in fact no more control block to process
+	 * Bail-out when there is in fact no control block to process
 	 */
-	if (len <= sizeof(struct xinpgen)) {
-		free(buf);
+	if (pcb_iter_init(&it, buf, len, istcp) < 0)
 		return;
+
+	/*
+	 * The table can run to many thousands of lines; write it out a
+	 * buffer at a time even to a terminal, and go back to a line at
+	 * a time for whatever follows.
+	 */
+	tty = isatty(STDOUT_FILENO);
+	if (tty) {
+		(void) fflush(stdout);
+		(void) setvbuf(stdout, NULL, _IOFBF, 0);
 	}
-	
-	oxig = xig = (struct xinpgen *)buf;
-	for (next = buf + ROUNDUP64(xig->xig_len); next < buf + len; next += ROUNDUP64(xgn->xgn_len)) {
-		
-		xgn = (struct xgen_n*)next;
-		if (xgn->xgn_len <= sizeof(struct xinpgen))
-			break;
-		
-		if ((which & xgn->xgn_kind) == 0) {
-			which |= xgn->xgn_kind;
-			switch (xgn->xgn_kind) {
-				case XSO_SOCKET:
-					so = (struct xsocket_n *)xgn;
-					break;
-				case XSO_RCVBUF:
-					so_rcv = (struct xsockbuf_n *)xgn;
-					break;
-				case XSO_SNDBUF:
-					so_snd = (struct xsockbuf_n *)xgn;
-					break;
-				case XSO_STATS:
-					so_stat = (struct xsockstat_n *)xgn;
-					break;
-				case XSO_INPCB:
-					inp = (struct xinpcb_n *)xgn;
-					break;
-				case XSO_TCPCB:
-					tp = (struct xtcpcb_n *)xgn;
-					break;
-				default:
-					printf("unexpected kind %d\n", xgn->xgn_kind);
-					break;
-			} 		
-		} else {
-			if (vflag)
-        	        	printf("got %d twice\n", xgn->xgn_kind);
-		}
-		
-		if ((istcp && which != ALL_XGN_KIND_TCP) || (!istcp && which != ALL_XGN_KIND_INP))
-			continue;
-		which = 0;
+
+	oxig = xig = it.head;
+	if (!nflag)
+		pcb_prefetch(buf, len, istcp);
+	while ((rec = pcb_iter_next(&it)) != NULL) {
+		so = rec->so;
+		so_rcv = rec->rcv;
+		so_snd = rec->snd;
+		so_stat = rec->stat;
+		inp = rec->inp;
+		tp = rec->tp;
 		
 		/* Ignore sockets for protocols other than the desired one. */
 		if (so->xso_protocol != (int)proto)
@@ -516,6 +599,8 @@ protopr(uint32_t proto,		/* for sysctl version we pass proto # */
 		}
 		putchar('\n');
 	}
+	if (it.tail != NULL)
+		xig = it.tail;
 	if (xig != oxig && xig->xig_gen != oxig->xig_gen) {
 		if (oxig->xig_count > xig->xig_count) {
 			printf("Some %s sockets may have been deleted.\n",
@@ -524,184 +609,535 @@ protopr(uint32_t proto,		/* for sysctl version we pass proto # */
 			printf("Some %s sockets may have been created.\n",
 			       name);
 		} else {
-			printf("Some %s sockets may have been created or deleted",
+			printf("Some %s sockets may have been created or deleted.\n",
 			       name);
 		}
 	}
-	free(buf);
+	if (tty) {
+		(void) fflush(stdout);
+		(void) setvbuf(stdout, NULL, _IOLBF, 0);
+	}
 }
 
 /*
- * Dump TCP statistics structure.
+ * Show the sockets moving the most traffic, every interval seconds.
+ *
+ * Each sample of the PCB lists is joined with the one before by the
+ * generation count of each PCB, which no other PCB ever has, so the
+ * counters of every socket can be differenced.  A socket first seen
+ * in a sample was opened since the last one and counts from zero.
+ * The entries of sockets that have gone are kept on a free list for
+ * the ones that come, so memory stays level once the number of
+ * sockets does.
  */
-void
-tcp_stats(uint32_t off , char *name, int af)
+
+struct top_sock {			/* a socket's counters last sample */
+	struct top_sock	*next;
+	u_int64_t	gencnt;
+	u_int32_t	proto;
+	u_int32_t	seen;		/* sample it was last in */
+	u_int64_t	rxbytes, txbytes;
+	u_int64_t	rxpackets, txpackets;
+};
+
+struct top_line {			/* a line of the display */
+	double		rate;		/* what the lines are ranked by */
+	double		rxbytes, txbytes;	/* per second */
+	double		rxpackets, txpackets;
+	char		*name;
+	int		state;		/* TCP state, or -1 */
+	struct xinpcb_n	inp;
+};
+
+#define	TOP_NHASH	1024		/* least size of the socket hash */
+
+static struct top_sock **top_hash;
+static u_int32_t top_nhash, top_nsocks;
+static struct top_sock *top_free;
+static u_int32_t top_nfree;
+static struct top_line *top_lines;
+static int top_nlines;
+
+static u_int32_t
+top_bucket(u_int32_t proto, u_int64_t gencnt)
 {
-	static struct tcpstat ptcpstat;
-	struct tcpstat tcpstat;
-	size_t len = sizeof tcpstat;
-	static uint32_t r_swcsum, pr_swcsum;
-	static uint32_t t_swcsum, pt_swcsum;
+	u_int64_t h;
 
-	if (sysctlbyname("net.inet.tcp.stats", &tcpstat, &len, 0, 0) < 0) {
-		warn("sysctl: net.inet.tcp.stats");
+	h = (gencnt ^ ((u_int64_t)proto << 56)) * 0x9e3779b97f4a7c15ULL;
+	return ((u_int32_t)(h >> 32) & (top_nhash - 1));
+}
+
+/* Move the entries to a hash of nhash buckets; kept as is if no memory */
+static void
+top_rehash(u_int32_t nhash)
+{
+	struct top_sock *ts, *next, **ohash;
+	u_int32_t i, h, onhash;
+
+	ohash = top_hash;
+	onhash = top_nhash;
+	if ((top_hash = calloc(nhash, sizeof(*top_hash))) == NULL) {
+		top_hash = ohash;
 		return;
 	}
+	top_nhash = nhash;
+	for (i = 0; i < onhash; i++)
+		for (ts = ohash[i]; ts != NULL; ts = next) {
+			next = ts->next;
+			h = top_bucket(ts->proto, ts->gencnt);
+			ts->next = top_hash[h];
+			top_hash[h] = ts;
+		}
+	free(ohash);
+}
 
-#ifdef INET6
-	if (tcp_done != 0 && interval == 0)
+/* The entry of a socket, made if new; NULL if out of memory */
+static struct top_sock *
+top_lookup(u_int32_t proto, u_int64_t gencnt)
+{
+	struct top_sock *ts;
+	u_int32_t h;
+
+	h = top_bucket(proto, gencnt);
+	for (ts = top_hash[h]; ts != NULL; ts = ts->next)
+		if (ts->gencnt == gencnt && ts->proto == proto)
+			return (ts);
+
+	if (top_nsocks >= top_nhash) {
+		top_rehash(top_nhash * 2);
+		h = top_bucket(proto, gencnt);
+	}
+	if ((ts = top_free) != NULL) {
+		top_free = ts->next;
+		top_nfree--;
+	} else if ((ts = malloc(sizeof(*ts))) == NULL)
+		return (NULL);
+	bzero(ts, sizeof(*ts));
+	ts->gencnt = gencnt;
+	ts->proto = proto;
+	ts->next = top_hash[h];
+	top_hash[h] = ts;
+	top_nsocks++;
+	return (ts);
+}
+
+/*
+ * Put the entries of sockets not in this sample on the free list.  When
+ * the number of sockets has fallen well below the size of the hash, the
+ * hash is made smaller and the free list cut down to match, so that a
+ * burst of short lived sockets does not hold memory for good.
+ */
+static void
+top_sweep(u_int32_t sample)
+{
+	struct top_sock *ts, **tsp;
+	u_int32_t i, nhash;
+
+	for (i = 0; i < top_nhash; i++)
+		for (tsp = &top_hash[i]; (ts = *tsp) != NULL; ) {
+			if (ts->seen == sample) {
+				tsp = &ts->next;
+				continue;
+			}
+			*tsp = ts->next;
+			ts->next = top_free;
+			top_free = ts;
+			top_nfree++;
+			top_nsocks--;
+		}
+
+	if (top_nhash > TOP_NHASH && top_nsocks < top_nhash / 4) {
+		for (nhash = top_nhash / 2;
+		    nhash > TOP_NHASH && top_nsocks < nhash / 4; nhash /= 2)
+			;
+		top_rehash(nhash);
+	}
+	while (top_nfree > 0 && top_nsocks + top_nfree > top_nhash) {
+		ts = top_free;
+		top_free = ts->next;
+		top_nfree--;
+		free(ts);
+	}
+}
+
+/* Keep the busiest lines in a heap with the least busy on top */
+static void
+top_offer(struct top_line *tl, int max)
+{
+	struct top_line t;
+	int i, c;
+
+	if (top_nlines < max) {
+		i = top_nlines++;
+		top_lines[i] = *tl;
+		for (; i > 0 && top_lines[(i - 1) / 2].rate > top_lines[i].rate;
+		    i = (i - 1) / 2) {
+			t = top_lines[i];
+			top_lines[i] = top_lines[(i - 1) / 2];
+			top_lines[(i - 1) / 2] = t;
+		}
+		return;
+	}
+	if (tl->rate <= top_lines[0].rate)
+		return;
+	top_lines[0] = *tl;
+	for (i = 0; (c = 2 * i + 1) < top_nlines; i = c) {
+		if (c + 1 < top_nlines && top_lines[c + 1].rate < top_lines[c].rate)
+			c++;
+		if (top_lines[i].rate <= top_lines[c].rate)
+			break;
+		t = top_lines[i];
+		top_lines[i] = top_lines[c];
+		top_lines[c] = t;
+	}
+}
+
+static int
+top_cmp(const void *a, const void *b)
+{
+	const struct top_line *la = a, *lb = b;
+
+	return (la->rate < lb->rate ? 1 : la->rate > lb->rate ? -1 : 0);
+}
+
+#define	TOPRATE(cur, last) ((cur) > (last) ? ((cur) - (last)) / secs : 0.0)
+
+/* Take one protocol's sockets into the sample */
+static void
+top_sample(uint32_t proto, char *name, u_int32_t sample, double secs)
+{
+	struct pcb_iter it;
+	struct pcb_rec *rec;
+	struct top_sock *ts;
+	struct top_line tl;
+	u_int64_t rxb, txb, rxp, txp;
+	char *buf;
+	size_t len;
+	int i;
+
+	if ((buf = pcb_fetch(pcb_mib(proto), &len)) == NULL ||
+	    pcb_iter_init(&it, buf, len, proto == IPPROTO_TCP) < 0)
 		return;
+	while ((rec = pcb_iter_next(&it)) != NULL) {
+		if (rec->so->xso_protocol != (int)proto)
+			continue;
+		if (rec->inp->inp_gencnt > it.head->xig_gen)
+			continue;
+		if ((af == AF_INET && (rec->inp->inp_vflag & INP_IPV4) == 0)
+#ifdef INET6
+		    || (af == AF_INET6 && (rec->inp->inp_vflag & INP_IPV6) == 0)
+#endif /* INET6 */
+		    )
+			continue;
+
+		rxb = txb = rxp = txp = 0;
+		for (i = 0; i < SO_TC_STATS_MAX; i++) {
+			rxb += rec->stat->xst_tc_stats[i].rxbytes;
+			txb += rec->stat->xst_tc_stats[i].txbytes;
+			rxp += rec->stat->xst_tc_stats[i].rxpackets;
+			txp += rec->stat->xst_tc_stats[i].txpackets;
+		}
+		if ((ts = top_lookup(proto, rec->inp->inp_gencnt)) == NULL)
+			continue;
+		ts->seen = sample;
+		if (sample > 1) {
+			tl.rxbytes = TOPRATE(rxb, ts->rxbytes);
+			tl.txbytes = TOPRATE(txb, ts->txbytes);
+			tl.rxpackets = TOPRATE(rxp, ts->rxpackets);
+			tl.txpackets = TOPRATE(txp, ts->txpackets);
+			tl.rate = topkey ? tl.rxpackets + tl.txpackets :
+			    tl.rxbytes + tl.txbytes;
+			if (tl.rate > 0) {
+				tl.name = name;
+				tl.state = rec->tp != NULL ? rec->tp->t_state : -1;
+				tl.inp = *rec->inp;
+				top_offer(&tl, topcount);
+			}
+		}
+		ts->rxbytes = rxb;
+		ts->txbytes = txb;
+		ts->rxpackets = rxp;
+		ts->txpackets = txp;
+	}
+}
+
+static void
+top_print(struct top_line *tl)
+{
+	struct xinpcb_n *inp = &tl->inp;
+	const char *vchar;
+
+#ifdef INET6
+	if ((inp->inp_vflag & INP_IPV6) != 0)
+		vchar = ((inp->inp_vflag & INP_IPV4) != 0) ? "46" : "6 ";
 	else
-		tcp_done = 1;
 #endif
+		vchar = ((inp->inp_vflag & INP_IPV4) != 0) ? "4 " : "  ";
+	printf("%-3.3s%-2.2s ", tl->name, vchar);
+	if (inp->inp_vflag & INP_IPV4) {
+		inetprint(&inp->inp_laddr, (int)inp->inp_lport, tl->name, nflag);
+		inetprint(&inp->inp_faddr, (int)inp->inp_fport, tl->name, nflag);
+	}
+#ifdef INET6
+	else if (inp->inp_vflag & INP_IPV6) {
+		inet6print(&inp->in6p_laddr, (int)inp->inp_lport, tl->name,
+		    nflag);
+		inet6print(&inp->in6p_faddr, (int)inp->inp_fport, tl->name,
+		    nflag);
+	}
+#endif /* INET6 */
+	if (tl->state < 0)
+		printf("%-11s", "");
+	else if (tl->state >= TCP_NSTATES)
+		printf("%-11d", tl->state);
+	else
+		printf("%-11s", tcpstates[tl->state]);
+	printf(" %10.0f %10.0f %8.0f %8.0f\n", tl->rxbytes, tl->txbytes,
+	    tl->rxpackets, tl->txpackets);
+}
 
-	if (interval && vflag > 0)
-		print_time();
-	printf ("%s:\n", name);
+void
+toppr(uint32_t proto, char *name)
+{
+	struct timeval now, last;
+	u_int32_t sample;
+	double secs;
+	int i;
+
+	top_nhash = TOP_NHASH;
+	top_hash = calloc(top_nhash, sizeof(*top_hash));
+	top_lines = calloc(topcount, sizeof(*top_lines));
+	if (top_hash == NULL || top_lines == NULL)
+		err(1, "malloc");
+	gettimeofday(&last, NULL);
+	for (sample = 1; ; sample++) {
+		gettimeofday(&now, NULL);
+		secs = (now.tv_sec - last.tv_sec) +
+		    (now.tv_usec - last.tv_usec) / 1e6;
+		if (secs <= 0)
+			secs = 1e-6;
+		last = now;
+
+		top_nlines = 0;
+		if (name != NULL)
+			top_sample(proto, name, sample, secs);
+		else {
+			top_sample(IPPROTO_TCP, "tcp", sample, secs);
+			top_sample(IPPROTO_UDP, "udp", sample, secs);
+		}
+		top_sweep(sample);
+
+		if (sample > 1) {
+			qsort(top_lines, top_nlines, sizeof(*top_lines), top_cmp);
+			putchar('\n');
+			print_time();
+			printf("%u sockets, busiest by %s per second\n",
+			    top_nsocks, topkey ? "packets" : "bytes");
+			printf("%-5.5s %-22.22s %-22.22s %-11.11s %10.10s %10.10s "
+			    "%8.8s %8.8s\n", "Proto", "Local Address",
+			    "Foreign Address", "(state)", "rxbytes", "txbytes",
+			    "rxpkts", "txpkts");
+			for (i = 0; i < top_nlines; i++)
+				top_print(&top_lines[i]);
+		}
+		fflush(stdout);
+		sleep(interval > 0 ? interval : 1);
+	}
+}
 
-#define	TCPDIFF(f) (tcpstat.f - ptcpstat.f)
-#define	p(f, m) if (TCPDIFF(f) || sflag <= 1) \
-    printf(m, TCPDIFF(f), plural(TCPDIFF(f)))
-#define	p1a(f, m) if (TCPDIFF(f) || sflag <= 1) \
-    printf(m, TCPDIFF(f))
-#define	p2(f1, f2, m) if (TCPDIFF(f1) || TCPDIFF(f2) || sflag <= 1) \
-    printf(m, TCPDIFF(f1), plural(TCPDIFF(f1)), TCPDIFF(f2), plural(TCPDIFF(f2)))
-#define	p2a(f1, f2, m) if (TCPDIFF(f1) || TCPDIFF(f2) || sflag <= 1) \
-    printf(m, TCPDIFF(f1), plural(TCPDIFF(f1)), TCPDIFF(f2))
-#define	p3(f, m) if (TCPDIFF(f) || sflag <= 1) \
-    printf(m, TCPDIFF(f), plurales(TCPDIFF(f)))
-
-	p(tcps_sndtotal, "\t%u packet%s sent\n");
+/*
+ * TCP statistics, one entry per line of text.
+ */
+#define	p(f, m)		SF_FIELD(SF_P, tcpstat, f, m)
+#define	p1a(f, m)	SF_FIELD(SF_P1A, tcpstat, f, m)
+#define	p2(f1, f2, m)	SF_FIELD2(SF_P2, tcpstat, f1, f2, m)
+#define	p2a(f1, f2, m)	SF_FIELD2(SF_P2A, tcpstat, f1, f2, m)
+#define	sum(f1, f2, m)	SF_FIELD2(SF_SUM, tcpstat, f1, f2, m)
+static struct statfield tcpfields[] = {
+	p(tcps_sndtotal, "\t%u packet%s sent\n"),
 	p2(tcps_sndpack,tcps_sndbyte,
-		"\t\t%u data packet%s (%u byte%s)\n");
+		"\t\t%u data packet%s (%u byte%s)\n"),
 	p2(tcps_sndrexmitpack, tcps_sndrexmitbyte,
-		"\t\t%u data packet%s (%u byte%s) retransmitted\n");
-	p(tcps_mturesent, "\t\t%u resend%s initiated by MTU discovery\n");
+		"\t\t%u data packet%s (%u byte%s) retransmitted\n"),
+	p(tcps_mturesent, "\t\t%u resend%s initiated by MTU discovery\n"),
 	p2a(tcps_sndacks, tcps_delack,
-		"\t\t%u ack-only packet%s (%u delayed)\n");
-	p(tcps_sndurg, "\t\t%u URG only packet%s\n");
-	p(tcps_sndprobe, "\t\t%u window probe packet%s\n");
-	p(tcps_sndwinup, "\t\t%u window update packet%s\n");
-	p(tcps_sndctrl, "\t\t%u control packet%s\n");
-	p(tcps_fcholdpacket, "\t\t%u data packet%s sent after flow control\n");
-	t_swcsum = tcpstat.tcps_snd_swcsum + tcpstat.tcps_snd6_swcsum;
-	if ((t_swcsum - pt_swcsum) || sflag <= 1)
-        printf("\t\t%u checksummed in software\n", (t_swcsum - pt_swcsum));
+		"\t\t%u ack-only packet%s (%u delayed)\n"),
+	p(tcps_sndurg, "\t\t%u URG only packet%s\n"),
+	p(tcps_sndprobe, "\t\t%u window probe packet%s\n"),
+	p(tcps_sndwinup, "\t\t%u window update packet%s\n"),
+	p(tcps_sndctrl, "\t\t%u control packet%s\n"),
+	p(tcps_fcholdpacket, "\t\t%u data packet%s sent after flow control\n"),
+	sum(tcps_snd_swcsum, tcps_snd6_swcsum,
+	    "\t\t%u checksummed in software\n"),
 	p2(tcps_snd_swcsum, tcps_snd_swcsum_bytes,
-	    "\t\t\t%u segment%s (%u byte%s) over IPv4\n");
+	    "\t\t\t%u segment%s (%u byte%s) over IPv4\n"),
 #if INET6
 	p2(tcps_snd6_swcsum, tcps_snd6_swcsum_bytes,
-	    "\t\t\t%u segment%s (%u byte%s) over IPv6\n");
+	    "\t\t\t%u segment%s (%u byte%s) over IPv6\n"),
 #endif /* INET6 */
-	p(tcps_rcvtotal, "\t%u packet%s received\n");
-	p2(tcps_rcvackpack, tcps_rcvackbyte, "\t\t%u ack%s (for %u byte%s)\n");
-	p(tcps_rcvdupack, "\t\t%u duplicate ack%s\n");
-	p(tcps_rcvacktoomuch, "\t\t%u ack%s for unsent data\n");
+	p(tcps_rcvtotal, "\t%u packet%s received\n"),
+	p2(tcps_rcvackpack, tcps_rcvackbyte, "\t\t%u ack%s (for %u byte%s)\n"),
+	p(tcps_rcvdupack, "\t\t%u duplicate ack%s\n"),
+	p(tcps_rcvacktoomuch, "\t\t%u ack%s for unsent data\n"),
 	p2(tcps_rcvpack, tcps_rcvbyte,
-		"\t\t%u packet%s (%u byte%s) received in-sequence\n");
+		"\t\t%u packet%s (%u byte%s) received in-sequence\n"),
 	p2(tcps_rcvduppack, tcps_rcvdupbyte,
-		"\t\t%u completely duplicate packet%s (%u byte%s)\n");
-	p(tcps_pawsdrop, "\t\t%u old duplicate packet%s\n");
-	p(tcps_rcvmemdrop, "\t\t%u received packet%s dropped due to low memory\n");
+		"\t\t%u completely duplicate packet%s (%u byte%s)\n"),
+	p(tcps_pawsdrop, "\t\t%u old duplicate packet%s\n"),
+	p(tcps_rcvmemdrop, "\t\t%u received packet%s dropped due to low memory\n"),
 	p2(tcps_rcvpartduppack, tcps_rcvpartdupbyte,
-		"\t\t%u packet%s with some dup. data (%u byte%s duped)\n");
+		"\t\t%u packet%s with some dup. data (%u byte%s duped)\n"),
 	p2(tcps_rcvoopack, tcps_rcvoobyte,
-		"\t\t%u out-of-order packet%s (%u byte%s)\n");
+		"\t\t%u out-of-order packet%s (%u byte%s)\n"),
 	p2(tcps_rcvpackafterwin, tcps_rcvbyteafterwin,
-		"\t\t%u packet%s (%u byte%s) of data after window\n");
-	p(tcps_rcvwinprobe, "\t\t%u window probe%s\n");
-	p(tcps_rcvwinupd, "\t\t%u window update packet%s\n");
-	p(tcps_rcvafterclose, "\t\t%u packet%s received after close\n");
-	p(tcps_badrst, "\t\t%u bad reset%s\n");
-	p(tcps_rcvbadsum, "\t\t%u discarded for bad checksum%s\n");
-	r_swcsum = tcpstat.tcps_rcv_swcsum + tcpstat.tcps_rcv6_swcsum;
-	if ((r_swcsum - pr_swcsum) || sflag <= 1)
-        printf("\t\t%u checksummed in software\n",
-               (r_swcsum - pr_swcsum));
+		"\t\t%u packet%s (%u byte%s) of data after window\n"),
+	p(tcps_rcvwinprobe, "\t\t%u window probe%s\n"),
+	p(tcps_rcvwinupd, "\t\t%u window update packet%s\n"),
+	p(tcps_rcvafterclose, "\t\t%u packet%s received after close\n"),
+	p(tcps_badrst, "\t\t%u bad reset%s\n"),
+	p(tcps_rcvbadsum, "\t\t%u discarded for bad checksum%s\n"),
+	sum(tcps_rcv_swcsum, tcps_rcv6_swcsum,
+	    "\t\t%u checksummed in software\n"),
 	p2(tcps_rcv_swcsum, tcps_rcv_swcsum_bytes,
-	    "\t\t\t%u segment%s (%u byte%s) over IPv4\n");
+	    "\t\t\t%u segment%s (%u byte%s) over IPv4\n"),
 #if INET6
 	p2(tcps_rcv6_swcsum, tcps_rcv6_swcsum_bytes,
-	    "\t\t\t%u segment%s (%u byte%s) over IPv6\n");
+	    "\t\t\t%u segment%s (%u byte%s) over IPv6\n"),
 #endif /* INET6 */
-	p(tcps_rcvbadoff, "\t\t%u discarded for bad header offset field%s\n");
-	p1a(tcps_rcvshort, "\t\t%u discarded because packet too short\n");
-	p(tcps_connattempt, "\t%u connection request%s\n");
-	p(tcps_accepts, "\t%u connection accept%s\n");
-	p(tcps_badsyn, "\t%u bad connection attempt%s\n");
-	p(tcps_listendrop, "\t%u listen queue overflow%s\n");
-	p(tcps_connects, "\t%u connection%s established (including accepts)\n");
+	p(tcps_rcvbadoff, "\t\t%u discarded for bad header offset field%s\n"),
+	p1a(tcps_rcvshort, "\t\t%u discarded because packet too short\n"),
+	p(tcps_connattempt, "\t%u connection request%s\n"),
+	p(tcps_accepts, "\t%u connection accept%s\n"),
+	p(tcps_badsyn, "\t%u bad connection attempt%s\n"),
+	p(tcps_listendrop, "\t%u listen queue overflow%s\n"),
+	p(tcps_connects, "\t%u connection%s established (including accepts)\n"),
 	p2(tcps_closed, tcps_drops,
-		"\t%u connection%s closed (including %u drop%s)\n");
-	p(tcps_cachedrtt, "\t\t%u connection%s updated cached RTT on close\n");
+		"\t%u connection%s closed (including %u drop%s)\n"),
+	p(tcps_cachedrtt, "\t\t%u connection%s updated cached RTT on close\n"),
 	p(tcps_cachedrttvar, 
-	  "\t\t%u connection%s updated cached RTT variance on close\n");
+	  "\t\t%u connection%s updated cached RTT variance on close\n"),
 	p(tcps_cachedssthresh,
-	  "\t\t%u connection%s updated cached ssthresh on close\n");
-	p(tcps_conndrops, "\t%u embryonic connection%s dropped\n");
+	  "\t\t%u connection%s updated cached ssthresh on close\n"),
+	p(tcps_conndrops, "\t%u embryonic connection%s dropped\n"),
 	p2(tcps_rttupdated, tcps_segstimed,
-		"\t%u segment%s updated rtt (of %u attempt%s)\n");
-	p(tcps_rexmttimeo, "\t%u retransmit timeout%s\n");
-	p(tcps_timeoutdrop, "\t\t%u connection%s dropped by rexmit timeout\n");
-	p(tcps_rxtfindrop, "\t\t%u connection%s dropped after retransmitting FIN\n");
-	p(tcps_persisttimeo, "\t%u persist timeout%s\n");
-	p(tcps_persistdrop, "\t\t%u connection%s dropped by persist timeout\n");
-	p(tcps_keeptimeo, "\t%u keepalive timeout%s\n");
-	p(tcps_keepprobe, "\t\t%u keepalive probe%s sent\n");
-	p(tcps_keepdrops, "\t\t%u connection%s dropped by keepalive\n");
-	p(tcps_predack, "\t%u correct ACK header prediction%s\n");
-	p(tcps_preddat, "\t%u correct data packet header prediction%s\n");
+		"\t%u segment%s updated rtt (of %u attempt%s)\n"),
+	p(tcps_rexmttimeo, "\t%u retransmit timeout%s\n"),
+	p(tcps_timeoutdrop, "\t\t%u connection%s dropped by rexmit timeout\n"),
+	p(tcps_rxtfindrop, "\t\t%u connection%s dropped after retransmitting FIN\n"),
+	p(tcps_persisttimeo, "\t%u persist timeout%s\n"),
+	p(tcps_persistdrop, "\t\t%u connection%s dropped by persist timeout\n"),
+	p(tcps_keeptimeo, "\t%u keepalive timeout%s\n"),
+	p(tcps_keepprobe, "\t\t%u keepalive probe%s sent\n"),
+	p(tcps_keepdrops, "\t\t%u connection%s dropped by keepalive\n"),
+	p(tcps_predack, "\t%u correct ACK header prediction%s\n"),
+	p(tcps_preddat, "\t%u correct data packet header prediction%s\n"),
 #ifdef TCP_MAX_SACK
 	/* TCP_MAX_SACK indicates the header has the SACK structures */
-	p(tcps_sack_recovery_episode, "\t%u SACK recovery episode%s\n"); 
+	p(tcps_sack_recovery_episode, "\t%u SACK recovery episode%s\n"),
 	p(tcps_sack_rexmits,
-		"\t%u segment rexmit%s in SACK recovery episodes\n");
+		"\t%u segment rexmit%s in SACK recovery episodes\n"),
 	p(tcps_sack_rexmit_bytes,
-		"\t%u byte rexmit%s in SACK recovery episodes\n"); 
+		"\t%u byte rexmit%s in SACK recovery episodes\n"),
 	p(tcps_sack_rcv_blocks,
-		"\t%u SACK option%s (SACK blocks) received\n"); 
-	p(tcps_sack_send_blocks, "\t%u SACK option%s (SACK blocks) sent\n"); 
-	p1a(tcps_sack_sboverflow, "\t%u SACK scoreboard overflow\n"); 
+		"\t%u SACK option%s (SACK blocks) received\n"),
+	p(tcps_sack_send_blocks, "\t%u SACK option%s (SACK blocks) sent\n"),
+	p1a(tcps_sack_sboverflow, "\t%u SACK scoreboard overflow\n"),
 #endif /* TCP_MAX_SACK */
 
-	p(tcps_coalesced_pack, "\t%u LRO coalesced packet%s\n");
-	p(tcps_flowtbl_full, "\t\t%u time%s LRO flow table was full\n");
-	p(tcps_flowtbl_collision, "\t\t%u collision%s in LRO flow table\n");
-	p(tcps_lro_twopack, "\t\t%u time%s LRO coalesced 2 packets\n");
-	p(tcps_lro_multpack, "\t\t%u time%s LRO coalesced 3 or 4 packets\n");
-	p(tcps_lro_largepack, "\t\t%u time%s LRO coalesced 5 or more packets\n");
-
-	p(tcps_limited_txt, "\t%u limited transmit%s done\n");
-	p(tcps_early_rexmt, "\t%u early retransmit%s done\n");
-	p(tcps_sack_ackadv, "\t%u time%s cumulative ack advanced along with SACK\n");
-	p(tcps_pto, "\t%u probe timeout%s\n");
-	p(tcps_rto_after_pto, "\t\t%u time%s retransmit timeout triggered after probe\n");
-	p(tcps_tlp_recovery, "\t\t%u time%s fast recovery after tail loss\n");
-	p(tcps_tlp_recoverlastpkt, "\t\t%u time%s recovered last packet \n");
-	p(tcps_ecn_setup, "\t%u connection%s negotiated ECN\n");
-	p(tcps_sent_ece, "\t\t%u time%s congestion notification was sent using ECE\n");
-	p(tcps_sent_cwr, "\t\t%u time%s CWR was sent in response to ECE\n");
-
-	p(tcps_detect_reordering, "\t%u time%s packet reordering was detected on a connection\n");
-	p(tcps_reordered_pkts, "\t\t%u time%s transmitted packets were reordered\n");
-	p(tcps_delay_recovery, "\t\t%u time%s fast recovery was delayed to handle reordering\n");
-	p(tcps_avoid_rxmt, "\t\t%u time%s retransmission was avoided by delaying recovery\n");
-	p(tcps_unnecessary_rxmt, "\t\t%u retransmission%s not needed \n");
-
-	if (interval > 0) {
-		bcopy(&tcpstat, &ptcpstat, len);
-		pr_swcsum = r_swcsum;
-		pt_swcsum = t_swcsum;
-	}
-
-#undef TCPDIFF
+	p(tcps_coalesced_pack, "\t%u LRO coalesced packet%s\n"),
+	p(tcps_flowtbl_full, "\t\t%u time%s LRO flow table was full\n"),
+	p(tcps_flowtbl_collision, "\t\t%u collision%s in LRO flow table\n"),
+	p(tcps_lro_twopack, "\t\t%u time%s LRO coalesced 2 packets\n"),
+	p(tcps_lro_multpack, "\t\t%u time%s LRO coalesced 3 or 4 packets\n"),
+	p(tcps_lro_largepack, "\t\t%u time%s LRO coalesced 5 or more packets\n"),
+
+	p(tcps_limited_txt, "\t%u limited transmit%s done\n"),
+	p(tcps_early_rexmt, "\t%u early retransmit%s done\n"),
+	p(tcps_sack_ackadv, "\t%u time%s cumulative ack advanced along with SACK\n"),
+	p(tcps_pto, "\t%u probe timeout%s\n"),
+	p(tcps_rto_after_pto, "\t\t%u time%s retransmit timeout triggered after probe\n"),
+	p(tcps_tlp_recovery, "\t\t%u time%s fast recovery after tail loss\n"),
+	p(tcps_tlp_recoverlastpkt, "\t\t%u time%s recovered last packet \n"),
+	p(tcps_ecn_setup, "\t%u connection%s negotiated ECN\n"),
+	p(tcps_sent_ece, "\t\t%u time%s congestion notification was sent using ECE\n"),
+	p(tcps_sent_cwr, "\t\t%u time%s CWR was sent in response to ECE\n"),
+
+	p(tcps_detect_reordering, "\t%u time%s packet reordering was detected on a connection\n"),
+	p(tcps_reordered_pkts, "\t\t%u time%s transmitted packets were reordered\n"),
+	p(tcps_delay_recovery, "\t\t%u time%s fast recovery was delayed to handle reordering\n"),
+	p(tcps_avoid_rxmt, "\t\t%u time%s retransmission was avoided by delaying recovery\n"),
+	p(tcps_unnecessary_rxmt, "\t\t%u retransmission%s not needed \n"),
+};
 #undef p
 #undef p1a
 #undef p2
 #undef p2a
-#undef p3
+#undef sum
+
+/*
+ * Dump TCP statistics structure.
+ */
+void
+tcp_stats(uint32_t off , char *name, int af)
+{
+	static struct tcpstat ptcpstat;
+	static int tcpid;
+	struct tcpstat tcpstat;
+	size_t len = sizeof tcpstat;
+
+	if (sysctlbyname("net.inet.tcp.stats", &tcpstat, &len, 0, 0) < 0) {
+		warn("sysctl: net.inet.tcp.stats");
+		return;
+	}
+
+	if (statfmt != STATFMT_TEXT) {
+		SF_EXPORT(name, tcpfields, &tcpstat, &tcpid);
+		return;
+	}
+
+#ifdef INET6
+	if (tcp_done != 0 && interval == 0)
+		return;
+	else
+		tcp_done = 1;
+#endif
+
+	if (interval && vflag > 0)
+		print_time();
+	printf ("%s:\n", name);
+
+	SF_PRINT(tcpfields, &tcpstat, &ptcpstat);
+
+	if (interval > 0)
+		bcopy(&tcpstat, &ptcpstat, len);
 }
 
+/*
+ * MPTCP statistics, kept in the TCP statistics structure.
+ */
+#define	p(f, m)		SF_FIELD(SF_P, tcpstat, f, m)
+#define	p3(f, m)	SF_FIELD(SF_P3, tcpstat, f, m)
+static struct statfield mptcpfields[] = {
+	p(tcps_mp_sndpacks, "\t%u data packet%s sent\n"),
+	p(tcps_mp_sndbytes, "\t%u data byte%s sent\n"),
+	p(tcps_mp_rcvtotal, "\t%u data packet%s received\n"),
+	p(tcps_mp_rcvbytes, "\t%u data byte%s received\n"),
+	p(tcps_invalid_mpcap, "\t%u packet%s with an invalid MPCAP option\n"),
+	p(tcps_invalid_joins, "\t%u packet%s with an invalid MPJOIN option\n"),
+	p(tcps_mpcap_fallback, "\t%u time%s primary subflow fell back to "
+	    "TCP\n"),
+	p(tcps_join_fallback, "\t%u time%s secondary subflow fell back to "
+	    "TCP\n"),
+	p(tcps_estab_fallback, "\t%u DSS option drop%s\n"),
+	p(tcps_invalid_opt, "\t%u other invalid MPTCP option%s\n"),
+	p(tcps_mp_reducedwin, "\t%u time%s the MPTCP subflow window was reduced\n"),
+	p(tcps_mp_badcsum, "\t%u bad DSS checksum%s\n"),
+	p(tcps_mp_oodata, "\t%u time%s received out of order data \n"),
+	p3(tcps_mp_switches, "\t%u subflow switch%s\n"),
+};
+#undef p
+#undef p3
+
 /*
  * Dump MPTCP statistics
  */
@@ -709,6 +1145,7 @@ void
 mptcp_stats(uint32_t off , char *name, int af)
 {
 	static struct tcpstat ptcpstat;
+	static int mptcpid;
 	struct tcpstat tcpstat;
 	size_t len = sizeof tcpstat;
 
@@ -717,6 +1154,11 @@ mptcp_stats(uint32_t off , char *name, int af)
 		return;
 	}
 
+	if (statfmt != STATFMT_TEXT) {
+		SF_EXPORT(name, mptcpfields, &tcpstat, &mptcpid);
+		return;
+	}
+
 #ifdef INET6
 	if (mptcp_done != 0 && interval == 0)
 		return;
@@ -728,47 +1170,62 @@ mptcp_stats(uint32_t off , char *name, int af)
 		print_time();
 	printf ("%s:\n", name);
 
-#define	MPTCPDIFF(f) (tcpstat.f - ptcpstat.f)
-#define	p(f, m) if (MPTCPDIFF(f) || sflag <= 1) \
-    printf(m, MPTCPDIFF(f), plural(MPTCPDIFF(f)))
-#define	p1a(f, m) if (MPTCPDIFF(f) || sflag <= 1) \
-    printf(m, MPTCPDIFF(f))
-#define	p2(f1, f2, m) if (MPTCPDIFF(f1) || MPTCPDIFF(f2) || sflag <= 1) \
-    printf(m, MPTCPDIFF(f1), plural(MPTCPDIFF(f1)), \
-        MPTCPDIFF(f2), plural(MPTCPDIFF(f2)))
-#define	p2a(f1, f2, m) if (MPTCPDIFF(f1) || MPTCPDIFF(f2) || sflag <= 1) \
-    printf(m, MPTCPDIFF(f1), plural(MPTCPDIFF(f1)), MPTCPDIFF(f2))
-#define	p3(f, m) if (MPTCPDIFF(f) || sflag <= 1) \
-    printf(m, MPTCPDIFF(f), plurales(MPTCPDIFF(f)))
-
-	p(tcps_mp_sndpacks, "\t%u data packet%s sent\n");
-	p(tcps_mp_sndbytes, "\t%u data byte%s sent\n");
-	p(tcps_mp_rcvtotal, "\t%u data packet%s received\n");
-	p(tcps_mp_rcvbytes, "\t%u data byte%s received\n");
-	p(tcps_invalid_mpcap, "\t%u packet%s with an invalid MPCAP option\n");
-	p(tcps_invalid_joins, "\t%u packet%s with an invalid MPJOIN option\n");
-	p(tcps_mpcap_fallback, "\t%u time%s primary subflow fell back to "
-	    "TCP\n");
-	p(tcps_join_fallback, "\t%u time%s secondary subflow fell back to "
-	    "TCP\n");
-	p(tcps_estab_fallback, "\t%u DSS option drop%s\n");
-	p(tcps_invalid_opt, "\t%u other invalid MPTCP option%s\n");
-	p(tcps_mp_reducedwin, "\t%u time%s the MPTCP subflow window was reduced\n");
-	p(tcps_mp_badcsum, "\t%u bad DSS checksum%s\n");
-	p(tcps_mp_oodata, "\t%u time%s received out of order data \n");
-	p3(tcps_mp_switches, "\t%u subflow switch%s\n");
-	
+	SF_PRINT(mptcpfields, &tcpstat, &ptcpstat);
+
 	if (interval > 0) {
 		bcopy(&tcpstat, &ptcpstat, len);
 	}
+}
 
-#undef MPTCPDIFF
+/*
+ * UDP statistics, one entry per line of text.
+ */
+#define	o(f)		offsetof(struct udpstat, f)
+#define	p(f, m)		SF_FIELD(SF_P, udpstat, f, m)
+#define	p1a(f, m)	SF_FIELD(SF_P1A, udpstat, f, m)
+#define	p2(f1, f2, m)	SF_FIELD2(SF_P2, udpstat, f1, f2, m)
+#define	sum(f1, f2, m)	SF_FIELD2(SF_SUM, udpstat, f1, f2, m)
+static struct statfield udpfields[] = {
+	p(udps_ipackets, "\t%u datagram%s received\n"),
+	p1a(udps_hdrops, "\t\t%u with incomplete header\n"),
+	p1a(udps_badlen, "\t\t%u with bad data length field\n"),
+	p1a(udps_badsum, "\t\t%u with bad checksum\n"),
+	p1a(udps_nosum, "\t\t%u with no checksum\n"),
+	sum(udps_rcv_swcsum, udps_rcv6_swcsum,
+	    "\t\t%u checksummed in software\n"),
+	p2(udps_rcv_swcsum, udps_rcv_swcsum_bytes,
+	    "\t\t\t%u datagram%s (%u byte%s) over IPv4\n"),
+#if INET6
+	p2(udps_rcv6_swcsum, udps_rcv6_swcsum_bytes,
+	    "\t\t\t%u datagram%s (%u byte%s) over IPv6\n"),
+#endif /* INET6 */
+	p1a(udps_noport, "\t\t%u dropped due to no socket\n"),
+	p(udps_noportbcast,
+	    "\t\t%u broadcast/multicast datagram%s undelivered\n"),
+	/* the next statistic is cumulative in udps_noportbcast */
+	p(udps_filtermcast,
+	    "\t\t%u time%s multicast source filter matched\n"),
+	p1a(udps_fullsock, "\t\t%u dropped due to full socket buffers\n"),
+	p1a(udpps_pcbhashmiss, "\t\t%u not for hashed pcb\n"),
+	{ SF_LESS, "\t\t%u delivered\n", SF_SIZE(udpstat, udps_ipackets), 7,
+	    { o(udps_ipackets), o(udps_hdrops), o(udps_badlen),
+	      o(udps_badsum), o(udps_noport), o(udps_noportbcast),
+	      o(udps_fullsock) } },
+	p(udps_opackets, "\t%u datagram%s output\n"),
+	sum(udps_snd_swcsum, udps_snd6_swcsum,
+	    "\t\t%u checksummed in software\n"),
+	p2(udps_snd_swcsum, udps_snd_swcsum_bytes,
+	    "\t\t\t%u datagram%s (%u byte%s) over IPv4\n"),
+#if INET6
+	p2(udps_snd6_swcsum, udps_snd6_swcsum_bytes,
+	    "\t\t\t%u datagram%s (%u byte%s) over IPv6\n"),
+#endif /* INET6 */
+};
+#undef o
 #undef p
 #undef p1a
 #undef p2
-#undef p2a
-#undef p3
-}
+#undef sum
 
 /*
  * Dump UDP statistics structure.
@@ -777,17 +1234,20 @@ void
 udp_stats(uint32_t off , char *name, int af )
 {
 	static struct udpstat pudpstat;
+	static int udpid;
 	struct udpstat udpstat;
 	size_t len = sizeof udpstat;
-	uint32_t delivered;
-	static uint32_t r_swcsum, pr_swcsum;
-	static uint32_t t_swcsum, pt_swcsum;
 
 	if (sysctlbyname("net.inet.udp.stats", &udpstat, &len, 0, 0) < 0) {
 		warn("sysctl: net.inet.udp.stats");
 		return;
 	}
 
+	if (statfmt != STATFMT_TEXT) {
+		SF_EXPORT(name, udpfields, &udpstat, &udpid);
+		return;
+	}
+
 #ifdef INET6
 	if (udp_done != 0 && interval == 0)
 		return;
@@ -799,66 +1259,66 @@ udp_stats(uint32_t off , char *name, int af )
 		print_time();
 	printf("%s:\n", name);
 
-#define	UDPDIFF(f) (udpstat.f - pudpstat.f)
-#define	p(f, m) if (UDPDIFF(f) || sflag <= 1) \
-    printf(m, UDPDIFF(f), plural(UDPDIFF(f)))
-#define	p1a(f, m) if (UDPDIFF(f) || sflag <= 1) \
-    printf(m, UDPDIFF(f))
-#define	p2(f1, f2, m) if (UDPDIFF(f1) || UDPDIFF(f2) || sflag <= 1) \
-    printf(m, UDPDIFF(f1), plural(UDPDIFF(f1)), UDPDIFF(f2), plural(UDPDIFF(f2)))
-	p(udps_ipackets, "\t%u datagram%s received\n");
-	p1a(udps_hdrops, "\t\t%u with incomplete header\n");
-	p1a(udps_badlen, "\t\t%u with bad data length field\n");
-	p1a(udps_badsum, "\t\t%u with bad checksum\n");
-	p1a(udps_nosum, "\t\t%u with no checksum\n");
-	r_swcsum = udpstat.udps_rcv_swcsum + udpstat.udps_rcv6_swcsum;
-	if ((r_swcsum - pr_swcsum) || sflag <= 1)
-        printf("\t\t%u checksummed in software\n", (r_swcsum - pr_swcsum));
-	p2(udps_rcv_swcsum, udps_rcv_swcsum_bytes,
-	    "\t\t\t%u datagram%s (%u byte%s) over IPv4\n");
-#if INET6
-	p2(udps_rcv6_swcsum, udps_rcv6_swcsum_bytes,
-	    "\t\t\t%u datagram%s (%u byte%s) over IPv6\n");
-#endif /* INET6 */
-	p1a(udps_noport, "\t\t%u dropped due to no socket\n");
-	p(udps_noportbcast,
-	    "\t\t%u broadcast/multicast datagram%s undelivered\n");
-	/* the next statistic is cumulative in udps_noportbcast */
-	p(udps_filtermcast,
-	    "\t\t%u time%s multicast source filter matched\n");
-	p1a(udps_fullsock, "\t\t%u dropped due to full socket buffers\n");
-	p1a(udpps_pcbhashmiss, "\t\t%u not for hashed pcb\n");
-	delivered = UDPDIFF(udps_ipackets) -
-		    UDPDIFF(udps_hdrops) -
-		    UDPDIFF(udps_badlen) -
-		    UDPDIFF(udps_badsum) -
-		    UDPDIFF(udps_noport) -
-		    UDPDIFF(udps_noportbcast) -
-		    UDPDIFF(udps_fullsock);
-	if (delivered || sflag <= 1)
-		printf("\t\t%u delivered\n", delivered);
-	p(udps_opackets, "\t%u datagram%s output\n");
-	t_swcsum = udpstat.udps_snd_swcsum + udpstat.udps_snd6_swcsum;
-	if ((t_swcsum - pt_swcsum) || sflag <= 1)
-        printf("\t\t%u checksummed in software\n", (t_swcsum - pt_swcsum));
-	p2(udps_snd_swcsum, udps_snd_swcsum_bytes,
-	    "\t\t\t%u datagram%s (%u byte%s) over IPv4\n");
-#if INET6
-	p2(udps_snd6_swcsum, udps_snd6_swcsum_bytes,
-	    "\t\t\t%u datagram%s (%u byte%s) over IPv6\n");
-#endif /* INET6 */
+	SF_PRINT(udpfields, &udpstat, &pudpstat);
 
-	if (interval > 0) {
+	if (interval > 0)
 		bcopy(&udpstat, &pudpstat, len);
-		pr_swcsum = r_swcsum;
-		pt_swcsum = t_swcsum;
-	}
+}
 
-#undef UDPDIFF
+/*
+ * IP statistics, one entry per line of text.
+ */
+#define	p(f, m)		SF_FIELD(SF_P, ipstat, f, m)
+#define	p1a(f, m)	SF_FIELD(SF_P1A, ipstat, f, m)
+#define	p2(f1, f2, m)	SF_FIELD2(SF_P2, ipstat, f1, f2, m)
+#define	nl(f, m)	SF_FIELD(SF_NL, ipstat, f, m)
+static struct statfield ipfields[] = {
+	p(ips_total, "\t%u total packet%s received\n"),
+	p(ips_badsum, "\t\t%u bad header checksum%s\n"),
+	p2(ips_rcv_swcsum, ips_rcv_swcsum_bytes,
+	    "\t\t%u header%s (%u byte%s) checksummed in software\n"),
+	p1a(ips_toosmall, "\t\t%u with size smaller than minimum\n"),
+	p1a(ips_tooshort, "\t\t%u with data size < data length\n"),
+	p1a(ips_adj, "\t\t%u with data size > data length\n"),
+	p(ips_adj_hwcsum_clr,
+	    "\t\t\t%u packet%s forced to software checksum\n"),
+	p1a(ips_toolong, "\t\t%u with ip length > max ip packet size\n"),
+	p1a(ips_badhlen, "\t\t%u with header length < data size\n"),
+	p1a(ips_badlen, "\t\t%u with data length < header length\n"),
+	p1a(ips_badoptions, "\t\t%u with bad options\n"),
+	p1a(ips_badvers, "\t\t%u with incorrect version number\n"),
+	p(ips_fragments, "\t\t%u fragment%s received\n"),
+	p1a(ips_fragdropped, "\t\t\t%u dropped (dup or out of space)\n"),
+	p1a(ips_fragtimeout, "\t\t\t%u dropped after timeout\n"),
+	p1a(ips_reassembled, "\t\t\t%u reassembled ok\n"),
+	p(ips_delivered, "\t\t%u packet%s for this host\n"),
+	p(ips_noproto, "\t\t%u packet%s for unknown/unsupported protocol\n"),
+	p(ips_forward, "\t\t%u packet%s forwarded"),
+	p(ips_fastforward, " (%u packet%s fast forwarded)"),
+	nl(ips_forward, "\n"),
+	p(ips_cantforward, "\t\t%u packet%s not forwardable\n"),
+	p(ips_notmember,
+	  "\t\t%u packet%s received for unknown multicast group\n"),
+	p(ips_redirectsent, "\t\t%u redirect%s sent\n"),
+	p(ips_localout, "\t%u packet%s sent from this host\n"),
+	p(ips_rawout, "\t\t%u packet%s sent with fabricated ip header\n"),
+	p(ips_odropped,
+	  "\t\t%u output packet%s dropped due to no bufs, etc.\n"),
+	p(ips_noroute, "\t\t%u output packet%s discarded due to no route\n"),
+	p(ips_fragmented, "\t\t%u output datagram%s fragmented\n"),
+	p(ips_ofragments, "\t\t%u fragment%s created\n"),
+	p(ips_cantfrag, "\t\t%u datagram%s that can't be fragmented\n"),
+	p(ips_nogif, "\t\t%u tunneling packet%s that can't find gif\n"),
+	p(ips_badaddr, "\t\t%u datagram%s with bad address in header\n"),
+	p(ips_pktdropcntrl,
+	    "\t\t%u packet%s dropped due to no bufs for control data\n"),
+	p2(ips_snd_swcsum, ips_snd_swcsum_bytes,
+	    "\t\t%u header%s (%u byte%s) checksummed in software\n"),
+};
 #undef p
 #undef p1a
 #undef p2
-}
+#undef nl
 
 /*
  * Dump IP statistics structure.
@@ -867,6 +1327,7 @@ void
 ip_stats(uint32_t off , char *name, int af )
 {
 	static struct ipstat pipstat;
+	static int ipid;
 	struct ipstat ipstat;
 	size_t len = sizeof ipstat;
 
@@ -875,69 +1336,43 @@ ip_stats(uint32_t off , char *name, int af )
 		return;
 	}
 
+	if (statfmt != STATFMT_TEXT) {
+		SF_EXPORT(name, ipfields, &ipstat, &ipid);
+		return;
+	}
+
 	if (interval && vflag > 0)
 		print_time();
 	printf("%s:\n", name);
 
-#define	IPDIFF(f) (ipstat.f - pipstat.f)
-#define	p(f, m) if (IPDIFF(f) || sflag <= 1) \
-    printf(m, IPDIFF(f), plural(IPDIFF(f)))
-#define	p1a(f, m) if (IPDIFF(f) || sflag <= 1) \
-    printf(m, IPDIFF(f))
-#define	p2(f1, f2, m) if (IPDIFF(f1) || IPDIFF(f2) || sflag <= 1) \
-    printf(m, IPDIFF(f1), plural(IPDIFF(f1)), IPDIFF(f2), plural(IPDIFF(f2)))
-
-	p(ips_total, "\t%u total packet%s received\n");
-	p(ips_badsum, "\t\t%u bad header checksum%s\n");
-	p2(ips_rcv_swcsum, ips_rcv_swcsum_bytes,
-	    "\t\t%u header%s (%u byte%s) checksummed in software\n");
-	p1a(ips_toosmall, "\t\t%u with size smaller than minimum\n");
-	p1a(ips_tooshort, "\t\t%u with data size < data length\n");
-	p1a(ips_adj, "\t\t%u with data size > data length\n");
-	p(ips_adj_hwcsum_clr,
-	    "\t\t\t%u packet%s forced to software checksum\n");
-	p1a(ips_toolong, "\t\t%u with ip length > max ip packet size\n");
-	p1a(ips_badhlen, "\t\t%u with header length < data size\n");
-	p1a(ips_badlen, "\t\t%u with data length < header length\n");
-	p1a(ips_badoptions, "\t\t%u with bad options\n");
-	p1a(ips_badvers, "\t\t%u with incorrect version number\n");
-	p(ips_fragments, "\t\t%u fragment%s received\n");
-	p1a(ips_fragdropped, "\t\t\t%u dropped (dup or out of space)\n");
-	p1a(ips_fragtimeout, "\t\t\t%u dropped after timeout\n");
-	p1a(ips_reassembled, "\t\t\t%u reassembled ok\n");
-	p(ips_delivered, "\t\t%u packet%s for this host\n");
-	p(ips_noproto, "\t\t%u packet%s for unknown/unsupported protocol\n");
-	p(ips_forward, "\t\t%u packet%s forwarded");
-	p(ips_fastforward, " (%u packet%s fast forwarded)");
-	if (IPDIFF(ips_forward) || sflag <= 1)
-		putchar('\n');
-	p(ips_cantforward, "\t\t%u packet%s not forwardable\n");
-	p(ips_notmember,
-	  "\t\t%u packet%s received for unknown multicast group\n");
-	p(ips_redirectsent, "\t\t%u redirect%s sent\n");
-	p(ips_localout, "\t%u packet%s sent from this host\n");
-	p(ips_rawout, "\t\t%u packet%s sent with fabricated ip header\n");
-	p(ips_odropped,
-	  "\t\t%u output packet%s dropped due to no bufs, etc.\n");
-	p(ips_noroute, "\t\t%u output packet%s discarded due to no route\n");
-	p(ips_fragmented, "\t\t%u output datagram%s fragmented\n");
-	p(ips_ofragments, "\t\t%u fragment%s created\n");
-	p(ips_cantfrag, "\t\t%u datagram%s that can't be fragmented\n");
-	p(ips_nogif, "\t\t%u tunneling packet%s that can't find gif\n");
-	p(ips_badaddr, "\t\t%u datagram%s with bad address in header\n");
-	p(ips_pktdropcntrl,
-	    "\t\t%u packet%s dropped due to no bufs for control data\n");
-	p2(ips_snd_swcsum, ips_snd_swcsum_bytes,
-	    "\t\t%u header%s (%u byte%s) checksummed in software\n");
+	SF_PRINT(ipfields, &ipstat, &pipstat);
 
 	if (interval > 0)
 		bcopy(&ipstat, &pipstat, len);
+}
 
-#undef IPDIFF
+/*
+ * ARP statistics, one entry per line of text.
+ */
+#define	p(f, m)		SF_FIELD(SF_P, arpstat, f, m)
+#define	p2(f, m)	SF_FIELD(SF_PY, arpstat, f, m)
+static struct statfield arpfields[] = {
+	p(txrequests, "\t%u ARP request%s sent\n"),
+	p2(txreplies, "\t%u ARP repl%s sent\n"),
+	p(txannounces, "\t%u ARP announcement%s sent\n"),
+	p(rxrequests, "\t%u ARP request%s received\n"),
+	p2(rxreplies, "\t%u ARP repl%s received\n"),
+	p(received, "\t%u total ARP packet%s received\n"),
+	p(txconflicts, "\t%u ARP conflict probe%s sent\n"),
+	p(invalidreqs, "\t%u invalid ARP resolve request%s\n"),
+	p(reqnobufs, "\t%u total packet%s dropped due to lack of memory\n"),
+	p(dropped, "\t%u total packet%s dropped due to no ARP entry\n"),
+	p(purged, "\t%u total packet%s dropped during ARP entry removal\n"),
+	p2(timeouts, "\t%u ARP entr%s timed out\n"),
+	p(dupips, "\t%u Duplicate IP%s seen\n"),
+};
 #undef p
-#undef p1a
 #undef p2
-}
 
 /*
  * Dump ARP statistics structure.
@@ -946,6 +1381,7 @@ void
 arp_stats(uint32_t off, char *name, int af)
 {
 	static struct arpstat parpstat;
+	static int arpid;
 	struct arpstat arpstat;
 	size_t len = sizeof (arpstat);
 
@@ -955,36 +1391,19 @@ arp_stats(uint32_t off, char *name, int af)
 		return;
 	}
 
+	if (statfmt != STATFMT_TEXT) {
+		SF_EXPORT(name, arpfields, &arpstat, &arpid);
+		return;
+	}
+
 	if (interval && vflag > 0)
 		print_time();
 	printf("%s:\n", name);
 
-#define	ARPDIFF(f) (arpstat.f - parpstat.f)
-#define	p(f, m) if (ARPDIFF(f) || sflag <= 1) \
-    printf(m, ARPDIFF(f), plural(ARPDIFF(f)))
-#define	p2(f, m) if (ARPDIFF(f) || sflag <= 1) \
-    printf(m, ARPDIFF(f), pluralies(ARPDIFF(f)))
-
-	p(txrequests, "\t%u ARP request%s sent\n");
-	p2(txreplies, "\t%u ARP repl%s sent\n");
-	p(txannounces, "\t%u ARP announcement%s sent\n");
-	p(rxrequests, "\t%u ARP request%s received\n");
-	p2(rxreplies, "\t%u ARP repl%s received\n");
-	p(received, "\t%u total ARP packet%s received\n");
-	p(txconflicts, "\t%u ARP conflict probe%s sent\n");
-	p(invalidreqs, "\t%u invalid ARP resolve request%s\n");
-	p(reqnobufs, "\t%u total packet%s dropped due to lack of memory\n");
-	p(dropped, "\t%u total packet%s dropped due to no ARP entry\n");
-	p(purged, "\t%u total packet%s dropped during ARP entry removal\n");
-	p2(timeouts, "\t%u ARP entr%s timed out\n");
-	p(dupips, "\t%u Duplicate IP%s seen\n");
+	SF_PRINT(arpfields, &arpstat, &parpstat);
 
 	if (interval > 0)
 		bcopy(&arpstat, &parpstat, len);
-
-#undef ARPDIFF
-#undef p
-#undef p2
 }
 
 static	char *icmpnames[] = {
@@ -1009,6 +1428,30 @@ static	char *icmpnames[] = {
 	"address mask reply",
 };
 
+/*
+ * ICMP statistics, one entry per line of text.
+ */
+#define	p(f, m)		SF_FIELD(SF_P, icmpstat, f, m)
+#define	p1a(f, m)	SF_FIELD(SF_P1A, icmpstat, f, m)
+#define	hist(f, m)	SF_HISTOGRAM(icmpstat, f, icmpnames, m)
+static struct statfield icmpfields[] = {
+	p(icps_error, "\t%u call%s to icmp_error\n"),
+	p(icps_oldicmp,
+	    "\t%u error%s not generated 'cuz old message was icmp\n"),
+	hist(icps_outhist, "\tOutput histogram:\n"),
+	p(icps_badcode, "\t%u message%s with bad code fields\n"),
+	p(icps_tooshort, "\t%u message%s < minimum length\n"),
+	p(icps_checksum, "\t%u bad checksum%s\n"),
+	p(icps_badlen, "\t%u message%s with bad length\n"),
+	p1a(icps_bmcastecho, "\t%u multicast echo requests ignored\n"),
+	p1a(icps_bmcasttstamp, "\t%u multicast timestamp requests ignored\n"),
+	hist(icps_inhist, "\tInput histogram:\n"),
+	p(icps_reflect, "\t%u message response%s generated\n"),
+};
+#undef p
+#undef p1a
+#undef hist
+
 /*
  * Dump ICMP statistics.
  */
@@ -1016,8 +1459,9 @@ void
 icmp_stats(uint32_t off , char *name, int af )
 {
 	static struct icmpstat picmpstat;
+	static int icmpid;
 	struct icmpstat icmpstat;
-	int i, first;
+	int i;
 	int mib[4];		/* CTL_NET + PF_INET + IPPROTO_ICMP + req */
 	size_t len;
 
@@ -1031,48 +1475,17 @@ icmp_stats(uint32_t off , char *name, int af )
 	if (sysctl(mib, 4, &icmpstat, &len, (void *)0, 0) < 0)
 		return;		/* XXX should complain, but not traditional */
 
+	if (statfmt != STATFMT_TEXT) {
+		SF_EXPORT(name, icmpfields, &icmpstat, &icmpid);
+		return;
+	}
+
 	if (interval && vflag > 0)
 		print_time();
 	printf("%s:\n", name);
 
-#define	ICMPDIFF(f) (icmpstat.f - picmpstat.f)
-#define	p(f, m) if (ICMPDIFF(f) || sflag <= 1) \
-    printf(m, ICMPDIFF(f), plural(ICMPDIFF(f)))
-#define	p1a(f, m) if (ICMPDIFF(f) || sflag <= 1) \
-    printf(m, ICMPDIFF(f))
-
-	p(icps_error, "\t%u call%s to icmp_error\n");
-	p(icps_oldicmp,
-	    "\t%u error%s not generated 'cuz old message was icmp\n");
-	for (first = 1, i = 0; i < ICMP_MAXTYPE + 1; i++)
-		if (ICMPDIFF(icps_outhist[i]) != 0) {
-			if (first) {
-				printf("\tOutput histogram:\n");
-				first = 0;
-			}
-			printf("\t\t%s: %u\n", icmpnames[i],
-				ICMPDIFF(icps_outhist[i]));
-		}
-	p(icps_badcode, "\t%u message%s with bad code fields\n");
-	p(icps_tooshort, "\t%u message%s < minimum length\n");
-	p(icps_checksum, "\t%u bad checksum%s\n");
-	p(icps_badlen, "\t%u message%s with bad length\n");
-	p1a(icps_bmcastecho, "\t%u multicast echo requests ignored\n");
-	p1a(icps_bmcasttstamp, "\t%u multicast timestamp requests ignored\n");
-	for (first = 1, i = 0; i < ICMP_MAXTYPE + 1; i++)
-		if (ICMPDIFF(icps_inhist[i]) != 0) {
-			if (first) {
-				printf("\tInput histogram:\n");
-				first = 0;
-			}
-			printf("\t\t%s: %u\n", icmpnames[i],
-				ICMPDIFF(icps_inhist[i]));
-		}
-	p(icps_reflect, "\t%u message response%s generated\n");
+	SF_PRINT(icmpfields, &icmpstat, &picmpstat);
 
-#undef ICMPDIFF
-#undef p
-#undef p1a
 	mib[3] = ICMPCTL_MASKREPL;
 	len = sizeof i;
 	if (sysctl(mib, 4, &i, &len, (void *)0, 0) < 0)
@@ -1084,6 +1497,35 @@ icmp_stats(uint32_t off , char *name, int af )
 		bcopy(&icmpstat, &picmpstat, sizeof (icmpstat));
 }
 
+/*
+ * IGMP statistics, one entry per line of text.
+ */
+#define	p64(f, m)	SF_FIELD(SF_P, igmpstat_v3, f, m)
+#define	py64(f, m)	SF_FIELD(SF_PY, igmpstat_v3, f, m)
+static struct statfield igmpfields[] = {
+	p64(igps_rcv_total, "\t%llu message%s received\n"),
+	p64(igps_rcv_tooshort, "\t%llu message%s received with too few bytes\n"),
+	p64(igps_rcv_badttl, "\t%llu message%s received with wrong TTL\n"),
+	p64(igps_rcv_badsum, "\t%llu message%s received with bad checksum\n"),
+	py64(igps_rcv_v1v2_queries, "\t%llu V1/V2 membership quer%s received\n"),
+	py64(igps_rcv_v3_queries, "\t%llu V3 membership quer%s received\n"),
+	py64(igps_rcv_badqueries,
+	    "\t%llu membership quer%s received with invalid field(s)\n"),
+	py64(igps_rcv_gen_queries, "\t%llu general quer%s received\n"),
+	py64(igps_rcv_group_queries, "\t%llu group quer%s received\n"),
+	py64(igps_rcv_gsr_queries, "\t%llu group-source quer%s received\n"),
+	py64(igps_drop_gsr_queries, "\t%llu group-source quer%s dropped\n"),
+	p64(igps_rcv_reports, "\t%llu membership report%s received\n"),
+	p64(igps_rcv_badreports,
+	    "\t%llu membership report%s received with invalid field(s)\n"),
+	p64(igps_rcv_ourreports,
+"\t%llu membership report%s received for groups to which we belong\n"),
+	p64(igps_rcv_nora, "\t%llu V3 report%s received without Router Alert\n"),
+	p64(igps_snd_reports, "\t%llu membership report%s sent\n"),
+};
+#undef p64
+#undef py64
+
 /*
  * Dump IGMP statistics structure.
  */
@@ -1091,6 +1533,7 @@ void
 igmp_stats(uint32_t off , char *name, int af )
 {
 	static struct igmpstat_v3 pigmpstat;
+	static int igmpid;
 	struct igmpstat_v3 igmpstat;
 	size_t len = sizeof igmpstat;
 
@@ -1108,42 +1551,19 @@ igmp_stats(uint32_t off , char *name, int af )
 		    igmpstat.igps_len, IGPS_VERSION3_LEN);
 	}
 
+	if (statfmt != STATFMT_TEXT) {
+		SF_EXPORT(name, igmpfields, &igmpstat, &igmpid);
+		return;
+	}
+
 	if (interval && vflag > 0)
 		print_time();
 	printf("%s:\n", name);
 
-#define	IGMPDIFF(f) ((uintmax_t)(igmpstat.f - pigmpstat.f))
-#define	p64(f, m) if (IGMPDIFF(f) || sflag <= 1) \
-    printf(m, IGMPDIFF(f), plural(IGMPDIFF(f)))
-#define	py64(f, m) if (IGMPDIFF(f) || sflag <= 1) \
-    printf(m, IGMPDIFF(f), IGMPDIFF(f) != 1 ? "ies" : "y")
-
-	p64(igps_rcv_total, "\t%ju message%s received\n");
-	p64(igps_rcv_tooshort, "\t%ju message%s received with too few bytes\n");
-	p64(igps_rcv_badttl, "\t%ju message%s received with wrong TTL\n");
-	p64(igps_rcv_badsum, "\t%ju message%s received with bad checksum\n");
-	py64(igps_rcv_v1v2_queries, "\t%ju V1/V2 membership quer%s received\n");
-	py64(igps_rcv_v3_queries, "\t%ju V3 membership quer%s received\n");
-	py64(igps_rcv_badqueries,
-	    "\t%ju membership quer%s received with invalid field(s)\n");
-	py64(igps_rcv_gen_queries, "\t%ju general quer%s received\n");
-	py64(igps_rcv_group_queries, "\t%ju group quer%s received\n");
-	py64(igps_rcv_gsr_queries, "\t%ju group-source quer%s received\n");
-	py64(igps_drop_gsr_queries, "\t%ju group-source quer%s dropped\n");
-	p64(igps_rcv_reports, "\t%ju membership report%s received\n");
-	p64(igps_rcv_badreports,
-	    "\t%ju membership report%s received with invalid field(s)\n");
-	p64(igps_rcv_ourreports,
-"\t%ju membership report%s received for groups to which we belong\n");
-        p64(igps_rcv_nora, "\t%ju V3 report%s received without Router Alert\n");
-        p64(igps_snd_reports, "\t%ju membership report%s sent\n");
+	SF_PRINT(igmpfields, &igmpstat, &pigmpstat);
 
 	if (interval > 0)
 		bcopy(&igmpstat, &pigmpstat, len);
-
-#undef IGMPDIFF
-#undef p64
-#undef py64
 }
 
 /*
@@ -1188,7 +1608,7 @@ inetname(struct in_addr *inp)
 {
 	register char *cp;
 	static char line[MAXHOSTNAMELEN];
-	struct hostent *hp;
+	struct sockaddr_in sin;
 	struct netent *np;
 
 	cp = 0;
@@ -1202,11 +1622,11 @@ inetname(struct in_addr *inp)
 				cp = np->n_name;
 		}
 		if (cp == 0) {
-			hp = gethostbyaddr((char *)inp, sizeof (*inp), AF_INET);
-			if (hp) {
-				cp = hp->h_name;
-				 //### trimdomain(cp, strlen(cp));
-			}
+			bzero(&sin, sizeof(sin));
+			sin.sin_len = sizeof(sin);
+			sin.sin_family = AF_INET;
+			sin.sin_addr = *inp;
+			cp = (char *)addr_name((struct sockaddr *)&sin);
 		}
 	}
 	if (inp->s_addr == INADDR_ANY)
@@ -88,6 +88,7 @@
 #include <string.h>
 #include <unistd.h>
 #include "netstat.h"
+#include "statfield.h"
 
 #if defined(__APPLE__) && !defined(__unused)
 #define __unused
@@ -355,85 +356,15 @@ static	char *ip6nh[] = {
 	"#255",
 };
 
-/*
- * Dump IP6 statistics structure.
- */
-void
-ip6_stats(uint32_t off __unused, char *name, int af __unused)
+#define	IP6DIFF(f) (ip6stat->f - pip6stat->f)
+
+/* Per-interface mbuf counts, by interface name */
+static void
+ip6_m2mpr(const void *cur, const void *prev)
 {
-	static struct ip6stat pip6stat;
-	struct ip6stat ip6stat;
+	const struct ip6stat *ip6stat = cur, *pip6stat = prev;
 	int first, i;
-	int mib[4];
-	size_t len;
 
-	mib[0] = CTL_NET;
-	mib[1] = PF_INET6;
-	mib[2] = IPPROTO_IPV6;
-	mib[3] = IPV6CTL_STATS;
-
-	len = sizeof ip6stat;
-	memset(&ip6stat, 0, len);
-	if (sysctl(mib, 4, &ip6stat, &len, (void *)0, 0) < 0)
-		return;
-    if (interval && vflag > 0)
-        print_time();
-	printf("%s:\n", name);
-
-#define	IP6DIFF(f) (ip6stat.f - pip6stat.f)
-#define	p(f, m) if (IP6DIFF(f) || sflag <= 1) \
-    printf(m, (unsigned long long)IP6DIFF(f), plural(IP6DIFF(f)))
-#define	p1a(f, m) if (IP6DIFF(f) || sflag <= 1) \
-    printf(m, (unsigned long long)IP6DIFF(f))
-
-	p(ip6s_total, "\t%llu total packet%s received\n");
-	p1a(ip6s_toosmall, "\t\t%llu with size smaller than minimum\n");
-	p1a(ip6s_tooshort, "\t\t%llu with data size < data length\n");
-	p1a(ip6s_adj, "\t\t%llu with data size > data length\n");
-	p(ip6s_adj_hwcsum_clr,
-	    "\t\t\t%llu packet%s forced to software checksum\n");
-	p1a(ip6s_badoptions, "\t\t%llu with bad options\n");
-	p1a(ip6s_badvers, "\t\t%llu with incorrect version number\n");
-	p(ip6s_fragments, "\t\t%llu fragment%s received\n");
-	p1a(ip6s_fragdropped,
-	    "\t\t\t%llu dropped (dup or out of space)\n");
-	p1a(ip6s_fragtimeout, "\t\t\t%llu dropped after timeout\n");
-	p1a(ip6s_fragoverflow, "\t\t\t%llu exceeded limit\n");
-	p1a(ip6s_reassembled, "\t\t\t%llu reassembled ok\n");
-	p(ip6s_delivered, "\t\t%llu packet%s for this host\n");
-	p(ip6s_forward, "\t\t%llu packet%s forwarded\n");
-	p(ip6s_cantforward, "\t\t%llu packet%s not forwardable\n");
-	p(ip6s_redirectsent, "\t\t%llu redirect%s sent\n");
-	p(ip6s_notmember, "\t\t%llu multicast packet%s which we don't join\n");
-	p(ip6s_exthdrtoolong,
-	    "\t\t%llu packet%s whose headers are not continuous\n");
-	p(ip6s_nogif, "\t\t%llu tunneling packet%s that can't find gif\n");
-	p(ip6s_toomanyhdr,
-	    "\t\t%llu packet%s discarded due to too may headers\n");
-	p1a(ip6s_forward_cachehit, "\t\t%llu forward cache hit\n");
-	p1a(ip6s_forward_cachemiss, "\t\t%llu forward cache miss\n");
-	p(ip6s_pktdropcntrl,
-	    "\t\t%llu packet%s dropped due to no bufs for control data\n");
-	p(ip6s_localout, "\t%llu packet%s sent from this host\n");
-	p(ip6s_rawout, "\t\t%llu packet%s sent with fabricated ip header\n");
-	p(ip6s_odropped,
-	    "\t\t%llu output packet%s dropped due to no bufs, etc.\n");
-	p(ip6s_noroute, "\t\t%llu output packet%s discarded due to no route\n");
-	p(ip6s_fragmented, "\t\t%llu output datagram%s fragmented\n");
-	p(ip6s_ofragments, "\t\t%llu fragment%s created\n");
-	p(ip6s_cantfrag, "\t\t%llu datagram%s that can't be fragmented\n");
-	p(ip6s_badscope, "\t\t%llu packet%s that violated scope rules\n");
-	for (first = 1, i = 0; i < 256; i++)
-		if (IP6DIFF(ip6s_nxthist[i]) != 0) {
-			if (first) {
-				printf("\tInput histogram:\n");
-				first = 0;
-			}
-			printf("\t\t%s: %llu\n", ip6nh[i],
-			    (unsigned long long)IP6DIFF(ip6s_nxthist[i]));
-		}
-	printf("\tMbuf statistics:\n");
-	printf("\t\t%llu one mbuf\n", (unsigned long long)IP6DIFF(ip6s_m1));
 	for (first = 1, i = 0; i < 32; i++) {
 		char ifbuf[IFNAMSIZ];
 		if (IP6DIFF(ip6s_m2m[i]) != 0) {
@@ -446,10 +377,17 @@ ip6_stats(uint32_t off __unused, char *name, int af __unused)
 			    (unsigned long long)IP6DIFF(ip6s_m2m[i]));
 		}
 	}
-	printf("\t\t%llu one ext mbuf\n",
-	    (unsigned long long)IP6DIFF(ip6s_mext1));
-	printf("\t\t%llu two or more ext mbuf\n",
-	    (unsigned long long)IP6DIFF(ip6s_mext2m));
+}
+
+/* Counts of source addresses selected, by scope */
+static void
+ip6_srcpr(const void *cur, const void *prev)
+{
+	const struct ip6stat *ip6stat = cur, *pip6stat = prev;
+	int first, i;
+
+#define	p(f, m) if (IP6DIFF(f) || sflag <= 1) \
+    printf(m, (unsigned long long)IP6DIFF(f), plural(IP6DIFF(f)))
 
 	/* for debugging source address selection */
 #define PRINT_SCOPESTAT(s,i) do {\
@@ -472,8 +410,6 @@ ip6_stats(uint32_t off __unused, char *name, int af __unused)
 		}\
 	} while (0);
 
-	p(ip6s_sources_none,
-	  "\t\t%llu failure%s of source address selection\n");
 	for (first = 1, i = 0; i < 16; i++) {
 		if (IP6DIFF(ip6s_sources_sameif[i])) {
 			if (first) {
@@ -520,12 +456,102 @@ ip6_stats(uint32_t off __unused, char *name, int af __unused)
 		}
 	}
 
-	if (interval > 0)
-		bcopy(&ip6stat, &pip6stat, len);
-
+#undef p
+#undef PRINT_SCOPESTAT
+}
 #undef IP6DIFF
+
+/*
+ * IP6 statistics, one entry per line of text.
+ */
+#define	p(f, m)		SF_FIELD(SF_P, ip6stat, f, m)
+#define	p1a(f, m)	SF_FIELD(SF_P1A, ip6stat, f, m)
+#define	p_5(f, m)	SF_FIELD(SF_P1A | SF_ALWAYS, ip6stat, f, m)
+static struct statfield ip6fields[] = {
+	p(ip6s_total, "\t%llu total packet%s received\n"),
+	p1a(ip6s_toosmall, "\t\t%llu with size smaller than minimum\n"),
+	p1a(ip6s_tooshort, "\t\t%llu with data size < data length\n"),
+	p1a(ip6s_adj, "\t\t%llu with data size > data length\n"),
+	p(ip6s_adj_hwcsum_clr,
+	    "\t\t\t%llu packet%s forced to software checksum\n"),
+	p1a(ip6s_badoptions, "\t\t%llu with bad options\n"),
+	p1a(ip6s_badvers, "\t\t%llu with incorrect version number\n"),
+	p(ip6s_fragments, "\t\t%llu fragment%s received\n"),
+	p1a(ip6s_fragdropped,
+	    "\t\t\t%llu dropped (dup or out of space)\n"),
+	p1a(ip6s_fragtimeout, "\t\t\t%llu dropped after timeout\n"),
+	p1a(ip6s_fragoverflow, "\t\t\t%llu exceeded limit\n"),
+	p1a(ip6s_reassembled, "\t\t\t%llu reassembled ok\n"),
+	p(ip6s_delivered, "\t\t%llu packet%s for this host\n"),
+	p(ip6s_forward, "\t\t%llu packet%s forwarded\n"),
+	p(ip6s_cantforward, "\t\t%llu packet%s not forwardable\n"),
+	p(ip6s_redirectsent, "\t\t%llu redirect%s sent\n"),
+	p(ip6s_notmember, "\t\t%llu multicast packet%s which we don't join\n"),
+	p(ip6s_exthdrtoolong,
+	    "\t\t%llu packet%s whose headers are not continuous\n"),
+	p(ip6s_nogif, "\t\t%llu tunneling packet%s that can't find gif\n"),
+	p(ip6s_toomanyhdr,
+	    "\t\t%llu packet%s discarded due to too may headers\n"),
+	p1a(ip6s_forward_cachehit, "\t\t%llu forward cache hit\n"),
+	p1a(ip6s_forward_cachemiss, "\t\t%llu forward cache miss\n"),
+	p(ip6s_pktdropcntrl,
+	    "\t\t%llu packet%s dropped due to no bufs for control data\n"),
+	p(ip6s_localout, "\t%llu packet%s sent from this host\n"),
+	p(ip6s_rawout, "\t\t%llu packet%s sent with fabricated ip header\n"),
+	p(ip6s_odropped,
+	    "\t\t%llu output packet%s dropped due to no bufs, etc.\n"),
+	p(ip6s_noroute, "\t\t%llu output packet%s discarded due to no route\n"),
+	p(ip6s_fragmented, "\t\t%llu output datagram%s fragmented\n"),
+	p(ip6s_ofragments, "\t\t%llu fragment%s created\n"),
+	p(ip6s_cantfrag, "\t\t%llu datagram%s that can't be fragmented\n"),
+	p(ip6s_badscope, "\t\t%llu packet%s that violated scope rules\n"),
+	SF_HISTOGRAM(ip6stat, ip6s_nxthist, ip6nh, "\tInput histogram:\n"),
+	SF_TEXT("\tMbuf statistics:\n"),
+	p_5(ip6s_m1, "\t\t%llu one mbuf\n"),
+	SF_FUNC(ip6_m2mpr),
+	p_5(ip6s_mext1, "\t\t%llu one ext mbuf\n"),
+	p_5(ip6s_mext2m, "\t\t%llu two or more ext mbuf\n"),
+	p(ip6s_sources_none,
+	  "\t\t%llu failure%s of source address selection\n"),
+	SF_FUNC(ip6_srcpr),
+};
 #undef p
 #undef p1a
+#undef p_5
+
+/*
+ * Dump IP6 statistics structure.
+ */
+void
+ip6_stats(uint32_t off __unused, char *name, int af __unused)
+{
+	static struct ip6stat pip6stat;
+	static int ip6id;
+	struct ip6stat ip6stat;
+	int mib[4];
+	size_t len;
+
+	mib[0] = CTL_NET;
+	mib[1] = PF_INET6;
+	mib[2] = IPPROTO_IPV6;
+	mib[3] = IPV6CTL_STATS;
+
+	len = sizeof ip6stat;
+	memset(&ip6stat, 0, len);
+	if (sysctl(mib, 4, &ip6stat, &len, (void *)0, 0) < 0)
+		return;
+	if (statfmt != STATFMT_TEXT) {
+		SF_EXPORT(name, ip6fields, &ip6stat, &ip6id);
+		return;
+	}
+    if (interval && vflag > 0)
+        print_time();
+	printf("%s:\n", name);
+
+	SF_PRINT(ip6fields, &ip6stat, &pip6stat);
+
+	if (interval > 0)
+		bcopy(&ip6stat, &pip6stat, len);
 }
 
 /*
@@ -845,6 +871,53 @@ static	char *icmp6names[] = {
 	"#255",
 };
 
+/*
+ * ICMP6 statistics, one entry per line of text.
+ */
+#define	p(f, m)		SF_FIELD(SF_P, icmp6stat, f, m)
+#define	p_5(f, m)	SF_FIELD(SF_P1A | SF_ALWAYS, icmp6stat, f, m)
+#define	hist(f, m)	SF_HISTOGRAM(icmp6stat, f, icmp6names, m)
+static struct statfield icmp6fields[] = {
+	p(icp6s_error, "\t%llu call%s to icmp_error\n"),
+	p(icp6s_canterror,
+	    "\t%llu error%s not generated because old message was icmp error or so\n"),
+	p(icp6s_toofreq,
+	  "\t%llu error%s not generated because rate limitation\n"),
+	hist(icp6s_outhist, "\tOutput histogram:\n"),
+	p(icp6s_badcode, "\t%llu message%s with bad code fields\n"),
+	p(icp6s_tooshort, "\t%llu message%s < minimum length\n"),
+	p(icp6s_checksum, "\t%llu bad checksum%s\n"),
+	p(icp6s_badlen, "\t%llu message%s with bad length\n"),
+	hist(icp6s_inhist, "\tInput histogram:\n"),
+	SF_TEXT("\tHistogram of error messages to be generated:\n"),
+	p_5(icp6s_odst_unreach_noroute, "\t\t%llu no route\n"),
+	p_5(icp6s_odst_unreach_admin, "\t\t%llu administratively prohibited\n"),
+	p_5(icp6s_odst_unreach_beyondscope, "\t\t%llu beyond scope\n"),
+	p_5(icp6s_odst_unreach_addr, "\t\t%llu address unreachable\n"),
+	p_5(icp6s_odst_unreach_noport, "\t\t%llu port unreachable\n"),
+	p_5(icp6s_opacket_too_big, "\t\t%llu packet too big\n"),
+	p_5(icp6s_otime_exceed_transit, "\t\t%llu time exceed transit\n"),
+	p_5(icp6s_otime_exceed_reassembly, "\t\t%llu time exceed reassembly\n"),
+	p_5(icp6s_oparamprob_header, "\t\t%llu erroneous header field\n"),
+	p_5(icp6s_oparamprob_nextheader, "\t\t%llu unrecognized next header\n"),
+	p_5(icp6s_oparamprob_option, "\t\t%llu unrecognized option\n"),
+	p_5(icp6s_oredirect, "\t\t%llu redirect\n"),
+	p_5(icp6s_ounknown, "\t\t%llu unknown\n"),
+
+	p(icp6s_reflect, "\t%llu message response%s generated\n"),
+	p(icp6s_nd_toomanyopt, "\t%llu message%s with too many ND options\n"),
+	p(icp6s_nd_badopt, "\t%llu message%s with bad ND options\n"),
+	p(icp6s_badns, "\t%llu bad neighbor solicitation message%s\n"),
+	p(icp6s_badna, "\t%llu bad neighbor advertisement message%s\n"),
+	p(icp6s_badrs, "\t%llu bad router solicitation message%s\n"),
+	p(icp6s_badra, "\t%llu bad router advertisement message%s\n"),
+	p(icp6s_badredirect, "\t%llu bad redirect message%s\n"),
+	p(icp6s_pmtuchg, "\t%llu path MTU change%s\n"),
+};
+#undef p
+#undef p_5
+#undef hist
+
 /*
  * Dump ICMP6 statistics.
  */
@@ -852,8 +925,8 @@ void
 icmp6_stats(uint32_t off __unused, char *name, int af __unused)
 {
 	static struct icmp6stat picmp6stat;
+	static int icmp6id;
 	struct icmp6stat icmp6stat;
-	register int i, first;
 	int mib[4];
 	size_t len;
 
@@ -866,77 +939,18 @@ icmp6_stats(uint32_t off __unused, char *name, int af __unused)
 	memset(&icmp6stat, 0, len);
 	if (sysctl(mib, 4, &icmp6stat, &len, (void *)0, 0) < 0)
 		return;
+	if (statfmt != STATFMT_TEXT) {
+		SF_EXPORT(name, icmp6fields, &icmp6stat, &icmp6id);
+		return;
+	}
     if (interval && vflag > 0)
         print_time();
 	printf("%s:\n", name);
 
-#define	ICMP6DIFF(f) (icmp6stat.f - picmp6stat.f)
-#define	p(f, m) if (ICMP6DIFF(f) || sflag <= 1) \
-    printf(m, (unsigned long long)ICMP6DIFF(f), plural(ICMP6DIFF(f)))
-#define p_5(f, m) printf(m, (unsigned long long)ICMP6DIFF(f))
-
-	p(icp6s_error, "\t%llu call%s to icmp_error\n");
-	p(icp6s_canterror,
-	    "\t%llu error%s not generated because old message was icmp error or so\n");
-	p(icp6s_toofreq,
-	  "\t%llu error%s not generated because rate limitation\n");
-#define NELEM (sizeof(icmp6stat.icp6s_outhist)/sizeof(icmp6stat.icp6s_outhist[0]))
-	for (first = 1, i = 0; i < NELEM; i++)
-		if (ICMP6DIFF(icp6s_outhist[i]) != 0) {
-			if (first) {
-				printf("\tOutput histogram:\n");
-				first = 0;
-			}
-			printf("\t\t%s: %llu\n", icmp6names[i],
-			    (unsigned long long)ICMP6DIFF(icp6s_outhist[i]));
-		}
-#undef NELEM
-	p(icp6s_badcode, "\t%llu message%s with bad code fields\n");
-	p(icp6s_tooshort, "\t%llu message%s < minimum length\n");
-	p(icp6s_checksum, "\t%llu bad checksum%s\n");
-	p(icp6s_badlen, "\t%llu message%s with bad length\n");
-#define NELEM (sizeof(icmp6stat.icp6s_inhist)/sizeof(icmp6stat.icp6s_inhist[0]))
-	for (first = 1, i = 0; i < NELEM; i++)
-		if (ICMP6DIFF(icp6s_inhist[i]) != 0) {
-			if (first) {
-				printf("\tInput histogram:\n");
-				first = 0;
-			}
-			printf("\t\t%s: %llu\n", icmp6names[i],
-			    (unsigned long long)ICMP6DIFF(icp6s_inhist[i]));
-		}
-#undef NELEM
-	printf("\tHistogram of error messages to be generated:\n");
-	p_5(icp6s_odst_unreach_noroute, "\t\t%llu no route\n");
-	p_5(icp6s_odst_unreach_admin, "\t\t%llu administratively prohibited\n");
-	p_5(icp6s_odst_unreach_beyondscope, "\t\t%llu beyond scope\n");
-	p_5(icp6s_odst_unreach_addr, "\t\t%llu address unreachable\n");
-	p_5(icp6s_odst_unreach_noport, "\t\t%llu port unreachable\n");
-	p_5(icp6s_opacket_too_big, "\t\t%llu packet too big\n");
-	p_5(icp6s_otime_exceed_transit, "\t\t%llu time exceed transit\n");
-	p_5(icp6s_otime_exceed_reassembly, "\t\t%llu time exceed reassembly\n");
-	p_5(icp6s_oparamprob_header, "\t\t%llu erroneous header field\n");
-	p_5(icp6s_oparamprob_nextheader, "\t\t%llu unrecognized next header\n");
-	p_5(icp6s_oparamprob_option, "\t\t%llu unrecognized option\n");
-	p_5(icp6s_oredirect, "\t\t%llu redirect\n");
-	p_5(icp6s_ounknown, "\t\t%llu unknown\n");
-
-	p(icp6s_reflect, "\t%llu message response%s generated\n");
-	p(icp6s_nd_toomanyopt, "\t%llu message%s with too many ND options\n");
-	p(icp6s_nd_badopt, "\t%qu message%s with bad ND options\n");
-	p(icp6s_badns, "\t%qu bad neighbor solicitation message%s\n");
-	p(icp6s_badna, "\t%qu bad neighbor advertisement message%s\n");
-	p(icp6s_badrs, "\t%qu bad router solicitation message%s\n");
-	p(icp6s_badra, "\t%qu bad router advertisement message%s\n");
-	p(icp6s_badredirect, "\t%qu bad redirect message%s\n");
-	p(icp6s_pmtuchg, "\t%llu path MTU change%s\n");
+	SF_PRINT(icmp6fields, &icmp6stat, &picmp6stat);
 
 	if (interval > 0)
 		bcopy(&icmp6stat, &picmp6stat, len);
-
-#undef ICMP6DIFF
-#undef p
-#undef p_5
 }
 
 /*
@@ -1006,6 +1020,28 @@ icmp6_ifstats(char *ifname)
 #undef p
 }
 
+/*
+ * Raw IP6 statistics, one entry per line of text.
+ */
+#define	o(f)		offsetof(struct rip6stat, f)
+#define	p(f, m)		SF_FIELD(SF_P, rip6stat, f, m)
+static struct statfield rip6fields[] = {
+	p(rip6s_ipackets, "\t%llu message%s received\n"),
+	p(rip6s_isum, "\t%llu checksum calcuration%s on inbound\n"),
+	p(rip6s_badsum, "\t%llu message%s with bad checksum\n"),
+	p(rip6s_nosock, "\t%llu message%s dropped due to no socket\n"),
+	p(rip6s_nosockmcast,
+	    "\t%llu multicast message%s dropped due to no socket\n"),
+	p(rip6s_fullsock,
+	    "\t%llu message%s dropped due to full socket buffers\n"),
+	{ SF_LESS, "\t%llu delivered\n", SF_SIZE(rip6stat, rip6s_ipackets), 5,
+	    { o(rip6s_ipackets), o(rip6s_badsum), o(rip6s_nosock),
+	      o(rip6s_nosockmcast), o(rip6s_fullsock) } },
+	p(rip6s_opackets, "\t%llu datagram%s output\n"),
+};
+#undef o
+#undef p
+
 /*
  * Dump raw ip6 statistics structure.
  */
@@ -1013,8 +1049,8 @@ void
 rip6_stats(uint32_t off __unused, char *name, int af __unused)
 {
 	static struct rip6stat prip6stat;
+	static int rip6id;
 	struct rip6stat rip6stat;
-	u_quad_t delivered;
 	int mib[4];
 	size_t l;
 
@@ -1028,35 +1064,19 @@ rip6_stats(uint32_t off __unused, char *name, int af __unused)
 		return;
 	}
 
+	if (statfmt != STATFMT_TEXT) {
+		SF_EXPORT(name, rip6fields, &rip6stat, &rip6id);
+		return;
+	}
+
     if (interval && vflag > 0)
         print_time();
 	printf("%s:\n", name);
 
-#define	RIP6DIFF(f) (rip6stat.f - prip6stat.f)
-#define	p(f, m) if (RIP6DIFF(f) || sflag <= 1) \
-    printf(m, (unsigned long long)RIP6DIFF(f), plural(RIP6DIFF(f)))
-	p(rip6s_ipackets, "\t%llu message%s received\n");
-	p(rip6s_isum, "\t%llu checksum calcuration%s on inbound\n");
-	p(rip6s_badsum, "\t%llu message%s with bad checksum\n");
-	p(rip6s_nosock, "\t%llu message%s dropped due to no socket\n");
-	p(rip6s_nosockmcast,
-	    "\t%llu multicast message%s dropped due to no socket\n");
-	p(rip6s_fullsock,
-	    "\t%llu message%s dropped due to full socket buffers\n");
-	delivered = RIP6DIFF(rip6s_ipackets) -
-		    RIP6DIFF(rip6s_badsum) -
-		    RIP6DIFF(rip6s_nosock) -
-		    RIP6DIFF(rip6s_nosockmcast) -
-		    RIP6DIFF(rip6s_fullsock);
-	if (delivered || sflag <= 1)
-		printf("\t%llu delivered\n", (unsigned long long)delivered);
-	p(rip6s_opackets, "\t%llu datagram%s output\n");
+	SF_PRINT(rip6fields, &rip6stat, &prip6stat);
 
 	if (interval > 0)
 		bcopy(&rip6stat, &prip6stat, l);
-
-#undef RIP6DIFF
-#undef p
 }
 
 /*
@@ -1117,7 +1137,6 @@ inet6name(struct in6_addr *in6p)
 {
 	register char *cp;
 	static char line[50];
-	struct hostent *hp;
 	static char domain[MAXHOSTNAMELEN];
 	static int first = 1;
 	char hbuf[NI_MAXHOST];
@@ -1134,18 +1153,22 @@ inet6name(struct in6_addr *in6p)
 	}
 	cp = 0;
 	if (!nflag && !IN6_IS_ADDR_UNSPECIFIED(in6p)) {
-		hp = gethostbyaddr((char *)in6p, sizeof(*in6p), AF_INET6);
-		if (hp) {
-			if ((cp = index(hp->h_name, '.')) &&
-			    !strcmp(cp + 1, domain))
-				*cp = 0;
-			cp = hp->h_name;
-		}
+		memset(&sin6, 0, sizeof(sin6));
+		sin6.sin6_len = sizeof(sin6);
+		sin6.sin6_family = AF_INET6;
+		sin6.sin6_addr = *in6p;
+		cp = (char *)addr_name((struct sockaddr *)&sin6);
 	}
 	if (IN6_IS_ADDR_UNSPECIFIED(in6p))
 		strlcpy(line, "*", sizeof(line));
-	else if (cp)
-		strlcpy(line, cp, sizeof(line));
+	else if (cp) {
+		char *dp;
+
+		if ((dp = index(cp, '.')) && !strcmp(dp + 1, domain))
+			snprintf(line, sizeof(line), "%.*s", (int)(dp - cp), cp);
+		else
+			strlcpy(line, cp, sizeof(line));
+	}
 	else {
 		memset(&sin6, 0, sizeof(sin6));
 		sin6.sin6_len = sizeof(sin6);
@@ -86,6 +86,8 @@ char const copyright[] =
 #include "netstat.h"
 #include <sys/types.h>
 #include <sys/sysctl.h>
+#include <sys/time.h>
+#include <time.h>
 
 #ifdef __APPLE__
 #include <TargetConditionals.h>
@@ -169,6 +171,7 @@ struct protox *protoprotox[] = {
 };
 
 static void printproto (struct protox *, char *);
+static void exportpr (struct protox *);
 static void usage (void);
 static struct protox *name2protox (char *);
 static struct protox *knownname (char *);
@@ -202,8 +205,15 @@ int	qflag;		/* classq stats display */
 int	Qflag;		/* opportunistic polling stats display */
 int	xflag;		/* show extended link-layer reachability information */
 
+char	*pcbfile;	/* saved PCB list to show instead (-M) */
+int	topcount;	/* busiest sockets to show (-T) */
+int	topkey;		/* rank them by packets, not bytes (-o) */
+int	statfmt;	/* format of protocol statistics (-O) */
+int	statids;	/* binary schemas written so far */
+
 int	cq = -1;	/* send classq index (-1 for all) */
 int	interval;	/* repeat interval for i/f stats */
+static double statwait;	/* the same, to the fraction, for -O */
 
 char	*interface;	/* desired i/f for stats, or NULL for all i/fs */
 int	unit;		/* unit number for above */
@@ -220,7 +230,7 @@ main(argc, argv)
 
 	af = AF_UNSPEC;
 
-	while ((ch = getopt(argc, argv, "Aabc:dFf:gI:iLlmnP:p:qQrRstuvWw:x")) != -1)
+	while ((ch = getopt(argc, argv, "Aabc:dFf:gI:iLlM:mnO:o:P:p:qQrRsT:tuvWw:x")) != -1)
 		switch(ch) {
 		case 'A':
 			Aflag = 1;
@@ -285,12 +295,31 @@ main(argc, argv)
 		case 'L':
 			Lflag = 1;
 			break;
+		case 'M':
+			pcbfile = optarg;
+			break;
 		case 'm':
 			mflag++;
 			break;
 		case 'n':
 			nflag = 1;
 			break;
+		case 'O':
+			if (strcmp(optarg, "json") == 0)
+				statfmt = STATFMT_JSON;
+			else if (strcmp(optarg, "binary") == 0)
+				statfmt = STATFMT_BINARY;
+			else
+				errx(1, "%s: not json or binary", optarg);
+			break;
+		case 'o':
+			if (strcmp(optarg, "packets") == 0)
+				topkey = 1;
+			else if (strcmp(optarg, "bytes") == 0)
+				topkey = 0;
+			else
+				errx(1, "%s: not bytes or packets", optarg);
+			break;
 		case 'P':
 			prioflag = atoi(optarg);
 			break;
@@ -317,6 +346,11 @@ main(argc, argv)
 		case 's':
 			++sflag;
 			break;
+		case 'T':
+			topcount = atoi(optarg);
+			if (topcount <= 0)
+				usage();
+			break;
 		case 't':
 			tflag = 1;
 			break;
@@ -331,6 +365,7 @@ main(argc, argv)
 			break;
 		case 'w':
 			interval = atoi(optarg);
+			statwait = strtod(optarg, NULL);
 			iflag = 1;
 			break;
 		case 'x':
@@ -351,6 +386,7 @@ main(argc, argv)
 			interval = atoi(*argv);
 			if (interval <= 0)
 				usage();
+			statwait = interval;
 			++argv;
 			iflag = 1;
 		}
@@ -361,6 +397,28 @@ main(argc, argv)
 		mbpr();
 		exit(0);
 	}
+	if (topcount > 0) {
+		if ((tp != NULL && tp->pr_cblocks != protopr) || pcbfile ||
+		    (af != AF_UNSPEC && af != AF_INET
+#ifdef INET6
+		    && af != AF_INET6
+#endif
+		    ))
+			errx(1, "-T shows only Internet sockets of the running system");
+		toppr(tp ? tp->pr_protocol : 0, tp ? tp->pr_name : NULL);
+	}
+	if (statfmt != STATFMT_TEXT) {
+		if (!sflag)
+			errx(1, "-O needs -s");
+		if (interface != NULL || pcbfile || (af != AF_UNSPEC &&
+		    af != AF_INET
+#ifdef INET6
+		    && af != AF_INET6
+#endif
+		    ))
+			errx(1, "-O exports only Internet protocol statistics");
+		exportpr(tp);
+	}
 	if (iflag && !sflag && !gflag && !qflag && !Qflag) {
 		if (Rflag)
 			intpr_ri(NULL);
@@ -395,6 +453,10 @@ main(argc, argv)
 	}
 #endif
 
+	if (pcbfile != NULL && (tp == NULL || tp->pr_cblocks != protopr ||
+	    sflag))
+		errx(1, "-M needs -p with an Internet protocol");
+
 	if (tp) {
 		printproto(tp, tp->pr_name);
 		exit(0);
@@ -476,6 +538,94 @@ printproto(tp, name)
 	}
 }
 
+/*
+ * Whether tp is an Internet protocol whose statistics -O can export.
+ */
+static int
+exportable(struct protox *tp)
+{
+	struct protox *p;
+
+	if (tp->pr_stats == NULL)
+		return (0);
+#ifdef IPSEC
+	if (tp->pr_stats == ipsec_stats)
+		return (0);
+#endif
+	for (p = protox; p->pr_name; p++)
+		if (p == tp)
+			return (1);
+#ifdef INET6
+	for (p = ip6protox; p->pr_name; p++)
+		if (p == tp)
+			return (1);
+#endif
+	return (0);
+}
+
+/*
+ * Export the statistics of tp, or of every Internet protocol in the
+ * address family, in the format -O asked for.  With -w they are
+ * exported again every statwait seconds, which may be a fraction; the
+ * samples keep to that schedule however long each one takes.
+ */
+static void
+exportpr(struct protox *tp)
+{
+	void (*done[32])(uint32_t, char *, int);
+	struct protox *tables[2], *p;
+	struct timeval next, now, wait;
+	struct timespec ts;
+	int i, j, n, ndone;
+
+	if (tp != NULL && !exportable(tp))
+		errx(1, "%s: no statistics to export", tp->pr_name);
+	n = 0;
+	if (af == AF_INET || af == AF_UNSPEC)
+		tables[n++] = protox;
+#ifdef INET6
+	if (af == AF_INET6 || af == AF_UNSPEC)
+		tables[n++] = ip6protox;
+#endif
+	timerclear(&wait);
+	if (statwait > 0) {
+		wait.tv_sec = (time_t)statwait;
+		wait.tv_usec = (suseconds_t)((statwait - wait.tv_sec) * 1000000);
+	}
+	(void) gettimeofday(&next, NULL);
+	for (;;) {
+		if (tp != NULL)
+			(*tp->pr_stats)(tp->pr_protocol, tp->pr_name, af);
+		for (ndone = 0, i = 0; tp == NULL && i < n; i++)
+			for (p = tables[i]; p->pr_name; p++) {
+				if (!exportable(p))
+					continue;
+				/* tcp and udp are in both tables */
+				for (j = 0; j < ndone; j++)
+					if (done[j] == p->pr_stats)
+						break;
+				if (j < ndone)
+					continue;
+				done[ndone++] = p->pr_stats;
+				(*p->pr_stats)(p->pr_protocol, p->pr_name, af);
+			}
+		fflush(stdout);
+		if (!timerisset(&wait))
+			exit(0);
+
+		timeradd(&next, &wait, &next);
+		(void) gettimeofday(&now, NULL);
+		if (timercmp(&next, &now, <)) {
+			next = now;
+			continue;
+		}
+		timersub(&next, &now, &now);
+		ts.tv_sec = now.tv_sec;
+		ts.tv_nsec = now.tv_usec * 1000;
+		(void) nanosleep(&ts, NULL);
+	}
+}
+
 char *
 plural(int n)
 {
@@ -541,9 +691,14 @@ name2protox(char *name)
 
 #define	NETSTAT_USAGE "\
 Usage:	netstat [-AaLlnW] [-f address_family | -p protocol]\n\
+	netstat [-AaLlnW] -p protocol -M pcblist\n\
+	netstat -T count [-n] [-o bytes | packets] [-w wait]\n\
+		[-f address_family | -p protocol]\n\
 	netstat [-gilns] [-f address_family]\n\
 	netstat -i | -I interface [-w wait] [-abdgRt]\n\
 	netstat -s [-s] [-f address_family | -p protocol] [-w wait]\n\
+	netstat -s -O json | binary [-f address_family | -p protocol]\n\
+		[-w wait]\n\
 	netstat -i | -I interface -s [-f address_family | -p protocol]\n\
 	netstat -m [-m]\n\
 	netstat -r [-Aaln] [-f address_family]\n\
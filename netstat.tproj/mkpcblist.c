@@ -0,0 +1,134 @@
+/*
+ * Write the TCP PCB list that pcblist.test feeds to netstat -M.
+ *
+ * The records are laid out as the kernel lays out those of the
+ * net.inet.tcp.pcblist_n sysctl, from the same headers netstat is
+ * built with, so the list matches the system the test runs on.  Beside
+ * PCBs that are shown it holds the cases the decoder has to get past: a
+ * record of a kind it does not know, a PCB cut short by the next one, a
+ * PCB newer than the list, a socket of another protocol and a closing
+ * generation count that differs from the opening one.
+ */
+
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/socketvar.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/in_pcb.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_fsm.h>
+#include <netinet/tcp_var.h>
+
+#include <arpa/inet.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pcblist.h"
+
+#define	GEN	100			/* generation of the list */
+
+static char buf[16384];
+static size_t len;
+
+/* Add a zeroed record of the given kind and size */
+static void *
+record(u_int32_t kind, size_t size)
+{
+	struct xgen_n *xgn;
+
+	if (len + ROUNDUP64(size) > sizeof(buf))
+		errx(1, "list too long");
+	xgn = (struct xgen_n *)(buf + len);
+	xgn->xgn_len = size;
+	xgn->xgn_kind = kind;
+	len += ROUNDUP64(size);
+	return (xgn);
+}
+
+static void
+generation(u_int count, inp_gen_t gen)
+{
+	struct xinpgen *xig;
+
+	xig = (struct xinpgen *)(buf + len);
+	len += ROUNDUP64(sizeof(*xig));
+	xig->xig_len = sizeof(*xig);
+	xig->xig_count = count;
+	xig->xig_gen = gen;
+	xig->xig_sogen = gen;
+}
+
+/*
+ * A PCB, in the order the kernel writes its records.  Only the first
+ * nrec records are written, to make one that is cut short.
+ */
+static void
+pcb(int proto, const char *laddr, int lport, const char *faddr, int fport,
+    int state, u_int rcvcc, u_int sndcc, inp_gen_t gencnt, int nrec)
+{
+	struct xinpcb_n *inp;
+	struct xsocket_n *so;
+	struct xsockbuf_n *sb;
+	struct xtcpcb_n *tp;
+
+	inp = record(XSO_INPCB, sizeof(*inp));
+	inp->inp_vflag = INP_IPV4;
+	inp->inp_gencnt = gencnt;
+	inet_aton(laddr, &inp->inp_laddr);
+	inet_aton(faddr, &inp->inp_faddr);
+	inp->inp_lport = htons(lport);
+	inp->inp_fport = htons(fport);
+	if (--nrec == 0)
+		return;
+	so = record(XSO_SOCKET, sizeof(*so));
+	so->xso_protocol = proto;
+	so->so_qlimit = state == TCPS_LISTEN ? 128 : 0;
+	if (--nrec == 0)
+		return;
+	sb = record(XSO_RCVBUF, sizeof(*sb));
+	sb->sb_cc = rcvcc;
+	sb->sb_hiwat = 131072;
+	if (--nrec == 0)
+		return;
+	sb = record(XSO_SNDBUF, sizeof(*sb));
+	sb->sb_cc = sndcc;
+	sb->sb_hiwat = 131072;
+	if (--nrec == 0)
+		return;
+	(void)record(XSO_STATS, sizeof(struct xsockstat_n));
+	if (--nrec == 0)
+		return;
+	tp = record(XSO_TCPCB, sizeof(*tp));
+	tp->t_state = state;
+}
+
+int
+main(void)
+{
+
+	generation(4, GEN);
+	pcb(IPPROTO_TCP, "0.0.0.0", 22, "0.0.0.0", 0,
+	    TCPS_LISTEN, 0, 0, 10, 6);
+	(void)record(0x10000000, 40);
+	pcb(IPPROTO_TCP, "192.0.2.1", 22, "198.51.100.7", 51000,
+	    TCPS_ESTABLISHED, 0, 36, 11, 6);
+	pcb(IPPROTO_TCP, "192.0.2.1", 80, "198.51.100.8", 52000,
+	    TCPS_ESTABLISHED, 0, 0, 12, 3);
+	pcb(IPPROTO_TCP, "192.0.2.1", 8080, "198.51.100.9", 53000,
+	    TCPS_ESTABLISHED, 0, 0, GEN + 1, 6);
+	pcb(IPPROTO_UDP, "192.0.2.1", 53, "0.0.0.0", 0,
+	    TCPS_CLOSED, 0, 0, 13, 6);
+	pcb(IPPROTO_TCP, "192.0.2.1", 443, "203.0.113.5", 40000,
+	    TCPS_CLOSE_WAIT, 517, 0, 14, 6);
+	generation(5, GEN + 1);
+
+	if (fwrite(buf, 1, len, stdout) != len || fflush(stdout) != 0)
+		err(1, "stdout");
+	return (0);
+}
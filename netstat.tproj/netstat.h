@@ -91,6 +91,17 @@ extern int	qflag;	/* Display ifclassq stats */
 extern int	Qflag;	/* Display opportunistic polling stats */
 extern int	xflag;	/* show extended link-layer reachability information */
 
+extern char	*pcbfile; /* saved PCB list to show (-M) */
+extern int	topcount; /* busiest sockets to show (-T) */
+extern int	topkey;	/* rank them by packets, not bytes (-o) */
+
+extern int	statfmt; /* format of protocol statistics (-O) */
+extern int	statids; /* binary schemas written so far */
+
+#define	STATFMT_TEXT	0
+#define	STATFMT_JSON	1
+#define	STATFMT_BINARY	2
+
 extern int	cq;	/* send classq index (-1 for all) */
 extern int	interval; /* repeat interval for i/f stats */
 
@@ -104,6 +115,7 @@ extern char	*plurales(int);
 extern char	*pluralies(int);
 
 extern void	protopr(uint32_t, char *, int);
+extern void	toppr(uint32_t, char *);
 extern void	mptcppr(uint32_t, char *, int);
 extern void	tcp_stats(uint32_t, char *, int);
 extern void	mptcp_stats(uint32_t, char *, int);
@@ -153,6 +165,9 @@ extern void	rt_stats(void);
 extern void	upHex(char *);
 extern char	*routename(uint32_t);
 extern char	*netname(uint32_t, uint32_t);
+struct sockaddr;
+extern void	addr_prefetch(struct sockaddr *);
+extern const char *addr_name(struct sockaddr *);
 extern void	routepr(void);
 
 extern void	unixpr(void);
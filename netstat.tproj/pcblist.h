@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2013 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Decoder for the PCB lists of the net.inet.*.pcblist_n sysctls, kept
+ * in a header of inline functions like the name lookups.
+ *
+ * A list is a struct xinpgen, then for each PCB a run of records, one
+ * of each kind (socket, buffers, statistics, inpcb and, for TCP, the
+ * tcpcb), each starting with its length and kind, and last another
+ * struct xinpgen.  The iterator hands out one PCB at a time, pointing
+ * into the buffer rather than copying, and checks every length against
+ * the buffer so a list saved to a file and cut short decodes safely.
+ * It only needs the socket and PCB headers included before it.
+ */
+
+#ifndef _PCBLIST_H_
+#define _PCBLIST_H_
+
+#ifndef ROUNDUP64
+#define ROUNDUP64(a) \
+	((a) > 0 ? (1 + (((a) - 1) | (sizeof(uint64_t) - 1))) : sizeof(uint64_t))
+#endif
+
+struct xgen_n {
+	u_int32_t	xgn_len;			/* length of this structure */
+	u_int32_t	xgn_kind;		/* number of PCBs at this time */
+};
+
+#define ALL_XGN_KIND_INP (XSO_SOCKET | XSO_RCVBUF | XSO_SNDBUF | XSO_STATS | XSO_INPCB)
+#define ALL_XGN_KIND_TCP (ALL_XGN_KIND_INP | XSO_TCPCB)
+
+struct pcb_rec {
+	struct xsocket_n	*so;
+	struct xsockbuf_n	*rcv;
+	struct xsockbuf_n	*snd;
+	struct xsockstat_n	*stat;
+	struct xinpcb_n		*inp;
+	struct xtcpcb_n		*tp;		/* TCP lists only */
+};
+
+struct pcb_iter {
+	char			*next;		/* next record to decode */
+	char			*end;
+	struct xinpgen		*head;		/* generation at the start */
+	struct xinpgen		*tail;		/* and at the end, if seen */
+	u_int32_t		want;		/* kinds that make up a PCB */
+	u_int32_t		have;		/* kinds seen of this one */
+	struct pcb_rec		rec;
+};
+
+/* Start on the list in buf; -1 if it is too short to hold one */
+static __inline int
+pcb_iter_init(struct pcb_iter *it, char *buf, size_t len, int istcp)
+{
+
+	bzero(it, sizeof(*it));
+	if (len < sizeof(struct xinpgen))
+		return (-1);
+	it->head = (struct xinpgen *)buf;
+	if (it->head->xig_len < sizeof(struct xinpgen) ||
+	    ROUNDUP64(it->head->xig_len) > len)
+		return (-1);
+	it->next = buf + ROUNDUP64(it->head->xig_len);
+	it->end = buf + len;
+	it->want = istcp ? ALL_XGN_KIND_TCP : ALL_XGN_KIND_INP;
+	return (0);
+}
+
+/*
+ * The next PCB, or NULL at the end of the list.  Kinds not wanted are
+ * skipped, so a kernel that adds a kind does not upset the decoding,
+ * and a kind seen twice starts a new PCB, dropping one left incomplete.
+ */
+static __inline struct pcb_rec *
+pcb_iter_next(struct pcb_iter *it)
+{
+	struct xgen_n *xgn;
+	size_t left, need;
+
+	while ((left = it->end - it->next) >= sizeof(*xgn)) {
+		xgn = (struct xgen_n *)it->next;
+		if (xgn->xgn_len <= sizeof(struct xinpgen)) {
+			/* the closing generation count */
+			if (left >= sizeof(struct xinpgen))
+				it->tail = (struct xinpgen *)xgn;
+			break;
+		}
+		if (ROUNDUP64(xgn->xgn_len) > left)
+			break;
+		it->next += ROUNDUP64(xgn->xgn_len);
+
+		if (xgn->xgn_kind & ~it->want)
+			continue;
+		switch (xgn->xgn_kind) {
+			case XSO_SOCKET:
+				need = sizeof(struct xsocket_n);
+				break;
+			case XSO_RCVBUF:
+			case XSO_SNDBUF:
+				need = sizeof(struct xsockbuf_n);
+				break;
+			case XSO_STATS:
+				need = sizeof(struct xsockstat_n);
+				break;
+			case XSO_INPCB:
+				need = sizeof(struct xinpcb_n);
+				break;
+			case XSO_TCPCB:
+				need = sizeof(struct xtcpcb_n);
+				break;
+			default:
+				continue;
+		}
+		if (xgn->xgn_len < need)
+			continue;
+		if (it->have & xgn->xgn_kind)
+			it->have = 0;
+		it->have |= xgn->xgn_kind;
+		switch (xgn->xgn_kind) {
+			case XSO_SOCKET:
+				it->rec.so = (struct xsocket_n *)xgn;
+				break;
+			case XSO_RCVBUF:
+				it->rec.rcv = (struct xsockbuf_n *)xgn;
+				break;
+			case XSO_SNDBUF:
+				it->rec.snd = (struct xsockbuf_n *)xgn;
+				break;
+			case XSO_STATS:
+				it->rec.stat = (struct xsockstat_n *)xgn;
+				break;
+			case XSO_INPCB:
+				it->rec.inp = (struct xinpcb_n *)xgn;
+				break;
+			case XSO_TCPCB:
+				it->rec.tp = (struct xtcpcb_n *)xgn;
+				break;
+		}
+		if (it->have == it->want) {
+			it->have = 0;
+			return (&it->rec);
+		}
+	}
+	it->next = it->end;
+	return (NULL);
+}
+
+#endif /* !_PCBLIST_H_ */
@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2013 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Reverse name lookups shared by netstat, ping and traceroute, kept in
+ * a header of inline functions like the round-trip histogram.
+ *
+ * Every address asked about gets one entry in a hash table, and the
+ * entry is never freed, so a name returned stays valid.  Lookups are
+ * done by a pool of threads calling getnameinfo(), started as work is
+ * queued, so a caller can queue the addresses of a whole table with
+ * rdns_prefetch() and have them resolved in parallel while it prints.
+ * rdns_name() returns the name once it is known, waiting for it as
+ * long as the caller allows; a failed lookup is remembered for
+ * RDNS_RETRY seconds before it is tried again.
+ */
+
+#ifndef _RDNS_H_
+#define _RDNS_H_
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef RDNS_WORKERS
+#define	RDNS_WORKERS	32		/* most lookups in flight at once */
+#endif
+#define	RDNS_BUCKETS	(1 << 16)
+#define	RDNS_RETRY	60		/* seconds a failure is remembered */
+
+#define	RDNS_QUEUED	0		/* waiting for a thread */
+#define	RDNS_BUSY	1		/* being looked up */
+#define	RDNS_DONE	2		/* name is known */
+#define	RDNS_FAILED	3		/* address has no name */
+
+struct rdns_entry {
+	struct rdns_entry	*next;		/* hash chain */
+	TAILQ_ENTRY(rdns_entry)	link;		/* queue of lookups */
+	int			family;
+	union {
+		struct in_addr	in;
+		struct in6_addr	in6;
+	}			addr;
+	u_int32_t		scope;		/* sin6_scope_id */
+	int			state;
+	time_t			expire;		/* when a failure is retried */
+	char			*name;
+};
+
+static struct rdns {
+	pthread_mutex_t		lock;
+	pthread_cond_t		work;		/* something was queued */
+	pthread_cond_t		done;		/* some lookup finished */
+	struct rdns_entry	**bucket;
+	TAILQ_HEAD(, rdns_entry) queue;
+	int			nqueued;
+	int			nworkers;
+	int			nidle;
+} rdns = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER, NULL, { NULL, NULL }, 0, 0, 0
+};
+
+static __inline void
+rdns_resolve(struct rdns_entry *e)
+{
+	struct sockaddr_storage ss;
+	struct sockaddr_in *sin;
+	struct sockaddr_in6 *sin6;
+	char host[NI_MAXHOST];
+	char *name;
+	socklen_t len;
+
+	memset(&ss, 0, sizeof(ss));
+	if (e->family == AF_INET) {
+		sin = (struct sockaddr_in *)&ss;
+		len = sin->sin_len = sizeof(*sin);
+		sin->sin_family = AF_INET;
+		sin->sin_addr = e->addr.in;
+	} else {
+		sin6 = (struct sockaddr_in6 *)&ss;
+		len = sin6->sin6_len = sizeof(*sin6);
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_addr = e->addr.in6;
+		sin6->sin6_scope_id = e->scope;
+	}
+	name = NULL;
+	if (getnameinfo((struct sockaddr *)&ss, len, host, sizeof(host), NULL, 0,
+	    NI_NAMEREQD) == 0)
+		name = strdup(host);
+
+	pthread_mutex_lock(&rdns.lock);
+	if (name != NULL) {
+		e->name = name;
+		e->state = RDNS_DONE;
+	} else {
+		e->state = RDNS_FAILED;
+		e->expire = time(NULL) + RDNS_RETRY;
+	}
+	pthread_cond_broadcast(&rdns.done);
+	pthread_mutex_unlock(&rdns.lock);
+}
+
+static __inline void *
+rdns_worker(void *arg)
+{
+	struct rdns_entry *e;
+
+	pthread_mutex_lock(&rdns.lock);
+	for (;;) {
+		while ((e = TAILQ_FIRST(&rdns.queue)) == NULL) {
+			rdns.nidle++;
+			pthread_cond_wait(&rdns.work, &rdns.lock);
+			rdns.nidle--;
+		}
+		TAILQ_REMOVE(&rdns.queue, e, link);
+		rdns.nqueued--;
+		e->state = RDNS_BUSY;
+		pthread_mutex_unlock(&rdns.lock);
+		rdns_resolve(e);
+		pthread_mutex_lock(&rdns.lock);
+	}
+	/* NOTREACHED */
+	return (arg);
+}
+
+/* Queue e, starting another thread if none is free to take it */
+static __inline void
+rdns_enqueue(struct rdns_entry *e)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t all, omask;
+
+	e->state = RDNS_QUEUED;
+	TAILQ_INSERT_TAIL(&rdns.queue, e, link);
+	rdns.nqueued++;
+	if (rdns.nqueued > rdns.nidle && rdns.nworkers < RDNS_WORKERS) {
+		/* Leave the signals the tool handles to its own thread */
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &omask);
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (pthread_create(&thread, &attr, rdns_worker, NULL) == 0)
+			rdns.nworkers++;
+		pthread_attr_destroy(&attr);
+		pthread_sigmask(SIG_SETMASK, &omask, NULL);
+	}
+	pthread_cond_signal(&rdns.work);
+}
+
+/*
+ * The entry for the address in sa, queued for lookup if it is new or
+ * its last lookup failed long enough ago.  NULL for addresses that
+ * are not looked up at all.  Called with the lock held.
+ */
+static __inline struct rdns_entry *
+rdns_entry(const struct sockaddr *sa)
+{
+	struct rdns_entry *e, **bp;
+	const u_char *p;
+	u_int32_t h, scope;
+	size_t len;
+	int i;
+
+	if (sa->sa_family == AF_INET) {
+		p = (const u_char *)&((const struct sockaddr_in *)sa)->sin_addr;
+		len = sizeof(struct in_addr);
+		scope = 0;
+		if (((const struct sockaddr_in *)sa)->sin_addr.s_addr ==
+		    INADDR_ANY)
+			return (NULL);
+	} else if (sa->sa_family == AF_INET6) {
+		p = (const u_char *)&((const struct sockaddr_in6 *)sa)->sin6_addr;
+		len = sizeof(struct in6_addr);
+		scope = ((const struct sockaddr_in6 *)sa)->sin6_scope_id;
+		if (IN6_IS_ADDR_UNSPECIFIED(
+		    &((const struct sockaddr_in6 *)sa)->sin6_addr))
+			return (NULL);
+	} else
+		return (NULL);
+
+	if (rdns.bucket == NULL) {
+		rdns.bucket = calloc(RDNS_BUCKETS, sizeof(*rdns.bucket));
+		if (rdns.bucket == NULL)
+			return (NULL);
+		TAILQ_INIT(&rdns.queue);
+	}
+	h = 2166136261U ^ scope;
+	for (i = 0; i < len; i++)
+		h = (h ^ p[i]) * 16777619U;
+	bp = &rdns.bucket[h & (RDNS_BUCKETS - 1)];
+	for (e = *bp; e != NULL; e = e->next)
+		if (e->family == sa->sa_family && e->scope == scope &&
+		    memcmp(&e->addr, p, len) == 0)
+			break;
+	if (e == NULL) {
+		if ((e = calloc(1, sizeof(*e))) == NULL)
+			return (NULL);
+		e->family = sa->sa_family;
+		memcpy(&e->addr, p, len);
+		e->scope = scope;
+		e->next = *bp;
+		*bp = e;
+		rdns_enqueue(e);
+	} else if (e->state == RDNS_FAILED && time(NULL) >= e->expire)
+		rdns_enqueue(e);
+	return (e);
+}
+
+/* Start looking up the name of sa, if that is not already done */
+static __inline void
+rdns_prefetch(const struct sockaddr *sa)
+{
+
+	pthread_mutex_lock(&rdns.lock);
+	(void)rdns_entry(sa);
+	pthread_mutex_unlock(&rdns.lock);
+}
+
+/* Whether rdns_name() can answer for sa without waiting */
+static __inline int
+rdns_ready(const struct sockaddr *sa)
+{
+	struct rdns_entry *e;
+	int ready;
+
+	pthread_mutex_lock(&rdns.lock);
+	e = rdns_entry(sa);
+	ready = e == NULL || e->state == RDNS_DONE || e->state == RDNS_FAILED;
+	pthread_mutex_unlock(&rdns.lock);
+	return (ready);
+}
+
+/*
+ * The name of the address in sa, or NULL if it has none or it is not
+ * known within msecs milliseconds.  A negative msecs waits as long as
+ * the lookup takes, and looks the address up at once rather than
+ * waiting behind the queue.
+ */
+static __inline const char *
+rdns_name(const struct sockaddr *sa, int msecs)
+{
+	struct rdns_entry *e;
+	struct timespec ts;
+	struct timeval now;
+	const char *name;
+
+	pthread_mutex_lock(&rdns.lock);
+	if ((e = rdns_entry(sa)) == NULL) {
+		pthread_mutex_unlock(&rdns.lock);
+		return (NULL);
+	}
+	if (msecs < 0 && e->state == RDNS_QUEUED) {
+		TAILQ_REMOVE(&rdns.queue, e, link);
+		rdns.nqueued--;
+		e->state = RDNS_BUSY;
+		pthread_mutex_unlock(&rdns.lock);
+		rdns_resolve(e);
+		pthread_mutex_lock(&rdns.lock);
+	} else if (msecs != 0) {
+		gettimeofday(&now, NULL);
+		ts.tv_sec = now.tv_sec + msecs / 1000;
+		ts.tv_nsec = now.tv_usec * 1000 + (msecs % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_nsec -= 1000000000;
+			ts.tv_sec++;
+		}
+		while (e->state == RDNS_QUEUED || e->state == RDNS_BUSY) {
+			if (msecs < 0)
+				pthread_cond_wait(&rdns.done, &rdns.lock);
+			else if (pthread_cond_timedwait(&rdns.done,
+			    &rdns.lock, &ts) != 0)
+				break;
+		}
+	}
+	name = e->state == RDNS_DONE ? e->name : NULL;
+	pthread_mutex_unlock(&rdns.lock);
+	return (name);
+}
+
+#endif /* !_RDNS_H_ */
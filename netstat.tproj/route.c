@@ -83,6 +83,7 @@
 #include <err.h>
 #include <time.h>
 #include "netstat.h"
+#include "rdns.h"
 
 /* alignment constraint for routing socket */
 #define ROUNDUP(a) \
@@ -129,10 +130,14 @@ typedef union {
 } sa_u;
 
 static void np_rtentry __P((struct rt_msghdr2 *));
+static void np_prefetch __P((struct rt_msghdr2 *));
 static void p_sockaddr __P((struct sockaddr *, struct sockaddr *, int, int));
 static void p_flags __P((int, char *));
 static uint32_t forgemask __P((uint32_t));
 static void domask __P((char *, uint32_t, uint32_t));
+#ifdef INET6
+static void in6_fillscopeid __P((struct sockaddr_in6 *));
+#endif
 
 /*
  * Print address family header before a section of the routing table.
@@ -236,6 +241,12 @@ routepr(void)
 		err(1, "sysctl: net.route.0.0.dump");
 	}
 	lim  = buf + needed;
+	if (!nflag) {
+		for (next = buf; next < lim; next += rtm->rtm_msglen) {
+			rtm = (struct rt_msghdr2 *)next;
+			np_prefetch(rtm);
+		}
+	}
 	for (next = buf; next < lim; next += rtm->rtm_msglen) {
 		rtm = (struct rt_msghdr2 *)next;
 		np_rtentry(rtm);
@@ -257,6 +268,42 @@ get_rtaddrs(int addrs, struct sockaddr *sa, struct sockaddr **rti_info)
 }
 }
 
+/*
+ * Start the name lookups that np_rtentry() will make for this route,
+ * so that those of the whole table run in parallel.
+ */
+static void
+np_prefetch(struct rt_msghdr2 *rtm)
+{
+	struct sockaddr *sa = (struct sockaddr *)(rtm + 1);
+	struct sockaddr *rti_info[RTAX_MAX];
+	sa_u addr;
+	int i;
+
+	if ((rtm->rtm_flags & RTF_WASCLONED) &&
+	    (rtm->rtm_parentflags & RTF_PRCLONING) &&
+	    !aflag)
+		return;
+	if (af != AF_UNSPEC && af != sa->sa_family)
+		return;
+	get_rtaddrs(rtm->rtm_addrs, sa, rti_info);
+	for (i = 0; i < RTAX_MAX; i++) {
+		if ((i != RTAX_DST && i != RTAX_GATEWAY) || rti_info[i] == NULL)
+			continue;
+		/* netname() does not look up IPv4 networks */
+		if (i == RTAX_DST && rti_info[i]->sa_family == AF_INET &&
+		    !(rtm->rtm_flags & RTF_HOST))
+			continue;
+		bzero(&addr, sizeof(addr));
+		bcopy(rti_info[i], &addr, rti_info[i]->sa_len);
+#ifdef INET6
+		if (addr.u_sa.sa_family == AF_INET6)
+			in6_fillscopeid((struct sockaddr_in6 *)&addr.u_sa);
+#endif
+		addr_prefetch(&addr.u_sa);
+	}
+}
+
 static void
 np_rtentry(struct rt_msghdr2 *rtm)
 {
@@ -354,20 +401,8 @@ p_sockaddr(struct sockaddr *sa, struct sockaddr *mask, int flags, int width)
 #ifdef INET6
 	case AF_INET6: {
 		struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)sa;
-		struct in6_addr *in6 = &sa6->sin6_addr;
-
-		/*
-		 * XXX: This is a special workaround for KAME kernels.
-		 * sin6_scope_id field of SA should be set in the future.
-		 */
-		if (IN6_IS_ADDR_LINKLOCAL(in6) ||
-		    IN6_IS_ADDR_MC_NODELOCAL(in6) ||
-		    IN6_IS_ADDR_MC_LINKLOCAL(in6)) {
-		    /* XXX: override is ok? */
-		    sa6->sin6_scope_id = (u_int32_t)ntohs(*(u_short *)&in6->s6_addr[2]);
-		    *(u_short *)&in6->s6_addr[2] = 0;
-		}
 
+		in6_fillscopeid(sa6);
 		if (flags & RTF_HOST)
 		    cp = routename6(sa6);
 		else if (mask)
@@ -446,21 +481,41 @@ p_flags(int f, char *format)
 	printf(format, name);
 }
 
+/*
+ * Start looking up the name of an address that will be printed soon.
+ */
+void
+addr_prefetch(struct sockaddr *sa)
+{
+
+	rdns_prefetch(sa);
+}
+
+/*
+ * The name of an address, or NULL if it has none.  The lookups of
+ * inet.c, inet6.c and this file share one cache.
+ */
+const char *
+addr_name(struct sockaddr *sa)
+{
+
+	return (rdns_name(sa, -1));
+}
+
 char *
 routename(uint32_t in)
 {
-	char *cp;
+	const char *cp;
 	static char line[MAXHOSTNAMELEN];
-	struct hostent *hp;
+	struct sockaddr_in sin;
 
 	cp = 0;
 	if (!nflag) {
-		hp = gethostbyaddr((char *)&in, sizeof (struct in_addr),
-			AF_INET);
-		if (hp) {
-			cp = hp->h_name;
-			 //### trimdomain(cp, strlen(cp));
-		}
+		bzero(&sin, sizeof(sin));
+		sin.sin_len = sizeof(sin);
+		sin.sin_family = AF_INET;
+		sin.sin_addr.s_addr = in;
+		cp = addr_name((struct sockaddr *)&sin);
 	}
 	if (cp) {
 		strncpy(line, cp, sizeof(line) - 1);
@@ -580,6 +635,7 @@ char *
 netname6(struct sockaddr_in6 *sa6, struct sockaddr *sam)
 {
 	static char line[MAXHOSTNAMELEN];
+	const char *cp;
 	u_char *lim;
 	int masklen, illegal = 0, flag = NI_WITHSCOPEID;
 	struct in6_addr *mask = sam ? &((struct sockaddr_in6 *)sam)->sin6_addr : 0;
@@ -629,10 +685,11 @@ netname6(struct sockaddr_in6 *sa6, struct sockaddr *sam)
 	if (masklen == 0 && IN6_IS_ADDR_UNSPECIFIED(&sa6->sin6_addr))
 		return("default");
 
-	if (nflag)
-		flag |= NI_NUMERICHOST;
-	getnameinfo((struct sockaddr *)sa6, sa6->sin6_len, line, sizeof(line),
-		    NULL, 0, flag);
+	if (nflag || (cp = addr_name((struct sockaddr *)sa6)) == NULL)
+		getnameinfo((struct sockaddr *)sa6, sa6->sin6_len, line,
+		    sizeof(line), NULL, 0, flag | NI_NUMERICHOST);
+	else
+		strlcpy(line, cp, sizeof(line));
 
 	if (nflag)
 		snprintf(&line[strlen(line)], sizeof(line) - strlen(line), "/%d", masklen);
@@ -644,6 +701,7 @@ char *
 routename6(struct sockaddr_in6 *sa6)
 {
 	static char line[MAXHOSTNAMELEN];
+	const char *cp;
 	int flag = NI_WITHSCOPEID;
 	/* use local variable for safety */
 	struct sockaddr_in6 sa6_local = {sizeof(sa6_local), AF_INET6, };
@@ -651,14 +709,32 @@ routename6(struct sockaddr_in6 *sa6)
 	sa6_local.sin6_addr = sa6->sin6_addr;
 	sa6_local.sin6_scope_id = sa6->sin6_scope_id;
 
-	if (nflag)
-		flag |= NI_NUMERICHOST;
-
-	getnameinfo((struct sockaddr *)&sa6_local, sa6_local.sin6_len,
-		    line, sizeof(line), NULL, 0, flag);
+	if (nflag || (cp = addr_name((struct sockaddr *)&sa6_local)) == NULL)
+		getnameinfo((struct sockaddr *)&sa6_local, sa6_local.sin6_len,
+		    line, sizeof(line), NULL, 0, flag | NI_NUMERICHOST);
+	else
+		strlcpy(line, cp, sizeof(line));
 
 	return line;
 }
+
+/*
+ * XXX: This is a special workaround for KAME kernels.
+ * sin6_scope_id field of SA should be set in the future.
+ */
+static void
+in6_fillscopeid(struct sockaddr_in6 *sa6)
+{
+	struct in6_addr *in6 = &sa6->sin6_addr;
+
+	if (IN6_IS_ADDR_LINKLOCAL(in6) ||
+	    IN6_IS_ADDR_MC_NODELOCAL(in6) ||
+	    IN6_IS_ADDR_MC_LINKLOCAL(in6)) {
+	    /* XXX: override is ok? */
+	    sa6->sin6_scope_id = (u_int32_t)ntohs(*(u_short *)&in6->s6_addr[2]);
+	    *(u_short *)&in6->s6_addr[2] = 0;
+	}
+}
 #endif /*INET6*/
 
 /*
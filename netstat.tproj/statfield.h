@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) 2013 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Tables describing the counters of a protocol statistics structure,
+ * from which -s prints its text and -O exports the same counters, kept
+ * in a header of inline functions like the PCB list decoder.  Include
+ * it after netstat.h.
+ *
+ * Each entry stands for one line of the text output and names the
+ * counters the line is made of.  Counters are exported under the names
+ * of their members in the kernel structure, so a line reworded in the
+ * text leaves the export alone; lines derived from other counters, such
+ * as sums, are only printed.
+ *
+ * The binary export is a stream of records, each a struct sf_rec in
+ * host byte order followed by sr_len bytes.  The first record of a
+ * protocol is its schema: the protocol name and then the name of each
+ * of its sr_ncol columns, all NUL-terminated.  Every sample after that
+ * is the time in microseconds since the Epoch followed by one u_int64_t
+ * per column.  Histograms take one column per element, named like
+ * "icps_outhist[3]"; in JSON they are arrays.
+ */
+
+#ifndef _STATFIELD_H_
+#define _STATFIELD_H_
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#define	SF_P		1	/* count thing%s */
+#define	SF_P1A		2	/* count, nothing plural */
+#define	SF_P2		3	/* count thing%s (count thing%s) */
+#define	SF_P2A		4	/* count thing%s (count) */
+#define	SF_P3		5	/* count thing%es */
+#define	SF_PY		6	/* count thing%ies */
+#define	SF_HIST		7	/* title, then "name: count" per nonzero */
+#define	SF_SUM		8	/* the counters added up, printed only */
+#define	SF_LESS		9	/* the first less the others, printed only */
+#define	SF_NL		10	/* end of a line built from several */
+#define	SF_TITLE	11	/* text without counters */
+#define	SF_CALL		12	/* text printed by sf_fn */
+#define	SF_KIND		0x0f
+#define	SF_ALWAYS	0x10	/* print even with -ss */
+
+#define	SF_MAXOFF	7
+
+struct statfield {
+	int		sf_kind;
+	const char	*sf_text;		/* printf format, or histogram title */
+	size_t		sf_size;		/* bytes in each counter */
+	int		sf_n;			/* counters in the line */
+	size_t		sf_off[SF_MAXOFF];
+	const char	*sf_name[SF_MAXOFF];
+	size_t		sf_count;		/* SF_HIST: elements */
+	char		**sf_hist;		/* SF_HIST: their names */
+	void		(*sf_fn)(const void *, const void *);
+};
+
+#define	SF_SIZE(s, f)	sizeof(((struct s *)0)->f)
+#define	SF_FIELD(k, s, f, m) \
+	{ (k), (m), SF_SIZE(s, f), 1, { offsetof(struct s, f) }, { #f } }
+#define	SF_FIELD2(k, s, f1, f2, m) \
+	{ (k), (m), SF_SIZE(s, f1), 2, \
+	    { offsetof(struct s, f1), offsetof(struct s, f2) }, { #f1, #f2 } }
+#define	SF_HISTOGRAM(s, f, names, title) \
+	{ SF_HIST, (title), SF_SIZE(s, f[0]), 1, { offsetof(struct s, f) }, \
+	    { #f }, SF_SIZE(s, f) / SF_SIZE(s, f[0]), (names) }
+#define	SF_TEXT(m) \
+	{ SF_TITLE | SF_ALWAYS, (m) }
+#define	SF_FUNC(fn) \
+	{ SF_CALL | SF_ALWAYS, NULL, 0, 0, { 0 }, { NULL }, 0, NULL, (fn) }
+
+#define	SF_PRINT(t, cur, prev) \
+	sf_print((t), sizeof(t) / sizeof((t)[0]), (cur), (prev))
+#define	SF_EXPORT(name, t, cur, id) \
+	sf_export((name), (t), sizeof(t) / sizeof((t)[0]), (cur), (id))
+
+struct sf_rec {
+	u_int32_t	sr_magic;
+	u_int16_t	sr_type;
+	u_int16_t	sr_id;		/* which schema a sample follows */
+	u_int32_t	sr_ncol;
+	u_int32_t	sr_len;		/* bytes after this header */
+};
+
+#define	SF_MAGIC	0x4e534631	/* "NSF1" */
+#define	SF_SCHEMA	1
+#define	SF_SAMPLE	2
+
+/* Counter i of the line, or element i of a histogram */
+static __inline u_int64_t
+sf_get(const struct statfield *sf, const void *p, int i)
+{
+	const char *cp;
+
+	if ((sf->sf_kind & SF_KIND) == SF_HIST)
+		cp = (const char *)p + sf->sf_off[0] + i * sf->sf_size;
+	else
+		cp = (const char *)p + sf->sf_off[i];
+	if (sf->sf_size == sizeof(u_int64_t))
+		return (*(const u_int64_t *)cp);
+	return (*(const u_int32_t *)cp);
+}
+
+/* How much counter i grew since prev, wrapping at its own width */
+static __inline u_int64_t
+sf_diff(const struct statfield *sf, const void *cur, const void *prev, int i)
+{
+	u_int64_t d;
+
+	d = sf_get(sf, cur, i) - sf_get(sf, prev, i);
+	if (sf->sf_size != sizeof(u_int64_t))
+		d = (u_int32_t)d;
+	return (d);
+}
+
+static __inline void
+sf_printf(const struct statfield *sf, const char *m, u_int64_t v1,
+    const char *s1, u_int64_t v2, const char *s2)
+{
+
+	if (sf->sf_size == sizeof(u_int64_t))
+		printf(m, (unsigned long long)v1, s1, (unsigned long long)v2, s2);
+	else
+		printf(m, (u_int)v1, s1, (u_int)v2, s2);
+}
+
+/*
+ * Print the text of the n lines in sf for the counters in cur, less
+ * those in prev, in the way -s always has.
+ */
+static __inline void
+sf_print(const struct statfield *sf, size_t n, const void *cur,
+    const void *prev)
+{
+	u_int64_t v1, v2;
+	int all, first, i, one1, one2;
+	size_t j;
+
+	for (; n > 0; sf++, n--) {
+		all = sflag <= 1 || (sf->sf_kind & SF_ALWAYS);
+		v1 = sf->sf_n > 0 ? sf_diff(sf, cur, prev, 0) : 0;
+		v2 = sf->sf_n > 1 ? sf_diff(sf, cur, prev, 1) : 0;
+		/* plural() and its kin only ask whether a count is one */
+		one1 = v1 == 1;
+		one2 = v2 == 1;
+		switch (sf->sf_kind & SF_KIND) {
+		case SF_P:
+			if (v1 || all)
+				sf_printf(sf, sf->sf_text, v1, plural(one1), 0, NULL);
+			break;
+		case SF_P1A:
+			if (v1 || all)
+				sf_printf(sf, sf->sf_text, v1, NULL, 0, NULL);
+			break;
+		case SF_P2:
+			if (v1 || v2 || all)
+				sf_printf(sf, sf->sf_text, v1, plural(one1), v2,
+				    plural(one2));
+			break;
+		case SF_P2A:
+			if (!(v1 || v2 || all))
+				break;
+			if (sf->sf_size == sizeof(u_int64_t))
+				printf(sf->sf_text, (unsigned long long)v1,
+				    plural(one1), (unsigned long long)v2);
+			else
+				printf(sf->sf_text, (u_int)v1, plural(one1),
+				    (u_int)v2);
+			break;
+		case SF_P3:
+			if (v1 || all)
+				sf_printf(sf, sf->sf_text, v1, plurales(one1), 0,
+				    NULL);
+			break;
+		case SF_PY:
+			if (v1 || all)
+				sf_printf(sf, sf->sf_text, v1, pluralies(one1),
+				    0, NULL);
+			break;
+		case SF_HIST:
+			for (first = 1, j = 0; j < sf->sf_count; j++) {
+				if ((v1 = sf_diff(sf, cur, prev, j)) == 0)
+					continue;
+				if (first) {
+					printf("%s", sf->sf_text);
+					first = 0;
+				}
+				if (sf->sf_size == sizeof(u_int64_t))
+					printf("\t\t%s: %llu\n", sf->sf_hist[j],
+					    (unsigned long long)v1);
+				else
+					printf("\t\t%s: %u\n", sf->sf_hist[j],
+					    (u_int)v1);
+			}
+			break;
+		case SF_SUM:
+		case SF_LESS:
+			for (i = 1; i < sf->sf_n; i++)
+				if ((sf->sf_kind & SF_KIND) == SF_SUM)
+					v1 += sf_diff(sf, cur, prev, i);
+				else
+					v1 -= sf_diff(sf, cur, prev, i);
+			if (sf->sf_size != sizeof(u_int64_t))
+				v1 = (u_int32_t)v1;
+			if (v1 || all)
+				sf_printf(sf, sf->sf_text, v1, NULL, 0, NULL);
+			break;
+		case SF_NL:
+			if (v1 || all)
+				printf("%s", sf->sf_text);
+			break;
+		case SF_TITLE:
+			printf("%s", sf->sf_text);
+			break;
+		case SF_CALL:
+			(*sf->sf_fn)(cur, prev);
+			break;
+		}
+	}
+}
+
+/* Whether the counters of a line are exported */
+static __inline int
+sf_exported(const struct statfield *sf)
+{
+
+	switch (sf->sf_kind & SF_KIND) {
+	case SF_P:
+	case SF_P1A:
+	case SF_P2:
+	case SF_P2A:
+	case SF_P3:
+	case SF_PY:
+	case SF_HIST:
+		return (1);
+	}
+	return (0);
+}
+
+static __inline void
+sf_rec(int type, int id, u_int32_t ncol, u_int32_t len)
+{
+	struct sf_rec rec;
+
+	rec.sr_magic = SF_MAGIC;
+	rec.sr_type = type;
+	rec.sr_id = id;
+	rec.sr_ncol = ncol;
+	rec.sr_len = len;
+	fwrite(&rec, sizeof(rec), 1, stdout);
+}
+
+static __inline void
+sf_schema(const char *proto, const struct statfield *sf, size_t n, int id)
+{
+	char buf[64];
+	u_int32_t ncol, len;
+	size_t j, k;
+	int i, pass;
+
+	/* Sized on the first pass, written on the second */
+	for (pass = 0; pass < 2; pass++) {
+		if (pass == 1)
+			sf_rec(SF_SCHEMA, id, ncol, len);
+		ncol = 0;
+		len = strlen(proto) + 1;
+		if (pass == 1)
+			fwrite(proto, len, 1, stdout);
+		for (k = 0; k < n; k++) {
+			if (!sf_exported(&sf[k]))
+				continue;
+			if ((sf[k].sf_kind & SF_KIND) != SF_HIST) {
+				for (i = 0; i < sf[k].sf_n; i++) {
+					ncol++;
+					len += strlen(sf[k].sf_name[i]) + 1;
+					if (pass == 1)
+						fwrite(sf[k].sf_name[i],
+						    strlen(sf[k].sf_name[i]) + 1,
+						    1, stdout);
+				}
+				continue;
+			}
+			for (j = 0; j < sf[k].sf_count; j++) {
+				snprintf(buf, sizeof(buf), "%s[%zu]",
+				    sf[k].sf_name[0], j);
+				ncol++;
+				len += strlen(buf) + 1;
+				if (pass == 1)
+					fwrite(buf, strlen(buf) + 1, 1, stdout);
+			}
+		}
+	}
+}
+
+/*
+ * Write the counters in cur as one JSON line or one binary sample, in
+ * the format -O asked for.  *id is zero until the schema of this table
+ * has been written, and then the number it was given.
+ */
+static __inline void
+sf_export(const char *proto, const struct statfield *sf, size_t n,
+    const void *cur, int *id)
+{
+	struct timeval now;
+	u_int64_t v, ncol;
+	size_t j, k;
+	int i;
+
+	gettimeofday(&now, NULL);
+	if (statfmt == STATFMT_BINARY) {
+		if (*id == 0) {
+			*id = ++statids;
+			sf_schema(proto, sf, n, *id);
+		}
+		for (ncol = 0, k = 0; k < n; k++)
+			if (sf_exported(&sf[k]))
+				ncol += (sf[k].sf_kind & SF_KIND) == SF_HIST ?
+				    sf[k].sf_count : sf[k].sf_n;
+		sf_rec(SF_SAMPLE, *id, ncol, (ncol + 1) * sizeof(v));
+		v = (u_int64_t)now.tv_sec * 1000000 + now.tv_usec;
+		fwrite(&v, sizeof(v), 1, stdout);
+	} else
+		printf("{\"proto\":\"%s\",\"time\":%ld.%06d", proto,
+		    (long)now.tv_sec, (int)now.tv_usec);
+
+	for (k = 0; k < n; k++) {
+		if (!sf_exported(&sf[k]))
+			continue;
+		if ((sf[k].sf_kind & SF_KIND) == SF_HIST) {
+			if (statfmt != STATFMT_BINARY)
+				printf(",\"%s\":[", sf[k].sf_name[0]);
+			for (j = 0; j < sf[k].sf_count; j++) {
+				v = sf_get(&sf[k], cur, j);
+				if (statfmt == STATFMT_BINARY)
+					fwrite(&v, sizeof(v), 1, stdout);
+				else
+					printf("%s%llu", j ? "," : "",
+					    (unsigned long long)v);
+			}
+			if (statfmt != STATFMT_BINARY)
+				putchar(']');
+			continue;
+		}
+		for (i = 0; i < sf[k].sf_n; i++) {
+			v = sf_get(&sf[k], cur, i);
+			if (statfmt == STATFMT_BINARY)
+				fwrite(&v, sizeof(v), 1, stdout);
+			else
+				printf(",\"%s\":%llu", sf[k].sf_name[i],
+				    (unsigned long long)v);
+		}
+	}
+	if (statfmt != STATFMT_BINARY)
+		printf("}\n");
+}
+
+#endif /* !_STATFIELD_H_ */
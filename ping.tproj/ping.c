@@ -114,6 +114,10 @@ __unused static const char copyright[] =
 #include <unistd.h>
 #include <ifaddrs.h>
 
+#include "../alias/alias_cksum.h"
+#include "../netstat.tproj/rdns.h"
+#include "ping_hist.h"
+
 #define	INADDR_LEN	((int)sizeof(in_addr_t))
 #define	TIMEVAL_LEN	((int)sizeof(struct tv32))
 #define	MASK_LEN	(ICMP_MASKLEN - ICMP_MINLEN)
@@ -126,6 +130,13 @@ __unused static const char copyright[] =
 #define	MAXWAIT		10000		/* max ms to wait for response */
 #define	MAXALARM	(60 * 60)	/* max seconds for alarm timeout */
 #define	MAXTOS		255
+#define	MAXTARGETS	(1 << 20)	/* max hosts in multi-target mode */
+#define	MULTIWAIT	1000		/* default ms to wait, multi-target */
+#define	DEFRATE		1000		/* default probes/sec, multi-target */
+#define	USERRATE	10		/* max probes/sec, multi-target, non-root */
+#define	MAXBATCH	64		/* max probes sent back to back */
+#define	MAXPROBES	(1 << 20)	/* max probes awaiting replies */
+#define	NAMEWAIT	500		/* max ms to wait for a host name */
 
 #define	A(bit)		rcvd_tbl[(bit)>>3]	/* identify byte in array */
 #define	B(bit)		(1 << ((bit) & 0x07))	/* identify bit in byte */
@@ -169,13 +180,17 @@ int options;
 #define	F_WAITTIME	0x400000
 
 /*
- * MAX_DUP_CHK is the number of bits in received table, i.e. the maximum
- * number of received sequence numbers we can keep track of.  Change 128
- * to 8192 for complete accuracy...
+ * The received table is a bitmap over the last mx_dup_ck packets sent,
+ * indexed by sequence number.  It starts with room for every packet
+ * that can be waiting for a reply, MAX_DUP_CHK bits at least, and
+ * doubles if replies come back from further behind.  MAX_DUP_WIN is
+ * half the 16 bit sequence space, so that the sequence number in a
+ * reply names exactly one packet in the window.
  */
 #define	MAX_DUP_CHK	(8 * 128)
+#define	MAX_DUP_WIN	(1 << 15)
 int mx_dup_ck = MAX_DUP_CHK;
-char rcvd_tbl[MAX_DUP_CHK / 8];
+u_char *rcvd_tbl;
 
 struct sockaddr_in whereto;	/* who to ping */
 int datalen = DEFDATALEN;
@@ -218,6 +233,9 @@ int sweepincr = 1;		/* payload increment in sweep */
 int interval = 1000;		/* interval between packets, ms */
 int waittime = MAXWAIT;		/* timeout for each packet */
 long nrcvtimeout = 0;		/* # of packets we got back after waittime */
+long nreordered;		/* # of packets we got back out of order */
+long maxreorder;		/* most packets one arrived behind */
+long maxseqrcvd = -1;		/* highest sequence # we got back */
 
 /* timing */
 int timing;			/* flag to do timing */
@@ -225,6 +243,40 @@ double tmin = 999999999.0;	/* minimum round trip time */
 double tmax = 0.0;		/* maximum round trip time */
 double tsum = 0.0;		/* sum of all times, for doing average */
 double tsumsq = 0.0;		/* sum of all times squared, for std. dev. */
+struct ping_hist rtthist;	/* all times, for percentiles */
+char *histfile;			/* -e file to dump rtthist to */
+
+/*
+ * Multi-target mode.  Each target keeps its own counters.  Every echo
+ * sent gets a probe number, carried in icmp_id and icmp_seq; the probes
+ * still waiting for replies sit in a ring indexed by probe number, so a
+ * reply leads straight to its probe and target with no search.
+ */
+struct target {
+	struct in_addr	addr;
+	char		*name;		/* host name, or NULL if numeric */
+	long		ntransmitted;
+	long		nreceived;
+	long		nrepeats;
+	double		tmin, tmax, tsum, tsumsq;
+};
+
+struct probe {
+	struct timeval	sent;		/* when it went out */
+	u_int32_t	target;		/* index into targets[] */
+	u_int16_t	seq;		/* echo number for that target */
+	u_int8_t	received;
+};
+
+struct target *targets;
+u_int ntargets, maxtargets;
+struct probe *probes;		/* ring of outstanding probes */
+u_int32_t probemask;		/* ring size - 1 */
+u_int32_t probeoldest;		/* first probe still in the ring */
+u_int32_t probenext;		/* number of the next probe sent */
+u_int32_t nwaiting;		/* probes in the ring not yet answered */
+char *targetfile;		/* -F file of targets */
+int rate;			/* probes per second over all targets */
 
 volatile sig_atomic_t finish_up;  /* nonzero if we've been told to finish up */
 volatile sig_atomic_t siginfo_p;
@@ -232,9 +284,11 @@ volatile sig_atomic_t siginfo_p;
 static void fill(char *, char *);
 static u_short in_cksum(u_short *, int);
 static void check_status(void);
+static void dup_grow(void);
 static void finish(void) __dead2;
 static void pinger(void);
 static char *pr_addr(struct in_addr);
+static void pr_prefetch(u_char *, int);
 static char *pr_ntime(n_time);
 static void pr_icmph(struct icmp *);
 static void pr_iph(struct ip *);
@@ -245,6 +299,14 @@ static void stopit(int);
 static void tvsub(struct timeval *, const struct timeval *);
 static uint32_t str2svc(const char *);
 static void usage(void) __dead2;
+static void add_target(char *);
+static void new_target(struct in_addr, const char *);
+static void add_targets_file(const char *);
+static void multi_ping(void) __dead2;
+static u_int multi_send(u_int, u_int);
+static void multi_pack(char *, int, struct sockaddr_in *, struct timeval *);
+static void multi_expire(struct timeval *);
+static void multi_finish(void) __dead2;
 
 int
 main(int argc, char *const *argv)
@@ -299,7 +361,7 @@ main(int argc, char *const *argv)
 
 	outpack = outpackhdr + sizeof(struct ip);
 	while ((ch = getopt(argc, argv,
-		"Aab:Cc:DdfG:g:h:I:i:k:Ll:M:m:nop:QqRrS:s:T:t:vW:z:"
+		"Aab:Cc:De:dF:fG:g:h:I:i:k:Ll:M:m:nop:QqRrS:s:T:t:vW:x:z:"
 #ifdef IPSEC
 #ifdef IPSEC_POLICY_IPSEC
 		"P:"
@@ -344,6 +406,12 @@ main(int argc, char *const *argv)
 		case 'd':
 			options |= F_SO_DEBUG;
 			break;
+		case 'e':
+			histfile = optarg;
+			break;
+		case 'F':
+			targetfile = optarg;
+			break;
 		case 'f':
 			if (uid) {
 				errno = EPERM;
@@ -545,6 +613,17 @@ main(int argc, char *const *argv)
 			options |= F_WAITTIME;
 			waittime = (int)t;
 			break;
+		case 'x':		/* probes per second, multi-target */
+			ultmp = strtoul(optarg, &ep, 0);
+			if (*ep || ep == optarg || !ultmp || ultmp > INT_MAX)
+				errx(EX_USAGE, "invalid probe rate: `%s'",
+				    optarg);
+			if (uid && ultmp > USERRATE) {
+				errno = EPERM;
+				err(EX_NOPERM, "-x rate too high");
+			}
+			rate = ultmp;
+			break;
 		case 'z':
 			options |= F_HDRINCL;
 			ultmp = strtoul(optarg, &ep, 0);
@@ -560,9 +639,35 @@ main(int argc, char *const *argv)
 	if (boundif != NULL && (ifscope = if_nametoindex(boundif)) == 0)
 		errx(1, "bad interface name");
 
-	if (argc - optind != 1)
+	/*
+	 * Several hosts, an address range or a file of targets select
+	 * multi-target mode; a single host is pinged as always.
+	 */
+	target = NULL;
+	if (targetfile != NULL || argc - optind > 1 ||
+	    (argc - optind == 1 && strchr(argv[optind], '/') != NULL)) {
+		if (options & (F_FLOOD | F_HDRINCL | F_MASK | F_MIF |
+		    F_NOLOOP | F_MTTL | F_RROUTE | F_SWEEP | F_TIME))
+			errx(EX_USAGE, "-D, -f, -G, -g, -h, -I, -L, -M, -R, "
+			    "-T and -z cannot be used with several targets");
+		if (rate == 0)
+			rate = uid ? USERRATE : DEFRATE;
+		if (targetfile != NULL)
+			add_targets_file(targetfile);
+		for (i = optind; i < argc; i++)
+			add_target(argv[i]);
+		if (ntargets == 0)
+			errx(EX_USAGE, "no targets");
+		if (npackets == 0)
+			npackets = 1;
+		if (!(options & F_WAITTIME))
+			waittime = MULTIWAIT;
+	} else if (argc - optind == 1) {
+		if (rate != 0)
+			errx(EX_USAGE, "-x needs several targets");
+		target = argv[optind];
+	} else
 		usage();
-	target = argv[optind];
 
 	switch (options & (F_MASK|F_TIME)) {
 	case 0: break;
@@ -626,7 +731,9 @@ main(int argc, char *const *argv)
 	to = &whereto;
 	to->sin_family = AF_INET;
 	to->sin_len = sizeof *to;
-	if (inet_aton(target, &to->sin_addr) != 0) {
+	if (target == NULL) {
+		hostname = "targets";
+	} else if (inet_aton(target, &to->sin_addr) != 0) {
 		hostname = target;
 	} else {
 		hp = gethostbyname2(target, AF_INET);
@@ -645,6 +752,8 @@ main(int argc, char *const *argv)
 	do {
 		struct ifaddrs *ifa_list, *ifa;
 		
+		if (target == NULL)
+			break;
 		if (IN_MULTICAST(ntohl(whereto.sin_addr.s_addr)) || whereto.sin_addr.s_addr == INADDR_BROADCAST) {
 			no_dup = 1;
 			break;
@@ -680,6 +789,16 @@ main(int argc, char *const *argv)
 	if (datalen >= TIMEVAL_LEN)	/* can we time transfer */
 		timing = 1;
 
+	/* Room in the received table for all the packets in flight */
+	if (options & F_FLOOD || interval <= 0)
+		mx_dup_ck = MAX_DUP_WIN;
+	else
+		while (mx_dup_ck < MAX_DUP_WIN &&
+		    mx_dup_ck < 2L * (waittime / interval) + preload)
+			mx_dup_ck <<= 1;
+	if ((rcvd_tbl = calloc(mx_dup_ck / 8, 1)) == NULL)
+		err(EX_OSERR, "malloc");
+
 	if (!(options & F_PINGFILLED))
 		for (i = TIMEVAL_LEN; i < datalen; ++i)
 			*datap++ = i;
@@ -860,7 +979,13 @@ main(int argc, char *const *argv)
 		(void)setsockopt(s, SOL_SOCKET, SO_SNDBUF, (char *)&hold,
 		    sizeof(hold));
 
-	if (to->sin_family == AF_INET) {
+	if (target == NULL) {
+		(void)printf("PING %u targets", ntargets);
+		if (source)
+			(void)printf(" from %s", shostname);
+		(void)printf(": %d data bytes, %d probes/sec\n", datalen,
+		    rate);
+	} else if (to->sin_family == AF_INET) {
 		(void)printf("PING %s (%s)", hostname,
 		    inet_ntoa(to->sin_addr));
 		if (source)
@@ -907,6 +1032,9 @@ main(int argc, char *const *argv)
 			err(EX_OSERR, "sigaction SIGALRM");
 	}
 
+	if (target == NULL)
+		multi_ping();
+
 	bzero(&msg, sizeof(msg));
 	msg.msg_name = (caddr_t)&from;
 	msg.msg_iov = &iov;
@@ -1163,6 +1291,501 @@ pinger(void)
 		(void)write(STDOUT_FILENO, &DOT, 1);
 }
 
+/*
+ * add_target --
+ *	Add a host, or every address in an address/prefix range, to the
+ * targets of a multi-target ping.  Ranges wider than a /31 leave out
+ * their network and broadcast addresses.
+ */
+static void
+add_target(char *spec)
+{
+	struct hostent *hp;
+	struct in_addr in;
+	u_int32_t a, last, mask;
+	u_long bits;
+	char *ep, *slash;
+
+	if ((slash = strchr(spec, '/')) != NULL) {
+		*slash++ = '\0';
+		bits = strtoul(slash, &ep, 10);
+		if (*ep || ep == slash || bits > 32 || inet_aton(spec, &in) == 0)
+			errx(EX_USAGE, "invalid address range: `%s/%s'",
+			    spec, slash);
+		mask = bits ? 0xffffffff << (32 - bits) : 0;
+		a = ntohl(in.s_addr) & mask;
+		last = a | ~mask;
+		if (bits < 31) {
+			a++;
+			last--;
+		}
+		for (;; a++) {
+			in.s_addr = htonl(a);
+			new_target(in, NULL);
+			if (a == last)
+				break;
+		}
+	} else if (inet_aton(spec, &in) != 0) {
+		new_target(in, NULL);
+	} else {
+		hp = gethostbyname2(spec, AF_INET);
+		if (!hp)
+			errx(EX_NOHOST, "cannot resolve %s: %s",
+			    spec, hstrerror(h_errno));
+		if ((unsigned)hp->h_length > sizeof(in))
+			errx(1, "gethostbyname2 returned an illegal address");
+		memcpy(&in, hp->h_addr_list[0], sizeof(in));
+		new_target(in, hp->h_name);
+	}
+}
+
+/*
+ * add_targets_file --
+ *	Add the targets listed in a file, or on the standard input if it
+ * is "-".  Targets are separated by white space; '#' starts a comment
+ * that runs to the end of the line.
+ */
+static void
+add_targets_file(const char *path)
+{
+	FILE *fp;
+	char *cp, *line, *word;
+	size_t linecap;
+
+	if (strcmp(path, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen(path, "r")) == NULL)
+		err(EX_NOINPUT, "%s", path);
+	line = NULL;
+	linecap = 0;
+	while (getline(&line, &linecap, fp) != -1) {
+		if ((cp = strchr(line, '#')) != NULL)
+			*cp = '\0';
+		cp = line;
+		while ((word = strsep(&cp, " \t\r\n")) != NULL)
+			if (*word != '\0')
+				add_target(word);
+	}
+	if (ferror(fp))
+		err(EX_IOERR, "%s", path);
+	free(line);
+	if (fp != stdin)
+		(void)fclose(fp);
+}
+
+static void
+new_target(struct in_addr addr, const char *name)
+{
+	struct target *t;
+
+	if (ntargets == MAXTARGETS)
+		errx(EX_USAGE, "too many targets (at most %d)", MAXTARGETS);
+	if (ntargets == maxtargets) {
+		maxtargets = maxtargets ? maxtargets * 2 : 64;
+		targets = realloc(targets, maxtargets * sizeof(*targets));
+		if (targets == NULL)
+			err(EX_OSERR, "malloc");
+	}
+	t = &targets[ntargets++];
+	bzero(t, sizeof(*t));
+	t->addr = addr;
+	t->tmin = 999999999.0;
+	if (name != NULL && (t->name = strdup(name)) == NULL)
+		err(EX_OSERR, "malloc");
+}
+
+/*
+ * multi_ping --
+ *	Ping every target once per interval, npackets times.  Probes are
+ * paced at rate per second over all the targets, in batches of up to
+ * MAXBATCH sent back to back, so that a high rate does not take one
+ * wakeup per probe.  Each wakeup then drains the socket, timing every
+ * reply against the kernel's receive timestamp.
+ */
+static void
+multi_ping(void)
+{
+	struct timeval gap, intvl, next_round, next_send, now, stamp, timeout,
+	    wake;
+	struct sockaddr_in from;
+	struct cmsghdr *cmsg;
+	struct timeval *tv;
+	struct iovec iov;
+	struct msghdr msg;
+	fd_set rfds;
+	u_char packet[IP_MAXPACKET] __attribute__((aligned(4)));
+	char ctrl[CMSG_SPACE(sizeof(struct timeval))];
+	u_int32_t size;
+	u_int batch, cursor, n;
+	long rounds;
+	int cc, nread;
+
+	/* Room for all the probes that can be sent in one waittime */
+	size = 1024;
+	while (size < MAXPROBES &&
+	    size < (double)rate * waittime / 1000 + MAXBATCH)
+		size <<= 1;
+	if ((probes = calloc(size, sizeof(*probes))) == NULL)
+		err(EX_OSERR, "malloc");
+	probemask = size - 1;
+
+	batch = rate / 1000;
+	if (batch < 1)
+		batch = 1;
+	if (batch > MAXBATCH)
+		batch = MAXBATCH;
+	gap.tv_sec = batch / rate;
+	gap.tv_usec = (u_int64_t)(batch % rate) * 1000000 / rate;
+	intvl.tv_sec = interval / 1000;
+	intvl.tv_usec = interval % 1000 * 1000;
+	timing = 1;
+
+	bzero(&msg, sizeof(msg));
+	msg.msg_name = (caddr_t)&from;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+#ifdef SO_TIMESTAMP
+	msg.msg_control = (caddr_t)ctrl;
+#endif
+	iov.iov_base = packet;
+	iov.iov_len = IP_MAXPACKET;
+
+	(void)gettimeofday(&now, NULL);
+	next_send = now;
+	timeradd(&now, &intvl, &next_round);
+	cursor = 0;
+	rounds = 1;
+	while (!finish_up) {
+		check_status();
+		(void)gettimeofday(&now, NULL);
+		multi_expire(&now);
+
+		/* Start the next round once the interval is up */
+		if (cursor == ntargets && rounds < npackets &&
+		    timercmp(&now, &next_round, >=)) {
+			cursor = 0;
+			rounds++;
+			timeradd(&next_round, &intvl, &next_round);
+			if (timercmp(&next_round, &now, <))
+				timeradd(&now, &intvl, &next_round);
+		}
+		if (cursor < ntargets && timercmp(&now, &next_send, >=)) {
+			n = ntargets - cursor;
+			if (n > batch)
+				n = batch;
+			cursor += multi_send(cursor, n);
+			/* Catch up by at most one batch after a late wakeup */
+			timeradd(&next_send, &gap, &next_send);
+			timersub(&now, &gap, &stamp);
+			if (timercmp(&next_send, &stamp, <))
+				next_send = now;
+		}
+		if (cursor == ntargets && rounds >= npackets && nwaiting == 0)
+			break;
+
+		/* Sleep until the next send or the next probe times out */
+		if (cursor < ntargets)
+			wake = next_send;
+		else if (rounds < npackets)
+			wake = next_round;
+		else {
+			wake.tv_sec = now.tv_sec + waittime / 1000 + 1;
+			wake.tv_usec = now.tv_usec;
+		}
+		if (probeoldest != probenext) {
+			timeout.tv_sec = waittime / 1000;
+			timeout.tv_usec = waittime % 1000 * 1000;
+			timeradd(&probes[probeoldest & probemask].sent,
+			    &timeout, &stamp);
+			if (timercmp(&stamp, &wake, <))
+				wake = stamp;
+		}
+		if (timercmp(&wake, &now, >))
+			timersub(&wake, &now, &timeout);
+		else
+			timeout.tv_sec = timeout.tv_usec = 0;
+
+		if ((unsigned)s >= FD_SETSIZE)
+			errx(EX_OSERR, "descriptor too large");
+		FD_ZERO(&rfds);
+		FD_SET(s, &rfds);
+		if (select(s + 1, &rfds, NULL, NULL, &timeout) <= 0)
+			continue;
+
+		for (nread = 0; nread < 4 * MAXBATCH; nread++) {
+#ifdef SO_TIMESTAMP
+			msg.msg_controllen = sizeof(ctrl);
+#endif
+			msg.msg_namelen = sizeof(from);
+			if ((cc = recvmsg(s, &msg, MSG_DONTWAIT)) < 0) {
+				if (errno != EAGAIN && errno != EINTR)
+					warn("recvmsg");
+				break;
+			}
+			tv = NULL;
+#ifdef SO_TIMESTAMP
+			for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+			    cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+				if (cmsg->cmsg_level == SOL_SOCKET &&
+				    cmsg->cmsg_type == SCM_TIMESTAMP &&
+				    cmsg->cmsg_len == CMSG_LEN(sizeof *tv)) {
+					/* Copy to avoid alignment problems: */
+					memcpy(&stamp, CMSG_DATA(cmsg),
+					    sizeof(stamp));
+					tv = &stamp;
+				}
+			}
+#endif
+			if (tv == NULL) {
+				(void)gettimeofday(&stamp, NULL);
+				tv = &stamp;
+			}
+			multi_pack((char *)packet, cc, &from, tv);
+		}
+		if (options & F_ONCE && nreceived)
+			break;
+	}
+	multi_finish();
+}
+
+/*
+ * multi_send --
+ *	Send the next echo to count targets starting with targets[first],
+ * and return how many went out.  A full probe ring or interface queue
+ * ends the batch early; the rest go out on a later pass.
+ */
+static u_int
+multi_send(u_int first, u_int count)
+{
+	struct sockaddr_in to;
+	struct tv32 tv32;
+	struct icmp *icp;
+	struct probe *p;
+	struct target *t;
+	u_int n;
+	int cc, i;
+
+	bzero(&to, sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_len = sizeof(to);
+	icp = (struct icmp *)outpack;
+	icp->icmp_type = ICMP_ECHO;
+	icp->icmp_code = 0;
+	cc = ICMP_MINLEN + datalen;
+	for (n = 0; n < count; n++) {
+		if (probenext - probeoldest > probemask)
+			break;			/* ring is full */
+		t = &targets[first + n];
+		p = &probes[probenext & probemask];
+
+		/* The probe number, split over the ID and sequence */
+		icp->icmp_cksum = 0;
+		icp->icmp_id = (ident + (probenext >> 16)) & 0xffff;
+		icp->icmp_seq = htons(probenext & 0xffff);
+		(void)gettimeofday(&p->sent, NULL);
+		if (datalen >= TIMEVAL_LEN) {
+			tv32.tv32_sec = htonl(p->sent.tv_sec);
+			tv32.tv32_usec = htonl(p->sent.tv_usec);
+			bcopy((void *)&tv32, (void *)&outpack[ICMP_MINLEN],
+			    sizeof(tv32));
+		}
+		icp->icmp_cksum = in_cksum((u_short *)icp, cc);
+
+		to.sin_addr = t->addr;
+		i = sendto(s, (char *)outpack, cc, 0, (struct sockaddr *)&to,
+		    sizeof(to));
+		if (i < 0 && errno == ENOBUFS)
+			break;
+		if (i < 0)
+			warn("sendto %s", inet_ntoa(t->addr));
+		else if (i != cc)
+			warn("%s: partial write: %d of %d bytes",
+			    inet_ntoa(t->addr), i, cc);
+		p->target = first + n;
+		p->seq = t->ntransmitted;
+		p->received = 0;
+		t->ntransmitted++;
+		ntransmitted++;
+		probenext++;
+		nwaiting++;
+	}
+	return (n);
+}
+
+/*
+ * multi_pack --
+ *	Match a reply to its probe, count it and print it.  Anything that
+ * is not an echo reply for a probe still in the ring, from the address
+ * that probe went to, is not ours.
+ */
+static void
+multi_pack(char *buf, int cc, struct sockaddr_in *from, struct timeval *tv)
+{
+	struct icmp *icp;
+	struct ip *ip;
+	struct probe *p;
+	struct target *t;
+	struct timeval rtt;
+	double triptime;
+	u_int32_t pn;
+	int dupflag, hlen;
+
+	ip = (struct ip *)buf;
+	hlen = ip->ip_hl << 2;
+	if (cc < hlen + ICMP_MINLEN)
+		return;
+	cc -= hlen;
+	icp = (struct icmp *)(buf + hlen);
+	if (icp->icmp_type != ICMP_ECHOREPLY)
+		return;
+
+	pn = (u_int32_t)((icp->icmp_id - ident) & 0xffff) << 16 |
+	    ntohs(icp->icmp_seq);
+	if (pn - probeoldest >= probenext - probeoldest)
+		return;
+	p = &probes[pn & probemask];
+	t = &targets[p->target];
+	if (from->sin_addr.s_addr != t->addr.s_addr)
+		return;
+
+	rtt = *tv;
+	tvsub(&rtt, &p->sent);
+	triptime = ((double)rtt.tv_sec) * 1000.0 +
+	    ((double)rtt.tv_usec) / 1000.0;
+	dupflag = p->received;
+	if (dupflag) {
+		++t->nrepeats;
+		++nrepeats;
+	} else {
+		p->received = 1;
+		++t->nreceived;
+		++nreceived;
+		--nwaiting;
+	}
+	t->tsum += triptime;
+	t->tsumsq += triptime * triptime;
+	if (triptime < t->tmin)
+		t->tmin = triptime;
+	if (triptime > t->tmax)
+		t->tmax = triptime;
+	tsum += triptime;
+	tsumsq += triptime * triptime;
+	if (triptime < tmin)
+		tmin = triptime;
+	if (triptime > tmax)
+		tmax = triptime;
+	hist_add(&rtthist, triptime);
+
+	if (options & F_QUIET)
+		return;
+	(void)printf("%d bytes from %s: icmp_seq=%u ttl=%d time=%.3f ms%s\n",
+	    cc, inet_ntoa(from->sin_addr), p->seq, ip->ip_ttl, triptime,
+	    dupflag ? " (DUP!)" : "");
+	if (options & F_AUDIBLE)
+		(void)write(STDOUT_FILENO, &BBELL, 1);
+}
+
+/*
+ * multi_expire --
+ *	Retire the probes sent more than waittime ago, reporting those
+ * that were never answered.
+ */
+static void
+multi_expire(struct timeval *now)
+{
+	struct timeval age;
+	struct probe *p;
+
+	while (probeoldest != probenext) {
+		p = &probes[probeoldest & probemask];
+		age = *now;
+		tvsub(&age, &p->sent);
+		if (age.tv_sec * 1000 + age.tv_usec / 1000 < waittime)
+			break;
+		if (!p->received) {
+			--nwaiting;
+			if (options & F_MISSED)
+				(void)write(STDOUT_FILENO, &BBELL, 1);
+			if (!(options & F_QUIET))
+				(void)printf("Request timeout for %s icmp_seq %u\n",
+				    inet_ntoa(targets[p->target].addr), p->seq);
+		}
+		probeoldest++;
+	}
+}
+
+/*
+ * multi_finish --
+ *	Print out statistics for every target and in total, and give up.
+ */
+static void
+multi_finish(void)
+{
+	struct target *t;
+	double avg, n, vari;
+	u_int alive, i;
+
+	(void)signal(SIGINT, SIG_IGN);
+	(void)signal(SIGALRM, SIG_IGN);
+	(void)putchar('\n');
+	(void)fflush(stdout);
+	(void)printf("--- ping statistics for %u targets ---\n", ntargets);
+	alive = 0;
+	for (i = 0; i < ntargets; i++) {
+		t = &targets[i];
+		if (t->name != NULL)
+			(void)printf("%s (%s): ", t->name, inet_ntoa(t->addr));
+		else
+			(void)printf("%s: ", inet_ntoa(t->addr));
+		(void)printf("%ld/%ld received", t->nreceived,
+		    t->ntransmitted);
+		if (t->nrepeats)
+			(void)printf(" +%ld duplicates", t->nrepeats);
+		if (t->ntransmitted)
+			(void)printf(", %.1f%% loss",
+			    ((t->ntransmitted - t->nreceived) * 100.0) /
+			    t->ntransmitted);
+		if (t->nreceived) {
+			alive++;
+			n = t->nreceived + t->nrepeats;
+			avg = t->tsum / n;
+			vari = t->tsumsq / n - avg * avg;
+			(void)printf(", min/avg/max/stddev = "
+			    "%.3f/%.3f/%.3f/%.3f ms",
+			    t->tmin, avg, t->tmax, sqrt(vari));
+		}
+		(void)putchar('\n');
+	}
+	(void)printf("%ld packets transmitted, ", ntransmitted);
+	(void)printf("%ld packets received, ", nreceived);
+	if (nrepeats)
+		(void)printf("+%ld duplicates, ", nrepeats);
+	if (ntransmitted)
+		(void)printf("%.1f%% packet loss, ",
+		    ((ntransmitted - nreceived) * 100.0) / ntransmitted);
+	(void)printf("%u/%u targets answered\n", alive, ntargets);
+	if (nreceived) {
+		n = nreceived + nrepeats;
+		avg = tsum / n;
+		vari = tsumsq / n - avg * avg;
+		(void)printf(
+		    "round-trip min/avg/max/stddev = %.3f/%.3f/%.3f/%.3f ms\n",
+		    tmin, avg, tmax, sqrt(vari));
+		(void)printf(
+		    "round-trip p50/p90/p99/p99.9 = %.3f/%.3f/%.3f/%.3f ms\n",
+		    hist_quantile(&rtthist, 0.5), hist_quantile(&rtthist, 0.9),
+		    hist_quantile(&rtthist, 0.99),
+		    hist_quantile(&rtthist, 0.999));
+	}
+	if (histfile != NULL)
+		hist_dump(&rtthist, histfile);
+
+	if (nreceived)
+		exit(0);
+	else
+		exit(2);
+}
+
 /*
  * pr_pack --
  *	Print out the packet, if it came from us.  This logic is necessary
@@ -1180,7 +1803,8 @@ pr_pack(char *buf, int cc, struct sockaddr_in *from, struct timeval *tv,
 	struct ip *ip;
 	const void *tp;
 	double triptime;
-	int dupflag, hlen, i, j, recv_len, seq;
+	long fullseq;
+	int dupflag, hlen, i, j, late, recv_len, seq;
 	static int old_rrlen;
 	static char old_rr[MAX_IPOPTLEN];
 
@@ -1227,28 +1851,46 @@ pr_pack(char *buf, int cc, struct sockaddr_in *from, struct timeval *tv,
 					tmin = triptime;
 				if (triptime > tmax)
 					tmax = triptime;
+				hist_add(&rtthist, triptime);
 			} else
 				timing = 0;
 		}
 
 		seq = ntohs(icp->icmp_seq);
 
-		if (TST(seq % mx_dup_ck)) {
+		/*
+		 * Widen the sequence number to the last packet sent with
+		 * it.  A reply from further back than the received table
+		 * reaches cannot be checked, and is late in any case.
+		 */
+		fullseq = ntransmitted - 1 - (u_int16_t)(ntransmitted - 1 - seq);
+		late = timing && triptime > waittime;
+		dupflag = 0;
+		if (fullseq < 0 || ntransmitted - fullseq > mx_dup_ck)
+			late = 1;
+		else if (TST(fullseq % mx_dup_ck)) {
 			++nrepeats;
 			--nreceived;
 			dupflag = 1;
 		} else {
-			SET(seq % mx_dup_ck);
-			dupflag = 0;
+			SET(fullseq % mx_dup_ck);
+			if (fullseq < maxseqrcvd) {
+				++nreordered;
+				if (maxseqrcvd - fullseq > maxreorder)
+					maxreorder = maxseqrcvd - fullseq;
+			} else
+				maxseqrcvd = fullseq;
+			if (ntransmitted - fullseq > mx_dup_ck / 2)
+				dup_grow();
 		}
+		if (late)
+			++nrcvtimeout;
 
 		if (options & F_QUIET)
 			return;
 	
-		if (options & F_WAITTIME && triptime > waittime) {
-			++nrcvtimeout;
+		if (options & F_WAITTIME && late)
 			return;
-		}
 
 		if (options & F_FLOOD)
 			(void)write(STDOUT_FILENO, &BSPACE, 1);
@@ -1363,6 +2005,7 @@ pr_pack(char *buf, int cc, struct sockaddr_in *from, struct timeval *tv,
 			cp += 2;
 			if (j >= INADDR_LEN &&
 			    j <= hlen - (int)sizeof(struct ip)) {
+				pr_prefetch(cp + 1, j);
 				for (;;) {
 					bcopy(++cp, &ina.s_addr, INADDR_LEN);
 					if (ina.s_addr == 0)
@@ -1405,6 +2048,7 @@ pr_pack(char *buf, int cc, struct sockaddr_in *from, struct timeval *tv,
 			(void)printf("\nRR: ");
 			if (i >= INADDR_LEN &&
 			    i <= hlen - (int)sizeof(struct ip)) {
+				pr_prefetch(cp + 1, i);
 				for (;;) {
 					bcopy(++cp, &ina.s_addr, INADDR_LEN);
 					if (ina.s_addr == 0)
@@ -1437,45 +2081,13 @@ pr_pack(char *buf, int cc, struct sockaddr_in *from, struct timeval *tv,
 
 /*
  * in_cksum --
- *	Checksum routine for Internet Protocol family headers (C Version)
+ *	Checksum routine for Internet Protocol family headers, using the
+ *	one's complement sum shared with libalias.
  */
 u_short
 in_cksum(u_short *addr, int len)
 {
-	int nleft, sum;
-	u_short *w;
-	union {
-		u_short	us;
-		u_char	uc[2];
-	} last;
-	u_short answer;
-
-	nleft = len;
-	sum = 0;
-	w = addr;
-
-	/*
-	 * Our algorithm is simple, using a 32 bit accumulator (sum), we add
-	 * sequential 16 bit words to it, and at the end, fold back all the
-	 * carry bits from the top 16 bits into the lower 16 bits.
-	 */
-	while (nleft > 1)  {
-		sum += *w++;
-		nleft -= 2;
-	}
-
-	/* mop up an odd byte, if necessary */
-	if (nleft == 1) {
-		last.uc[0] = *(u_char *)w;
-		last.uc[1] = 0;
-		sum += last.us;
-	}
-
-	/* add back carry outs from top 16 bits to low 16 bits */
-	sum = (sum >> 16) + (sum & 0xffff);	/* add hi 16 to low 16 */
-	sum += (sum >> 16);			/* add carry */
-	answer = ~sum;				/* truncate to 16 bits */
-	return(answer);
+	return ((u_short)~CksumFold(CksumAccumulate(addr, len, 0)));
 }
 
 /*
@@ -1494,6 +2106,33 @@ tvsub(struct timeval *out, const struct timeval *in)
 	out->tv_sec -= in->tv_sec;
 }
 
+/*
+ * dup_grow --
+ *	Double the received table, once replies come back from more than
+ * half way across it.  The bits for the packets the old table covered
+ * move to their places in the new one.
+ */
+static void
+dup_grow(void)
+{
+	u_char *tbl;
+	long seq;
+	int bit, old;
+
+	old = mx_dup_ck;
+	if (old >= MAX_DUP_WIN || (tbl = calloc(old * 2 / 8, 1)) == NULL)
+		return;
+	for (seq = ntransmitted - old; seq < ntransmitted; seq++) {
+		if (seq < 0 || !TST(seq % old))
+			continue;
+		bit = seq % (old * 2);
+		tbl[bit >> 3] |= B(bit);
+	}
+	free(rcvd_tbl);
+	rcvd_tbl = tbl;
+	mx_dup_ck = old * 2;
+}
+
 /*
  * status --
  *	Print out statistics when SIGINFO is received.
@@ -1516,8 +2155,12 @@ check_status(void)
 		    nreceived, ntransmitted,
 		    ntransmitted ? nreceived * 100.0 / ntransmitted : 0.0);
 		if (nreceived && timing)
-			(void)fprintf(stderr, " %.3f min / %.3f avg / %.3f max",
-			    tmin, tsum / (nreceived + nrepeats), tmax);
+			(void)fprintf(stderr, " %.3f min / %.3f avg / %.3f max"
+			    " / %.3f p50 / %.3f p99 / %.3f p99.9",
+			    tmin, tsum / (nreceived + nrepeats), tmax,
+			    hist_quantile(&rtthist, 0.5),
+			    hist_quantile(&rtthist, 0.99),
+			    hist_quantile(&rtthist, 0.999));
 		(void)fprintf(stderr, "\n");
 	}
 }
@@ -1549,6 +2192,9 @@ finish(void)
 	}
 	if (nrcvtimeout)
 		(void)printf(", %ld packets out of wait time", nrcvtimeout);
+	if (nreordered)
+		(void)printf(", %ld out of order (at most %ld behind)",
+		    nreordered, maxreorder);
 	(void)putchar('\n');
 	if (nreceived && timing) {
 		double n = nreceived + nrepeats;
@@ -1557,7 +2203,14 @@ finish(void)
 		(void)printf(
 		    "round-trip min/avg/max/stddev = %.3f/%.3f/%.3f/%.3f ms\n",
 		    tmin, avg, tmax, sqrt(vari));
+		(void)printf(
+		    "round-trip p50/p90/p99/p99.9 = %.3f/%.3f/%.3f/%.3f ms\n",
+		    hist_quantile(&rtthist, 0.5), hist_quantile(&rtthist, 0.9),
+		    hist_quantile(&rtthist, 0.99),
+		    hist_quantile(&rtthist, 0.999));
 	}
+	if (histfile != NULL)
+		hist_dump(&rtthist, histfile);
 
 	if (nreceived)
 		exit(0);
@@ -1767,18 +2420,52 @@ pr_iph(struct ip *ip)
 static char *
 pr_addr(struct in_addr ina)
 {
-	struct hostent *hp;
+	struct sockaddr_in sin;
+	const char *name;
+	int msecs;
 	static char buf[16 + 3 + MAXHOSTNAMELEN];
 
-	if ((options & F_NUMERIC) ||
-	    !(hp = gethostbyaddr((char *)&ina, 4, AF_INET)))
+	if (options & F_NUMERIC)
+		return inet_ntoa(ina);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_len = sizeof(sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr = ina;
+	/*
+	 * Don't hold up the replies behind a slow lookup: a name that is
+	 * not known in time is printed numerically, and by name on a later
+	 * packet once the lookup finishes.
+	 */
+	msecs = (options & F_FLOOD) ? 0 : MIN(interval / 2, NAMEWAIT);
+	if (!(name = rdns_name((struct sockaddr *)&sin, msecs)))
 		return inet_ntoa(ina);
 	else
-		(void)snprintf(buf, sizeof(buf), "%s (%s)", hp->h_name,
+		(void)snprintf(buf, sizeof(buf), "%s (%s)", name,
 		    inet_ntoa(ina));
 	return(buf);
 }
 
+/*
+ * pr_prefetch --
+ *	Start looking up the names of a list of addresses from an IP
+ * option, so that they are resolved together rather than one by one.
+ */
+static void
+pr_prefetch(u_char *cp, int len)
+{
+	struct sockaddr_in sin;
+
+	if (options & F_NUMERIC)
+		return;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_len = sizeof(sin);
+	sin.sin_family = AF_INET;
+	for (; len >= INADDR_LEN; len -= INADDR_LEN, cp += INADDR_LEN) {
+		bcopy(cp, &sin.sin_addr.s_addr, INADDR_LEN);
+		rdns_prefetch((struct sockaddr *)&sin);
+	}
+}
+
 /*
  * pr_retip --
  *	Dump some info on a returned (via ICMP) IP packet.
@@ -1893,15 +2580,18 @@ static void
 usage(void)
 {
 
-	(void)fprintf(stderr, "%s\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n",
-"usage: ping [-AaDdfnoQqRrv] [-b boundif] [-c count] [-G sweepmaxsize]",
-"            [-g sweepminsize] [-h sweepincrsize] [-i wait] [−k trafficclass]",
-"            [-l preload] [-M mask | time] [-m ttl]" SECOPT " [-p pattern]",
+	(void)fprintf(stderr, "%s\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n",
+"usage: ping [-AaDdfnoQqRrv] [-b boundif] [-c count] [-e histfile]",
+"            [-G sweepmaxsize] [-g sweepminsize] [-h sweepincrsize] [-i wait]",
+"            [−k trafficclass] [-l preload] [-M mask | time] [-m ttl]" SECOPT " [-p pattern]",
 "            [-S src_addr] [-s packetsize] [-t timeout][-W waittime] [-z tos]",
 "            host",
-"       ping [-AaDdfLnoQqRrv] [-b boundif] [-c count] [-I iface] [-i wait]",
+"       ping [-AaDdfLnoQqRrv] [-b boundif] [-c count] [-e histfile] [-I iface] [-i wait]",
 "            [−k trafficclass] [-l preload] [-M mask | time] [-m ttl]" SECOPT " [-p pattern] [-S src_addr]",
 "            [-s packetsize] [-T ttl] [-t timeout] [-W waittime]",
-"            [-z tos] mcast-group");
+"            [-z tos] mcast-group",
+"       ping [-AanoQqv] [-b boundif] [-c count] [-e histfile] [-F file] [-i wait]",
+"            [-k trafficclass] [-m ttl] [-p pattern] [-S src_addr] [-s packetsize]",
+"            [-t timeout] [-W waittime] [-x rate] [host | network/bits ...]");
 	exit(EX_USAGE);
 }
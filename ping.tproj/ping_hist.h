@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2013 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Round-trip time histogram shared by ping and ping6, kept in a header
+ * of inline functions like the checksum code.
+ *
+ * Times are counted in microseconds.  Below 2 * HIST_SUB microseconds
+ * every value has its own bucket; above that each power of two is cut
+ * into HIST_SUB buckets, so a bucket is never wider than 1/HIST_SUB of
+ * the values in it.  The table has a fixed size however long ping runs,
+ * and percentiles read from it are within about 1% of the exact ones.
+ */
+
+#ifndef _PING_HIST_H_
+#define _PING_HIST_H_
+
+#include <sys/types.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+
+#define	HIST_SUB_BITS	6		/* log2 of buckets per power of two */
+#define	HIST_SUB	(1 << HIST_SUB_BITS)
+#define	HIST_MAX_BITS	40		/* times up to 2^40 us, about 12 days */
+#define	HIST_BUCKETS	((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct ping_hist {
+	u_int64_t	count;		/* samples in the table */
+	double		min, max;	/* exact extremes, in ms */
+	u_int64_t	bucket[HIST_BUCKETS];
+};
+
+static __inline int
+hist_index(u_int64_t us)
+{
+	int shift;
+
+	if (us >= (u_int64_t)1 << HIST_MAX_BITS)
+		us = ((u_int64_t)1 << HIST_MAX_BITS) - 1;
+	if (us < 2 * HIST_SUB)
+		return ((int)us);
+	shift = 63 - __builtin_clzll(us) - HIST_SUB_BITS;
+	return ((shift + 1) * HIST_SUB + (int)(us >> shift) - HIST_SUB);
+}
+
+/* Lowest time, in us, that falls in bucket i */
+static __inline u_int64_t
+hist_lowest(int i)
+{
+
+	if (i < 2 * HIST_SUB)
+		return (i);
+	return ((u_int64_t)(i % HIST_SUB + HIST_SUB) << (i / HIST_SUB - 1));
+}
+
+static __inline u_int64_t
+hist_width(int i)
+{
+
+	if (i < 2 * HIST_SUB)
+		return (1);
+	return ((u_int64_t)1 << (i / HIST_SUB - 1));
+}
+
+/* Count a round-trip time given in ms */
+static __inline void
+hist_add(struct ping_hist *h, double ms)
+{
+
+	if (h->count == 0 || ms < h->min)
+		h->min = ms;
+	if (h->count == 0 || ms > h->max)
+		h->max = ms;
+	h->bucket[hist_index(ms > 0 ? (u_int64_t)(ms * 1000.0 + 0.5) : 0)]++;
+	h->count++;
+}
+
+/*
+ * The time, in ms, that a fraction q of the samples do not exceed:
+ * the middle of the bucket holding that sample, kept within the
+ * smallest and largest times seen.
+ */
+static __inline double
+hist_quantile(const struct ping_hist *h, double q)
+{
+	u_int64_t rank, seen;
+	double ms;
+	int i;
+
+	if (h->count == 0)
+		return (0.0);
+	rank = (u_int64_t)(q * h->count);
+	if (rank < q * h->count)
+		rank++;
+	if (rank < 1)
+		rank = 1;
+	seen = 0;
+	for (i = 0; i < HIST_BUCKETS - 1; i++) {
+		seen += h->bucket[i];
+		if (seen >= rank)
+			break;
+	}
+	ms = (hist_lowest(i) + (hist_width(i) - 1) / 2.0) / 1000.0;
+	if (ms < h->min)
+		ms = h->min;
+	if (ms > h->max)
+		ms = h->max;
+	return (ms);
+}
+
+/*
+ * Write the non-empty buckets to path, or to the standard output if it
+ * is "-": one line per bucket giving its lowest and highest time in us,
+ * its count and the fraction of samples up to and including it.
+ */
+static __inline void
+hist_dump(const struct ping_hist *h, const char *path)
+{
+	u_int64_t seen;
+	FILE *fp;
+	int i;
+
+	if (strcmp(path, "-") == 0)
+		fp = stdout;
+	else if ((fp = fopen(path, "w")) == NULL) {
+		warn("%s", path);
+		return;
+	}
+	(void)fprintf(fp, "# round-trip histogram, %llu samples\n",
+	    (unsigned long long)h->count);
+	(void)fprintf(fp, "# low_us high_us count cumulative\n");
+	seen = 0;
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if (h->bucket[i] == 0)
+			continue;
+		seen += h->bucket[i];
+		(void)fprintf(fp, "%llu %llu %llu %.6f\n",
+		    (unsigned long long)hist_lowest(i),
+		    (unsigned long long)(hist_lowest(i) + hist_width(i) - 1),
+		    (unsigned long long)h->bucket[i],
+		    (double)seen / h->count);
+	}
+	if (fp == stdout)
+		(void)fflush(fp);
+	else if (fclose(fp) != 0)
+		warn("%s", path);
+}
+
+#endif /* !_PING_HIST_H_ */
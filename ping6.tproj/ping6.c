@@ -158,6 +158,7 @@ __unused static const char copyright[] =
 #endif
 
 #include "md5.h"
+#include "../ping.tproj/ping_hist.h"
 
 struct tv32 {
 	u_int32_t tv32_sec;
@@ -271,6 +272,8 @@ double tmin = 999999999.0;	/* minimum round trip time */
 double tmax = 0.0;		/* maximum round trip time */
 double tsum = 0.0;		/* sum of all times, for doing average */
 double tsumsq = 0.0;		/* sum of all times squared, for std. dev. */
+struct ping_hist rtthist;	/* all times, for percentiles */
+char *histfile;			/* -e file to dump rtthist to */
 
 /* for node addresses */
 u_short naflags;
@@ -382,7 +385,7 @@ main(int argc, char *argv[])
 #endif /*IPSEC_POLICY_IPSEC*/
 #endif
 	while ((ch = getopt(argc, argv,
-	    "a:b:B:Cc:DdfHg:h:I:i:k:l:mnNop:qrRS:s:tvwWz:" ADDOPTS)) != -1) {
+	    "a:b:B:Cc:Dde:fHg:h:I:i:k:l:mnNop:qrRS:s:tvwWz:" ADDOPTS)) != -1) {
 #undef ADDOPTS
 		switch (ch) {
 		case 'a':
@@ -460,6 +463,9 @@ main(int argc, char *argv[])
 		case 'd':
 			options |= F_SO_DEBUG;
 			break;
+		case 'e':
+			histfile = optarg;
+			break;
 		case 'f':
 			if (getuid()) {
 				errno = EPERM;
@@ -1354,6 +1360,8 @@ main(int argc, char *argv[])
 		}
 	}
 	summary();
+	if (histfile != NULL)
+		hist_dump(&rtthist, histfile);
 
 	if (res != NULL)
 		freeaddrinfo(res);
@@ -1734,6 +1742,7 @@ pr_pack(u_char *buf, int cc, struct msghdr *mhdr)
 				tmin = triptime;
 			if (triptime > tmax)
 				tmax = triptime;
+			hist_add(&rtthist, triptime);
 		}
 
 		if (TST(seq % mx_dup_ck)) {
@@ -2464,6 +2473,8 @@ void
 onint(int notused __unused)
 {
 	summary();
+	if (histfile != NULL)
+		hist_dump(&rtthist, histfile);
 
 	if (res != NULL)
 		freeaddrinfo(res);
@@ -2518,6 +2529,11 @@ summary(void)
 		(void)printf(
 		    "round-trip min/avg/max/std-dev = %.3f/%.3f/%.3f/%.3f ms\n",
 		    tmin, avg, tmax, dev);
+		(void)printf(
+		    "round-trip p50/p90/p99/p99.9 = %.3f/%.3f/%.3f/%.3f ms\n",
+		    hist_quantile(&rtthist, 0.5), hist_quantile(&rtthist, 0.9),
+		    hist_quantile(&rtthist, 0.99),
+		    hist_quantile(&rtthist, 0.999));
 		(void)fflush(stdout);
 	}
 	(void)fflush(stdout);
@@ -3049,7 +3065,7 @@ usage(void)
 #endif
 	    "nNoqrRtvwW] "
 	    "[-a addrtype] [-b bufsiz] [-B boundif] [-c count]\n"
-	    "             [-g gateway] [-h hoplimit] [-I interface] [-i wait] [-l preload]"
+	    "             [-e histfile] [-g gateway] [-h hoplimit] [-I interface] [-i wait] [-l preload]"
 #if defined(IPSEC) && defined(IPSEC_POLICY_IPSEC)
 	    " [-P policy]"
 #endif
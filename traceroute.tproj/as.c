@@ -37,6 +37,18 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+/*
+ * AS numbers come from an optional table of prefixes, longest match
+ * first, given as a file of "prefix/len AS" lines (or the "prefix len
+ * AS" lines of a pfx2as dump), and otherwise from the answers of a RADB
+ * style whois server.  Queries to the server are pipelined: as_prefetch()
+ * sends one without waiting and the answers are parsed as they stream
+ * in.  An answer is kept for the address it was asked about only; the
+ * route it names may hold more specific routes with other origins, which
+ * the server was not asked about.  The answers may be kept across runs
+ * in a cache file of host routes.
+ */
+
 #include <sys/cdefs.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -55,31 +67,212 @@
 #define DEFAULT_AS_SERVER "whois.radb.net"
 #undef AS_DEBUG_FILE
 
+#define AS_IDLE		0		/* waiting for an answer to start */
+#define AS_DATA		1		/* reading the objects of an answer */
+#define AS_END		2		/* waiting for the end code */
+
+struct asroute {
+	struct asroute *next;
+	in_addr_t net;			/* host order, masked to len */
+	int len;
+	int as;
+	int learned;			/* from the server, to be cached */
+};
+
 struct aslookup {
-	FILE *as_f;
+	int as_fd;			/* whois connection, or -1 */
+	char as_buf[1024];		/* partial line read */
+	size_t as_buflen;
+	int as_state;
+	int as_dlen;			/* bytes left in the answer */
+	int as_as;			/* origin of the answer */
+	struct in_addr *as_pending;	/* queries sent, oldest first */
+	int as_npending;
+	int as_maxpending;
+	struct asroute **as_hash;
+	int as_nhash;
+	int as_nroutes;
+	u_int64_t as_lens;		/* prefix lengths in the table */
+	char *as_cache;
 #ifdef AS_DEBUG_FILE
 	FILE *as_debug;
 #endif /* AS_DEBUG_FILE */
 };
 
-void *
-as_setup(server)
-	char *server;
+static in_addr_t
+as_mask(len)
+	int len;
+{
+
+	return (len == 0 ? 0 : 0xffffffffU << (32 - len));
+}
+
+static struct asroute **
+as_bucket(asn, net, len)
+	struct aslookup *asn;
+	in_addr_t net;
+	int len;
 {
+	u_int32_t h;
+
+	h = (net ^ ((u_int32_t)len << 27)) * 2654435761U;
+	return (&asn->as_hash[(h ^ (h >> 16)) & (asn->as_nhash - 1)]);
+}
+
+static void
+as_insert(asn, net, len, as, learned)
 	struct aslookup *asn;
+	in_addr_t net;
+	int len, as, learned;
+{
+	struct asroute *r, *next, **bp, **ohash;
+	int i, onhash;
+
+	net &= as_mask(len);
+	for (r = *as_bucket(asn, net, len); r != NULL; r = r->next)
+		if (r->net == net && r->len == len) {
+			r->as = as;
+			r->learned = learned;
+			return;
+		}
+
+	if (asn->as_nroutes >= asn->as_nhash) {
+		ohash = asn->as_hash;
+		onhash = asn->as_nhash;
+		bp = calloc(onhash * 2, sizeof(*bp));
+		if (bp != NULL) {
+			asn->as_hash = bp;
+			asn->as_nhash = onhash * 2;
+			for (i = 0; i < onhash; i++)
+				for (r = ohash[i]; r != NULL; r = next) {
+					next = r->next;
+					bp = as_bucket(asn, r->net, r->len);
+					r->next = *bp;
+					*bp = r;
+				}
+			free(ohash);
+		}
+	}
+
+	if ((r = malloc(sizeof(*r))) == NULL)
+		return;
+	r->net = net;
+	r->len = len;
+	r->as = as;
+	r->learned = learned;
+	bp = as_bucket(asn, net, len);
+	r->next = *bp;
+	*bp = r;
+	asn->as_nroutes++;
+	asn->as_lens |= (u_int64_t)1 << len;
+}
+
+/* The longest prefix in the table holding addr */
+static struct asroute *
+as_find(asn, addr)
+	struct aslookup *asn;
+	struct in_addr *addr;
+{
+	struct asroute *r;
+	in_addr_t a, net;
+	int len;
+
+	a = ntohl(addr->s_addr);
+	for (len = 32; len >= 0; len--) {
+		if ((asn->as_lens & ((u_int64_t)1 << len)) == 0)
+			continue;
+		net = a & as_mask(len);
+		for (r = *as_bucket(asn, net, len); r != NULL; r = r->next)
+			if (r->net == net && r->len == len)
+				return (r);
+	}
+	return (NULL);
+}
+
+/* "a.b.c.d/len" or "a.b.c.d len", then the AS, possibly as "ASn" */
+static int
+as_parse(line, net, len, as)
+	char *line;
+	in_addr_t *net;
+	int *len, *as;
+{
+	char addr[16], *cp;
+	struct in_addr in;
+
+	if (sscanf(line, " %15[0-9.]/%d", addr, len) != 2 &&
+	    sscanf(line, " %15[0-9.] %d", addr, len) != 2)
+		return (0);
+	if (inet_aton(addr, &in) == 0 || *len < 0 || *len > 32)
+		return (0);
+	cp = line + strspn(line, " \t");
+	cp += strcspn(cp, " \t");
+	if (strchr(line, '/') == NULL || strchr(line, '/') > cp) {
+		/* pfx2as: the length is a field of its own */
+		cp += strspn(cp, " \t");
+		cp += strcspn(cp, " \t");
+	}
+	cp += strspn(cp, " \t");
+	if (strncasecmp(cp, "AS", 2) == 0)
+		cp += 2;
+	if (sscanf(cp, "%d", as) != 1)
+		return (0);
+	*net = ntohl(in.s_addr);
+	return (1);
+}
+
+/* A table, or with hosts set a cache, which holds host routes only */
+static int
+as_load(asn, path, hosts)
+	struct aslookup *asn;
+	char *path;
+	int hosts;
+{
+	char line[256];
+	in_addr_t net;
+	int len, as;
+	FILE *f;
+
+	if ((f = fopen(path, "r")) == NULL)
+		return (-1);
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (line[0] == '#')
+			continue;
+		if (as_parse(line, &net, &len, &as) && (!hosts || len == 32))
+			as_insert(asn, net, len, as, 0);
+	}
+	(void)fclose(f);
+	return (0);
+}
+
+/*
+ * Connect to the server, given as "host" or "host:port", and put it in
+ * multiple command mode
+ */
+static int
+as_connect(server)
+	char *server;
+{
 	struct hostent *he = NULL;
 	struct servent *se;
 	struct sockaddr_in in;
-	FILE *f;
+	char host[256], *cp;
+	long port;
 	int s;
 
-	if (server == NULL)
-		server = DEFAULT_AS_SERVER;
-
 	(void)memset(&in, 0, sizeof(in));
 	in.sin_family = AF_INET;
 	in.sin_len = sizeof(in);
-	if ((se = getservbyname("whois", "tcp")) == NULL) {
+	(void)strlcpy(host, server, sizeof(host));
+	server = host;
+	if ((cp = strchr(host, ':')) != NULL) {
+		*cp++ = '\0';
+		port = strtol(cp, &cp, 10);
+		if (*cp != '\0' || port <= 0 || port > 65535) {
+			warnx("%s: bad port", server);
+			return (-1);
+		}
+		in.sin_port = htons(port);
+	} else if ((se = getservbyname("whois", "tcp")) == NULL) {
 		warnx("warning: whois/tcp service not found");
 		in.sin_port = ntohs(43);
 	} else
@@ -89,12 +282,12 @@ as_setup(server)
 	    ((he = gethostbyname(server)) == NULL ||
 	    he->h_addr == NULL)) {
 		warnx("%s: %s", server, hstrerror(h_errno));
-		return (NULL);
+		return (-1);
 	}
 
 	if ((s = socket(PF_INET, SOCK_STREAM, 0)) == -1) {
 		warn("socket");
-		return (NULL);
+		return (-1);
 	}
 
 	do {
@@ -113,18 +306,189 @@ as_setup(server)
 
 	if (s == -1) {
 		warn("connect");
-		return (NULL);
+		return (-1);
+	}
+
+	if (write(s, "!!\n", 3) != 3) {
+		warn("write");
+		close(s);
+		return (-1);
+	}
+	return (s);
+}
+
+/* The server went away: answer what is left from the table alone */
+static void
+as_disconnect(asn)
+	struct aslookup *asn;
+{
+
+	if (asn->as_fd != -1) {
+		(void)close(asn->as_fd);
+		asn->as_fd = -1;
+	}
+	asn->as_npending = 0;
+	asn->as_buflen = 0;
+	asn->as_state = AS_IDLE;
+}
+
+/* The answer to the oldest query is complete */
+static void
+as_answer(asn)
+	struct aslookup *asn;
+{
+	in_addr_t a;
+
+	if (asn->as_npending == 0)
+		return;
+	a = ntohl(asn->as_pending[0].s_addr);
+	asn->as_npending--;
+	memmove(&asn->as_pending[0], &asn->as_pending[1],
+	    asn->as_npending * sizeof(asn->as_pending[0]));
+
+	/* A miss is remembered for this run only */
+	as_insert(asn, a, 32, asn->as_as, asn->as_as != 0);
+	asn->as_state = AS_IDLE;
+}
+
+static void
+as_line(asn, buf)
+	struct aslookup *asn;
+	char *buf;
+{
+
+#ifdef AS_DEBUG_FILE
+	if (asn->as_debug) {
+		(void)fprintf(asn->as_debug, "<< %s", buf);
+		(void)fflush(asn->as_debug);
+	}
+#endif /* AS_DEBUG_FILE */
+
+	switch (asn->as_state) {
+	    case AS_IDLE:
+		asn->as_as = 0;
+		switch (buf[0]) {
+		    case 'A':
+			/* A - followed by # bytes of answer */
+			asn->as_dlen = 0;
+			sscanf(buf, "A%d", &asn->as_dlen);
+			asn->as_state = asn->as_dlen > 0 ? AS_DATA : AS_END;
+			break;
+		    case 'C':
+		    case 'D':
+		    case 'E':
+		    case 'F':
+			/* C - no data returned */
+			/* D - key not found */
+			/* E - multiple copies of key */
+			/* F - some other error */
+			as_answer(asn);
+			break;
+		}
+		break;
+
+	    case AS_DATA:
+		/* data received, thank you */
+		asn->as_dlen -= strlen(buf);
+
+		/* the first origin */
+		if (asn->as_as == 0 && strncasecmp(buf, "origin:", 7) == 0)
+			sscanf(buf + 7, " AS%d", &asn->as_as);
+		if (asn->as_dlen <= 0)
+			asn->as_state = AS_END;
+		break;
+
+	    case AS_END:
+		/* out of data, this line is the end code */
+		as_answer(asn);
+		break;
+	}
+}
+
+/*
+ * Read what the server has sent and parse the complete lines.  Returns
+ * -1 if the connection is gone, else whether anything was read.
+ */
+static int
+as_read(asn, block)
+	struct aslookup *asn;
+	int block;
+{
+	char *cp, *eol, line[sizeof(asn->as_buf) + 1];
+	ssize_t n;
+	size_t len;
+
+	if (asn->as_fd == -1)
+		return (-1);
+	n = recv(asn->as_fd, asn->as_buf + asn->as_buflen,
+	    sizeof(asn->as_buf) - asn->as_buflen, block ? 0 : MSG_DONTWAIT);
+	if (n < 0 && (errno == EINTR || (!block && errno == EAGAIN)))
+		return (0);
+	if (n <= 0) {
+		as_disconnect(asn);
+		return (-1);
 	}
+	asn->as_buflen += n;
 
-	f = fdopen(s, "r+");
-	(void)fprintf(f, "!!\n");
-	(void)fflush(f);
+	cp = asn->as_buf;
+	while ((eol = memchr(cp, '\n', asn->as_buf + asn->as_buflen - cp))
+	    != NULL || (cp == asn->as_buf &&
+	    asn->as_buflen == sizeof(asn->as_buf))) {
+		/* an overlong line is taken in pieces */
+		len = eol != NULL ? eol + 1 - cp : asn->as_buflen;
+		memcpy(line, cp, len);
+		line[len] = '\0';
+		cp += len;
+		as_line(asn, line);
+		if (asn->as_fd == -1)
+			return (-1);
+	}
+	asn->as_buflen -= cp - asn->as_buf;
+	memmove(asn->as_buf, cp, asn->as_buflen);
+	return (1);
+}
 
-	asn = malloc(sizeof(struct aslookup));
+/*
+ * Set up AS lookups.  With a table and no server the lookups are made
+ * from the table alone; otherwise what the table and cache do not hold
+ * is asked of the server.
+ */
+void *
+as_setup(server, table, cache)
+	char *server, *table, *cache;
+{
+	struct aslookup *asn;
+
+	asn = calloc(1, sizeof(struct aslookup));
 	if (asn == NULL)
-		(void)fclose(f);
-	else
-		asn->as_f = f;
+		return (NULL);
+	asn->as_fd = -1;
+	asn->as_nhash = 256;
+	asn->as_hash = calloc(asn->as_nhash, sizeof(*asn->as_hash));
+	if (asn->as_hash == NULL) {
+		free(asn);
+		return (NULL);
+	}
+
+	if (table != NULL && as_load(asn, table, 0) == -1) {
+		warn("%s", table);
+		as_shutdown(asn);
+		return (NULL);
+	}
+	if (cache != NULL) {
+		if (as_load(asn, cache, 1) == -1 && errno != ENOENT)
+			warn("%s", cache);
+		asn->as_cache = cache;
+	}
+
+	if (server != NULL || table == NULL) {
+		if (server == NULL)
+			server = DEFAULT_AS_SERVER;
+		if ((asn->as_fd = as_connect(server)) == -1) {
+			as_shutdown(asn);
+			return (NULL);
+		}
+	}
 
 #ifdef AS_DEBUG_FILE
 	asn->as_debug = fopen(AS_DEBUG_FILE, "w");
@@ -137,89 +501,99 @@ as_setup(server)
 	return (asn);
 }
 
-int
-as_lookup(_asn, addr)
+/*
+ * Ask the server about addr without waiting for the answer, unless the
+ * table already answers or the question is out already.
+ */
+void
+as_prefetch(_asn, addr)
 	void *_asn;
 	struct in_addr *addr;
 {
 	struct aslookup *asn = _asn;
-	char buf[1024];
-	int as, rc, dlen;
+	struct in_addr *p;
+	char buf[64];
+	int i, n;
 
-	as = rc = dlen = 0;
-	(void)fprintf(asn->as_f, "!r%s/32,l\n", inet_ntoa(*addr));
-	(void)fflush(asn->as_f);
+	if (asn->as_fd == -1 || as_find(asn, addr) != NULL)
+		return;
+	for (i = 0; i < asn->as_npending; i++)
+		if (asn->as_pending[i].s_addr == addr->s_addr)
+			return;
+	if (asn->as_npending == asn->as_maxpending) {
+		n = asn->as_maxpending ? asn->as_maxpending * 2 : 64;
+		p = realloc(asn->as_pending, n * sizeof(*p));
+		if (p == NULL)
+			return;
+		asn->as_pending = p;
+		asn->as_maxpending = n;
+	}
+
+	n = snprintf(buf, sizeof(buf), "!r%s/32,l\n", inet_ntoa(*addr));
+	if (write(asn->as_fd, buf, n) != n) {
+		as_disconnect(asn);
+		return;
+	}
+	asn->as_pending[asn->as_npending++] = *addr;
 
 #ifdef AS_DEBUG_FILE
 	if (asn->as_debug) {
-		(void)fprintf(asn->as_debug, ">> !r%s/32,l\n",
-		     inet_ntoa(*addr));
+		(void)fprintf(asn->as_debug, ">> %s", buf);
 		(void)fflush(asn->as_debug);
 	}
 #endif /* AS_DEBUG_FILE */
+}
 
-	while (fgets(buf, sizeof(buf), asn->as_f) != NULL) {
-		buf[sizeof(buf) - 1] = '\0';
+/* The server connection, to wait on for answers, or -1 */
+int
+as_fd(_asn)
+	void *_asn;
+{
+	struct aslookup *asn = _asn;
 
-#ifdef AS_DEBUG_FILE
-		if (asn->as_debug) {
-			(void)fprintf(asn->as_debug, "<< %s", buf);
-			(void)fflush(asn->as_debug);
-		}
-#endif /* AS_DEBUG_FILE */
+	return (asn->as_fd);
+}
 
-		if (rc == 0) {
-			rc = buf[0];
-			switch (rc) {
-			    case 'A':
-				/* A - followed by # bytes of answer */
-				sscanf(buf, "A%d\n", &dlen);
-#ifdef AS_DEBUG_FILE
-				if (asn->as_debug) {
-					(void)fprintf(asn->as_debug,
-					     "dlen: %d\n", dlen);
-					(void)fflush(asn->as_debug);
-				}
-#endif /* AS_DEBUG_FILE */
-				break;
-			    case 'C':	
-			    case 'D':
-			    case 'E':
-			    case 'F':
-				/* C - no data returned */
-				/* D - key not found */
-				/* E - multiple copies of key */
-				/* F - some other error */
-				break;
-			}
-			if (rc == 'A')
-				/* skip to next input line */
-				continue;
-		}
+/* Take in the answers that have arrived, without waiting */
+void
+as_input(_asn)
+	void *_asn;
+{
 
-		if (dlen == 0)
-			/* out of data, next char read is end code */
-			rc = buf[0];
-		if (rc != 'A')
-			/* either an error off the bat, or a done code */
-			break;
+	(void)as_read(_asn, 0);
+}
 
-		/* data received, thank you */
-		dlen -= strlen(buf);
+/* Whether as_lookup() can answer for addr without waiting */
+int
+as_ready(_asn, addr)
+	void *_asn;
+	struct in_addr *addr;
+{
+	struct aslookup *asn = _asn;
+	int i;
 
-		/* origin line is the interesting bit */
-		if (as == 0 && strncasecmp(buf, "origin:", 7) == 0) {
-			sscanf(buf + 7, " AS%d", &as);
-#ifdef AS_DEBUG_FILE
-			if (asn->as_debug) {
-				(void)fprintf(asn->as_debug, "as: %d\n", as);
-				(void)fflush(asn->as_debug);
-			}
-#endif /* AS_DEBUG_FILE */
-		}
-	}
+	if (asn->as_fd == -1 || as_find(asn, addr) != NULL)
+		return (1);
+	for (i = 0; i < asn->as_npending; i++)
+		if (asn->as_pending[i].s_addr == addr->s_addr)
+			return (0);
+	return (1);
+}
 
-	return (as);
+int
+as_lookup(_asn, addr)
+	void *_asn;
+	struct in_addr *addr;
+{
+	struct aslookup *asn = _asn;
+	struct asroute *r;
+
+	/* Every answer enters a host route for the address it was for */
+	as_prefetch(asn, addr);
+	while ((r = as_find(asn, addr)) == NULL)
+		if (asn->as_npending == 0 || as_read(asn, 1) == -1)
+			return (0);
+	return (r->as);
 }
 
 void
@@ -227,9 +601,41 @@ as_shutdown(_asn)
 	void *_asn;
 {
 	struct aslookup *asn = _asn;
+	struct asroute *r, *next;
+	FILE *f;
+	int i;
+
+	if (asn->as_fd != -1) {
+		(void)write(asn->as_fd, "!q\n", 3);
+		(void)close(asn->as_fd);
+	}
+
+	/* Add what the server told us to the cache */
+	f = NULL;
+	for (i = 0; i < asn->as_nhash; i++)
+		for (r = asn->as_hash[i]; r != NULL; r = r->next) {
+			if (!r->learned || asn->as_cache == NULL)
+				continue;
+			if (f == NULL &&
+			    (f = fopen(asn->as_cache, "a")) == NULL) {
+				warn("%s", asn->as_cache);
+				asn->as_cache = NULL;
+				continue;
+			}
+			(void)fprintf(f, "%u.%u.%u.%u/%d %d\n",
+			    r->net >> 24, (r->net >> 16) & 0xff,
+			    (r->net >> 8) & 0xff, r->net & 0xff, r->len, r->as);
+		}
+	if (f != NULL && fclose(f) != 0)
+		warn("%s", asn->as_cache);
 
-	(void)fprintf(asn->as_f, "!q\n");
-	(void)fclose(asn->as_f);
+	for (i = 0; i < asn->as_nhash; i++)
+		for (r = asn->as_hash[i]; r != NULL; r = next) {
+			next = r->next;
+			free(r);
+		}
+	free(asn->as_hash);
+	free(asn->as_pending);
 
 #ifdef AS_DEBUG_FILE
 	if (asn->as_debug) {
@@ -37,6 +37,10 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-void	*as_setup __P((char *));
+void	*as_setup __P((char *, char *, char *));
+void	as_prefetch __P((void *, struct in_addr *));
+int	as_fd __P((void *));
+void	as_input __P((void *));
+int	as_ready __P((void *, struct in_addr *));
 int	as_lookup __P((void *, struct in_addr *));
 void	as_shutdown __P((void *));
@@ -0,0 +1,65 @@
+/*
+ * Drive as.c the way traceroute -a does, for as.test: the addresses on
+ * the command line are looked up one after another, or with -c all
+ * asked about at once first, and their AS numbers printed in order, one
+ * "address AS" line each.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "as.h"
+
+int
+main(argc, argv)
+	int argc;
+	char **argv;
+{
+	char *server = NULL, *table = NULL, *cache = NULL;
+	struct in_addr *addrs;
+	void *asn;
+	int ch, i, pipeline = 0;
+
+	while ((ch = getopt(argc, argv, "A:cC:T:")) != -1)
+		switch (ch) {
+		case 'A':
+			server = optarg;
+			break;
+		case 'c':
+			pipeline = 1;
+			break;
+		case 'C':
+			cache = optarg;
+			break;
+		case 'T':
+			table = optarg;
+			break;
+		default:
+			(void)fprintf(stderr, "usage: astest [-A as_server] "
+			    "[-c] [-C as_cache] [-T as_table] address ...\n");
+			exit(1);
+		}
+	argc -= optind;
+	argv += optind;
+
+	if ((addrs = calloc(argc, sizeof(*addrs))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < argc; i++)
+		if (inet_aton(argv[i], &addrs[i]) == 0)
+			errx(1, "%s: bad address", argv[i]);
+
+	if ((asn = as_setup(server, table, cache)) == NULL)
+		errx(1, "as_setup failed");
+	for (i = 0; pipeline && i < argc; i++)
+		as_prefetch(asn, &addrs[i]);
+	for (i = 0; i < argc; i++)
+		(void)printf("%s %d\n", argv[i], as_lookup(asn, &addrs[i]));
+	as_shutdown(asn);
+	return (0);
+}
@@ -289,6 +289,8 @@ The Regents of the University of California.  All rights reserved.\n";
 #include "ifaddrlist.h"
 #include "as.h"
 #include "traceroute.h"
+#include "../alias/alias_cksum.h"
+#include "../netstat.tproj/rdns.h"
 
 /* Maximum number of gateways (include room for one noop) */
 #define NGATEWAYS ((int)((MAX_IPOPTLEN - IPOPT_MINOFF - 1) / sizeof(u_int32_t)))
@@ -377,6 +379,8 @@ int waittime = 5;		/* time to wait for response (in seconds) */
 int nflag;			/* print addresses numerically */
 int as_path;			/* print as numbers for each hop */
 char *as_server = NULL;
+char *as_table = NULL;		/* prefix to AS file, for offline use */
+char *as_cache = NULL;		/* prefix to AS results kept across runs */
 void *asn;
 #ifdef CANT_HACK_IPCKSUM
 int doipcksum = 0;		/* don't calculate ip checksums by default */
@@ -386,6 +390,7 @@ int doipcksum = 1;		/* calculate ip checksums by default */
 int optlen;			/* length of ip options */
 int fixedPort = 0;		/* Use fixed destination port for TCP and UDP */
 int printdiff = 0;		/* Print the difference between sent and quoted */
+int nsim = 1;			/* probes in flight at once (-c) */
 
 extern int optind;
 extern int opterr;
@@ -403,6 +408,11 @@ u_short p_cksum(struct ip *, u_short *, int);
 int	packet_ok(u_char *, int, struct sockaddr_in *, int);
 char	*pr_type(u_char);
 void	print(u_char *, int, struct sockaddr_in *);
+void	print_code(int, struct ip *, int, int *, int *);
+void	print_rtt(double);
+int	probe_seq(u_char *, int);
+int	lookups_ready(struct in_addr *);
+void	trace_parallel(struct sockaddr_in *, int);
 #ifdef	IPSEC
 int	setpolicy __P((int so, char *policy));
 #endif
@@ -497,7 +507,7 @@ const char *ip_hdr_key = "vhtslen id  off tlprsum srcip   dstip   opts";
 int
 main(int argc, char **argv)
 {
-	register int op, code, n;
+	register int op, n;
 	register char *cp;
 	register const char *err;
 	register u_int32_t *ap;
@@ -563,7 +573,7 @@ main(int argc, char **argv)
 		prog = argv[0];
 
 	opterr = 0;
-	while ((op = getopt(argc, argv, "aA:edDFInrSvxf:g:i:M:m:P:p:q:s:t:w:z:")) != EOF)
+	while ((op = getopt(argc, argv, "aA:c:C:edDFInrSvxf:g:i:M:m:P:p:q:s:t:T:w:z:")) != EOF)
 		switch (op) {
 		case 'a':
 			as_path = 1;
@@ -574,6 +584,15 @@ main(int argc, char **argv)
 			as_server = optarg;
 			break;
 			    
+		case 'c':
+			nsim = str2val(optarg, "simultaneous probes", 1, 254);
+			break;
+
+		case 'C':
+			as_path = 1;
+			as_cache = optarg;
+			break;
+
 		case 'd':
 			options |= SO_DEBUG;
 			break;
@@ -656,6 +675,11 @@ main(int argc, char **argv)
 			++settos;
 			break;
 
+		case 'T':
+			as_path = 1;
+			as_table = optarg;
+			break;
+
 		case 'v':
 			++verbose;
 			break;
@@ -684,6 +708,11 @@ main(int argc, char **argv)
 	if (nprobes == -1)
 		nprobes = printdiff ? 1 : 3;
 
+	if (nsim > 1 && printdiff) {
+		Fprintf(stderr, "%s: -c may not be used with -D\n", prog);
+		exit(1);
+	}
+
 	if (first_ttl > max_ttl) {
 		Fprintf(stderr,
 		    "%s: first ttl (%d) may not be greater than max ttl (%d)\n",
@@ -952,7 +981,7 @@ main(int argc, char **argv)
 	}
 
 	if (as_path) {
-		asn = as_setup(as_server);
+		asn = as_setup(as_server, as_table, as_cache);
 		if (asn == NULL) {
 			Fprintf(stderr, "%s: as_setup failed, AS# lookups"
 			    " disabled\n", prog);
@@ -976,6 +1005,13 @@ main(int argc, char **argv)
 	Fprintf(stderr, ", %d hops max, %d byte packets\n", max_ttl, packlen);
 	(void)fflush(stderr);
 
+	if (nsim > 1) {
+		trace_parallel(from, sump);
+		if (as_path)
+			as_shutdown(asn);
+		exit(0);
+	}
+
 	for (ttl = first_ttl; ttl <= max_ttl; ++ttl) {
 		u_int32_t lastaddr = 0;
 		int gotlastaddr = 0;
@@ -989,7 +1025,6 @@ main(int argc, char **argv)
 			register int cc;
 			struct timeval t1, t2;
 			struct timezone tz;
-			register struct ip *ip;
 			struct outdata outdata;
 
 			if (sentfirst && pausemsecs > 0)
@@ -1009,9 +1044,6 @@ main(int argc, char **argv)
 
 			/* Wait for a reply */
 			while ((cc = wait_for_reply(s, from, &t1)) != 0) {
-				double T;
-				int precis;
-
 				(void)gettimeofday(&t2, &tz);
 				i = packet_ok(packet, cc, from, seq);
 				/* Skip short packet */
@@ -1024,18 +1056,7 @@ main(int argc, char **argv)
 					lastaddr = from->sin_addr.s_addr;
 					++gotlastaddr;
 				}
-				T = deltaT(&t1, &t2);
-#ifdef SANE_PRECISION
-				if (T >= 1000.0)
-					precis = 0;
-				else if (T >= 100.0)
-					precis = 1;
-				else if (T >= 10.0)
-					precis = 2;
-				else
-#endif
-					precis = 3;
-				Printf("  %.*f ms", precis, T);
+				print_rtt(deltaT(&t1, &t2));
 				if (printdiff) {
 					Printf("\n");
 					Printf("%*.*s%s\n",
@@ -1046,129 +1067,452 @@ main(int argc, char **argv)
 					pkt_compare((void *)outip, packlen,
 					    (void *)hip, hiplen);
 				}
-				if (i == -2) {
+				print_code(i, (struct ip *)packet, pmtu,
+				    &got_there, &unreachable);
+				break;
+			}
+			if (cc == 0) {
+				loss++;
+				Printf(" *");
+			}
+			(void)fflush(stdout);
+		}
+		if (sump) {
+			Printf(" (%d%% loss)", (loss * 100) / nprobes);
+		}
+		putchar('\n');
+		if (got_there ||
+		    (unreachable > 0 && unreachable >= nprobes - 1))
+			break;
+	}
+	if (as_path)
+		as_shutdown(asn);
+	exit(0);
+}
+
+/*
+ * Print the note for a reply that packet_ok() returned i for, and
+ * count its hop as reached or unreachable.
+ */
+void
+print_code(int i, struct ip *ip, int mtu, int *got_there, int *unreachable)
+{
+	int code;
+
+	if (i == -2) {
 #ifndef ARCHAIC
-					ip = (struct ip *)packet;
-					if (ip->ip_ttl <= 1)
-						Printf(" !");
+		if (ip->ip_ttl <= 1)
+			Printf(" !");
 #endif
-					++got_there;
-					break;
-				}
-				/* time exceeded in transit */
-				if (i == -1)
-					break;
-				code = i - 1;
-				switch (code) {
+		++*got_there;
+		return;
+	}
+	/* time exceeded in transit */
+	if (i == -1)
+		return;
+	code = i - 1;
+	switch (code) {
 
-				case ICMP_UNREACH_PORT:
+	case ICMP_UNREACH_PORT:
 #ifndef ARCHAIC
-					ip = (struct ip *)packet;
-					if (ip->ip_ttl <= 1)
-						Printf(" !");
+		if (ip->ip_ttl <= 1)
+			Printf(" !");
 #endif
-					++got_there;
-					break;
+		++*got_there;
+		break;
 
-				case ICMP_UNREACH_NET:
-					++unreachable;
-					Printf(" !N");
-					break;
+	case ICMP_UNREACH_NET:
+		++*unreachable;
+		Printf(" !N");
+		break;
 
-				case ICMP_UNREACH_HOST:
-					++unreachable;
-					Printf(" !H");
-					break;
+	case ICMP_UNREACH_HOST:
+		++*unreachable;
+		Printf(" !H");
+		break;
 
-				case ICMP_UNREACH_PROTOCOL:
-					++got_there;
-					Printf(" !P");
-					break;
+	case ICMP_UNREACH_PROTOCOL:
+		++*got_there;
+		Printf(" !P");
+		break;
 
-				case ICMP_UNREACH_NEEDFRAG:
-					++unreachable;
-					Printf(" !F-%d", pmtu);
-					break;
+	case ICMP_UNREACH_NEEDFRAG:
+		++*unreachable;
+		Printf(" !F-%d", mtu);
+		break;
 
-				case ICMP_UNREACH_SRCFAIL:
-					++unreachable;
-					Printf(" !S");
-					break;
+	case ICMP_UNREACH_SRCFAIL:
+		++*unreachable;
+		Printf(" !S");
+		break;
 
-				case ICMP_UNREACH_NET_UNKNOWN:
-					++unreachable;
-					Printf(" !U");
-					break;
+	case ICMP_UNREACH_NET_UNKNOWN:
+		++*unreachable;
+		Printf(" !U");
+		break;
 
-				case ICMP_UNREACH_HOST_UNKNOWN:
-					++unreachable;
-					Printf(" !W");
-					break;
+	case ICMP_UNREACH_HOST_UNKNOWN:
+		++*unreachable;
+		Printf(" !W");
+		break;
 
-				case ICMP_UNREACH_ISOLATED:
-					++unreachable;
-					Printf(" !I");
-					break;
+	case ICMP_UNREACH_ISOLATED:
+		++*unreachable;
+		Printf(" !I");
+		break;
 
-				case ICMP_UNREACH_NET_PROHIB:
-					++unreachable;
-					Printf(" !A");
-					break;
+	case ICMP_UNREACH_NET_PROHIB:
+		++*unreachable;
+		Printf(" !A");
+		break;
 
-				case ICMP_UNREACH_HOST_PROHIB:
-					++unreachable;
-					Printf(" !Z");
-					break;
+	case ICMP_UNREACH_HOST_PROHIB:
+		++*unreachable;
+		Printf(" !Z");
+		break;
 
-				case ICMP_UNREACH_TOSNET:
-					++unreachable;
-					Printf(" !Q");
-					break;
+	case ICMP_UNREACH_TOSNET:
+		++*unreachable;
+		Printf(" !Q");
+		break;
 
-				case ICMP_UNREACH_TOSHOST:
-					++unreachable;
-					Printf(" !T");
-					break;
+	case ICMP_UNREACH_TOSHOST:
+		++*unreachable;
+		Printf(" !T");
+		break;
 
-				case ICMP_UNREACH_FILTER_PROHIB:
-					++unreachable;
-					Printf(" !X");
-					break;
+	case ICMP_UNREACH_FILTER_PROHIB:
+		++*unreachable;
+		Printf(" !X");
+		break;
 
-				case ICMP_UNREACH_HOST_PRECEDENCE:
-					++unreachable;
-					Printf(" !V");
-					break;
+	case ICMP_UNREACH_HOST_PRECEDENCE:
+		++*unreachable;
+		Printf(" !V");
+		break;
 
-				case ICMP_UNREACH_PRECEDENCE_CUTOFF:
-					++unreachable;
-					Printf(" !C");
-					break;
+	case ICMP_UNREACH_PRECEDENCE_CUTOFF:
+		++*unreachable;
+		Printf(" !C");
+		break;
 
-				default:
-					++unreachable;
-					Printf(" !<%d>", code);
-					break;
+	default:
+		++*unreachable;
+		Printf(" !<%d>", code);
+		break;
+	}
+}
+
+void
+print_rtt(double T)
+{
+	int precis;
+
+#ifdef SANE_PRECISION
+	if (T >= 1000.0)
+		precis = 0;
+	else if (T >= 100.0)
+		precis = 1;
+	else if (T >= 10.0)
+		precis = 2;
+	else
+#endif
+		precis = 3;
+	Printf("  %.*f ms", precis, T);
+}
+
+/*
+ * Parallel probing (-c).  Rather than wait out each probe in turn, keep
+ * up to nsim probes in flight, sent in order of ttl and pausemsecs apart.
+ * Each probe in flight has its own sequence number; a reply is matched
+ * to its probe through the IP ID quoted in it, checked by packet_ok()
+ * as usual, and kept until every probe of its hop has been answered or
+ * has timed out.  Hops are then printed in order, as the serial loop
+ * would have printed them.
+ */
+struct hopprobe {
+	struct timeval sent;		/* when the probe left */
+	struct timeval rcvd;		/* when its reply came */
+	struct in_addr from;		/* who replied */
+	struct ip ip;			/* IP header of the reply */
+	int cc;				/* length of the reply */
+	int code;			/* from packet_ok(), 0 if none */
+	int mtu;			/* next hop MTU, for !F */
+	int done;
+};
+
+/*
+ * Whether the name and AS of a hop are known, so that printing it will
+ * not hold up the reading of other replies.
+ */
+int
+lookups_ready(struct in_addr *addr)
+{
+	struct sockaddr_in sin;
+
+	if (as_path && !as_ready(asn, addr))
+		return (0);
+	if (nflag)
+		return (1);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_len = sizeof(sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr = *addr;
+	return (rdns_ready((struct sockaddr *)&sin));
+}
+
+/*
+ * The sequence number of the probe that an inbound packet may be the
+ * answer to, or 0 if it cannot be an answer at all.
+ */
+int
+probe_seq(register u_char *buf, int cc)
+{
+	register struct icmp *icp;
+	register int hlen;
+
+	hlen = ((struct ip *)buf)->ip_hl << 2;
+	if (cc < hlen + ICMP_MINLEN)
+		return (0);
+	icp = (struct icmp *)(buf + hlen);
+	if (icp->icmp_type == ICMP_ECHOREPLY)
+		return ((u_char)ntohs(icp->icmp_seq));
+	if (icp->icmp_type != ICMP_TIMXCEED && icp->icmp_type != ICMP_UNREACH)
+		return (0);
+	if (cc < hlen + ICMP_MINLEN + (int)sizeof(struct ip))
+		return (0);
+	return ((u_char)(ntohs(icp->icmp_ip.ip_id) - ident));
+}
+
+void
+trace_parallel(register struct sockaddr_in *from, int sump)
+{
+	register struct hopprobe *pr, *probes;
+	register int i;
+	struct outdata outdata;
+	struct timeval now, next, wait;
+	struct timezone tz;
+	fd_set *fdsp;
+	size_t nfds;
+	socklen_t fromlen;
+	short inflight[256];		/* probe index by sequence number */
+	int cc, got_there, gotlastaddr, loss, nflight, nsent, ntotal;
+	int hold_ttl, rseq, seq, ttl, unreachable, stop_ttl;
+	int afd, maxfd, stalled;
+	u_int32_t lastaddr;
+
+	ntotal = (max_ttl - first_ttl + 1) * nprobes;
+	probes = calloc(ntotal, sizeof(*probes));
+	/* Answers to AS lookups are taken in while waiting for replies */
+	maxfd = s;
+	if (as_path && as_fd(asn) > maxfd)
+		maxfd = as_fd(asn);
+	nfds = howmany(maxfd + 1, NFDBITS);
+	fdsp = malloc(nfds * sizeof(fd_mask));
+	if (probes == NULL || fdsp == NULL) {
+		Fprintf(stderr, "%s: malloc: %s\n", prog, strerror(errno));
+		exit(1);
+	}
+	for (i = 0; i < 256; i++)
+		inflight[i] = -1;
+
+	(void)gettimeofday(&next, &tz);
+	nsent = nflight = seq = 0;
+	stop_ttl = hold_ttl = max_ttl;
+	ttl = first_ttl;
+	for (;;) {
+		(void)gettimeofday(&now, &tz);
+
+		/* Give up on probes that have waited long enough */
+		for (i = 1; i < 256; i++) {
+			if (inflight[i] == -1)
+				continue;
+			pr = &probes[inflight[i]];
+			if (now.tv_sec - pr->sent.tv_sec > waittime ||
+			    (now.tv_sec - pr->sent.tv_sec == waittime &&
+			    now.tv_usec >= pr->sent.tv_usec)) {
+				pr->done = 1;
+				inflight[i] = -1;
+				--nflight;
+			}
+		}
+
+		/* Send while there is room, pausemsecs apart */
+		while (nsent < ntotal && nflight < nsim &&
+		    first_ttl + nsent / nprobes <= hold_ttl &&
+		    !timercmp(&now, &next, <)) {
+			do
+				seq = seq % 255 + 1;
+			while (inflight[seq] != -1);
+			pr = &probes[nsent];
+			outdata.seq = seq;
+			outdata.ttl = first_ttl + nsent / nprobes;
+			pr->sent = now;
+			memcpy(&outdata.tv, &now, sizeof(outdata.tv));
+			(*proto->prepare)(&outdata);
+			send_probe(seq, outdata.ttl);
+			inflight[seq] = nsent++;
+			++nflight;
+			if (pausemsecs > 0) {
+				next.tv_sec = now.tv_sec + pausemsecs / 1000;
+				next.tv_usec = now.tv_usec +
+				    (pausemsecs % 1000) * 1000;
+				if (next.tv_usec >= 1000000) {
+					next.tv_usec -= 1000000;
+					++next.tv_sec;
 				}
+			}
+			(void)gettimeofday(&now, &tz);
+		}
+
+		/*
+		 * Print the hops whose probes are all done, in order.  While
+		 * replies may still come, wait for the lookups a hop needs
+		 * rather than make them here, which would hold up reading
+		 * the replies and inflate their times.
+		 */
+		stalled = 0;
+		while (ttl <= stop_ttl) {
+			pr = &probes[(ttl - first_ttl) * nprobes];
+			for (i = 0; i < nprobes; i++)
+				if (!pr[i].done)
+					break;
+			if (i < nprobes)
 				break;
+			if (nflight > 0 || (nsent < ntotal &&
+			    first_ttl + nsent / nprobes <= hold_ttl)) {
+				for (i = 0; i < nprobes; i++)
+					if (pr[i].code != 0 &&
+					    !lookups_ready(&pr[i].from))
+						break;
+				if (i < nprobes) {
+					stalled = 1;
+					break;
+				}
 			}
-			if (cc == 0) {
-				loss++;
-				Printf(" *");
+			Printf("%2d ", ttl);
+			got_there = unreachable = loss = gotlastaddr = 0;
+			lastaddr = 0;
+			for (i = 0; i < nprobes; i++, pr++) {
+				if (pr->code == 0) {
+					loss++;
+					Printf(" *");
+					continue;
+				}
+				if (!gotlastaddr ||
+				    pr->from.s_addr != lastaddr) {
+					if (gotlastaddr) printf("\n   ");
+					setsin(from, pr->from.s_addr);
+					print((u_char *)&pr->ip, pr->cc, from);
+					lastaddr = pr->from.s_addr;
+					++gotlastaddr;
+				}
+				print_rtt(deltaT(&pr->sent, &pr->rcvd));
+				print_code(pr->code, &pr->ip, pr->mtu,
+				    &got_there, &unreachable);
+			}
+			if (sump) {
+				Printf(" (%d%% loss)", (loss * 100) / nprobes);
 			}
+			putchar('\n');
 			(void)fflush(stdout);
+			if (got_there ||
+			    (unreachable > 0 && unreachable >= nprobes - 1))
+				stop_ttl = ttl;
+			else if (ttl == hold_ttl)
+				hold_ttl = stop_ttl;
+			++ttl;
 		}
-		if (sump) {
-			Printf(" (%d%% loss)", (loss * 100) / nprobes);
-		}
-		putchar('\n');
-		if (got_there ||
-		    (unreachable > 0 && unreachable >= nprobes - 1))
+		if (ttl > stop_ttl)
 			break;
+
+		/*
+		 * Sleep until a reply comes in, the next probe may be sent
+		 * or the oldest probe in flight times out.
+		 */
+		wait.tv_sec = now.tv_sec + waittime;
+		wait.tv_usec = now.tv_usec;
+		for (i = 1; i < 256; i++) {
+			if (inflight[i] == -1)
+				continue;
+			pr = &probes[inflight[i]];
+			if (pr->sent.tv_sec + waittime < wait.tv_sec ||
+			    (pr->sent.tv_sec + waittime == wait.tv_sec &&
+			    pr->sent.tv_usec < wait.tv_usec)) {
+				wait.tv_sec = pr->sent.tv_sec + waittime;
+				wait.tv_usec = pr->sent.tv_usec;
+			}
+		}
+		if (nsent < ntotal && nflight < nsim &&
+		    first_ttl + nsent / nprobes <= hold_ttl &&
+		    timercmp(&next, &wait, <))
+			wait = next;
+		/* Name lookups finish unseen; look in on them now and then */
+		if (stalled && (wait.tv_sec > now.tv_sec ||
+		    wait.tv_usec - now.tv_usec > 10000)) {
+			wait.tv_sec = now.tv_sec;
+			wait.tv_usec = now.tv_usec + 10000;
+			if (wait.tv_usec >= 1000000) {
+				wait.tv_usec -= 1000000;
+				++wait.tv_sec;
+			}
+		}
+		tvsub(&wait, &now);
+		if (wait.tv_sec < 0) {
+			wait.tv_sec = 0;
+			wait.tv_usec = 1;
+		}
+		memset(fdsp, 0, nfds * sizeof(fd_mask));
+		FD_SET(s, fdsp);
+		afd = as_path ? as_fd(asn) : -1;
+		if (afd != -1)
+			FD_SET(afd, fdsp);
+		if (select(maxfd + 1, fdsp, NULL, NULL, &wait) <= 0)
+			continue;
+		if (afd != -1 && FD_ISSET(afd, fdsp))
+			as_input(asn);
+		if (!FD_ISSET(s, fdsp))
+			continue;
+		fromlen = sizeof(*from);
+		cc = recvfrom(s, (char *)packet, sizeof(packet), 0,
+		    (struct sockaddr *)from, &fromlen);
+		if (cc <= 0)
+			continue;
+		(void)gettimeofday(&now, &tz);
+		rseq = probe_seq(packet, cc);
+		if (inflight[rseq] == -1)
+			rseq = 0;
+		i = packet_ok(packet, cc, from, rseq);
+		/* Skip short and unrelated packets */
+		if (i == 0)
+			continue;
+		pr = &probes[inflight[rseq]];
+		pr->rcvd = now;
+		pr->from = from->sin_addr;
+		memcpy(&pr->ip, packet, sizeof(pr->ip));
+		pr->cc = cc;
+		pr->code = i;
+		pr->mtu = pmtu;
+		pr->done = 1;
+		inflight[rseq] = -1;
+		--nflight;
+		/* Look the hop up while the earlier hops are still out */
+		if (!nflag)
+			rdns_prefetch((struct sockaddr *)from);
+		if (as_path)
+			as_prefetch(asn, &from->sin_addr);
+		/*
+		 * An answer other than time exceeded may end the trace at
+		 * this hop, so send nothing further until it is printed.
+		 */
+		if (i != -1) {
+			i = first_ttl + (pr - probes) / nprobes;
+			if (i < hold_ttl)
+				hold_ttl = i;
+		}
 	}
-	if (as_path)
-		as_shutdown(asn);
-	exit(0);
+	free(fdsp);
+	free(probes);
 }
 
 int
@@ -1544,38 +1888,14 @@ p_cksum(struct ip *ip, u_short *data, int len)
 }
 
 /*
- * Checksum routine for Internet Protocol family headers (C Version)
+ * Checksum routine for Internet Protocol family headers.  The sum
+ * itself is the one shared with libalias, which also takes an odd
+ * trailing byte as the high-order byte of a word on any byte order.
  */
 u_short
 in_cksum(register u_short *addr, register int len)
 {
-	register int nleft = len;
-	register u_short *w = addr;
-	register u_short answer;
-	register int sum = 0;
-
-	/*
-	 *  Our algorithm is simple, using a 32 bit accumulator (sum),
-	 *  we add sequential 16 bit words to it, and at the end, fold
-	 *  back all the carry bits from the top 16 bits into the lower
-	 *  16 bits.
-	 */
-	while (nleft > 1)  {
-		sum += *w++;
-		nleft -= 2;
-	}
-
-	/* mop up an odd byte, if necessary */
-	if (nleft == 1)
-		sum += *(u_char *)w;
-
-	/*
-	 * add back carry outs from top 16 bits to low 16 bits
-	 */
-	sum = (sum >> 16) + (sum & 0xffff);	/* add hi 16 to low 16 */
-	sum += (sum >> 16);			/* add carry */
-	answer = ~sum;				/* truncate to 16 bits */
-	return (answer);
+	return ((u_short)~CksumFold(CksumAccumulate(addr, len, 0)));
 }
 
 /*
@@ -1603,6 +1923,8 @@ inetname(struct in_addr in)
 {
 	register char *cp;
 	register struct hostent *hp;
+	register const char *name;
+	struct sockaddr_in sin;
 	static int first = 1;
 	static char domain[MAXHOSTNAMELEN + 1], line[MAXHOSTNAMELEN + 1];
 
@@ -1627,13 +1949,17 @@ inetname(struct in_addr in)
 		}
 	}
 	if (!nflag && in.s_addr != INADDR_ANY) {
-		hp = gethostbyaddr((char *)&in, sizeof(in), AF_INET);
-		if (hp != NULL) {
-			if ((cp = strchr(hp->h_name, '.')) != NULL &&
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_len = sizeof(sin);
+		sin.sin_family = AF_INET;
+		sin.sin_addr = in;
+		name = rdns_name((struct sockaddr *)&sin, -1);
+		if (name != NULL) {
+			(void)strncpy(line, name, sizeof(line) - 1);
+			line[sizeof(line) - 1] = '\0';
+			if ((cp = strchr(line, '.')) != NULL &&
 			    strcmp(cp + 1, domain) == 0)
 				*cp = '\0';
-			(void)strncpy(line, hp->h_name, sizeof(line) - 1);
-			line[sizeof(line) - 1] = '\0';
 			return (line);
 		}
 	}
@@ -1817,8 +2143,9 @@ usage(void)
 
 	Fprintf(stderr, "Version %s\n", version);
 	Fprintf(stderr,
-	    "Usage: %s [-adDeFInrSvx] [-A as_server] [-f first_ttl] [-g gateway] [-i iface]\n"
-	    "\t[-M first_ttl] [-m max_ttl] [-p port] [-P proto] [-q nqueries] [-s src_addr]\n"
-	    "\t[-t tos] [-w waittime] [-z pausemsecs] host [packetlen]\n", prog);
+	    "Usage: %s [-adDeFInrSvx] [-A as_server] [-C as_cache] [-c nprobes]\n"
+	    "\t[-f first_ttl] [-g gateway] [-i iface] [-M first_ttl] [-m max_ttl]\n"
+	    "\t[-p port] [-P proto] [-q nqueries] [-s src_addr] [-T as_table] [-t tos]\n"
+	    "\t[-w waittime] [-z pausemsecs] host [packetlen]\n", prog);
 	exit(1);
 }
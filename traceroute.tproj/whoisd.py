@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+#
+# A stand-in RADB whois server for as.test.  It listens on 127.0.0.1,
+# writes its port to the file named by its first argument and logs each
+# query to the second.  The answers come from the table below and are
+# sent in small pieces that split lines, to exercise the parsing of
+# answers that arrive a little at a time.
+
+import socket
+import sys
+import time
+
+ANSWERS = {
+    # A covering route, and a more specific one with another origin
+    "192.0.2.1": "A",
+    "192.0.2.129": "A",
+    # An answer with a line longer than the reader's buffer
+    "203.0.113.9": "A",
+    # No data, and key not found
+    "198.51.100.1": "C",
+    "198.51.100.2": "D",
+}
+
+OBJECTS = {
+    "192.0.2.1": "route:      192.0.2.0/24\norigin:     AS64496\n",
+    "192.0.2.129": "route:      192.0.2.128/25\norigin:     AS64497\n",
+    "203.0.113.9": "route:      203.0.113.0/24\n" +
+                   "descr:      " + "x" * 3000 + "\n" +
+                   "origin:     AS64499\n",
+}
+
+def answer(addr):
+    code = ANSWERS.get(addr, "D")
+    if code != "A":
+        return code + "\n"
+    data = OBJECTS[addr]
+    return "A%d\n%sC\n" % (len(data), data)
+
+def serve(conn, log):
+    buf = b""
+    while True:
+        data = conn.recv(4096)
+        if not data:
+            return
+        buf += data
+        while b"\n" in buf:
+            line, buf = buf.split(b"\n", 1)
+            query = line.decode().strip()
+            log.write(query + "\n")
+            log.flush()
+            if query == "!q":
+                return
+            if not query.startswith("!r"):
+                continue
+            reply = answer(query[2:].split("/")[0]).encode()
+            for i in range(0, len(reply), 7):
+                conn.sendall(reply[i:i + 7])
+                time.sleep(0.001)
+
+def main():
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    s.bind(("127.0.0.1", 0))
+    s.listen(1)
+    with open(sys.argv[1], "w") as f:
+        f.write("%d\n" % s.getsockname()[1])
+    with open(sys.argv[2], "a") as log:
+        while True:
+            conn, _ = s.accept()
+            serve(conn, log)
+            conn.close()
+
+main()
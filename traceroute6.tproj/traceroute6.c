@@ -317,6 +317,9 @@ double	deltaT(struct timeval *, struct timeval *);
 char	*pr_type(int);
 int	packet_ok(struct msghdr *, int, int);
 void	print(struct msghdr *, int);
+void	print_code(int, int, int *, int *);
+int	probe_seq(u_char *, int);
+void	trace_parallel(void);
 const char *inetname(struct sockaddr *);
 void	usage(void);
 
@@ -342,6 +345,7 @@ char *source = 0;
 char *hostname;
 
 u_long nprobes = 3;
+u_long nsim = 1;		/* probes in flight at once (-c) */
 u_long first_hop = 1;
 u_long max_hops = 30;
 u_int16_t srcport;
@@ -404,8 +408,20 @@ main(argc, argv)
 
 	seq = 0;
 
-	while ((ch = getopt(argc, argv, "df:g:Ilm:nNp:q:rs:Uvw:")) != -1)
+	while ((ch = getopt(argc, argv, "c:df:g:Ilm:nNp:q:rs:Uvw:")) != -1)
 		switch (ch) {
+		case 'c':
+			ep = NULL;
+			errno = 0;
+			nsim = strtoul(optarg, &ep, 0);
+			if (errno || !*optarg || *ep || nsim < 1 ||
+			    nsim > 254) {
+				fprintf(stderr,
+				    "traceroute6: invalid number of "
+				    "simultaneous probes.\n");
+				exit(1);
+			}
+			break;
 		case 'd':
 			options |= SO_DEBUG;
 			break;
@@ -569,6 +585,11 @@ main(argc, argv)
 		    useproto);
 		exit(5);
 	}
+	if (nsim > 1 && useproto == IPPROTO_NONE) {
+		fprintf(stderr,
+		    "traceroute6: -c may not be used with -N.\n");
+		exit(1);
+	}
 	if (max_hops < first_hop) {
 		fprintf(stderr,
 		    "traceroute6: max hoplimit must be larger than first hoplimit.\n");
@@ -875,6 +896,11 @@ main(argc, argv)
 	if (first_hop > 1)
 		printf("Skipping %lu intermediate hops\n", first_hop - 1);
 
+	if (nsim > 1) {
+		trace_parallel();
+		exit(0);
+	}
+
 	/*
 	 * Main loop
 	 */
@@ -902,30 +928,8 @@ main(argc, argv)
 						lastaddr = Rcv.sin6_addr;
 					}
 					printf("  %.3f ms", deltaT(&t1, &t2));
-					switch (i - 1) {
-					case ICMP6_DST_UNREACH_NOROUTE:
-						++unreachable;
-						printf(" !N");
-						break;
-					case ICMP6_DST_UNREACH_ADMIN:
-						++unreachable;
-						printf(" !P");
-						break;
-					case ICMP6_DST_UNREACH_NOTNEIGHBOR:
-						++unreachable;
-						printf(" !S");
-						break;
-					case ICMP6_DST_UNREACH_ADDR:
-						++unreachable;
-						printf(" !A");
-						break;
-					case ICMP6_DST_UNREACH_NOPORT:
-						if (rcvhlim >= 0 &&
-						    rcvhlim <= 1)
-							printf(" !");
-						++got_there;
-						break;
-					}
+					print_code(i, rcvhlim, &got_there,
+					    &unreachable);
 					break;
 				}
 			}
@@ -943,6 +947,232 @@ main(argc, argv)
 	exit(0);
 }
 
+/*
+ * Print the note for a reply that packet_ok() returned i for, and
+ * count its hop as reached or unreachable.
+ */
+void
+print_code(i, hlim, got_there, unreachable)
+	int i, hlim;
+	int *got_there, *unreachable;
+{
+
+	switch (i - 1) {
+	case ICMP6_DST_UNREACH_NOROUTE:
+		++*unreachable;
+		printf(" !N");
+		break;
+	case ICMP6_DST_UNREACH_ADMIN:
+		++*unreachable;
+		printf(" !P");
+		break;
+	case ICMP6_DST_UNREACH_NOTNEIGHBOR:
+		++*unreachable;
+		printf(" !S");
+		break;
+	case ICMP6_DST_UNREACH_ADDR:
+		++*unreachable;
+		printf(" !A");
+		break;
+	case ICMP6_DST_UNREACH_NOPORT:
+		if (hlim >= 0 && hlim <= 1)
+			printf(" !");
+		++*got_there;
+		break;
+	}
+}
+
+/*
+ * Parallel probing (-c).  Keep up to nsim probes in flight, sent in
+ * order of hop limit, and match each reply to its probe through the
+ * port or ICMPv6 sequence number quoted in it.  A hop is printed once
+ * all of its probes are answered or timed out, so the output is the
+ * same as that of the serial loop in main().
+ */
+struct hopprobe {
+	struct timeval sent;		/* when the probe left */
+	struct timeval rcvd;		/* when its reply came */
+	struct sockaddr_in6 from;	/* who replied */
+	struct in6_pktinfo pktinfo;	/* where the reply was sent to */
+	int havepktinfo;
+	int hlim;			/* hop limit of the reply */
+	int cc;				/* length of the reply */
+	int code;			/* from packet_ok(), 0 if none */
+	int done;
+};
+
+/*
+ * The sequence number of the probe that a received packet may be the
+ * answer to, or 0 if it cannot be an answer at all.
+ */
+int
+probe_seq(buf, cc)
+	u_char *buf;
+	int cc;
+{
+	struct icmp6_hdr *icp;
+	void *up;
+
+#ifdef OLDRAWSOCKET
+	if (cc < sizeof(struct ip6_hdr) + sizeof(struct icmp6_hdr))
+		return (0);
+	cc -= sizeof(struct ip6_hdr);
+	icp = (struct icmp6_hdr *)(buf + sizeof(struct ip6_hdr));
+#else
+	if (cc < sizeof(struct icmp6_hdr))
+		return (0);
+	icp = (struct icmp6_hdr *)buf;
+#endif
+	if (icp->icmp6_type == ICMP6_ECHO_REPLY)
+		return (ntohs(icp->icmp6_seq));
+	if (icp->icmp6_type != ICMP6_TIME_EXCEEDED &&
+	    icp->icmp6_type != ICMP6_DST_UNREACH)
+		return (0);
+	up = get_uphdr((struct ip6_hdr *)(icp + 1), (u_char *)icp + cc);
+	if (up == NULL)
+		return (0);
+	if (useproto == IPPROTO_ICMPV6)
+		return (ntohs(((struct icmp6_hdr *)up)->icmp6_seq));
+	return ((u_int16_t)(ntohs(((struct udphdr *)up)->uh_dport) - port));
+}
+
+void
+trace_parallel()
+{
+	struct hopprobe *pr, *probes;
+	struct in6_addr lastaddr;
+	struct timeval now, wait;
+	fd_set *fdsp;
+	socklen_t controllen;
+	u_long hold_hops, hops, stop_hops;
+	int cc, fdsn, got_there, i, nflight, nsent, ntotal, seq, unreachable;
+
+	ntotal = (max_hops - first_hop + 1) * nprobes;
+	probes = (struct hopprobe *)calloc(ntotal, sizeof(*probes));
+	fdsn = howmany(rcvsock + 1, NFDBITS) * sizeof(fd_mask);
+	fdsp = (fd_set *)malloc(fdsn);
+	if (probes == NULL || fdsp == NULL) {
+		fprintf(stderr, "traceroute6: malloc failed\n");
+		exit(1);
+	}
+	controllen = rcvmhdr.msg_controllen;
+
+	nsent = nflight = 0;
+	stop_hops = hold_hops = max_hops;
+	hops = first_hop;
+	for (;;) {
+		/* Give up on probes that have waited long enough */
+		(void) gettimeofday(&now, NULL);
+		for (pr = probes; pr < probes + nsent; pr++) {
+			if (!pr->done &&
+			    (now.tv_sec - pr->sent.tv_sec > waittime ||
+			    (now.tv_sec - pr->sent.tv_sec == waittime &&
+			    now.tv_usec >= pr->sent.tv_usec))) {
+				pr->done = 1;
+				nflight--;
+			}
+		}
+
+		/*
+		 * Send while there is room.  Probe k goes out with sequence
+		 * number k + 1, as it would from the serial loop.
+		 */
+		while (nsent < ntotal && nflight < nsim &&
+		    first_hop + nsent / nprobes <= hold_hops) {
+			pr = &probes[nsent];
+			(void) gettimeofday(&pr->sent, NULL);
+			send_probe(nsent + 1, first_hop + nsent / nprobes);
+			nsent++;
+			nflight++;
+		}
+
+		/* Print the hops whose probes are all done, in order */
+		while (hops <= stop_hops) {
+			pr = &probes[(hops - first_hop) * nprobes];
+			for (i = 0; i < nprobes; i++)
+				if (!pr[i].done)
+					break;
+			if (i < nprobes)
+				break;
+			printf("%2lu ", hops);
+			bzero(&lastaddr, sizeof(lastaddr));
+			got_there = unreachable = 0;
+			for (i = 0; i < nprobes; i++, pr++) {
+				if (pr->code == 0) {
+					printf(" *");
+					continue;
+				}
+				if (!IN6_ARE_ADDR_EQUAL(&pr->from.sin6_addr,
+				    &lastaddr)) {
+					if (i > 0)
+						fputs("\n   ", stdout);
+					lastaddr = pr->from.sin6_addr;
+					Rcv = pr->from;
+					rcvpktinfo = pr->havepktinfo ?
+					    &pr->pktinfo : NULL;
+					print(&rcvmhdr, pr->cc);
+				}
+				printf("  %.3f ms", deltaT(&pr->sent, &pr->rcvd));
+				print_code(pr->code, pr->hlim, &got_there,
+				    &unreachable);
+			}
+			putchar('\n');
+			if (got_there || (unreachable > 0 &&
+			    unreachable >= ((nprobes + 1) / 2)))
+				stop_hops = hops;
+			else if (hops == hold_hops)
+				hold_hops = stop_hops;
+			hops++;
+		}
+		if (hops > stop_hops)
+			break;
+
+		/* Sleep until a reply comes in or a probe times out */
+		wait = now;
+		for (pr = probes; pr < probes + nsent; pr++) {
+			if (!pr->done && timercmp(&pr->sent, &wait, <))
+				wait = pr->sent;
+		}
+		wait.tv_sec += waittime;
+		timersub(&wait, &now, &wait);
+		if (wait.tv_sec < 0)
+			timerclear(&wait);
+		memset(fdsp, 0, fdsn);
+		FD_SET(rcvsock, fdsp);
+		if (select(rcvsock + 1, fdsp, NULL, NULL, &wait) <= 0)
+			continue;
+		rcvmhdr.msg_namelen = sizeof(Rcv);
+		rcvmhdr.msg_controllen = controllen;
+		if ((cc = recvmsg(rcvsock, &rcvmhdr, 0)) <= 0)
+			continue;
+		(void) gettimeofday(&now, NULL);
+		seq = probe_seq(packet, cc);
+		if (seq < 1 || seq > nsent || probes[seq - 1].done)
+			seq = 0;
+		/* Skip short and unrelated packets */
+		if ((i = packet_ok(&rcvmhdr, cc, seq)) == 0)
+			continue;
+		pr = &probes[seq - 1];
+		pr->rcvd = now;
+		pr->from = Rcv;
+		if ((pr->havepktinfo = rcvpktinfo != NULL))
+			pr->pktinfo = *rcvpktinfo;
+		pr->hlim = rcvhlim;
+		pr->cc = cc;
+		pr->code = i;
+		pr->done = 1;
+		nflight--;
+		/*
+		 * An answer other than time exceeded may end the trace at
+		 * this hop, so send nothing further until it is printed.
+		 */
+		if (i != -1 && first_hop + (seq - 1) / nprobes < hold_hops)
+			hold_hops = first_hop + (seq - 1) / nprobes;
+	}
+	free(fdsp);
+	free(probes);
+}
+
 int
 wait_for_reply(sock, mhdr)
 	int sock;
@@ -1417,7 +1647,8 @@ usage()
 {
 
 	fprintf(stderr,
-"usage: traceroute6 [-dIlnNrUv] [-f firsthop] [-g gateway] [-m hoplimit]\n"
-"       [-p port] [-q probes] [-s src] [-w waittime] target [datalen]\n");
+"usage: traceroute6 [-dIlnNrUv] [-c nprobes] [-f firsthop] [-g gateway]\n"
+"       [-m hoplimit] [-p port] [-q probes] [-s src] [-w waittime]\n"
+"       target [datalen]\n");
 	exit(1);
 }